@@ -3,16 +3,15 @@
 #include "icslocalserver.hpp"
 #include "mempool.hpp"
 #include "log.hpp"
-#include "database.hpp"
 #include "downloadfile.hpp"
 #include "util.hpp"
 #include "icsprotocol.hpp"
-#include "database.hpp"
-#include "downloadfile.hpp"
+#include "messageschema.hpp"
+#include <tuple>
+#include <algorithm>
 
 
 
-extern ics::DataBase g_database;
 extern ics::IcsConfig g_configFile;
 
 
@@ -27,15 +26,10 @@ IcsTerminalClient::IcsTerminalClient(IcsLocalServer& localServer, socket&& s, co
 
 IcsTerminalClient::~IcsTerminalClient()
 {
-	if (!_baseType::m_replaced && !m_monitorID.empty())
+	// 未经error关闭的链接
+	if (!_baseType::m_replaced && !m_gwid.empty())
 	{
-		OtlConnectionGuard connGuard(g_database);
-
-		otl_stream s(1
-			, "{ call sp_offline(:id<char[33],in>,:ip<char[17],in>,:port<int,in>) }"
-			, connGuard.connection());
-
-		s << m_monitorID << m_localServer.getWebIp() << m_localServer.getWebPort();
+		m_localServer.getPresence().offline(m_gwid, this);
 	}
 }
 
@@ -133,11 +127,10 @@ void IcsTerminalClient::dispatch(ProtocolStream& request) throw(IcsException, ot
 	// 消息结构：网关ID 消息ID 消息体内容(请求ID 文件ID)
 	ShortString terminalName;
 	uint16_t messageID;
-	uint32_t requestID;
-	request >> terminalName >> messageID;
+	MessageLayout<W2C_send_to_ics_terminal_0x2001>::decode(request, terminalName, messageID);
 
 	// 发送到该链接对端
-	ProtocolStream response(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 	response.initHead((MessageId)messageID, false);
 	response << request;
 
@@ -149,19 +142,9 @@ void IcsTerminalClient::error() throw()
 {
 	if (!_baseType::m_replaced && !m_gwid.empty())
 	{
-		m_localServer.removeTerminalClient(m_gwid);
-		try {
-			OtlConnectionGuard connGuard(g_database);
-			otl_stream s(1
-				, "{ call sp_offline(:gwid<char[33],in>,:ip<char[17],in>,:port<int,in>) }"
-					, connGuard.connection());
-			s << m_gwid << m_localServer.getWebIp() << m_localServer.getWebPort();
-		}
-		catch (otl_exception& ex)
-		{
-			LOG_WARN("otl_exception:" << ex.msg);
-		}
-		m_gwid.clear();
+		m_localServer.removeTerminalClient(m_gwid, shared_from_this());
+		m_localServer.getPresence().offline(m_gwid, this);
+		m_gwid = IcsId();
 	}
 }
 
@@ -176,55 +159,88 @@ void IcsTerminalClient::handleAuthRequest(ProtocolStream& request, ProtocolStrea
 		return;
 	}
 
+	if (m_authorizing)
+	{
+		LOG_DEBUG(this->name() << " ignore authrize message while authorizing");
+		return;
+	}
+
 	// auth info
-	string gwPwd, extendInfo;
+	string gwid, gwPwd, extendInfo;
 
-	request >> m_gwid >> gwPwd >> m_deviceKind >> extendInfo;
+	MessageLayout<T2C_auth_request_0x0101>::decode(request, gwid, gwPwd, m_deviceKind, extendInfo);
 
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-
-	otl_stream authroizeStream(1,
-		"{ call sp_authroize(:gwid<char[33],in>,:pwd<char[33],in>,@ret,@monitorID,@monitorName) }",
-		connGuard.connection());
+	// 缓存中没有时在认证线程中查询数据库,结果在本链接的strand中处理
+	TerminalAuth::Result result;
+	auto self = std::static_pointer_cast<IcsTerminalClient>(shared_from_this());
+	bool cached = m_localServer.getTerminalAuth().authorize(gwid, gwPwd, result, [self, gwid](const TerminalAuth::Result& result)
+	{
+		self->strandPost([self, gwid, result]()
+		{
+			ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+			if (self->handleAuthResult(gwid, result, response))
+			{
+				self->trySend(response);
+			}
+		});
+	});
 
-	authroizeStream << m_gwid << gwPwd;
-	authroizeStream.close();
+	if (!cached)
+	{
+		m_authorizing = true;
+		deferResponse();
+		return;
+	}
 
-	otl_stream getStream(1, "select @ret :#ret<int>,@monitorID :#monitorID<char[32]>,@monitorName :#monitorName<char[32]>", connGuard.connection());
+	handleAuthResult(gwid, result, response);
+}
 
-	int ret = 2;
-	string monitorID, monitorName;
+// 认证结果
+bool IcsTerminalClient::handleAuthResult(const string& gwid, const TerminalAuth::Result& result, ProtocolStream& response)
+{
+	m_authorizing = false;
+	if (!isValid())
+	{
+		return false;
+	}
 
-	getStream >> ret >> monitorID >> monitorName;
+	if (result.ret < 0)	// 数据库忙,不回应由终端重新认证
+	{
+		LOG_WARN(this->name() << " gwid [" << gwid << "] authorize is delayed");
+		return false;
+	}
 
 	response.initHead(MessageId::C2T_auth_response_0x0102, false);
 
-	if (ret == 0)	// 成功
+	if (result.ret == 0)	// 成功
 	{
-		m_monitorID = std::move(monitorID); // 保存检测点id
+		// 认证通过的gwid及监测点id加入ID表,之后的消息只使用其句柄
+		IcsId id = g_idTable.intern(gwid);
+		if (!m_localServer.addTerminalClient(id, shared_from_this()))
+		{
+			LOG_WARN(this->name() << " gwid [" << gwid << "] is refused, terminals reach the max count, online " << m_localServer.terminalCount());
+			response << ShortString("failed");
+			return true;
+		}
 
-		otl_stream onlineStream(1
-			, "{ call sp_online(:gwid<char[33],in>,:monitorID<char[33],in>,:devKind<int,in>,:ip<char[16],in>,:port<int,in>) }"
-			, connGuard.connection());
+		m_gwid = id;
+		m_monitorID = g_idTable.intern(result.monitorID); // 保存检测点id
 
-		onlineStream << m_gwid << m_monitorID << (int)m_deviceKind << m_localServer.getWebIp() << m_localServer.getWebPort();
+		m_localServer.getPresence().online(m_gwid, m_monitorID, m_deviceKind, this);
 
 		response << ShortString("ok") << m_localServer.getHeartbeatTime();
 
-		m_localServer.addTerminalClient(m_gwid, shared_from_this());
-
 		LOG_INFO("gwid [" << m_gwid << "] created on " << this->name());
 
-		this->setName(m_gwid + "@" + this->name());
+		this->setName(m_gwid.str() + "@" + this->name());
 	}
 	else
 	{
-		m_gwid.clear();
 		response << ShortString("failed");
 	}
-
+	return true;
 }
 
 // 标准状态上报
@@ -232,7 +248,7 @@ void IcsTerminalClient::handleStdStatusReport(ProtocolStream& request, ProtocolS
 {
 	uint32_t status_type;	// 标准状态类别
 
-	request >> status_type;
+	MessageLayout<T2C_std_status_report_0x0301>::decode(request, status_type);
 
 	// 通用衡器
 	if (status_type == 1)
@@ -243,20 +259,14 @@ void IcsTerminalClient::handleStdStatusReport(ProtocolStream& request, ProtocolS
 		string cheat_status;	// 作弊状态
 		float zero_point;		// 秤体零点	
 
-		request >> device_ligtht >> device_status >> cheat_ligtht >> cheat_status >> zero_point;
+		StatusLayout<1>::decode(request, device_ligtht, device_status, cheat_ligtht, cheat_status, zero_point);
 
 		request.assertEmpty();
 
 		IcsDataTime recv_time;
 		ics::getIcsNowTime(recv_time);
 
-		OtlConnectionGuard connGuard(g_database);
-
-		otl_stream o(1,
-			"{ call sp_status_standard(:monitorID<char[16],in>,:gwID<char[16],in>,:devFlag<int,in>,:devStat<char[512],in>,:cheatFlag<int,in>,:cheatStat<char[512],in>,:zeroPoint<float,in>,:recvTime<timestamp,in>) }"
-			, connGuard.connection());
-
-		o << m_monitorID << m_gwid << (int)device_ligtht << device_status << (int)cheat_ligtht << cheat_status << zero_point << recv_time;
+		m_localServer.getStorage().statusReport(m_monitorID, m_gwid, device_ligtht, device_status, cheat_ligtht, cheat_status, zero_point, recv_time);
 	}
 	// 其它
 	else
@@ -310,26 +320,18 @@ void IcsTerminalClient::handleEventsReport(ProtocolStream& request, ProtocolStre
 
 	getIcsNowTime(recv_time);
 
-	request >> event_time >> event_count;
-
-
-	OtlConnectionGuard connGuard(g_database);
-
-	otl_stream eventStream(1
-		, "{ call sp_event_report(:id<char[33],in>,:devKind<int,in>,:eventID<int,in>,:eventType<int,in>,:eventValue<char[256],in>,:eventTime<timestamp,in>,:recvTime<timestamp,in>) }"
-		, connGuard.connection());
-
+	MessageLayout<T2C_event_report_0x0501>::decode(request, event_time, event_count);
 
 	// 遍历取出全部事件
 	for (uint16_t i = 0; i < event_count; i++)
 	{
-		request >> event_id >> event_type >> event_value;
+		EventItemLayout::decode(request, event_id, event_type, event_value);
 
-		eventStream << m_monitorID << (int)m_deviceKind << (int)event_id << (int)event_type << event_value << event_time << recv_time;
+		m_localServer.getStorage().eventReport(m_monitorID, m_deviceKind, event_id, event_type, event_value, event_time, recv_time);
 
 		// 发送给推送服务器: 监测点ID 发生时间 事件编号 事件值
-		ProtocolStream pushStream(ProtocolStream::OptType::writeType, g_memoryPool.get());
-		pushStream << m_monitorID << m_deviceKind << event_time << event_id << event_value;
+		ProtocolStream pushStream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		MessageLayout<C2P_push_message_0x3001>::encode(pushStream, m_monitorID.str(), m_deviceKind, event_time, event_id, event_value);
 
 		m_localServer.getPushSystem().send(pushStream);
 	}
@@ -345,7 +347,7 @@ void IcsTerminalClient::handleBusinessReport(ProtocolStream& request, ProtocolSt
 
 	getIcsNowTime(recv_time);
 
-	request >> report_time >> business_no >> business_type;
+	MessageLayout<T2C_bus_report_0x0901>::decode(request, report_time, business_no, business_type);
 
 	if (m_lastBusSerialNum == business_no)	// 重复的业务流水号，直接忽略
 	{
@@ -353,102 +355,80 @@ void IcsTerminalClient::handleBusinessReport(ProtocolStream& request, ProtocolSt
 		return;
 	}
 
-	OtlConnectionGuard connGuard(g_database);
-
 	m_lastBusSerialNum = business_no;	// 更新最近的业务流水号
 
+	Storage::BusinessRecord record;
+	record.type = business_type;
+	record.monitorID = m_monitorID;
+	record.businessNo = business_no;
+	record.reportTime = report_time;
+	record.recvTime = recv_time;
+
 	if (business_type == 1)	// 静态汽车衡
 	{
-		ShortString cargo_num;	// 货物单号	
-		ShortString vehicle_num;	// 车号
-		ShortString consigness;	// 收货单位
-		ShortString cargo_name;	// 货物名称
-
-		float weight1, weight2, weight3, weight4, unit_price, money;	// 毛重 皮重 扣重 净重 单价 金额
 		uint8_t in_out;	// 进出
+		auto& v = record.vehicle;
 
-		request >> cargo_num >> vehicle_num >> consigness >> cargo_name >> weight1 >> weight2 >> weight3 >> weight4 >> unit_price >> money >> in_out;
-
-		otl_stream s(1
-			, "{ call `ics_vehicle`.sp_business_vehicle(:id<char[33],in>,:num<int,in>,:cargoNum<char[126],in>,:vehNum<char[126],in>"
-			",:consigness<char[126],in>,:cargoName<char[126],in>,:weight1<float,in>,:weight2<float,in>,:weight3<float,in>,:weight4<float,in>"
-			",:unitPrice<float,in>,:money<float,in>,:inOrOut<int,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }"
-			, connGuard.connection());
-
-		s << m_monitorID << (int)business_no << cargo_num << vehicle_num
-			<< consigness << cargo_name << weight1 << weight2 << weight3 << weight4
-			<< unit_price << money << (int)in_out << report_time << recv_time;
-
+		// 货物单号 车号 收货单位 货物名称 毛重 皮重 扣重 净重 单价 金额 进出
+		BusinessLayout<1>::decode(request, v.cargoNum, v.vehicleNum, v.consignee, v.cargoName
+			, v.grossWeight, v.tareWeight, v.deductWeight, v.netWeight, v.unitPrice, v.money, in_out);
+		v.inOut = in_out;
 	}
 	else if (business_type == 2)	// 包装秤
 	{
 		uint8_t count;	// 秤数量
-		request >> count;
+		BusinessLayout<2>::decode(request, count);
 
-		otl_stream s(1
-			, "{ call `ics_packing`.sp_business_pack(:id<char[33],in>,:num<int,in>,:amount<int,in>,:weight<int,in>,:sWeight<int,in>,:F6<float,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }"
-			, connGuard.connection());
+		record.scales.reserve(count);
 
-		for (uint8_t i = 0; i < count; i++)	// 依次取出秤的称重数据
+		// 依次取出秤的称重数据: 秤编号 称重次数 称重总重 单次重量
+		PackingScaleLayout::decodeRepeated(request, count, [&record](uint8_t number, uint16_t amount, float total_weight, float single_weighet)
 		{
-			uint8_t number;		// 秤编号
-			uint16_t amount;	// 称重次数
-			float total_weight;		// 称重总重
-			float single_weighet;// 单次重量
-
-			request >> number >> amount >> total_weight >> single_weighet;
-
-			s << m_monitorID << business_no << (int)amount << total_weight << single_weighet << report_time << recv_time;
-		}
+			record.scales.push_back(Storage::BusinessRecord::Scale{ amount, total_weight, single_weighet });
+		});
 	}
 	else if (business_type == 3)	// 公路衡器
 	{
 		char buff[126];
-		string axle_str;	// 轴重字符串：轴重1,轴重2,轴重3 ......
-		string type_str;	// 轴类型字符串：类型1,类型2,类型3 ......
+		auto& h = record.highway;
 
 		uint32_t total_weight;// 总重
 		uint16_t speed;	// 车速
 		uint8_t axle_num;	// 轴数(1-20)
 		uint8_t type_num;	// 轴类型数(1-轴数)
 
-		request >> total_weight >> speed >> axle_num;
+		BusinessLayout<3>::decode(request, total_weight, speed, axle_num);
 
-		// 处理各个轴重
-		for (uint8_t i = 0; i < axle_num; i++)
+		// 处理各个轴重,轴重字符串：轴重1,轴重2,轴重3 ......
+		AxleWeightLayout::decodeRepeated(request, axle_num, [&h, &buff](uint16_t axle_weight)
 		{
-			uint16_t axle_weight;
-			request >> axle_weight;
 			std::sprintf(buff, "%u,", axle_weight);
-			axle_str += buff;
-		}
+			h.axleWeights += buff;
+		});
 
-		if (!axle_str.empty())
+		if (!h.axleWeights.empty())
 		{
-			axle_str.erase(axle_str.end() - 1);
+			h.axleWeights.erase(h.axleWeights.end() - 1);
 		}
 
-		request >> type_num;
+		MessageSchema<uint8_t>::decode(request, type_num);
 
-		// 处理各个轴类型
-		for (uint8_t i = 0; i < type_num; i++)
+		// 处理各个轴类型,轴类型字符串：类型1+类型2+类型3 ......
+		AxleTypeLayout::decodeRepeated(request, type_num, [&h, &buff](uint8_t axle_type)
 		{
-			uint8_t axle_type;
-			request >> axle_type;
 			std::sprintf(buff, "%u+", axle_type);
-			type_str += buff;
-		}
+			h.axleTypes += buff;
+		});
 
-		if (!type_str.empty())
+		if (!h.axleTypes.empty())
 		{
-			type_str.erase(type_str.end() - 1);
+			h.axleTypes.erase(h.axleTypes.end() - 1);
 		}
 
-		otl_stream s(1
-			, "{ call `ics_highway`.sp_business_expressway(:id<char[33],in>,:num<int,in>,:weight<int,in>,:speed<double,in>,:axleNum<int,in>,:axleStr<char[256],in>,:typeNum<int,in>,:typeStr<char[256],in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }"
-			, connGuard.connection());
-
-		s << m_monitorID << (int)business_no << (int)total_weight << ((float)speed)*0.1 << (int)axle_num << axle_str << (int)type_num << type_str << report_time << recv_time;
+		h.totalWeight = total_weight;
+		h.speed = ((float)speed)*0.1;
+		h.axleNum = axle_num;
+		h.typeNum = type_num;
 	}
 	else if (business_type == 4)	// 餐厨车
 	{
@@ -468,8 +448,6 @@ void IcsTerminalClient::handleBusinessReport(ProtocolStream& request, ProtocolSt
 		ShortString tubID;
 		uint32_t tubVolumn, weight, driverID;
 
-		request >> weightFlag.data >> tubID >> tubVolumn >> weight >> driverID;
-
 		union
 		{
 			uint8_t	data;
@@ -482,52 +460,51 @@ void IcsTerminalClient::handleBusinessReport(ProtocolStream& request, ProtocolSt
 		}postionFlag;
 		uint32_t longitude, latitude, height, speed;
 
-		request >> postionFlag.data >> longitude >> latitude >> height >> speed;
-
-		otl_stream s(1
-			, "{ call `ics_canchu`.sp_weight_report(:id<char[33],in>,:num<int,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>"
-			",:mode<int,in>,:unit<int,in>,:cardid<int,in>,:flow<int,in>,:evalution<int,in>"
-			",:tubID<char[33],in>,:volumn<int,in>,:weight<int,in>,:driverID<int,in>"
-			",:logFlag<int,in>,:logitude<int,in>,:laFlag<int,in>,:latitude<int,in>,:signal<int,in>,:height<int,in>,:speed<int,in>) }"
-			, connGuard.connection());
-
-		s << m_monitorID << (int)business_no << report_time << recv_time
-			<< (int)weightFlag.mode << (int)weightFlag.unit << (int)weightFlag.card << (int)weightFlag.flow << (int)weightFlag.evalution
-			<< tubID << (int)tubVolumn << (int)weight << (int)driverID
-			<< (int)postionFlag.longitude_flag << (int)longitude << (int)postionFlag.latitude_flag << (int)latitude << (int)postionFlag.signal << (int)height << (int)speed;
+		BusinessLayout<4>::decode(request, weightFlag.data, tubID, tubVolumn, weight, driverID, postionFlag.data, longitude, latitude, height, speed);
+
+		auto& k = record.kitchen;
+		k.mode = weightFlag.mode;
+		k.unit = weightFlag.unit;
+		k.card = weightFlag.card;
+		k.flow = weightFlag.flow;
+		k.evaluation = weightFlag.evalution;
+		k.tubID = std::move(tubID);
+		k.tubVolume = tubVolumn;
+		k.weight = weight;
+		k.driverID = driverID;
+		k.position.longitudeFlag = postionFlag.longitude_flag;
+		k.position.longitude = longitude;
+		k.position.latitudeFlag = postionFlag.latitude_flag;
+		k.position.latitude = latitude;
+		k.position.signal = postionFlag.signal;
+		k.position.height = height;
+		k.position.speed = speed;
 	}
 	else if (business_type == 5)	// 高速治超
 	{
-		ShortString vehicleID;	// 车牌号
 		IcsDataTime checkTime1, checkTime2; // 预检时间,复检时间
 		uint8_t axleCount1, axleCount2;	// 预检轴数,复检轴数
 		uint32_t totalWeight1, totalWeight2, limitWeight1, limitWeight2, overWeight;
-
-		request >> vehicleID >> checkTime2 >> totalWeight2 >> limitWeight2 >> axleCount2 >> checkTime1 >> totalWeight1 >> limitWeight1 >> overWeight >> axleCount1;
-		request.assertEmpty();
-
-		otl_stream s(1
-			, "{ call `ics_freewayOverloadControl`.sp_business_overload(:id<char[33],in>,:busNum<int,in>,:recvTime<timestamp,in>,:vehNum<char[256],in>"
-			",:checkT1<timestamp,in>,:totalW1<int,in>,:limitW1<int,in>,:axleCount1<int,in>,:overW<int,in>"
-			",:checkT2<timestamp,in>,:totalW2<int,in>,:limitW2<int,in>,:axleCount2<int,in>) }"
-			, connGuard.connection());
-
-		s << m_monitorID << (int)business_no << recv_time << vehicleID 
-			<< checkTime1 << (int)totalWeight1 << (int)limitWeight1 << (int)axleCount1 << (int)overWeight
-			<< checkTime2 << (int)totalWeight2 << (int)limitWeight2 << (int)axleCount2;
+		auto& o = record.overload;
+
+		BusinessLayout<5>::decode(request, o.vehicleNum, checkTime2, totalWeight2, limitWeight2, axleCount2, checkTime1, totalWeight1, limitWeight1, overWeight, axleCount1);
+
+		o.checkTime[0] = checkTime1;
+		o.totalWeight[0] = totalWeight1;
+		o.limitWeight[0] = limitWeight1;
+		o.axleCount[0] = axleCount1;
+		o.overWeight = overWeight;
+		o.checkTime[1] = checkTime2;
+		o.totalWeight[1] = totalWeight2;
+		o.limitWeight[1] = limitWeight2;
+		o.axleCount[1] = axleCount2;
 	}
 	else if (business_type == 6)	// 高速治超汇报
 	{
 		uint32_t vehicleCount;
 
-		request >> vehicleCount;
-		request.assertEmpty();
-
-		otl_stream s(1
-			, "{ call `ics_freewayOverloadControl`.sp_business_dayreport(:id<char[33],in>,:recvTime<timestamp,in>,:reportTime<timestamp,in>,:count<int,in>) }"
-			, connGuard.connection());
-
-		s << m_monitorID << recv_time << report_time << (int)vehicleCount;
+		BusinessLayout<6>::decode(request, vehicleCount);
+		record.vehicleCount = vehicleCount;
 	}
 	else
 	{
@@ -536,6 +513,36 @@ void IcsTerminalClient::handleBusinessReport(ProtocolStream& request, ProtocolSt
 
 	request.assertEmpty();
 
+	Storage::Completion done;
+	if (request.getHead()->needResposne())
+	{
+		// 业务数据写入数据库、本地缓存或被数据库拒绝(重试几次后另存)后再应答;
+		// 只有数据库不可用且无法写入本地缓存时失败,不应答由终端稍后重发
+		deferResponse();
+		auto self = std::static_pointer_cast<IcsTerminalClient>(shared_from_this());
+		uint16_t ackNum = request.getHead()->getSendNum();
+		done = [self, ackNum, business_no](bool success)
+		{
+			if (success)
+			{
+				self->sendAck(ackNum);
+			}
+			else	// 重发的业务不能作为重复数据忽略
+			{
+				uint32_t expected = business_no;
+				self->m_lastBusSerialNum.compare_exchange_strong(expected, uint32_t(-1));
+			}
+		};
+	}
+
+	try {
+		m_localServer.getStorage().businessReport(std::move(record), std::move(done));
+	}
+	catch (IcsException&)
+	{
+		m_lastBusSerialNum = uint32_t(-1);
+		throw;
+	}
 }
 
 // GPS上报
@@ -554,17 +561,13 @@ void IcsTerminalClient::handleGpsReport(ProtocolStream& request, ProtocolStream&
 
 	uint32_t longitude, latitude, height, speed;
 
-	request >> postionFlag.data >> longitude >> latitude >> height >> speed;
+	MessageLayout<T2C_gps_report_0x0902>::decode(request, postionFlag.data, longitude, latitude, height, speed);
 
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-
-	otl_stream s(1
-		, "{ call `ics_canchu`.sp_gps_report(:id<char[33],in>,:logFlag<int,in>,:logitude<int,in>,:laFlag<int,in>,:latitude<int,in>,:signal<int,in>,:height<int,in>,:speed<int,in>) }"
-		, connGuard.connection());
-
-	s << m_monitorID << (int)postionFlag.longitude_flag << (int)longitude << (int)postionFlag.latitude_flag << (int)latitude << (int)postionFlag.signal << (int)height << (int)speed;
+	Storage::GpsPosition position{ postionFlag.longitude_flag, (int)longitude, postionFlag.latitude_flag, (int)latitude
+		, postionFlag.signal, (int)height, (int)speed };
+	m_localServer.getStorage().gpsReport(m_monitorID, position);
 }
 
 // 终端回应参数查询
@@ -578,18 +581,16 @@ void IcsTerminalClient::handleParamQueryResponse(ProtocolStream& request, Protoc
 	uint8_t param_type = 0;	//	参数值类型
 	string param_value;		//	参数值
 
-	request >> request_id >> param_count;
+	MessageLayout<T2C_param_query_response_0x0602>::decode(request, request_id, param_count);
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call `ics_base`.sp_param_query_result(:requestID<int,in>,:netID<int,in>,:paramID<int,in>,:paramValue<char[256],in>) }"
-		, connGuard.connection());
+	Storage::ParamList params;
 	for (uint16_t i = 0; i<param_count; i++)
 	{
-		request >> net_id >> param_id >> param_type >> param_value;
-		s << (int)request_id << (int)net_id << (int)param_id << param_value;	// 存入数据库
+		ParamItemLayout::decode(request, net_id, param_id, param_type, param_value);
+		params.emplace_back(net_id, param_id, param_value);
 	}
 
+	m_localServer.getStorage().paramQueryResult(request_id, std::move(params));
 }
 
 // 终端主动上报参数修改
@@ -603,17 +604,16 @@ void IcsTerminalClient::handleParamAlertReport(ProtocolStream& request, Protocol
 	uint8_t param_type = 0;	//	参数值类型
 	string param_value;		//	参数值
 
-	request >> alert_time >> param_count;
+	MessageLayout<T2C_param_alter_report_0x0701>::decode(request, alert_time, param_count);
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call `ics_base`.sp_param_report_modify(:monitorID<char[32],in>,:devKind<int,in>,:modifyTime<timestamp,in>,:netID<int,in>,:paramID<int,in>,:result<char[256],in>) }"
-		, connGuard.connection());
+	Storage::ParamList params;
 	for (uint16_t i = 0; i < param_count; i++)
 	{
-		request >> net_id >> param_id >> param_type >> param_value;
-		s << m_monitorID << (int)m_deviceKind << alert_time << (int)net_id << (int)param_id << param_value;	// 存入数据库
+		ParamItemLayout::decode(request, net_id, param_id, param_type, param_value);
+		params.emplace_back(net_id, param_id, param_value);
 	}
+
+	m_localServer.getStorage().paramReportModify(m_monitorID.str(), m_deviceKind, alert_time, std::move(params));
 }
 
 // 终端回应参数修改
@@ -626,30 +626,29 @@ void IcsTerminalClient::handleParamModifyResponse(ProtocolStream& request, Proto
 	uint16_t param_id = 0;	//	参数编号
 	string result;		//	修改结果
 
-	request >> request_id >> param_count;
+	MessageLayout<T2C_param_modiy_response_0x0802>::decode(request, request_id, param_count);
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call `ics_base`.sp_param_modify_result(:requestID<int,in>,:netID<int,in>,:paramID<int,in>,:result<char[256],in>) }"
-		, connGuard.connection());
+	Storage::ParamList results;
 	for (uint16_t i = 0; i < param_count; i++)
 	{
-		request >> net_id >> param_id >> result;
-		s << (int)request_id << (int)net_id << (int)param_id << result;	// 存入数据库
+		ParamResultLayout::decode(request, net_id, param_id, result);
+		results.emplace_back(net_id, param_id, result);
 	}
+
+	m_localServer.getStorage().paramModifyResult(request_id, std::move(results));
 }
 
 // 终端发送时钟同步请求
 void IcsTerminalClient::handleDatetimeSync(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	IcsDataTime dt1, dt2;
-	request >> dt1;
+	MessageLayout<T2C_datetime_sync_request_0x0a01>::decode(request, dt1);
 	request.assertEmpty();
 
 	getIcsNowTime(dt2);
 
 	response.initHead(MessageId::C2T_datetime_sync_response_0x0a02, false);
-	response << dt1 << dt2 << dt2;
+	MessageLayout<C2T_datetime_sync_response_0x0a02>::encode(response, dt1, dt2, dt2);
 }
 
 // 终端上报日志
@@ -660,7 +659,7 @@ void IcsTerminalClient::handleLogReport(ProtocolStream& request, ProtocolStream&
 	uint8_t encode_type = 0;	//	编码方式
 	string log_value;			//	日志内容
 
-	request >> status_time >> log_level >> encode_type >> log_value;
+	MessageLayout<T2C_log_report_0x0c01>::decode(request, status_time, log_level, encode_type, log_value);
 
 	request.assertEmpty();
 
@@ -674,12 +673,7 @@ void IcsTerminalClient::handleLogReport(ProtocolStream& request, ProtocolStream&
 		throw IcsException("undefined encode type");
 	}
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_log_report(:id<char[32],in>,:logtime<timestamp,in>,:logLevel<int,in>,:logValue<char[256],in>) }"
-		, connGuard.connection());
-
-	s << m_monitorID << status_time << (int)log_level << log_value;
+	m_localServer.getStorage().logReport(m_monitorID.str(), status_time, log_level, log_value);
 }
 
 // 终端发送心跳到中心
@@ -694,31 +688,21 @@ void IcsTerminalClient::handleDenyUpgrade(ProtocolStream& request, ProtocolStrea
 	uint32_t request_id;	// 请求id
 	string reason;	// 拒绝升级原因
 
-	request >> request_id >> reason;
+	MessageLayout<T2C_upgrade_deny_0x0202>::decode(request, request_id, reason);
 
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_upgrade_refuse(:id<char[33],in>,:reqID<int,in>,:reason<char[126],in>) }"
-		, connGuard.connection());
-
-	s << m_monitorID << int(request_id) << reason;
+	m_localServer.getStorage().upgradeRefuse(m_monitorID.str(), request_id, reason);
 }
 
 // 终端接收升级请求
 void IcsTerminalClient::handleAgreeUpgrade(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	uint32_t request_id;	// 请求id
-	request >> request_id;
+	MessageLayout<T2C_upgrade_agree_0x0203>::decode(request, request_id);
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_upgrade_accept(:id<char[33],in>,:reqID<int,in>) }"
-		, connGuard.connection());
-
-	s << m_monitorID << int(request_id);
+	m_localServer.getStorage().upgradeAccept(m_monitorID.str(), request_id);
 }
 
 // 索要升级文件片段
@@ -727,53 +711,66 @@ void IcsTerminalClient::handleRequestFile(ProtocolStream& request, ProtocolStrea
 	uint32_t file_id, request_id, fragment_offset, received_size;
 	uint16_t fragment_length;
 
-	request >> file_id >> request_id >> fragment_offset >> fragment_length >> received_size;
+	MessageLayout<T2C_upgrade_file_request_0x0204>::decode(request, file_id, request_id, fragment_offset, fragment_length, received_size);
 
 	request.assertEmpty();
 
 
-	// 设置升级进度(查询该请求id对应的状态)
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_upgrade_set_progress(:requestID<int,in>,:recvSize<int,in>,@stat) }"
-		, connGuard.connection());
-
-	s << (int)request_id << (int)received_size;
-
-	otl_stream queryResutl(1, "select @stat :#<int>", connGuard.connection());
-
-	int result = 99;
-
-	queryResutl >> result;
-
-	// 查找文件
-	auto fileInfo = FileUpgradeManager::getInstance()->getFileInfo(file_id);
-
-
-	// 查看是否已取消升级
-	if (fragment_length > 0 && result == 0 && fileInfo)	// 正常状态且找到该文件
+	// 设置升级进度(查询该请求id对应的状态),查询和读取文件不在io线程上进行,完成后应答
+	auto self = std::static_pointer_cast<IcsTerminalClient>(shared_from_this());
+	uint16_t ackNum = request.getHead()->getAckNum();
+	m_localServer.getStorage().upgradeProgress(request_id, received_size
+		, [self, file_id, request_id, fragment_offset, fragment_length, ackNum](bool success, int result)
 	{
-		if (fragment_offset > fileInfo->file_length)	// 超出文件大小
+		if (!success)
 		{
-			throw IcsException("require file offset [%d] is more than file's length [%d]", fragment_offset, fileInfo->file_length);
+			// 不应答,终端稍后重新请求
+			LOG_ERROR(self->name() << " set the progress of upgrade " << request_id << " failed");
+			return;
 		}
-		else if (fragment_offset + fragment_length > fileInfo->file_length)	// 超过文件大小则取剩余大小
+
+		// 查看是否已取消升级
+		if (fragment_length == 0 || result != 0)
 		{
-			fragment_length = fileInfo->file_length - fragment_offset;
+			self->sendFileFragment(nullptr, file_id, request_id, fragment_offset, fragment_length, ackNum);
+			return;
 		}
 
-		if (fragment_length > UPGRADE_FILE_SEGMENG_SIZE)	// 限制文件片段最大为缓冲区剩余长度
+		// 查找文件
+		FileUpgradeManager::getInstance()->getFileInfo(file_id
+			, [self, file_id, request_id, fragment_offset, fragment_length, ackNum](const std::shared_ptr<FileUpgradeManager::FileInfo>& fileInfo)
 		{
-			fragment_length = UPGRADE_FILE_SEGMENG_SIZE;
-		}
+			self->sendFileFragment(fileInfo, file_id, request_id, fragment_offset, fragment_length, ackNum);
+		});
+	});
+	_baseType::deferResponse();
+}
+
+// 发送升级文件片段
+void IcsTerminalClient::sendFileFragment(const std::shared_ptr<FileUpgradeManager::FileInfo>& fileInfo
+	, uint32_t file_id, uint32_t request_id, uint32_t fragment_offset, uint16_t fragment_length, uint16_t ackNum)
+{
+	try {
+		ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		if (fileInfo && fragment_offset < fileInfo->file_length)	// 正常状态且找到该文件
+		{
+			response.initHead(C2T_upgrade_file_response_0x0206, false);
+			response << file_id << request_id;
 
-		response.initHead(C2T_upgrade_file_response_0x0206, false);
-		response << file_id << request_id << fragment_offset << fragment_length;
-		response.append((char*)fileInfo->file_content + fragment_offset, fragment_length);
+			// 片段长度由终端指定,限制为响应缓冲区剩余可容纳的长度(片段偏移+片段长度+片段内容+校验码)
+			std::size_t room = response.leftLength() - sizeof(fragment_offset) - sizeof(fragment_length) - IcsMsgHead::CrcCodeSize;
+			auto fragment = fileInfo->getFragment(fragment_offset, (uint16_t)std::min<std::size_t>(fragment_length, room));
+			response.append(fragment->body.data(), fragment->body.size(), fragment->crc);
+		}
+		else	// 无升级事务
+		{
+			response.initHead(MessageId::C2T_upgrade_not_found_0x0205, ackNum);
+		}
+		_baseType::trySend(response);
 	}
-	else	// 无升级事务
+	catch (IcsException& ex)
 	{
-		response.initHead(MessageId::C2T_upgrade_not_found_0x0205, request.getHead()->getAckNum());
+		LOG_ERROR(this->name() << " send the fragment of file " << file_id << " error:" << ex.message());
 	}
 }
 
@@ -783,16 +780,11 @@ void IcsTerminalClient::handleUpgradeResult(ProtocolStream& request, ProtocolStr
 	uint32_t request_id;	// 文件id
 	string upgrade_result;	// 升级结果
 
-	request >> request_id >> upgrade_result;
+	MessageLayout<T2C_upgrade_result_report_0x0207>::decode(request, request_id, upgrade_result);
 
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_upgrade_result(:F1<int,in>,:F3<char[126],in>) }"
-		, connGuard.connection());
-
-	s << (int)request_id << upgrade_result;
+	m_localServer.getStorage().upgradeResult(request_id, upgrade_result);
 }
 
 // 终端确认取消升级
@@ -800,16 +792,11 @@ void IcsTerminalClient::handleUpgradeCancelAck(ProtocolStream& request, Protocol
 {
 	uint32_t request_id;	// 请求id
 
-	request >> request_id;
+	MessageLayout<T2C_upgrade_cancel_ack_0x0209>::decode(request, request_id);
 
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_upgrade_cancel_ack(:F1<int,in>) }"
-		, connGuard.connection());
-
-	s << (int)request_id;
+	m_localServer.getStorage().upgradeCancelAck(request_id);
 }
 
 // 终端回应控制结果
@@ -819,15 +806,10 @@ void IcsTerminalClient::handleControlAck(ProtocolStream& request, ProtocolStream
 	uint16_t operator_id;	// 操作id
 	ShortString result;		// 操作结果
 
-	request >> request_id >> operator_id >> result;
+	MessageLayout<T2C_control_response_0x0d02>::decode(request, request_id, operator_id, result);
 	request.assertEmpty();
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_control_result(:requestID<int,in>,:operatorID<int,in>,:result<char[256],in>) }"
-		, connGuard.connection());
-
-	s << (int)request_id << (int)operator_id << result;;
+	m_localServer.getStorage().controlResult(request_id, operator_id, result);
 }
 
 //---------------------------ics web---------------------------//
@@ -858,6 +840,14 @@ void IcsWebClient::handle(ProtocolStream& request, ProtocolStream& response) thr
 		handleRemoteForward(request, response);
 		break;
 
+	case MessageId::W2C_invalidate_cache_0x2005:
+		handleInvalidateCache(request, response);
+		break;
+
+	case MessageId::W2C_online_query_0x2006:
+		handleOnlineQuery(request, response);
+		break;
+
 	default:
 		throw IcsException("unknown web message id: %04x", request.getHead()->getMsgID());
 		break;
@@ -873,7 +863,7 @@ void IcsWebClient::dispatch(ProtocolStream& request) throw(IcsException, otl_exc
 // 出错处理
 void IcsWebClient::error() throw()
 {
-
+	m_localServer.removeWebClient(shared_from_this());
 }
 
 // 转发到ICS对应终端
@@ -883,19 +873,21 @@ void IcsWebClient::handleICSForward(ProtocolStream& request, ProtocolStream& res
 	ShortString gwid;
 	uint16_t messageID;
 	uint32_t requestID;
-	request >> gwid >> messageID >> requestID;
+	MessageLayout<W2C_send_to_ics_terminal_0x2001>::decode(request, gwid, messageID);
+	ForwardRequestLayout::decode(request, requestID);
 	request.rewind();
 
 	if (!gwid.empty())
 	{
+		// 根据终端ID转发该消息,查询不等待终端的上下线
 		bool ret = false;
-		// 根据终端ID转发该消息
-		auto conn = m_localServer.findTerminalClient(gwid);
-
+		IcsLocalServer::ConneciontPrt conn = m_localServer.findTerminalClient(gwid);
 		if (conn)
 		{
 			try {
-				conn->dispatch(request);
+				IcsMsgHead* head = request.getHead();
+				ProtocolStream forward(ProtocolStream::OptType::readType, head, head->getLength());
+				conn->dispatch(forward);
 				ret = true;
 			}
 			catch (IcsException& ex)
@@ -909,10 +901,12 @@ void IcsWebClient::handleICSForward(ProtocolStream& request, ProtocolStream& res
 		}
 
 		// 转发结果记录到数据库
+		try {
+			m_localServer.getStorage().webCommandStatus(requestID, messageID, ret ? 0 : 1);
+		}
+		catch (IcsException& ex)
 		{
-			OtlConnectionGuard connection(g_database);
-			otl_stream s(1, "{ call sp_web_command_status(:requestID<int,in>,:msgID<int,in>,:stat<int,in>) }", connection.connection());
-			s << (int)requestID << (int)messageID << (ret ? 0 : 1);
+			LOG_ERROR("record forward status of " << gwid << " error:" << ex.message());
 		}
 	}
 }
@@ -921,7 +915,7 @@ void IcsWebClient::handleICSForward(ProtocolStream& request, ProtocolStream& res
 void IcsWebClient::handleConnectRemote(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	ShortString remoteID;
-	request >> remoteID;
+	MessageLayout<W2C_connect_remote_request_0x2002>::decode(request, remoteID);
 	request.assertEmpty();
 
 	if (remoteID.empty())
@@ -937,56 +931,44 @@ void IcsWebClient::handleConnectRemote(ProtocolStream& request, ProtocolStream&
 		return;
 	}
 
-	// 从数据库中查询该远端地址
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream queryStream(1
-		, "SELECT t.IP,t.PORT FROM b_enterprise_t t	WHERE t.ENTERPRISE_CODE=:id<char[33]> AND t.HAVING_SUBCOMM=1"
-		, connGuard.connection());
-
-	queryStream << remoteID;
-
-	string remoteIP;
-	int remotePort;
-
-	if (!queryStream.eof())
-	{
-		queryStream >> remoteIP >> remotePort;
-	}
-
-	// 回应web连接结果:0-成功,1-失败
-
-	if (!remoteIP.empty() || remotePort != 0)
+	// 查询该远端地址后连接,查询和连接都不阻塞io线程
+	IcsLocalServer& localServer = m_localServer;
+	string name = this->name();
+	string enterpriseID = remoteID;
+	m_localServer.findEnterpriseAddress(enterpriseID, [&localServer, name, enterpriseID](LookupCacheBase::Status status, const IcsLocalServer::RemoteAddress& address)
 	{
-		// 连接该远端
-		asio::ip::tcp::socket remoteSocket(m_localServer.getIoService());
-		asio::ip::tcp::endpoint endpoint(asio::ip::address::from_string(remoteIP), remotePort);
 		asio::error_code ec;
-		remoteSocket.connect(endpoint, ec);
-
-		if (!ec)
-		{
-			auto conn = std::make_shared<IcsRemoteProxyClient>(m_localServer, std::move(remoteSocket), remoteID);
-			conn->start();
-			conn->requestAuthrize();
-		}
-		else
+		auto ip = asio::ip::address::from_string(address.ip, ec);
+		if (status != LookupCacheBase::Found || ec || address.port == 0)
 		{
-			LOG_ERROR(this->name() << " connect to " << remoteIP << ":" << remotePort << " failed," << ec.message());
+			LOG_WARN(name << " ip or port of " << enterpriseID << " error");
+			return;
 		}
-	}
-	else
-	{
-		LOG_WARN(this->name() << " ip or port error");	
-	}
 
-	
+		// 连接该远端
+		asio::ip::tcp::endpoint endpoint(ip, address.port);
+		auto remoteSocket = std::make_shared<asio::ip::tcp::socket>(localServer.getIoService());
+		remoteSocket->async_connect(endpoint, [&localServer, remoteSocket, name, enterpriseID, endpoint](const asio::error_code& ec)
+		{
+			if (!ec)
+			{
+				auto conn = std::make_shared<IcsRemoteProxyClient>(localServer, std::move(*remoteSocket), enterpriseID);
+				conn->start();
+				conn->requestAuthrize();
+			}
+			else
+			{
+				LOG_ERROR(name << " connect to " << endpoint << " failed," << ec.message());
+			}
+		});
+	});
 }
 
 // 断开远端子服务器
 void IcsWebClient::handleDisconnectRemote(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	ShortString remoteID;
-	request >> remoteID;
+	MessageLayout<W2C_disconnect_remote_0x2003>::decode(request, remoteID);
 	request.assertEmpty();
 
 	auto conn = m_localServer.findRemoteProxy(remoteID);
@@ -997,6 +979,37 @@ void IcsWebClient::handleDisconnectRemote(ProtocolStream& request, ProtocolStrea
 
 }
 
+// 数据库查询缓存失效
+void IcsWebClient::handleInvalidateCache(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
+{
+	uint8_t kind;
+	ShortString key;
+	MessageLayout<W2C_invalidate_cache_0x2005>::decode(request, kind, key);
+	request.assertEmpty();
+
+	if (kind > IcsLocalServer::AuthCache)
+	{
+		throw IcsException("unknown cache kind=%d", kind);
+	}
+
+	LOG_INFO(this->name() << " invalidate cache kind=" << (int)kind << " key=" << key);
+	m_localServer.invalidateCache((IcsLocalServer::CacheKind)kind, key);
+}
+
+// 查询在线终端
+void IcsWebClient::handleOnlineQuery(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
+{
+	uint32_t start;
+	uint16_t limit;
+	MessageLayout<W2C_online_query_0x2006>::decode(request, start, limit);
+	request.assertEmpty();
+
+	// 最近一次写入时的在线终端,不查询数据库;一个回应放不下时只写入放得下的部分,web按回应中的数量翻页
+	auto snapshot = m_localServer.getPresence().snapshot();
+	response.initHead(MessageId::C2W_online_response_0x2007, false);
+	PresenceTracker::writeOnline(*snapshot, start, std::min<uint16_t>(limit, MaxOnlineQuery), response);
+}
+
 // 转发到remote对应终端
 void IcsWebClient::handleRemoteForward(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
@@ -1005,7 +1018,8 @@ void IcsWebClient::handleRemoteForward(ProtocolStream& request, ProtocolStream&
 	ShortString gwid;
 	uint16_t messageID;
 	uint32_t requestID;
-	request >> enterpriseName >> gwid >> messageID >> requestID;
+	MessageLayout<W2C_send_to_remote_terminal_0x2004>::decode(request, enterpriseName, gwid, messageID);
+	ForwardRequestLayout::decode(request, requestID);
 	request.rewind();
 
 	if (!gwid.empty())
@@ -1027,9 +1041,7 @@ void IcsWebClient::handleRemoteForward(ProtocolStream& request, ProtocolStream&
 			// 转发失败结果记录到数据库
 			LOG_ERROR("can't find enterpirse:" << gwid);
 
-			OtlConnectionGuard connection(g_database);
-			otl_stream s(1, "{ call sp_web_command_status(:requestID<int,in>,:msgID<int,in>,:stat<int,in>) }", connection.connection());
-			s << (int)requestID << (int)messageID << (int)0;
+			m_localServer.getStorage().webCommandStatus(requestID, messageID, 0);
 		}
 		
 	}
@@ -1039,7 +1051,7 @@ void IcsWebClient::handleRemoteForward(ProtocolStream& request, ProtocolStream&
 //---------------------------ics remote proxy client---------------------------//
 IcsRemoteProxyClient::IcsRemoteProxyClient(IcsLocalServer& localServer, socket&& s, std::string remoteID)
 	: _baseType(localServer, std::move(s), "RemoteProxy")
-	, m_enterpriseID(remoteID)
+	, m_enterpriseID(g_idTable.intern(remoteID))
 	, m_isLegal(false)
 {
 }
@@ -1090,64 +1102,58 @@ void IcsRemoteProxyClient::handle(ProtocolStream& request, ProtocolStream& respo
 void IcsRemoteProxyClient::dispatch(ProtocolStream& request) throw(IcsException, otl_exception)
 {
 	// 消息结构：企业ID 网关ID 消息ID 消息体内容(请求ID 文件ID)
-	ProtocolStream response(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 	response.initHead(MessageId::C2C_forward_to_terminal_0x4004, false);
 
-	ShortString entepriseID;
+	ShortString entepriseID, gwid;
 	uint16_t messageID;
 
-	request >> entepriseID;
-	/// 跳过网关ID
-	request.moveForward<ShortString>();
-	request >> messageID;
+	MessageLayout<W2C_send_to_remote_terminal_0x2004>::decode(request, entepriseID, gwid, messageID);
 
 	/// 若升级消息时需要提前查找文件路径放到该消息末尾处
 	if (messageID == MessageId::C2T_upgrade_request_0x0201)
 	{
-		uint32_t fileid;
+		uint32_t requestid, fileid;
 
-		/// 跳过请求ID,取出文件ID
-		request.moveForward<uint32_t>();
-		request >> fileid;
+		/// 取出请求ID 文件ID后退回
+		MessageLayout<C2T_upgrade_request_0x0201>::decode(request, requestid, fileid);
+		request.moveBack(sizeof(requestid) + sizeof(fileid));
 
-		std::string filepath;
+		// 剩余消息在查到文件路径后发送
+		std::string rest((const char*)request.position(), request.leftLength());
 
+		// 查询该文件ID对应的文件名
+		auto self = shared_from_this();
+		m_localServer.findRemoteFile(entepriseID, fileid, [this, self, entepriseID, fileid, gwid, messageID, rest](LookupCacheBase::Status status, const std::string& filepath)
 		{
-			// 从数据库中查询该文件ID对应的文件名
-			// 转发结果记录到数据库
-			OtlConnectionGuard connection(g_database);
-			otl_stream s(1, "SELECT FILE_PATH FROM b_subComm_file_t WHERE FILE_ID=:fileid<int,in> AND ENTERPRISE_CODE=:entId<char[32],in>; ", connection.connection());
-			s << (int)fileid << entepriseID;
-
-			s >> filepath;
-		}
-
-		if (filepath.empty())
-		{
-			throw IcsException("can't find the file of the fileid(%d) for enterprise(%s)", fileid, entepriseID.c_str());
-		}
-
-		std::string tmp;
-		request.rewind();
-		request.moveForward<ShortString>();
-
-		request >> tmp;
-		response << tmp;	//  网关ID
-
-		request >> messageID;
-		response << messageID;	// 消息ID
-		
-		response << filepath;	// 文件全路径
+			if (status != LookupCacheBase::Found || filepath.empty())
+			{
+				LOG_ERROR("can't find the file of the fileid(" << fileid << ") for enterprise(" << entepriseID << ")");
+				return;
+			}
 
-		response << request;	// 剩余消息
+			try {
+				ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+				response.initHead(MessageId::C2C_forward_to_terminal_0x4004, false);
+				response << gwid;		//  网关ID
+				response << messageID;	// 消息ID
+				response << filepath;	// 文件全路径
+				response.append(rest.data(), rest.size());	// 剩余消息
+				_baseType::_baseType::trySend(response);
+			}
+			catch (IcsException& ex)
+			{
+				LOG_ERROR("forward the upgrade request to " << gwid << " error:" << ex.message());
+			}
+		});
 	}
 	else
 	{
 		request.rewind();
 		request.moveForward<ShortString>();
 		response << request;
+		_baseType::_baseType::trySend(response);
 	}
-	_baseType::_baseType::trySend(response);
 }
 
 // 出错
@@ -1158,20 +1164,22 @@ void IcsRemoteProxyClient::error() throw()
 		m_localServer.removeRemotePorxy(m_enterpriseID);
 		if (m_isLegal)
 		{
-			OtlConnectionGuard connGuard(g_database);
-			otl_stream s(1
-				, "{ call sp_remote_proxy_onoff_line(:ent<char[33],in>,2,'',0) }"
-				, connGuard.connection());
-			s << m_enterpriseID;
+			try {
+				m_localServer.getStorage().remoteProxyOffline(m_enterpriseID.str());
+			}
+			catch (IcsException& ex)
+			{
+				LOG_ERROR("record " << m_enterpriseID << " offline error:" << ex.message());
+			}
 		}
-		m_enterpriseID.clear();
+		m_enterpriseID = IcsId();
 	}
 }
 
 // 请求验证中心身份
 void IcsRemoteProxyClient::requestAuthrize()
 {
-	ProtocolStream request(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream request(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 	request.initHead(MessageId::C2C_auth_request1_0x4001, false);
 
 	// 取当前时间点
@@ -1180,7 +1188,7 @@ void IcsRemoteProxyClient::requestAuthrize()
 	// 加密该数据
 	ics::encrypt(&t, sizeof(t));
 
-	request << t;
+	MessageLayout<C2C_auth_request1_0x4001>::encode(request, t);
 
 
 	// 发送给远端通信服务器
@@ -1192,7 +1200,7 @@ void IcsRemoteProxyClient::requestAuthrize()
 // 发送心跳消息
 void IcsRemoteProxyClient::sendHeartbeat()
 {
-	ProtocolStream request(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream request(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 	request.initHead(MessageId::C2C_heartbeat_0x4008, true);
 
 	// 发送给远端通信服务器
@@ -1201,32 +1209,11 @@ void IcsRemoteProxyClient::sendHeartbeat()
 	LOG_DEBUG("send heartbeat to proxy server");
 }
 
-// 查找远程ID对应的本地ID
-const string& IcsRemoteProxyClient::findLocalID(const string& remoteID)
-{
-	auto& localId = m_remoteIdToDeviceIdMap[remoteID];
-	// 不存在时从数据库中查询
-	if (localId.empty())
-	{
-		OtlConnectionGuard connGuard(g_database);
-		otl_stream s(1
-			, "SELECT t.MONITORING_POINT_CODE FROM b_monitoring_point_t t WHERE t.GW_ID =:id<char[33]> AND t.STATUS = 0 LIMIT 1"
-			, connGuard.connection());
-		s << remoteID;
-		s >> localId;
-		if (localId.empty())
-		{
-			LOG_ERROR(name() << " the remote id=" << remoteID << " don't have local id");
-		}
-	}
-	return localId;
-}
-
 // 处理认证请求结果
 void IcsRemoteProxyClient::handleAuthResponse(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	std::time_t t1, t2, t3 = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	request >> t1 >> t2;
+	MessageLayout<C2C_auth_response_0x4002>::decode(request, t1, t2);
 
 	request.assertEmpty();
 
@@ -1238,15 +1225,11 @@ void IcsRemoteProxyClient::handleAuthResponse(ProtocolStream& request, ProtocolS
 		LOG_DEBUG("authrize success, interval=" << interval);
 
 		// 链接成功记录到数据库
-		OtlConnectionGuard connGuard(g_database);
-		otl_stream s(1
-			, "{ call sp_remote_proxy_onoff_line(:ent<char[33],in>,1,:ip<char[16],in>,:port<int,in>) }"
-			, connGuard.connection());
-		s << m_enterpriseID << m_localServer.getWebIp() << m_localServer.getWebPort();
+		m_localServer.getStorage().remoteProxyOnline(m_enterpriseID.str(), m_localServer.getWebIp(), m_localServer.getWebPort());
 
 		m_isLegal = true;
 		response.initHead(MessageId::C2C_auth_request2_0x4003, false);
-		response << t2;
+		MessageLayout<C2C_auth_request2_0x4003>::encode(response, t2);
 
 		m_localServer.addRemotePorxy(m_enterpriseID, shared_from_this());
 	}
@@ -1265,25 +1248,17 @@ void IcsRemoteProxyClient::handleForwardResponse(ProtocolStream& request, Protoc
 	uint16_t messageID;
 	uint8_t result;
 
-	request >> gwid >> messageID >> requestID >> result;
-
-	// 记录转发结果到数据库
-
-	OtlConnectionGuard connection(g_database);
-	otl_stream s(1, "{ call sp_webcmd_to_remote_proxy(:enterpriseID<char[32],in>,:requestID<int,in>,:msgID<int,in>,:stat<int,in>,:info<char[256],in>) }", connection.connection());
-	s << m_enterpriseID << (int)requestID << (int)messageID << (int)result;
+	MessageLayout<C2C_forward_response_0x4005>::decode(request, gwid, messageID, requestID, result);
 
 	if (result != 0) // 失败
 	{
-		request >> reason;
-		s << reason;
+		ForwardFailureLayout::decode(request, reason);
 		LOG_ERROR("forward to gwid=" << gwid << " failed,message id=" << messageID << ",request id=" << requestID << ",reason=" << reason);
 	}
-	else
-	{
-		s << "";
-	}
 	request.assertEmpty();
+
+	// 记录转发结果到数据库
+	m_localServer.getStorage().webCommandToRemote(m_enterpriseID.str(), requestID, messageID, result, reason);
 }
 
 // 代理服务器上下线消息
@@ -1292,16 +1267,12 @@ void IcsRemoteProxyClient::handleOnoffLine(ProtocolStream& request, ProtocolStre
 	ShortString gwid;
 	uint16_t devKind;
 	uint8_t status;
-	request >> gwid >> devKind >> status;
+	MessageLayout<C2C_terminal_onoff_line_0x4006>::decode(request, gwid, devKind, status);
 	request.assertEmpty();
 
 	LOG_DEBUG(gwid << (status == 0 ? " online" : " offline"));
 
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1
-		, "{ call sp_remote_terminal_onoff_line(:entID<char[32],in>,:gwid<char[33],in>,:devKind<int,in>,:stat<int,in>) }"
-		, connGuard.connection());
-	s << m_enterpriseID << gwid << (int)devKind << (int)status;
+	m_localServer.getStorage().remoteTerminalOnoffLine(m_enterpriseID.str(), gwid, devKind, status);
 }
 
 // 代理服务器转发终端的消息
@@ -1311,37 +1282,84 @@ void IcsRemoteProxyClient::handleTerminalMessage(ProtocolStream& request, Protoc
 	ShortString remoteGwid;
 	uint16_t msgid;
 
-	request >> remoteGwid >> msgid;
+	MessageLayout<C2C_forward_to_ics_0x4007>::decode(request, remoteGwid, msgid);
 
-	auto& monitorName = findLocalID(remoteGwid);
-	// 不存在时从数据库中查询
-	if (!monitorName.empty())
+	// 查到本地ID后在本链接的strand中按终端消息处理,查不到时只应答原消息
+	bool needResponse = request.getHead()->needResposne();
+	uint16_t ackNum = request.getHead()->getSendNum();
+	request.keep();
+	auto message = std::make_shared<ProtocolStream>(std::move(request));
+	auto self = std::static_pointer_cast<IcsRemoteProxyClient>(shared_from_this());
+	m_localServer.findMonitorPoint(remoteGwid, [self, message, remoteGwid, msgid, needResponse, ackNum](LookupCacheBase::Status status, const string& monitorName)
 	{
-		request.initHead((MessageId)msgid, false);
-		_baseType::m_monitorID = monitorName;
-		try {
-			_baseType::handle(request, response);
-		}
-		catch (IcsException& ex)
+		if (status != LookupCacheBase::Found || monitorName.empty())
 		{
-			LOG_ERROR("Handle the remote gwid '" << remoteGwid<<"' IcsException,"<<ex.message());
+			LOG_ERROR(self->name() << " the remote id=" << remoteGwid << " don't have local id");
+			if (needResponse)
+			{
+				self->sendAck(ackNum);
+			}
+			return;
 		}
-		catch (otl_exception& ex)
+
+		self->strandPost([self, message, monitorName, msgid, ackNum]()
 		{
-			LOG_ERROR("Handle the remote gwid '" << remoteGwid << "' otl_exception," << ex.msg);
-		}
-	}
+			// 改为终端消息后不再需要通用应答
+			message->initHead((MessageId)msgid, false);
+			self->m_monitorID = g_idTable.intern(monitorName);
+			self->handleDeferred(*message, false, ackNum);
+		});
+	});
+	deferResponse();
 }
 
 
 
 //---------------------------ics local server---------------------------//
-IcsLocalServer::IcsLocalServer(asio::io_service& ioService, const string& terminalAddr, std::size_t terminalMaxCount, const string& webAddr, std::size_t webMaxCount, const string& pushAddr)
-	: m_ioService(ioService)
-	, m_terminalTcpServer(ioService), m_terminalMaxCount(terminalMaxCount)
-	, m_webTcpServer(ioService), m_webMaxCount(webMaxCount)
-	, m_pushSystem(ioService, pushAddr)
+IcsLocalServer::IcsLocalServer(IoServicePool& ioPool, Storage& storage, const string& terminalAddr, std::size_t terminalMaxCount, const string& webAddr, std::size_t webMaxCount, const string& pushAddr)
+	: m_ioPool(ioPool)
+	, m_storage(storage)
+	, m_terminalTcpServer(ioPool), m_terminalMaxCount(terminalMaxCount)
+	, m_terminals(g_configFile.getAttributeInt("connection", "shards"), terminalMaxCount)
+	, m_webTcpServer(ioPool), m_webMaxCount(webMaxCount)
+	, m_webClients(1, webMaxCount)
+	, m_proxies(1)
+	, m_pushSystem(ioPool.getIoService(), pushAddr)
+	, m_presence(ioPool.getIoService(), storage)
+	, m_terminalAuth(storage)
+	, m_monitorPointCache("monitor point", [&storage](const string& remoteGwid, StringHandler&& done)
+	{
+		storage.findMonitorPoint(remoteGwid, [done](bool success, bool found, const string& monitorPoint)
+		{
+			done(!success ? LookupCacheBase::Failed : found ? LookupCacheBase::Found : LookupCacheBase::NotFound, monitorPoint);
+		});
+	})
+	, m_enterpriseCache("enterprise", [&storage](const string& enterpriseID, AddressHandler&& done)
+	{
+		storage.findEnterpriseAddress(enterpriseID, [done](bool success, bool found, const string& ip, int port)
+		{
+			RemoteAddress address;
+			address.ip = ip;
+			address.port = port;
+			done(!success ? LookupCacheBase::Failed : found ? LookupCacheBase::Found : LookupCacheBase::NotFound, address);
+		});
+	})
+	, m_remoteFileCache("remote file", [&storage](const string& key, StringHandler&& done)
+	{
+		// key: 企业ID#文件ID
+		auto pos = key.rfind('#');
+		storage.findRemoteFile(key.substr(0, pos), std::atoi(key.c_str() + pos + 1), [done](bool success, bool found, const string& filePath)
+		{
+			done(!success ? LookupCacheBase::Failed : found ? LookupCacheBase::Found : LookupCacheBase::NotFound, filePath);
+		});
+	})
 {
+	// 每个io服务一个定时器
+	for (std::size_t i = 0; i < m_ioPool.ioServiceCount(); i++)
+	{
+		m_timers.emplace_back(new TimingWheel(m_ioPool.getIoService(i)));
+	}
+
 	//清除所有的链接信息;
 	clearConnectionInfo();
 
@@ -1349,7 +1367,53 @@ IcsLocalServer::IcsLocalServer(asio::io_service& ioService, const string& termin
 	m_onlinePort = g_configFile.getAttributeInt("protocol", "onlinePort");
 	m_heartbeatTime = g_configFile.getAttributeInt("protocol", "heartbeat");
 
-	m_timer.start();
+	// 查询缓存:启动时批量加载,每refresh秒在数据库线程中重新加载
+	std::size_t cacheTtl = g_configFile.getAttributeInt("cache", "ttl");
+	std::size_t negativeTtl = g_configFile.getAttributeInt("cache", "negativettl");
+	std::size_t maxEntries = g_configFile.getAttributeInt("cache", "maxentries");
+	m_monitorPointCache.setLimit(cacheTtl, negativeTtl, maxEntries);
+	m_enterpriseCache.setLimit(cacheTtl, negativeTtl, maxEntries);
+	m_remoteFileCache.setLimit(cacheTtl, negativeTtl, maxEntries);
+	m_cacheRefresh = g_configFile.getAttributeInt("cache", "refresh");
+	try {
+		m_storage.loadCatalog([this](const Storage::Catalog& catalog)
+		{
+			preloadCache(catalog);
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR("preload cache error:" << ex.message());
+	}
+
+	// 在线状态:每flushinterval毫秒合并写入一次
+	m_presence.start(m_onlineIP, m_onlinePort, g_configFile.getAttributeInt("presence", "flushinterval"));
+
+	// 事件推送:每delay毫秒合并发送,未确认的每retransmit毫秒重发,每个推送服务器每秒最多rate个事件
+	m_pushSystem.start(g_configFile.getAttributeInt("push", "queuesize")
+		, g_configFile.getAttributeInt("push", "delay")
+		, g_configFile.getAttributeInt("push", "retransmit")
+		, g_configFile.getAttributeInt("push", "maxretry")
+		, g_configFile.getAttributeInt("push", "rate"));
+
+	// 终端认证结果缓存ttl秒
+	m_terminalAuth.setTtl(g_configFile.getAttributeInt("auth", "ttl"));
+
+	// 升级文件的路径由存储查询
+	FileUpgradeManager::getInstance()->setFileResolver([&storage](uint32_t fileid, FileUpgradeManager::FileNameHandler&& handler)
+	{
+		storage.upgradeFile(fileid, [handler](bool success, bool found, const std::string& filename)
+		{
+			handler(filename);
+		});
+	});
+
+	for (auto& timer : m_timers)
+	{
+		timer->start();
+	}
+	trimMemoryPool();
+	refreshCache();
 
 	m_terminalTcpServer.init("center's terminal"
 		, terminalAddr
@@ -1365,44 +1429,49 @@ IcsLocalServer::IcsLocalServer(asio::io_service& ioService, const string& termin
 		, [this](socket&& s)
 		{
 			ConneciontPrt conn = std::make_shared<IcsWebClient>(*this, std::move(s));
+			if (!m_webClients.insert(conn->name(), conn))
+			{
+				LOG_WARN(conn->name() << " is refused, web connections reach the max count " << m_webMaxCount);
+				return;
+			}
 			conn->start();
 			connectionTimeoutHandler(conn);
 		});
 
 	// 数据库记录该服务器地址 sp_server_onoff_line
-	{
-		OtlConnectionGuard connGuard(g_database);
-		otl_stream s(1
-			, "{ call sp_server_onoff_line(:ip<char[16],in>,:port<int,in>,:stat<int,in>) }"
-			, connGuard.connection());
-		s << m_onlineIP << m_onlinePort << (int)1;
-	}
+	m_storage.serverOnoffLine(m_onlineIP, m_onlinePort, 1);
 }
 
 IcsLocalServer::~IcsLocalServer()
 {
 	// 服务器下线
+	try {
+		m_storage.serverOnoffLine(m_onlineIP, m_onlinePort, 2);
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR("server offline error:" << ex.message());
+	}
+	catch (otl_exception& ex)
 	{
-		OtlConnectionGuard connGuard(g_database);
-		otl_stream s(1
-			, "{ call sp_server_onoff_line(:ip<char[16],in>,:port<int,in>,:stat<int,in>) }"
-			, connGuard.connection());
-		s << m_onlineIP << m_onlinePort << (int)2;
+		LOG_ERROR("server offline otl_exception:" << ex.msg);
 	}
 
 	// 停止tcp服务
 	m_terminalTcpServer.stop();
 	m_webTcpServer.stop();
 
-	// 清除链接信息
-	{
-		std::lock_guard<std::mutex> lock(m_terminalConnMapLock);
-		m_terminalConnMap.clear();
-	}
-	{
-		std::lock_guard<std::mutex> lock(m_proxyConnMapLock);
-		m_proxyConnMap.clear();
-	}
+	// 停止事件推送
+	m_pushSystem.stop();
+
+	// 写入变化的在线状态,等待认证中的查询并写入未满一批的数据
+	m_presence.stop();
+	m_storage.stop();
+
+	// 清除链接信息:io服务线程已结束
+	m_terminals.clear();
+	m_webClients.clear();
+	m_proxies.clear();
 
 	clearConnectionInfo();
 }
@@ -1420,103 +1489,194 @@ void IcsLocalServer::stop()
 }
 
 /// 添加已认证终端对象
-void IcsLocalServer::addTerminalClient(const string& gwid, ConneciontPrt conn)
+bool IcsLocalServer::addTerminalClient(IcsId gwid, ConneciontPrt conn)
 {
-	std::lock_guard<std::mutex> lock(m_terminalConnMapLock);
-	auto& oldConn = m_terminalConnMap[gwid];
-	if (oldConn)
+	ConneciontPrt oldConn;
+	if (!m_terminals.insert(gwid, conn, &oldConn))
+	{
+		return false;
+	}
+	if (oldConn && oldConn != conn)
 	{
 		LOG_WARN(gwid << " from " << oldConn->name() << " is replaced by " << conn->name());
 		oldConn->replaced();
 	}
-	oldConn = conn;
+	return true;
 }
 
 /// 移除已认证终端对象
-void IcsLocalServer::removeTerminalClient(const string& conID)
+void IcsLocalServer::removeTerminalClient(IcsId gwid, ConneciontPrt conn)
 {
-	std::lock_guard<std::mutex> lock(m_terminalConnMapLock);
-	m_terminalConnMap.erase(conID);
+	// 已被新链接替换时不移除
+	m_terminals.erase(gwid, conn);
 }
 
 /// 查询终端链接
-IcsLocalServer::ConneciontPrt IcsLocalServer::findTerminalClient(const string& conID)
+IcsLocalServer::ConneciontPrt IcsLocalServer::findTerminalClient(const string& gwid)
 {
-	std::lock_guard<std::mutex> lock(m_proxyConnMapLock);
-	auto it = m_terminalConnMap.find(conID);
-	if (it != m_terminalConnMap.end())
-	{
-		return it->second;
-	}
-	else
-	{
-		return nullptr;
-	}
+	IcsId id = g_idTable.find(gwid);
+	return id.empty() ? ConneciontPrt() : m_terminals.find(id);
+}
+
+/// 移除web链接
+void IcsLocalServer::removeWebClient(ConneciontPrt conn)
+{
+	m_webClients.erase(conn->name(), conn);
 }
 
 /// 添加远程代理服务器对象
-void IcsLocalServer::addRemotePorxy(const string& remoteID, ConneciontPrt conn)
+void IcsLocalServer::addRemotePorxy(IcsId remoteID, ConneciontPrt conn)
 {
 //	keepHeartbeat(conn);
-	std::lock_guard<std::mutex> lock(m_proxyConnMapLock);
-	m_proxyConnMap[remoteID] = conn;
+	m_proxies.insert(remoteID, conn);
 }
 
 /// 移除远程代理服务器
-void IcsLocalServer::removeRemotePorxy(const string& remoteID)
+void IcsLocalServer::removeRemotePorxy(IcsId remoteID)
 {
-	std::lock_guard<std::mutex> lock(m_proxyConnMapLock);
-	m_proxyConnMap.erase(remoteID);
+	m_proxies.erase(remoteID);
 }
 
 /// 查询远端代理服务器
 IcsLocalServer::ConneciontPrt IcsLocalServer::findRemoteProxy(const string& remoteID)
 {
-	std::lock_guard<std::mutex> lock(m_proxyConnMapLock);
-	auto it = m_proxyConnMap.find(remoteID);
-	if (it != m_proxyConnMap.end())
-	{
-		return it->second;
-	}
-	else
-	{
-		return nullptr;
-	}
+	IcsId id = g_idTable.find(remoteID);
+	return id.empty() ? ConneciontPrt() : m_proxies.find(id);
 }
 
 /// 初始化数据库连接信息
 void IcsLocalServer::clearConnectionInfo()
 {
 
-		OtlConnectionGuard connGuard(g_database);
-		otl_stream s(1
-			, "{ call sp_clear_connection_info(:ip<char[32],in>,:port<int,in>) }"
-			, connGuard.connection());
-		s << m_onlineIP << m_onlinePort;
+		m_storage.clearConnectionInfo(m_onlineIP, m_onlinePort);
 
 }
 
 /// 连接超时处理
 void IcsLocalServer::connectionTimeoutHandler(ConneciontPrt conn)
 {
-	m_timer.add(m_heartbeatTime,
-		std::bind([conn, this](){
-		if (conn->timeout())
+	conn->watchIdle(connectionTimer(conn), std::chrono::seconds(m_heartbeatTime));
+}
+
+/// 链接所在io服务的定时器
+TimingWheel& IcsLocalServer::connectionTimer(ConneciontPrt& conn)
+{
+	return *m_timers[m_ioPool.indexOf(conn->getIoService())];
+}
+
+/// 定时回收内存池空闲的arena
+void IcsLocalServer::trimMemoryPool()
+{
+	m_trimTimer.setCallback([this](){
+		g_memoryPool.trim();
+		m_timers[0]->schedule(m_trimTimer, std::chrono::seconds(MemoryPool::TrimInterval));
+	});
+	m_timers[0]->schedule(m_trimTimer, std::chrono::seconds(MemoryPool::TrimInterval));
+}
+
+/// 远端网关ID对应的本地监测点编号
+void IcsLocalServer::findMonitorPoint(const string& remoteGwid, StringHandler&& handler)
+{
+	m_monitorPointCache.get(remoteGwid, std::move(handler));
+}
+
+/// 远端企业的通信服务器地址
+void IcsLocalServer::findEnterpriseAddress(const string& enterpriseID, AddressHandler&& handler)
+{
+	m_enterpriseCache.get(enterpriseID, std::move(handler));
+}
+
+/// 远端企业升级文件的路径
+void IcsLocalServer::findRemoteFile(const string& enterpriseID, uint32_t fileID, StringHandler&& handler)
+{
+	m_remoteFileCache.get(enterpriseID + "#" + std::to_string(fileID), std::move(handler));
+}
+
+/// 查询缓存失效
+void IcsLocalServer::invalidateCache(CacheKind kind, const string& key)
+{
+	if (kind == AllCache || kind == MonitorPointCache)
+	{
+		key.empty() ? m_monitorPointCache.clear() : m_monitorPointCache.invalidate(key);
+	}
+	if (kind == AllCache || kind == EnterpriseCache)
+	{
+		key.empty() ? m_enterpriseCache.clear() : m_enterpriseCache.invalidate(key);
+	}
+	if (kind == AllCache || kind == RemoteFileCache)
+	{
+		// 文件的键值为企业ID#文件ID,按企业失效时清空
+		m_remoteFileCache.clear();
+	}
+	if (kind == AllCache || kind == AuthCache)
+	{
+		// 密码修改或终端停用后立即失效,不等待ttl到期
+		key.empty() ? m_terminalAuth.clear() : m_terminalAuth.invalidate(key);
+	}
+}
+
+/// 批量加载查询缓存
+void IcsLocalServer::preloadCache(const Storage::Catalog& catalog)
+{
+	for (auto& point : catalog.monitorPoints)
+	{
+		m_monitorPointCache.put(point.first, point.second);
+	}
+
+	for (auto& enterprise : catalog.enterprises)
+	{
+		m_enterpriseCache.put(std::get<0>(enterprise), RemoteAddress{ std::get<1>(enterprise), std::get<2>(enterprise) });
+	}
+
+	for (auto& file : catalog.remoteFiles)
+	{
+		m_remoteFileCache.put(std::get<0>(file) + "#" + std::to_string(std::get<1>(file)), std::get<2>(file));
+	}
+
+	LOG_INFO("cache loaded monitor points=" << catalog.monitorPoints.size() << " enterprises=" << catalog.enterprises.size() << " files=" << catalog.remoteFiles.size()
+		<< ", hits=" << m_monitorPointCache.hits() + m_enterpriseCache.hits() + m_remoteFileCache.hits()
+		<< " misses=" << m_monitorPointCache.misses() + m_enterpriseCache.misses() + m_remoteFileCache.misses());
+}
+
+/// 定时在数据库线程中重新加载查询缓存
+void IcsLocalServer::refreshCache()
+{
+	if (m_cacheRefresh == 0)
+	{
+		return;
+	}
+
+	m_refreshTimer.setCallback([this](){
+		try {
+			m_storage.loadCatalog([this](const Storage::Catalog& catalog)
+			{
+				preloadCache(catalog);
+			});
+		}
+		catch (IcsException& ex)
 		{
-			this->connectionTimeoutHandler(conn);
+			LOG_WARN("refresh cache error:" << ex.message());
 		}
-	}));
+		m_timers[0]->schedule(m_refreshTimer, std::chrono::seconds(m_cacheRefresh));
+	});
+	m_timers[0]->schedule(m_refreshTimer, std::chrono::seconds(m_cacheRefresh));
 }
 
 /// 保持代理服务器心跳
 void IcsLocalServer::keepHeartbeat(ConneciontPrt conn)
 {
 	auto proxy = std::dynamic_pointer_cast<IcsRemoteProxyClient>(conn);
-	m_timer.add(m_heartbeatTime*2,
-		std::bind([proxy, this](){
-		proxy->sendHeartbeat();
-		keepHeartbeat(proxy);
-	}));
+	TimingWheel& timer = connectionTimer(conn);
+	std::weak_ptr<IcsRemoteProxyClient> weak(proxy);
+	proxy->heartbeatTimer().setCallback([this, &timer, weak]()
+	{
+		if (auto proxy = weak.lock())
+		{
+			proxy->sendHeartbeat();
+			timer.schedule(proxy->heartbeatTimer(), std::chrono::seconds(m_heartbeatTime * 2));
+		}
+	});
+	timer.schedule(proxy->heartbeatTimer(), std::chrono::seconds(m_heartbeatTime * 2));
 }
 
 
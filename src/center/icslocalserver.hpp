@@ -8,7 +8,18 @@
 #include "tcpserver.hpp"
 #include "icspushsystem.hpp"
 #include "timer.hpp"
+#include "ioservicepool.hpp"
+#include "connectionregistry.hpp"
+#include "idtable.hpp"
+#include "storage.hpp"
+#include "lookupcache.hpp"
+#include "downloadfile.hpp"
+#include "terminalauth.hpp"
+#include "presencetracker.hpp"
 #include <string>
+#include <vector>
+#include <memory>
+#include <functional>
 
 using namespace std;
 
@@ -41,6 +52,9 @@ private:
 	// ն֤
 	void handleAuthRequest(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
 
+	// ֤,ǷҪӦ
+	bool handleAuthResult(const string& gwid, const TerminalAuth::Result& result, ProtocolStream& response);
+
 	// ׼״̬ϱ
 	void handleStdStatusReport(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception, otl_exception);
 
@@ -83,6 +97,10 @@ private:
 	// ҪļƬ
 	void handleRequestFile(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
 
+	// ļƬ,ҲļʱӦ:̵߳
+	void sendFileFragment(const std::shared_ptr<FileUpgradeManager::FileInfo>& fileInfo
+		, uint32_t file_id, uint32_t request_id, uint32_t fragment_offset, uint16_t fragment_length, uint16_t ackNum);
+
 	// ļ
 	void handleUpgradeResult(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
 
@@ -95,15 +113,17 @@ private:
 protected:
 	IcsLocalServer&			m_localServer;
 	/// (ӦICSϵͳм)
-	std::string             m_monitorID;
+	IcsId					m_monitorID;
 	/// ID
-	std::string				m_gwid;
+	IcsId					m_gwid;
 	/// 豸ͱ(ʱͬ豸)
 	uint16_t				m_deviceKind = 0;
 	/// к
 	uint16_t				m_send_num = 0;
 	// һҵ(ȥظҵ)
-	uint32_t				m_lastBusSerialNum = uint32_t(-1);
+	std::atomic<uint32_t>	m_lastBusSerialNum{ uint32_t(-1) };
+	/// ڵȴ֤
+	bool					m_authorizing = false;
 };
 
 
@@ -139,6 +159,15 @@ private:
 	// תremoteӦն
 	void handleRemoteForward(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
 
+	// ݿѯʧЧ
+	void handleInvalidateCache(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
+
+	// ѯն
+	void handleOnlineQuery(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
+
+	// һβѯն
+	static const uint16_t MaxOnlineQuery = 500;
+
 private:
 	IcsLocalServer& m_localServer;
 	std::string		m_name;
@@ -171,10 +200,13 @@ public:
 
 	// Ϣ
 	void sendHeartbeat();
-private:
-	// ԶIDӦıID
-	const string& findLocalID(const string& remoteID);
 
+	// ʱ
+	TimerHandle& heartbeatTimer()
+	{
+		return m_heartbeatTimer;
+	}
+private:
 	// ֤
 	void handleAuthResponse(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
 
@@ -188,10 +220,9 @@ private:
 	void handleTerminalMessage(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
 
 private:
-	std::string		m_enterpriseID;
+	IcsId			m_enterpriseID;
 	bool			m_isLegal;
-	std::unordered_map<std::string, std::string> m_remoteIdToDeviceIdMap;
-	std::mutex m_remoteIdToDeviceIdMapLock;
+	TimerHandle		m_heartbeatTimer;
 };
 
 
@@ -202,14 +233,30 @@ public:
 
 	typedef std::shared_ptr<IcsConnection<icstcp>> ConneciontPrt;
 
+	/// Զҵͨŷַ
+	struct RemoteAddress {
+		std::string	ip;
+		int			port = 0;
+	};
+
+	/// ѯ,web֪ͨʧЧʱʹ
+	enum CacheKind : uint8_t {
+		AllCache = 0,
+		MonitorPointCache = 1,
+		EnterpriseCache = 2,
+		RemoteFileCache = 3,
+		AuthCache = 4,
+	};
+
 	/*
-	param ioService: io
+	param ioPool: io̳߳
 	param terminalAddr: ն˼ַ
 	param terminalMaxCount: նֵ
 	param webAddr: web˼ַ
 	param webMaxCount: webֵ
+	param storage: ݴ洢
 	*/
-	IcsLocalServer(asio::io_service& ioService
+	IcsLocalServer(IoServicePool& ioPool, Storage& storage
 		, const string& terminalAddr, std::size_t terminalMaxCount
 		, const string& webAddr, std::size_t webMaxCount
 		, const string& pushAddr);
@@ -222,21 +269,30 @@ public:
 	/// ֹͣ¼
 	void stop();
 
-	/// ֤ն˶
-	void addTerminalClient(const string& gwid, ConneciontPrt conn);
+	/// ֤ն˶,նѴֵʱfalse
+	bool addTerminalClient(IcsId gwid, ConneciontPrt conn);
 
-	/// Ƴ֤ն˶
-	void removeTerminalClient(const string& gwid);
+	/// Ƴ֤ն˶,¼ǸʱƳ
+	void removeTerminalClient(IcsId gwid, ConneciontPrt conn);
 
-	/// ѯն
+	/// ѯն,δ¼gwidID,δҵʱΪ
 	ConneciontPrt findTerminalClient(const string& gwid);
 
+	/// ֤ն
+	std::size_t terminalCount() const
+	{
+		return m_terminals.size();
+	}
+
+	/// Ƴweb
+	void removeWebClient(ConneciontPrt conn);
+
 
 	/// Զ̴
-	void addRemotePorxy(const string& remoteID, ConneciontPrt conn);
+	void addRemotePorxy(IcsId remoteID, ConneciontPrt conn);
 
 	/// ƳԶ̴
-	void removeRemotePorxy(const string& remoteID);
+	void removeRemotePorxy(IcsId remoteID);
 
 	/// ѯԶ˷
 	ConneciontPrt findRemoteProxy(const string& remoteID);
@@ -265,12 +321,49 @@ public:
 		return m_pushSystem;
 	}
 
+	/// ݴ洢
+	inline Storage& getStorage()
+	{
+		return m_storage;
+	}
+
+	/// ն״̬
+	inline PresenceTracker& getPresence()
+	{
+		return m_presence;
+	}
+
+	/// ն֤
+	inline TerminalAuth& getTerminalAuth()
+	{
+		return m_terminalAuth;
+	}
+
 	/// ȡio
 	inline asio::io_service& getIoService()
 	{
-		return m_ioService;
+		return m_ioPool.getIoService();
 	}
+
+	/// ²ѯĽ:ʱڵ߳ϻص,ڲѯɵ߳ϻص
+	typedef LookupCache<string>::Handler StringHandler;
+	typedef LookupCache<RemoteAddress>::Handler AddressHandler;
+
+	/// ԶIDӦıؼ
+	void findMonitorPoint(const string& remoteGwid, StringHandler&& handler);
+
+	/// Զҵͨŷַ
+	void findEnterpriseAddress(const string& enterpriseID, AddressHandler&& handler);
+
+	/// Զҵļ·
+	void findRemoteFile(const string& enterpriseID, uint32_t fileID, StringHandler&& handler);
+
+	/// ѯʧЧ,keyΪʱոֻ
+	void invalidateCache(CacheKind kind, const string& key);
 private:
+	/// ioĶʱ
+	TimingWheel& connectionTimer(ConneciontPrt& conn);
+
 	/// ʼݿϢ
 	void clearConnectionInfo();
 
@@ -279,14 +372,25 @@ private:
 
 	/// ִ
 	void keepHeartbeat(ConneciontPrt conn);
+
+	/// ʱڴؿеarena
+	void trimMemoryPool();
+
+	/// زѯ
+	void preloadCache(const Storage::Catalog& catalog);
+
+	/// ʱݿ߳¼زѯ
+	void refreshCache();
 private:
-	asio::io_service& m_ioService;
+	IoServicePool&	m_ioPool;
+
+	// ݴ洢
+	Storage&		m_storage;
 
 	// ն˷
 	TcpServer	m_terminalTcpServer;
 	std::size_t m_terminalMaxCount;
-	std::unordered_map<std::string, ConneciontPrt> m_terminalConnMap;	// gwidΪkeyӶΪvalue
-	std::mutex	m_terminalConnMapLock;
+	ConnectionRegistry<ConneciontPrt, IcsId>	m_terminals;	// gwidΪkeyӶΪvalue
 
 	// Ϣ
 	std::string		m_onlineIP;
@@ -296,15 +400,30 @@ private:
 	// web
 	TcpServer	m_webTcpServer;
 	std::size_t m_webMaxCount;
+	ConnectionRegistry<ConneciontPrt>	m_webClients;	// Ϊkey
 
 	// Զ˴
-	std::unordered_map<std::string, ConneciontPrt> m_proxyConnMap;	// ҵIDΪkeyӶΪvalue
-	std::mutex	m_proxyConnMapLock;
+	ConnectionRegistry<ConneciontPrt, IcsId>	m_proxies;	// ҵIDΪkeyӶΪvalue
 
 	// ϵͳ
 	PushSystem	m_pushSystem;
+
+	// ն״̬,ϲд
+	PresenceTracker	m_presence;
+
+	// ն֤
+	TerminalAuth	m_terminalAuth;
+
+	// ݿѯ
+	LookupCache<std::string>	m_monitorPointCache;	// ԶID -> ؼ
+	LookupCache<RemoteAddress>	m_enterpriseCache;		// ҵID -> Զͨŷַ
+	LookupCache<std::string>	m_remoteFileCache;		// ҵID#ļID -> ļ·
+	std::size_t		m_cacheRefresh;
 	
-	TimingWheel<64>	m_timer;
+	// ÿioһʱ
+	std::vector<std::unique_ptr<TimingWheel>>	m_timers;
+	TimerHandle		m_trimTimer;
+	TimerHandle		m_refreshTimer;
 };
 
 }
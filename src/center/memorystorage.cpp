@@ -0,0 +1,452 @@
+
+
+#include "memorystorage.hpp"
+#include "log.hpp"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+
+namespace ics {
+
+
+MemoryStorage::MemoryStorage()
+{
+
+}
+
+MemoryStorage::~MemoryStorage()
+{
+
+}
+
+void MemoryStorage::open(const std::string& seedFile, const std::string& writeLog, bool acceptAll) throw(IcsException)
+{
+	m_acceptAll = acceptAll;
+
+	if (!seedFile.empty())
+	{
+		loadSeed(seedFile);
+	}
+
+	if (!writeLog.empty())
+	{
+		m_log.open(writeLog, std::ios::out | std::ios::app);
+		if (!m_log.is_open())
+		{
+			throw IcsException("open storage log %s failed,as %s", writeLog.c_str(), strerror(errno));
+		}
+	}
+
+	LOG_INFO("memory storage opened, terminals=" << m_terminals.size() << " monitor points=" << m_monitorPoints.size()
+		<< " enterprises=" << m_enterprises.size() << " accept all=" << acceptAll << " log=" << writeLog);
+}
+
+void MemoryStorage::stop()
+{
+	std::lock_guard<std::mutex> lock(m_logLock);
+	if (m_log.is_open())
+	{
+		m_log.flush();
+	}
+	for (auto& count : m_counts)
+	{
+		LOG_INFO("memory storage " << count.first << " rows=" << count.second);
+	}
+}
+
+void MemoryStorage::loadSeed(const std::string& seedFile) throw(IcsException)
+{
+	std::ifstream in(seedFile);
+	if (!in.is_open())
+	{
+		throw IcsException("open storage seed %s failed,as %s", seedFile.c_str(), strerror(errno));
+	}
+
+	std::string line;
+	std::size_t lineNum = 0;
+	while (std::getline(in, line))
+	{
+		lineNum++;
+		auto comment = line.find('#');
+		if (comment != std::string::npos)
+		{
+			line.erase(comment);
+		}
+
+		std::istringstream fields(line);
+		std::string table;
+		if (!(fields >> table))
+		{
+			continue;
+		}
+
+		bool ok = false;
+		if (table == "terminal")
+		{
+			std::string gwid;
+			Credential credential;
+			ok = (bool)(fields >> gwid >> credential.password >> credential.monitorID >> credential.monitorName);
+			m_terminals[gwid] = credential;
+		}
+		else if (table == "monitorpoint")
+		{
+			std::string gwid, monitorPoint;
+			ok = (bool)(fields >> gwid >> monitorPoint);
+			m_monitorPoints[gwid] = monitorPoint;
+		}
+		else if (table == "enterprise")
+		{
+			std::string enterpriseID, ip;
+			int port;
+			ok = (bool)(fields >> enterpriseID >> ip >> port);
+			m_enterprises[enterpriseID] = std::make_pair(ip, port);
+		}
+		else if (table == "remotefile")
+		{
+			std::string enterpriseID, path;
+			uint32_t fileID;
+			ok = (bool)(fields >> enterpriseID >> fileID >> path);
+			m_remoteFiles[enterpriseID + "#" + std::to_string(fileID)] = path;
+		}
+		else if (table == "upgradefile")
+		{
+			std::string path;
+			uint32_t fileID;
+			ok = (bool)(fields >> fileID >> path);
+			m_upgradeFiles[fileID] = path;
+		}
+
+		if (!ok)
+		{
+			throw IcsException("storage seed %s line %d error: %s", seedFile.c_str(), (int)lineNum, line.c_str());
+		}
+	}
+}
+
+void MemoryStorage::put(std::ostream& os, const IcsDataTime& value)
+{
+	char buff[32];
+	std::snprintf(buff, sizeof(buff), "%04u-%02u-%02u %02u:%02u:%02u.%03u"
+		, value.year, value.month, value.day, value.hour, value.miniute, value.second, value.milesecond);
+	os << buff;
+}
+
+void MemoryStorage::put(std::ostream& os, const ParamList& params)
+{
+	for (auto& param : params)
+	{
+		os << std::get<0>(param) << ',' << std::get<1>(param) << ',' << std::get<2>(param) << ';';
+	}
+}
+
+void MemoryStorage::serverOnoffLine(const std::string& ip, int port, int stat) throw(IcsException)
+{
+	record("sp_server_onoff_line", ip, port, stat);
+}
+
+void MemoryStorage::clearConnectionInfo(const std::string& ip, int port) throw(IcsException)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_onlines.clear();
+	}
+	record("sp_clear_connection_info", ip, port);
+}
+
+void MemoryStorage::authorize(const std::string& gwid, const std::string& pwd, AuthHandler&& handler)
+{
+	AuthResult result;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_terminals.find(gwid);
+		if (it != m_terminals.end())
+		{
+			result.ret = it->second.password == pwd ? 0 : 1;
+			result.monitorID = it->second.monitorID;
+			result.monitorName = it->second.monitorName;
+		}
+		else if (m_acceptAll)
+		{
+			result.ret = 0;
+			result.monitorID = gwid;
+			result.monitorName = gwid;
+		}
+		else
+		{
+			result.ret = 1;
+		}
+	}
+	record("sp_authroize", gwid, result.ret);
+	handler(result);
+}
+
+void MemoryStorage::writePresence(const std::string& ip, int port, std::vector<Terminal>&& onlines, std::vector<IcsId>&& offlines, Completion&& done) throw(IcsException)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (auto& t : onlines)
+		{
+			m_onlines[t.gwid] = t;
+		}
+		for (auto& gwid : offlines)
+		{
+			m_onlines.erase(gwid);
+		}
+	}
+	for (auto& t : onlines)
+	{
+		record("sp_online", t.gwid, t.monitorID, t.deviceKind, ip, port);
+	}
+	for (auto& gwid : offlines)
+	{
+		record("sp_offline", gwid, ip, port);
+	}
+	if (done)
+	{
+		done(true);
+	}
+}
+
+void MemoryStorage::statusReport(IcsId monitorID, IcsId gwid, int deviceLight, const std::string& deviceStatus
+	, int cheatLight, const std::string& cheatStatus, float zeroPoint, const IcsDataTime& recvTime) throw(IcsException)
+{
+	record("sp_status_standard", monitorID, gwid, deviceLight, deviceStatus, cheatLight, cheatStatus, zeroPoint, recvTime);
+}
+
+void MemoryStorage::eventReport(IcsId monitorID, uint16_t deviceKind, int eventID, int eventType, const std::string& eventValue
+	, const IcsDataTime& eventTime, const IcsDataTime& recvTime) throw(IcsException)
+{
+	record("sp_event_report", monitorID, deviceKind, eventID, eventType, eventValue, eventTime, recvTime);
+}
+
+void MemoryStorage::gpsReport(IcsId monitorID, const GpsPosition& position) throw(IcsException)
+{
+	record("sp_gps_report", monitorID, position.longitudeFlag, position.longitude, position.latitudeFlag, position.latitude
+		, position.signal, position.height, position.speed);
+}
+
+void MemoryStorage::businessReport(BusinessRecord&& business, Completion&& done) throw(IcsException)
+{
+	const std::string& monitorID = business.monitorID.str();
+	if (business.type == 1)
+	{
+		const BusinessRecord::Vehicle& v = business.vehicle;
+		record("sp_business_vehicle", monitorID, business.businessNo, v.cargoNum, v.vehicleNum, v.consignee, v.cargoName
+			, v.grossWeight, v.tareWeight, v.deductWeight, v.netWeight, v.unitPrice, v.money, v.inOut, business.reportTime, business.recvTime);
+	}
+	else if (business.type == 2)
+	{
+		for (auto& scale : business.scales)
+		{
+			record("sp_business_pack", monitorID, business.businessNo, scale.amount, scale.totalWeight, scale.singleWeight, business.reportTime, business.recvTime);
+		}
+	}
+	else if (business.type == 3)
+	{
+		const BusinessRecord::Highway& h = business.highway;
+		record("sp_business_expressway", monitorID, business.businessNo, h.totalWeight, h.speed, h.axleNum, h.axleWeights, h.typeNum, h.axleTypes
+			, business.reportTime, business.recvTime);
+	}
+	else if (business.type == 4)
+	{
+		const BusinessRecord::Kitchen& k = business.kitchen;
+		record("sp_weight_report", monitorID, business.businessNo, business.reportTime, business.recvTime, k.mode, k.unit, k.card, k.flow, k.evaluation
+			, k.tubID, k.tubVolume, k.weight, k.driverID, k.position.longitudeFlag, k.position.longitude, k.position.latitudeFlag, k.position.latitude
+			, k.position.signal, k.position.height, k.position.speed);
+	}
+	else if (business.type == 5)
+	{
+		const BusinessRecord::Overload& o = business.overload;
+		record("sp_business_overload", monitorID, business.businessNo, business.recvTime, o.vehicleNum
+			, o.checkTime[0], o.totalWeight[0], o.limitWeight[0], o.axleCount[0], o.overWeight
+			, o.checkTime[1], o.totalWeight[1], o.limitWeight[1], o.axleCount[1]);
+	}
+	else if (business.type == 6)
+	{
+		record("sp_business_dayreport", monitorID, business.recvTime, business.reportTime, business.vehicleCount);
+	}
+	else
+	{
+		throw IcsException("unknown business type=%d", business.type);
+	}
+
+	if (done)
+	{
+		done(true);
+	}
+}
+
+void MemoryStorage::paramQueryResult(uint32_t requestID, ParamList&& params) throw(IcsException)
+{
+	record("sp_param_query_result", requestID, params);
+}
+
+void MemoryStorage::paramReportModify(const std::string& monitorID, uint16_t deviceKind, const IcsDataTime& modifyTime, ParamList&& params) throw(IcsException)
+{
+	record("sp_param_report_modify", monitorID, deviceKind, modifyTime, params);
+}
+
+void MemoryStorage::paramModifyResult(uint32_t requestID, ParamList&& results) throw(IcsException)
+{
+	record("sp_param_modify_result", requestID, results);
+}
+
+void MemoryStorage::logReport(const std::string& monitorID, const IcsDataTime& logTime, int logLevel, const std::string& logValue) throw(IcsException)
+{
+	record("sp_log_report", monitorID, logTime, logLevel, logValue);
+}
+
+void MemoryStorage::controlResult(uint32_t requestID, int operatorID, const std::string& result) throw(IcsException)
+{
+	record("sp_control_result", requestID, operatorID, result);
+}
+
+void MemoryStorage::upgradeRefuse(const std::string& monitorID, uint32_t requestID, const std::string& reason) throw(IcsException)
+{
+	record("sp_upgrade_refuse", monitorID, requestID, reason);
+}
+
+void MemoryStorage::upgradeAccept(const std::string& monitorID, uint32_t requestID) throw(IcsException)
+{
+	record("sp_upgrade_accept", monitorID, requestID);
+}
+
+void MemoryStorage::upgradeProgress(uint32_t requestID, uint32_t recvSize, ProgressHandler&& handler)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_upgradeProgress[requestID] = recvSize;
+	}
+	record("sp_upgrade_set_progress", requestID, recvSize);
+	handler(true, 0);
+}
+
+void MemoryStorage::upgradeResult(uint32_t requestID, const std::string& result) throw(IcsException)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_upgradeProgress.erase(requestID);
+	}
+	record("sp_upgrade_result", requestID, result);
+}
+
+void MemoryStorage::upgradeCancelAck(uint32_t requestID) throw(IcsException)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_upgradeProgress.erase(requestID);
+	}
+	record("sp_upgrade_cancel_ack", requestID);
+}
+
+void MemoryStorage::upgradeFile(uint32_t fileID, LookupHandler&& handler)
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_upgradeFiles.find(fileID);
+		if (it != m_upgradeFiles.end())
+		{
+			path = it->second;
+		}
+	}
+	handler(true, !path.empty(), path);
+}
+
+void MemoryStorage::webCommandStatus(uint32_t requestID, uint16_t messageID, int stat) throw(IcsException)
+{
+	record("sp_web_command_status", requestID, messageID, stat);
+}
+
+void MemoryStorage::remoteProxyOnline(const std::string& enterpriseID, const std::string& ip, int port) throw(IcsException)
+{
+	record("sp_remote_proxy_onoff_line", enterpriseID, 1, ip, port);
+}
+
+void MemoryStorage::remoteProxyOffline(const std::string& enterpriseID) throw(IcsException)
+{
+	record("sp_remote_proxy_onoff_line", enterpriseID, 2);
+}
+
+void MemoryStorage::webCommandToRemote(const std::string& enterpriseID, uint32_t requestID, uint16_t messageID, int stat, const std::string& info) throw(IcsException)
+{
+	record("sp_webcmd_to_remote_proxy", enterpriseID, requestID, messageID, stat, info);
+}
+
+void MemoryStorage::remoteTerminalOnoffLine(const std::string& enterpriseID, const std::string& gwid, uint16_t deviceKind, int stat) throw(IcsException)
+{
+	record("sp_remote_terminal_onoff_line", enterpriseID, gwid, deviceKind, stat);
+}
+
+void MemoryStorage::findMonitorPoint(const std::string& remoteGwid, LookupHandler&& handler)
+{
+	std::string monitorPoint;
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_monitorPoints.find(remoteGwid);
+		if (it != m_monitorPoints.end())
+		{
+			monitorPoint = it->second;
+			found = true;
+		}
+	}
+	handler(true, found, monitorPoint);
+}
+
+void MemoryStorage::findEnterpriseAddress(const std::string& enterpriseID, AddressHandler&& handler)
+{
+	std::pair<std::string, int> address;
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_enterprises.find(enterpriseID);
+		if (it != m_enterprises.end())
+		{
+			address = it->second;
+			found = true;
+		}
+	}
+	handler(true, found, address.first, address.second);
+}
+
+void MemoryStorage::findRemoteFile(const std::string& enterpriseID, uint32_t fileID, LookupHandler&& handler)
+{
+	std::string filePath;
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_remoteFiles.find(enterpriseID + "#" + std::to_string(fileID));
+		if (it != m_remoteFiles.end())
+		{
+			filePath = it->second;
+			found = true;
+		}
+	}
+	handler(true, found, filePath);
+}
+
+void MemoryStorage::loadCatalog(CatalogHandler&& handler) throw(IcsException)
+{
+	Catalog catalog;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (auto& point : m_monitorPoints)
+		{
+			catalog.monitorPoints.emplace_back(point.first, point.second);
+		}
+		for (auto& enterprise : m_enterprises)
+		{
+			catalog.enterprises.emplace_back(enterprise.first, enterprise.second.first, enterprise.second.second);
+		}
+		for (auto& file : m_remoteFiles)
+		{
+			auto pos = file.first.rfind('#');
+			catalog.remoteFiles.emplace_back(file.first.substr(0, pos), std::atoi(file.first.c_str() + pos + 1), file.second);
+		}
+	}
+	handler(catalog);
+}
+
+} // end namespace ics
@@ -0,0 +1,151 @@
+
+
+#ifndef _ICS_MEMORY_STORAGE_H
+#define _ICS_MEMORY_STORAGE_H
+
+#include "storage.hpp"
+#include <string>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+
+
+namespace ics {
+
+/*
+storage in process for load tests without a database:
+the lookup tables are read from a seed file, writes update the online state and the counters
+and are appended to a text log(one line per row: procedure and fields separated by tabs)
+
+seed file, one row per line, '#' starts a comment:
+	terminal <gwid> <password> <monitor id> <monitor name>
+	monitorpoint <remote gwid> <monitor point>
+	enterprise <enterprise id> <ip> <port>
+	remotefile <enterprise id> <file id> <path>
+	upgradefile <file id> <path>
+*/
+class MemoryStorage : public Storage {
+public:
+	MemoryStorage();
+
+	~MemoryStorage();
+
+	/// writeLog empty for no log, acceptAll passes the terminals not in the seed file with their gwid as monitor id
+	void open(const std::string& seedFile, const std::string& writeLog, bool acceptAll) throw(IcsException);
+
+	virtual void stop();
+
+	virtual void serverOnoffLine(const std::string& ip, int port, int stat) throw(IcsException);
+
+	virtual void clearConnectionInfo(const std::string& ip, int port) throw(IcsException);
+
+	virtual void authorize(const std::string& gwid, const std::string& pwd, AuthHandler&& handler);
+
+	virtual void writePresence(const std::string& ip, int port, std::vector<Terminal>&& onlines, std::vector<IcsId>&& offlines, Completion&& done) throw(IcsException);
+
+	virtual void statusReport(IcsId monitorID, IcsId gwid, int deviceLight, const std::string& deviceStatus
+		, int cheatLight, const std::string& cheatStatus, float zeroPoint, const IcsDataTime& recvTime) throw(IcsException);
+
+	virtual void eventReport(IcsId monitorID, uint16_t deviceKind, int eventID, int eventType, const std::string& eventValue
+		, const IcsDataTime& eventTime, const IcsDataTime& recvTime) throw(IcsException);
+
+	virtual void gpsReport(IcsId monitorID, const GpsPosition& position) throw(IcsException);
+
+	virtual void businessReport(BusinessRecord&& business, Completion&& done) throw(IcsException);
+
+	virtual void paramQueryResult(uint32_t requestID, ParamList&& params) throw(IcsException);
+
+	virtual void paramReportModify(const std::string& monitorID, uint16_t deviceKind, const IcsDataTime& modifyTime, ParamList&& params) throw(IcsException);
+
+	virtual void paramModifyResult(uint32_t requestID, ParamList&& results) throw(IcsException);
+
+	virtual void logReport(const std::string& monitorID, const IcsDataTime& logTime, int logLevel, const std::string& logValue) throw(IcsException);
+
+	virtual void controlResult(uint32_t requestID, int operatorID, const std::string& result) throw(IcsException);
+
+	virtual void upgradeRefuse(const std::string& monitorID, uint32_t requestID, const std::string& reason) throw(IcsException);
+
+	virtual void upgradeAccept(const std::string& monitorID, uint32_t requestID) throw(IcsException);
+
+	virtual void upgradeProgress(uint32_t requestID, uint32_t recvSize, ProgressHandler&& handler);
+
+	virtual void upgradeResult(uint32_t requestID, const std::string& result) throw(IcsException);
+
+	virtual void upgradeCancelAck(uint32_t requestID) throw(IcsException);
+
+	virtual void upgradeFile(uint32_t fileID, LookupHandler&& handler);
+
+	virtual void webCommandStatus(uint32_t requestID, uint16_t messageID, int stat) throw(IcsException);
+
+	virtual void remoteProxyOnline(const std::string& enterpriseID, const std::string& ip, int port) throw(IcsException);
+
+	virtual void remoteProxyOffline(const std::string& enterpriseID) throw(IcsException);
+
+	virtual void webCommandToRemote(const std::string& enterpriseID, uint32_t requestID, uint16_t messageID, int stat, const std::string& info) throw(IcsException);
+
+	virtual void remoteTerminalOnoffLine(const std::string& enterpriseID, const std::string& gwid, uint16_t deviceKind, int stat) throw(IcsException);
+
+	virtual void findMonitorPoint(const std::string& remoteGwid, LookupHandler&& handler);
+
+	virtual void findEnterpriseAddress(const std::string& enterpriseID, AddressHandler&& handler);
+
+	virtual void findRemoteFile(const std::string& enterpriseID, uint32_t fileID, LookupHandler&& handler);
+
+	virtual void loadCatalog(CatalogHandler&& handler) throw(IcsException);
+
+private:
+	struct Credential {
+		std::string	password;
+		std::string	monitorID;
+		std::string	monitorName;
+	};
+
+	void loadSeed(const std::string& seedFile) throw(IcsException);
+
+	/// count the row of the procedure and append it to the log
+	template<class... Args>
+	void record(const std::string& procedure, const Args&... fields)
+	{
+		std::lock_guard<std::mutex> lock(m_logLock);
+		m_counts[procedure]++;
+		if (m_log.is_open())
+		{
+			m_log << procedure;
+			int expand[] = { 0, (m_log << '\t', put(m_log, fields), 0)... };
+			(void)expand;
+			m_log << '\n';
+		}
+	}
+
+	template<class T>
+	static void put(std::ostream& os, const T& value)
+	{
+		os << value;
+	}
+
+	static void put(std::ostream& os, const IcsDataTime& value);
+
+	static void put(std::ostream& os, const ParamList& params);
+
+private:
+	bool			m_acceptAll = false;
+
+	// seed tables and state
+	std::mutex		m_lock;
+	std::unordered_map<std::string, Credential>	m_terminals;
+	std::unordered_map<std::string, std::string>	m_monitorPoints;
+	std::unordered_map<std::string, std::pair<std::string, int>>	m_enterprises;
+	std::unordered_map<std::string, std::string>	m_remoteFiles;	// enterprise id#file id
+	std::unordered_map<uint32_t, std::string>	m_upgradeFiles;
+	std::unordered_map<IcsId, Terminal>	m_onlines;
+	std::unordered_map<uint32_t, uint32_t>	m_upgradeProgress;
+
+	// write log and counters
+	std::mutex		m_logLock;
+	std::ofstream	m_log;
+	std::unordered_map<std::string, uint64_t>	m_counts;
+};
+
+} // end namespace ics
+#endif	// end _ICS_MEMORY_STORAGE_H
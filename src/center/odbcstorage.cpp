@@ -0,0 +1,593 @@
+
+
+#include "odbcstorage.hpp"
+#include "log.hpp"
+#include <memory>
+
+
+namespace ics {
+
+namespace {
+
+// the callers of the storage don't see the database errors
+IcsException storageError(const char* name, const otl_exception& ex)
+{
+	return IcsException("%s error:%s", name, (const char*)ex.msg);
+}
+
+// the writes of one web request(query, modify, upgrade...) are ordered by its id
+std::string requestKey(uint32_t requestID)
+{
+	return "request#" + std::to_string(requestID);
+}
+
+}
+
+OdbcStorage::OdbcStorage(asio::io_service& service, DataBase& db, DbExecutor& executor)
+: m_database(db)
+, m_executor(executor)
+, m_authExecutor(db)
+, m_gpsWriter(service, executor, "sp_gps_report"
+	, "{ call `ics_canchu`.sp_gps_report(:id<char[33],in>,:logFlag<int,in>,:logitude<int,in>,:laFlag<int,in>,:latitude<int,in>,:signal<int,in>,:height<int,in>,:speed<int,in>) }")
+, m_statusWriter(service, executor, "sp_status_standard"
+	, "{ call sp_status_standard(:monitorID<char[16],in>,:gwID<char[16],in>,:devFlag<int,in>,:devStat<char[512],in>,:cheatFlag<int,in>,:cheatStat<char[512],in>,:zeroPoint<float,in>,:recvTime<timestamp,in>) }")
+, m_eventWriter(service, executor, "sp_event_report"
+	, "{ call sp_event_report(:id<char[33],in>,:devKind<int,in>,:eventID<int,in>,:eventType<int,in>,:eventValue<char[256],in>,:eventTime<timestamp,in>,:recvTime<timestamp,in>) }")
+{
+
+}
+
+OdbcStorage::~OdbcStorage()
+{
+	stop();
+}
+
+void OdbcStorage::start(std::size_t batchRows, std::size_t batchDelay, std::size_t authThreads, std::size_t authPending)
+{
+	m_batchRows = batchRows ? batchRows : 1;
+	m_gpsWriter.start(batchRows, batchDelay);
+	m_statusWriter.start(batchRows, batchDelay);
+	m_eventWriter.start(batchRows, batchDelay);
+	m_authExecutor.start(authThreads, authPending);
+}
+
+void OdbcStorage::stop()
+{
+	m_authExecutor.stop();
+	m_gpsWriter.stop();
+	m_statusWriter.stop();
+	m_eventWriter.stop();
+}
+
+void OdbcStorage::serverOnoffLine(const std::string& ip, int port, int stat) throw(IcsException)
+{
+	try {
+		OtlConnectionGuard connGuard(m_database);
+		otl_stream s(1
+			, "{ call sp_server_onoff_line(:ip<char[16],in>,:port<int,in>,:stat<int,in>) }"
+			, connGuard.connection());
+		s << ip << port << stat;
+	}
+	catch (otl_exception& ex)
+	{
+		throw storageError("sp_server_onoff_line", ex);
+	}
+}
+
+void OdbcStorage::clearConnectionInfo(const std::string& ip, int port) throw(IcsException)
+{
+	try {
+		OtlConnectionGuard connGuard(m_database);
+		otl_stream s(1
+			, "{ call sp_clear_connection_info(:ip<char[32],in>,:port<int,in>) }"
+			, connGuard.connection());
+		s << ip << port;
+	}
+	catch (otl_exception& ex)
+	{
+		throw storageError("sp_clear_connection_info", ex);
+	}
+}
+
+void OdbcStorage::authorize(const std::string& gwid, const std::string& pwd, AuthHandler&& handler)
+{
+	auto queried = std::make_shared<AuthResult>();
+	auto h = std::make_shared<AuthHandler>(std::move(handler));
+	try {
+		m_authExecutor.post("authorize", [this, gwid, pwd, queried](OtlConnection& conn)
+		{
+			queryAuthorize(conn, gwid, pwd, *queried);
+		}
+		, [queried, h](bool success)
+		{
+			(*h)(success ? *queried : AuthResult());
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_WARN("authorize " << gwid << " refused:" << ex.message());
+		(*h)(AuthResult());
+	}
+}
+
+void OdbcStorage::queryAuthorize(OtlConnection& conn, const std::string& gwid, const std::string& pwd, AuthResult& result)
+{
+	otl_stream& authroizeStream = conn.stream(
+		"{ call sp_authroize(:gwid<char[33],in>,:pwd<char[33],in>,@ret,@monitorID,@monitorName) }");
+
+	authroizeStream << gwid << pwd;
+
+	otl_stream& getStream = conn.select("select @ret :#ret<int>,@monitorID :#monitorID<char[32]>,@monitorName :#monitorName<char[32]>");
+
+	result.ret = 2;
+	getStream >> result.ret >> result.monitorID >> result.monitorName;
+}
+
+void OdbcStorage::writePresence(const std::string& ip, int port, std::vector<Terminal>&& onlines, std::vector<IcsId>&& offlines, Completion&& done) throw(IcsException)
+{
+	m_executor.post("presence", ip + ":" + std::to_string(port), [this, ip, port, onlines = std::move(onlines), offlines = std::move(offlines)](OtlConnection& conn)
+	{
+		if (!onlines.empty())
+		{
+			otl_stream& s = conn.stream("{ call sp_online(:gwid<char[33],in>,:monitorID<char[33],in>,:devKind<int,in>,:ip<char[16],in>,:port<int,in>) }"
+				, (int)m_batchRows);
+			for (auto& t : onlines)
+			{
+				s << t.gwid.str() << t.monitorID.str() << (int)t.deviceKind << ip << port;
+			}
+			s.flush();
+		}
+		if (!offlines.empty())
+		{
+			otl_stream& s = conn.stream("{ call sp_offline(:gwid<char[33],in>,:ip<char[17],in>,:port<int,in>) }"
+				, (int)m_batchRows);
+			for (auto& gwid : offlines)
+			{
+				s << gwid.str() << ip << port;
+			}
+			s.flush();
+		}
+	}
+	, std::move(done));
+}
+
+void OdbcStorage::statusReport(IcsId monitorID, IcsId gwid, int deviceLight, const std::string& deviceStatus
+	, int cheatLight, const std::string& cheatStatus, float zeroPoint, const IcsDataTime& recvTime) throw(IcsException)
+{
+	// the rows keep the interned ids, the strings are only read by the writer
+	m_statusWriter.write([=](DbCall& o)
+	{
+		o << monitorID.str() << gwid.str() << deviceLight << deviceStatus << cheatLight << cheatStatus << zeroPoint << recvTime;
+	});
+}
+
+void OdbcStorage::eventReport(IcsId monitorID, uint16_t deviceKind, int eventID, int eventType, const std::string& eventValue
+	, const IcsDataTime& eventTime, const IcsDataTime& recvTime) throw(IcsException)
+{
+	m_eventWriter.write([=](DbCall& eventStream)
+	{
+		eventStream << monitorID.str() << (int)deviceKind << eventID << eventType << eventValue << eventTime << recvTime;
+	});
+}
+
+void OdbcStorage::gpsReport(IcsId monitorID, const GpsPosition& position) throw(IcsException)
+{
+	m_gpsWriter.write([monitorID, position](DbCall& s)
+	{
+		s << monitorID.str() << position.longitudeFlag << position.longitude << position.latitudeFlag << position.latitude
+			<< position.signal << position.height << position.speed;
+	});
+}
+
+void OdbcStorage::businessReport(BusinessRecord&& record, Completion&& done) throw(IcsException)
+{
+	// calls can be spooled while the database is down, the key makes the replay idempotent
+	m_executor.post("business report", record.monitorID.str(), businessCall(record), std::move(done));
+}
+
+DbCall OdbcStorage::businessCall(const BusinessRecord& record) throw(IcsException)
+{
+	std::string key = record.monitorID.str() + "#" + std::to_string(record.businessNo);
+	const std::string& monitorID = record.monitorID.str();
+	DbCall call;
+
+	if (record.type == 1)	// static vehicle scale
+	{
+		const BusinessRecord::Vehicle& v = record.vehicle;
+		call = DbCall("{ call `ics_vehicle`.sp_business_vehicle(:id<char[33],in>,:num<int,in>,:cargoNum<char[126],in>,:vehNum<char[126],in>"
+			",:consigness<char[126],in>,:cargoName<char[126],in>,:weight1<float,in>,:weight2<float,in>,:weight3<float,in>,:weight4<float,in>"
+			",:unitPrice<float,in>,:money<float,in>,:inOrOut<int,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }", key);
+
+		call << monitorID << (int)record.businessNo << v.cargoNum << v.vehicleNum
+			<< v.consignee << v.cargoName << v.grossWeight << v.tareWeight << v.deductWeight << v.netWeight
+			<< v.unitPrice << v.money << v.inOut << record.reportTime << record.recvTime;
+	}
+	else if (record.type == 2)	// packing scales
+	{
+		call = DbCall("{ call `ics_packing`.sp_business_pack(:id<char[33],in>,:num<int,in>,:amount<int,in>,:weight<int,in>,:sWeight<int,in>,:F6<float,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }", key);
+
+		for (auto& scale : record.scales)
+		{
+			call << monitorID << record.businessNo << scale.amount << scale.totalWeight << scale.singleWeight << record.reportTime << record.recvTime;
+		}
+	}
+	else if (record.type == 3)	// highway scale
+	{
+		const BusinessRecord::Highway& h = record.highway;
+		call = DbCall("{ call `ics_highway`.sp_business_expressway(:id<char[33],in>,:num<int,in>,:weight<int,in>,:speed<double,in>,:axleNum<int,in>,:axleStr<char[256],in>,:typeNum<int,in>,:typeStr<char[256],in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }", key);
+
+		call << monitorID << (int)record.businessNo << h.totalWeight << h.speed << h.axleNum << h.axleWeights << h.typeNum << h.axleTypes << record.reportTime << record.recvTime;
+	}
+	else if (record.type == 4)	// kitchen waste truck
+	{
+		const BusinessRecord::Kitchen& k = record.kitchen;
+		call = DbCall("{ call `ics_canchu`.sp_weight_report(:id<char[33],in>,:num<int,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>"
+			",:mode<int,in>,:unit<int,in>,:cardid<int,in>,:flow<int,in>,:evalution<int,in>"
+			",:tubID<char[33],in>,:volumn<int,in>,:weight<int,in>,:driverID<int,in>"
+			",:logFlag<int,in>,:logitude<int,in>,:laFlag<int,in>,:latitude<int,in>,:signal<int,in>,:height<int,in>,:speed<int,in>) }", key);
+
+		call << monitorID << (int)record.businessNo << record.reportTime << record.recvTime
+			<< k.mode << k.unit << k.card << k.flow << k.evaluation
+			<< k.tubID << k.tubVolume << k.weight << k.driverID
+			<< k.position.longitudeFlag << k.position.longitude << k.position.latitudeFlag << k.position.latitude
+			<< k.position.signal << k.position.height << k.position.speed;
+	}
+	else if (record.type == 5)	// overload check
+	{
+		const BusinessRecord::Overload& o = record.overload;
+		call = DbCall("{ call `ics_freewayOverloadControl`.sp_business_overload(:id<char[33],in>,:busNum<int,in>,:recvTime<timestamp,in>,:vehNum<char[256],in>"
+			",:checkT1<timestamp,in>,:totalW1<int,in>,:limitW1<int,in>,:axleCount1<int,in>,:overW<int,in>"
+			",:checkT2<timestamp,in>,:totalW2<int,in>,:limitW2<int,in>,:axleCount2<int,in>) }", key);
+
+		call << monitorID << (int)record.businessNo << record.recvTime << o.vehicleNum
+			<< o.checkTime[0] << o.totalWeight[0] << o.limitWeight[0] << o.axleCount[0] << o.overWeight
+			<< o.checkTime[1] << o.totalWeight[1] << o.limitWeight[1] << o.axleCount[1];
+	}
+	else if (record.type == 6)	// overload check daily report
+	{
+		call = DbCall("{ call `ics_freewayOverloadControl`.sp_business_dayreport(:id<char[33],in>,:recvTime<timestamp,in>,:reportTime<timestamp,in>,:count<int,in>) }", key);
+
+		call << monitorID << record.recvTime << record.reportTime << record.vehicleCount;
+	}
+	else
+	{
+		throw IcsException("unknown business type=%d", record.type);
+	}
+	return call;
+}
+
+void OdbcStorage::paramQueryResult(uint32_t requestID, ParamList&& params) throw(IcsException)
+{
+	m_executor.post("sp_param_query_result", requestKey(requestID), [requestID, params = std::move(params)](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call `ics_base`.sp_param_query_result(:requestID<int,in>,:netID<int,in>,:paramID<int,in>,:paramValue<char[256],in>) }");
+		for (auto& param : params)
+		{
+			s << (int)requestID << (int)std::get<0>(param) << (int)std::get<1>(param) << std::get<2>(param);
+		}
+	});
+}
+
+void OdbcStorage::paramReportModify(const std::string& monitorID, uint16_t deviceKind, const IcsDataTime& modifyTime, ParamList&& params) throw(IcsException)
+{
+	m_executor.post("sp_param_report_modify", monitorID, [monitorID, deviceKind, modifyTime, params = std::move(params)](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call `ics_base`.sp_param_report_modify(:monitorID<char[32],in>,:devKind<int,in>,:modifyTime<timestamp,in>,:netID<int,in>,:paramID<int,in>,:result<char[256],in>) }");
+		for (auto& param : params)
+		{
+			s << monitorID << (int)deviceKind << modifyTime << (int)std::get<0>(param) << (int)std::get<1>(param) << std::get<2>(param);
+		}
+	});
+}
+
+void OdbcStorage::paramModifyResult(uint32_t requestID, ParamList&& results) throw(IcsException)
+{
+	m_executor.post("sp_param_modify_result", requestKey(requestID), [requestID, results = std::move(results)](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call `ics_base`.sp_param_modify_result(:requestID<int,in>,:netID<int,in>,:paramID<int,in>,:result<char[256],in>) }");
+		for (auto& item : results)
+		{
+			s << (int)requestID << (int)std::get<0>(item) << (int)std::get<1>(item) << std::get<2>(item);
+		}
+	});
+}
+
+void OdbcStorage::logReport(const std::string& monitorID, const IcsDataTime& logTime, int logLevel, const std::string& logValue) throw(IcsException)
+{
+	m_executor.post("sp_log_report", monitorID, [monitorID, logTime, logLevel, logValue](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_log_report(:id<char[32],in>,:logtime<timestamp,in>,:logLevel<int,in>,:logValue<char[256],in>) }");
+
+		s << monitorID << logTime << logLevel << logValue;
+	});
+}
+
+void OdbcStorage::controlResult(uint32_t requestID, int operatorID, const std::string& result) throw(IcsException)
+{
+	m_executor.post("sp_control_result", requestKey(requestID), [requestID, operatorID, result](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_control_result(:requestID<int,in>,:operatorID<int,in>,:result<char[256],in>) }");
+
+		s << (int)requestID << operatorID << result;
+	});
+}
+
+void OdbcStorage::upgradeRefuse(const std::string& monitorID, uint32_t requestID, const std::string& reason) throw(IcsException)
+{
+	m_executor.post("sp_upgrade_refuse", requestKey(requestID), [monitorID, requestID, reason](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_upgrade_refuse(:id<char[33],in>,:reqID<int,in>,:reason<char[126],in>) }");
+
+		s << monitorID << int(requestID) << reason;
+	});
+}
+
+void OdbcStorage::upgradeAccept(const std::string& monitorID, uint32_t requestID) throw(IcsException)
+{
+	m_executor.post("sp_upgrade_accept", requestKey(requestID), [monitorID, requestID](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_upgrade_accept(:id<char[33],in>,:reqID<int,in>) }");
+
+		s << monitorID << int(requestID);
+	});
+}
+
+void OdbcStorage::upgradeProgress(uint32_t requestID, uint32_t recvSize, ProgressHandler&& handler)
+{
+	auto state = std::make_shared<int>(99);
+	auto h = std::make_shared<ProgressHandler>(std::move(handler));
+	try {
+		// after the accept of the same request
+		m_executor.post("sp_upgrade_set_progress", requestKey(requestID), [requestID, recvSize, state](OtlConnection& conn)
+		{
+			otl_stream& s = conn.stream("{ call sp_upgrade_set_progress(:requestID<int,in>,:recvSize<int,in>,@stat) }");
+
+			s << (int)requestID << (int)recvSize;
+
+			otl_stream& queryResutl = conn.select("select @stat :#<int>");
+
+			queryResutl >> *state;
+		}
+		, [state, h](bool success)
+		{
+			(*h)(success, *state);
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_WARN("sp_upgrade_set_progress of " << requestID << " refused:" << ex.message());
+		(*h)(false, 99);
+	}
+}
+
+void OdbcStorage::upgradeResult(uint32_t requestID, const std::string& result) throw(IcsException)
+{
+	m_executor.post("sp_upgrade_result", requestKey(requestID), [requestID, result](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_upgrade_result(:F1<int,in>,:F3<char[126],in>) }");
+
+		s << (int)requestID << result;
+	});
+}
+
+void OdbcStorage::upgradeCancelAck(uint32_t requestID) throw(IcsException)
+{
+	m_executor.post("sp_upgrade_cancel_ack", requestKey(requestID), [requestID](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_upgrade_cancel_ack(:F1<int,in>) }");
+
+		s << (int)requestID;
+	});
+}
+
+void OdbcStorage::upgradeFile(uint32_t fileID, LookupHandler&& handler)
+{
+	lookup("sp_upgrade_getfile", [fileID](OtlConnection& conn, std::string& filename)
+	{
+		otl_stream s(1, "{ call sp_upgrade_getfile(:fileid<int,in>,@filename) }", conn);
+		s << (int)fileID;
+
+		otl_stream queryResult(1, "select @filename :#filename<char[126]>", conn);
+		queryResult >> filename;
+		return !filename.empty();
+	}
+	, std::move(handler));
+}
+
+void OdbcStorage::webCommandStatus(uint32_t requestID, uint16_t messageID, int stat) throw(IcsException)
+{
+	m_executor.post("sp_web_command_status", requestKey(requestID), [requestID, messageID, stat](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_web_command_status(:requestID<int,in>,:msgID<int,in>,:stat<int,in>) }");
+
+		s << (int)requestID << (int)messageID << stat;
+	});
+}
+
+void OdbcStorage::remoteProxyOnline(const std::string& enterpriseID, const std::string& ip, int port) throw(IcsException)
+{
+	m_executor.post("sp_remote_proxy_onoff_line", enterpriseID, [enterpriseID, ip, port](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_remote_proxy_onoff_line(:ent<char[33],in>,1,:ip<char[16],in>,:port<int,in>) }");
+
+		s << enterpriseID << ip << port;
+	});
+}
+
+void OdbcStorage::remoteProxyOffline(const std::string& enterpriseID) throw(IcsException)
+{
+	m_executor.post("sp_remote_proxy_onoff_line", enterpriseID, [enterpriseID](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_remote_proxy_onoff_line(:ent<char[33],in>,2,'',0) }");
+
+		s << enterpriseID;
+	});
+}
+
+void OdbcStorage::webCommandToRemote(const std::string& enterpriseID, uint32_t requestID, uint16_t messageID, int stat, const std::string& info) throw(IcsException)
+{
+	m_executor.post("sp_webcmd_to_remote_proxy", enterpriseID, [enterpriseID, requestID, messageID, stat, info](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_webcmd_to_remote_proxy(:enterpriseID<char[32],in>,:requestID<int,in>,:msgID<int,in>,:stat<int,in>,:info<char[256],in>) }");
+
+		s << enterpriseID << (int)requestID << (int)messageID << stat << info;
+	});
+}
+
+void OdbcStorage::remoteTerminalOnoffLine(const std::string& enterpriseID, const std::string& gwid, uint16_t deviceKind, int stat) throw(IcsException)
+{
+	m_executor.post("sp_remote_terminal_onoff_line", enterpriseID, [enterpriseID, gwid, deviceKind, stat](OtlConnection& conn)
+	{
+		otl_stream& s = conn.stream("{ call sp_remote_terminal_onoff_line(:entID<char[32],in>,:gwid<char[33],in>,:devKind<int,in>,:stat<int,in>) }");
+
+		s << enterpriseID << gwid << (int)deviceKind << stat;
+	});
+}
+
+void OdbcStorage::findMonitorPoint(const std::string& remoteGwid, LookupHandler&& handler)
+{
+	lookup("find monitor point", [remoteGwid](OtlConnection& conn, std::string& monitorPoint)
+	{
+		otl_stream s(1
+			, "SELECT t.MONITORING_POINT_CODE FROM b_monitoring_point_t t WHERE t.GW_ID =:id<char[33]> AND t.STATUS = 0 LIMIT 1"
+			, conn);
+		s << remoteGwid;
+		if (s.eof())
+		{
+			return false;
+		}
+		s >> monitorPoint;
+		return true;
+	}
+	, std::move(handler));
+}
+
+void OdbcStorage::findEnterpriseAddress(const std::string& enterpriseID, AddressHandler&& handler)
+{
+	struct Address {
+		bool		found = false;
+		std::string	ip;
+		int			port = 0;
+	};
+	auto address = std::make_shared<Address>();
+	auto h = std::make_shared<AddressHandler>(std::move(handler));
+	try {
+		m_executor.post("find enterprise address", [enterpriseID, address](OtlConnection& conn)
+		{
+			otl_stream s(1
+				, "SELECT t.IP,t.PORT FROM b_enterprise_t t WHERE t.ENTERPRISE_CODE=:id<char[33]> AND t.HAVING_SUBCOMM=1"
+				, conn);
+			s << enterpriseID;
+			if (!s.eof())
+			{
+				s >> address->ip >> address->port;
+				address->found = true;
+			}
+		}
+		, [address, h](bool success)
+		{
+			(*h)(success, success && address->found, address->ip, address->port);
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_WARN("find enterprise address " << enterpriseID << " refused:" << ex.message());
+		(*h)(false, false, std::string(), 0);
+	}
+}
+
+void OdbcStorage::findRemoteFile(const std::string& enterpriseID, uint32_t fileID, LookupHandler&& handler)
+{
+	lookup("find remote file", [enterpriseID, fileID](OtlConnection& conn, std::string& filePath)
+	{
+		otl_stream s(1
+			, "SELECT FILE_PATH FROM b_subComm_file_t WHERE FILE_ID=:fileid<int,in> AND ENTERPRISE_CODE=:entId<char[32],in>"
+			, conn);
+		s << (int)fileID << enterpriseID;
+		if (s.eof())
+		{
+			return false;
+		}
+		s >> filePath;
+		return true;
+	}
+	, std::move(handler));
+}
+
+void OdbcStorage::lookup(const char* name, Query&& query, LookupHandler&& handler)
+{
+	struct Result {
+		bool		found = false;
+		std::string	value;
+	};
+	auto result = std::make_shared<Result>();
+	auto h = std::make_shared<LookupHandler>(std::move(handler));
+	try {
+		m_executor.post(name, [query = std::move(query), result](OtlConnection& conn)
+		{
+			result->found = query(conn, result->value);
+		}
+		, [result, h](bool success)
+		{
+			(*h)(success, success && result->found, result->value);
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_WARN(name << " refused:" << ex.message());
+		(*h)(false, false, std::string());
+	}
+}
+
+void OdbcStorage::loadCatalog(CatalogHandler&& handler) throw(IcsException)
+{
+	m_executor.post("load catalog", [this, handler = std::move(handler)](OtlConnection& conn)
+	{
+		Catalog catalog;
+		queryCatalog(conn, catalog);
+		handler(catalog);
+	});
+}
+
+void OdbcStorage::queryCatalog(OtlConnection& conn, Catalog& catalog)
+{
+	{
+		otl_stream s(500
+			, "SELECT t.GW_ID,t.MONITORING_POINT_CODE FROM b_monitoring_point_t t WHERE t.STATUS = 0"
+			, conn);
+		while (!s.eof())
+		{
+			std::string gwid, monitorPoint;
+			s >> gwid >> monitorPoint;
+			catalog.monitorPoints.emplace_back(std::move(gwid), std::move(monitorPoint));
+		}
+	}
+
+	{
+		otl_stream s(500
+			, "SELECT t.ENTERPRISE_CODE,t.IP,t.PORT FROM b_enterprise_t t WHERE t.HAVING_SUBCOMM=1"
+			, conn);
+		while (!s.eof())
+		{
+			std::string enterpriseID, ip;
+			int port;
+			s >> enterpriseID >> ip >> port;
+			catalog.enterprises.emplace_back(std::move(enterpriseID), std::move(ip), port);
+		}
+	}
+
+	{
+		otl_stream s(500
+			, "SELECT ENTERPRISE_CODE,FILE_ID,FILE_PATH FROM b_subComm_file_t"
+			, conn);
+		while (!s.eof())
+		{
+			std::string enterpriseID, filePath;
+			int fileID;
+			s >> enterpriseID >> fileID >> filePath;
+			catalog.remoteFiles.emplace_back(std::move(enterpriseID), fileID, std::move(filePath));
+		}
+	}
+}
+
+} // end namespace ics
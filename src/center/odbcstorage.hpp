@@ -0,0 +1,116 @@
+
+
+#ifndef _ICS_ODBC_STORAGE_H
+#define _ICS_ODBC_STORAGE_H
+
+#include "storage.hpp"
+#include "database.hpp"
+#include "dbexecutor.hpp"
+#include "dbbatchwriter.hpp"
+#include <asio.hpp>
+
+
+namespace ics {
+
+/*
+storage on the database through the stored procedures:
+high frequency reports are written in batches, other writes are queued to the executor,
+authorizations run on their own executor so that they don't wait behind the writes
+*/
+class OdbcStorage : public Storage {
+public:
+	OdbcStorage(asio::io_service& service, DataBase& db, DbExecutor& executor);
+
+	~OdbcStorage();
+
+	/// batchRows and batchDelay(milliseconds) of the batch writers, authThreads queries and authPending waiting ones
+	void start(std::size_t batchRows, std::size_t batchDelay, std::size_t authThreads, std::size_t authPending);
+
+	virtual void stop();
+
+	virtual void serverOnoffLine(const std::string& ip, int port, int stat) throw(IcsException);
+
+	virtual void clearConnectionInfo(const std::string& ip, int port) throw(IcsException);
+
+	virtual void authorize(const std::string& gwid, const std::string& pwd, AuthHandler&& handler);
+
+	virtual void writePresence(const std::string& ip, int port, std::vector<Terminal>&& onlines, std::vector<IcsId>&& offlines, Completion&& done) throw(IcsException);
+
+	virtual void statusReport(IcsId monitorID, IcsId gwid, int deviceLight, const std::string& deviceStatus
+		, int cheatLight, const std::string& cheatStatus, float zeroPoint, const IcsDataTime& recvTime) throw(IcsException);
+
+	virtual void eventReport(IcsId monitorID, uint16_t deviceKind, int eventID, int eventType, const std::string& eventValue
+		, const IcsDataTime& eventTime, const IcsDataTime& recvTime) throw(IcsException);
+
+	virtual void gpsReport(IcsId monitorID, const GpsPosition& position) throw(IcsException);
+
+	virtual void businessReport(BusinessRecord&& record, Completion&& done) throw(IcsException);
+
+	virtual void paramQueryResult(uint32_t requestID, ParamList&& params) throw(IcsException);
+
+	virtual void paramReportModify(const std::string& monitorID, uint16_t deviceKind, const IcsDataTime& modifyTime, ParamList&& params) throw(IcsException);
+
+	virtual void paramModifyResult(uint32_t requestID, ParamList&& results) throw(IcsException);
+
+	virtual void logReport(const std::string& monitorID, const IcsDataTime& logTime, int logLevel, const std::string& logValue) throw(IcsException);
+
+	virtual void controlResult(uint32_t requestID, int operatorID, const std::string& result) throw(IcsException);
+
+	virtual void upgradeRefuse(const std::string& monitorID, uint32_t requestID, const std::string& reason) throw(IcsException);
+
+	virtual void upgradeAccept(const std::string& monitorID, uint32_t requestID) throw(IcsException);
+
+	virtual void upgradeProgress(uint32_t requestID, uint32_t recvSize, ProgressHandler&& handler);
+
+	virtual void upgradeResult(uint32_t requestID, const std::string& result) throw(IcsException);
+
+	virtual void upgradeCancelAck(uint32_t requestID) throw(IcsException);
+
+	virtual void upgradeFile(uint32_t fileID, LookupHandler&& handler);
+
+	virtual void webCommandStatus(uint32_t requestID, uint16_t messageID, int stat) throw(IcsException);
+
+	virtual void remoteProxyOnline(const std::string& enterpriseID, const std::string& ip, int port) throw(IcsException);
+
+	virtual void remoteProxyOffline(const std::string& enterpriseID) throw(IcsException);
+
+	virtual void webCommandToRemote(const std::string& enterpriseID, uint32_t requestID, uint16_t messageID, int stat, const std::string& info) throw(IcsException);
+
+	virtual void remoteTerminalOnoffLine(const std::string& enterpriseID, const std::string& gwid, uint16_t deviceKind, int stat) throw(IcsException);
+
+	virtual void findMonitorPoint(const std::string& remoteGwid, LookupHandler&& handler);
+
+	virtual void findEnterpriseAddress(const std::string& enterpriseID, AddressHandler&& handler);
+
+	virtual void findRemoteFile(const std::string& enterpriseID, uint32_t fileID, LookupHandler&& handler);
+
+	virtual void loadCatalog(CatalogHandler&& handler) throw(IcsException);
+
+private:
+	void queryAuthorize(OtlConnection& conn, const std::string& gwid, const std::string& pwd, AuthResult& result);
+
+	void queryCatalog(OtlConnection& conn, Catalog& catalog);
+
+	/// reads one value, false if there is no row
+	typedef std::function<bool (OtlConnection& conn, std::string& value)> Query;
+
+	/// run the query on the executor and pass its result to the handler
+	void lookup(const char* name, Query&& query, LookupHandler&& handler);
+
+	/// the stored procedure call of the business record, keyed by monitor point#business number
+	static DbCall businessCall(const BusinessRecord& record) throw(IcsException);
+
+private:
+	DataBase&		m_database;
+	DbExecutor&		m_executor;
+	DbExecutor		m_authExecutor;
+	std::size_t		m_batchRows = 1;
+
+	// high frequency reports
+	DbBatchWriter	m_gpsWriter;
+	DbBatchWriter	m_statusWriter;
+	DbBatchWriter	m_eventWriter;
+};
+
+} // end namespace ics
+#endif	// end _ICS_ODBC_STORAGE_H
@@ -0,0 +1,274 @@
+
+
+#include "presencetracker.hpp"
+#include "log.hpp"
+#include "messageschema.hpp"
+#include <algorithm>
+
+
+namespace ics {
+
+
+PresenceTracker::PresenceTracker(asio::io_service& service, Storage& storage)
+: m_timer(service)
+, m_storage(storage)
+, m_snapshot(std::make_shared<Snapshot>())
+{
+
+}
+
+PresenceTracker::~PresenceTracker()
+{
+	stop();
+}
+
+void PresenceTracker::start(const std::string& ip, int port, std::size_t flushInterval)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_ip = ip;
+		m_port = port;
+		m_flushInterval = flushInterval ? flushInterval : 1;
+	}
+	tick();
+}
+
+void PresenceTracker::stop()
+{
+	asio::error_code ec;
+	m_timer.cancel(ec);
+
+	waitWritten();
+	flush();
+	waitWritten();
+}
+
+void PresenceTracker::online(IcsId gwid, IcsId monitorID, uint16_t deviceKind, const void* owner)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	Entry& entry = m_entries[gwid];
+	if (!entry.dirty)
+	{
+		m_dirty.push_back(gwid);
+		entry.dirty = true;
+	}
+	entry.terminal = Terminal{ gwid, monitorID, deviceKind };
+	entry.owner = owner;
+	entry.online = true;
+	m_changed = true;
+}
+
+void PresenceTracker::offline(IcsId gwid, const void* owner)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto it = m_entries.find(gwid);
+	if (it == m_entries.end() || it->second.owner != owner || !it->second.online)
+	{
+		return;
+	}
+
+	Entry& entry = it->second;
+	if (!entry.dirty)
+	{
+		m_dirty.push_back(gwid);
+		entry.dirty = true;
+	}
+	entry.owner = nullptr;
+	entry.online = false;
+	m_changed = true;
+}
+
+std::shared_ptr<const PresenceTracker::Snapshot> PresenceTracker::snapshot() const
+{
+	return std::atomic_load(&m_snapshot);
+}
+
+std::size_t PresenceTracker::writeOnline(const Snapshot& snapshot, std::size_t start, std::size_t limit, ProtocolStream& stream) throw(IcsException)
+{
+	typedef MessageLayout<MessageId::C2W_online_response_0x2007> Layout;
+
+	std::size_t space = stream.leftLength();
+	if (space < Layout::FixedSize + IcsMsgHead::CrcCodeSize)
+	{
+		throw IcsException("no space to write online response, left %d bytes", (int)space);
+	}
+	space -= Layout::FixedSize + IcsMsgHead::CrcCodeSize;
+
+	// the count is known before the terminals are written, stop at the first one that doesn't fit
+	std::size_t begin = std::min(start, snapshot.size());
+	std::size_t end = begin;
+	while (end < snapshot.size() && end - begin < limit)
+	{
+		const Terminal& terminal = snapshot[end];
+		std::size_t size = OnlineTerminalLayout::FixedSize + terminal.gwid.str().size() + terminal.monitorID.str().size();
+		if (size > space)
+		{
+			break;
+		}
+		space -= size;
+		end++;
+	}
+
+	Layout::encode(stream, (uint32_t)snapshot.size(), (uint16_t)(end - begin));
+	for (std::size_t i = begin; i < end; i++)
+	{
+		const Terminal& terminal = snapshot[i];
+		OnlineTerminalLayout::encode(stream, terminal.gwid.str(), terminal.monitorID.str(), terminal.deviceKind);
+	}
+	return end - begin;
+}
+
+void PresenceTracker::flush()
+{
+	std::vector<Terminal> onlines;
+	std::vector<IcsId> offlines;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		// the executor has several threads, a second write could commit before the one in flight:
+		// the changes stay dirty until it completed
+		if (!m_writing)
+		{
+			for (auto& gwid : m_dirty)
+			{
+				auto it = m_entries.find(gwid);
+				if (it == m_entries.end())
+				{
+					continue;
+				}
+				Entry& entry = it->second;
+				entry.dirty = false;
+
+				if (entry.online)
+				{
+					// written again if the terminal reconnected as another monitor point
+					onlines.push_back(entry.terminal);
+					entry.written = true;
+				}
+				else if (entry.written)
+				{
+					offlines.push_back(gwid);
+					m_entries.erase(it);
+				}
+				else	// online and offline within the interval
+				{
+					m_entries.erase(it);
+				}
+			}
+			m_dirty.clear();
+			m_writing = !onlines.empty() || !offlines.empty();
+		}
+	}
+
+	publish();
+
+	if (onlines.empty() && offlines.empty())
+	{
+		return;
+	}
+
+	std::vector<IcsId> gwids = offlines;
+	for (auto& t : onlines)
+	{
+		gwids.push_back(t.gwid);
+	}
+
+	try {
+		m_storage.writePresence(m_ip, m_port, std::move(onlines), std::move(offlines), [this, gwids](bool success)
+		{
+			written(gwids, success);
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR("presence write error:" << ex.message());
+		written(gwids, false);
+	}
+}
+
+void PresenceTracker::written(const std::vector<IcsId>& gwids, bool success)
+{
+	if (!success)
+	{
+		retry(gwids);
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_writing = false;
+	m_writeDone.notify_all();
+}
+
+void PresenceTracker::waitWritten()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_writeDone.wait(lock, [this]()
+	{
+		return !m_writing;
+	});
+}
+
+void PresenceTracker::tick()
+{
+	m_timer.expires_from_now(std::chrono::milliseconds(m_flushInterval));
+	m_timer.async_wait([this](const asio::error_code& ec)
+	{
+		if (ec)
+		{
+			return;
+		}
+		flush();
+		tick();
+	});
+}
+
+void PresenceTracker::publish()
+{
+	auto snapshot = std::make_shared<Snapshot>();
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (!m_changed)
+		{
+			return;
+		}
+		m_changed = false;
+
+		snapshot->reserve(m_entries.size());
+		for (auto& e : m_entries)
+		{
+			if (e.second.online)
+			{
+				snapshot->push_back(e.second.terminal);
+			}
+		}
+	}
+
+	std::sort(snapshot->begin(), snapshot->end(), [](const Terminal& a, const Terminal& b)
+	{
+		return a.gwid.str() < b.gwid.str();
+	});
+	std::atomic_store(&m_snapshot, std::shared_ptr<const Snapshot>(std::move(snapshot)));
+}
+
+void PresenceTracker::retry(const std::vector<IcsId>& gwids)
+{
+	LOG_WARN("write presence of " << gwids.size() << " terminals failed, retry later");
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (auto& gwid : gwids)
+	{
+		Entry& entry = m_entries[gwid];
+		if (entry.terminal.gwid.empty())
+		{
+			// offline was dropped from the map
+			entry.terminal.gwid = gwid;
+		}
+		// unknown state in the database, an offline terminal is written again
+		entry.written = true;
+		if (!entry.dirty)
+		{
+			m_dirty.push_back(gwid);
+			entry.dirty = true;
+		}
+	}
+}
+
+} // end namespace ics
@@ -0,0 +1,103 @@
+
+
+#ifndef _ICS_PRESENCE_TRACKER_H
+#define _ICS_PRESENCE_TRACKER_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "storage.hpp"
+#include <asio.hpp>
+#include <asio/steady_timer.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace ics {
+
+/*
+online state of the terminals: the latest state of each gwid is kept in memory and
+the changes are written every flush interval in batches, a terminal going offline and
+online again within one interval writes nothing;
+the online terminals are published as an immutable snapshot for the readers;
+the terminals are kept by their interned ids, the strings are only read when written
+*/
+class PresenceTracker : NonCopyable {
+public:
+	typedef Storage::Terminal Terminal;
+
+	/// online terminals ordered by gwid
+	typedef std::vector<Terminal> Snapshot;
+
+	PresenceTracker(asio::io_service& service, Storage& storage);
+
+	~PresenceTracker();
+
+	/// ip and port identify this server in the database
+	void start(const std::string& ip, int port, std::size_t flushInterval);
+
+	/// stop the timer and write the changes left, returns once they are written; called after the io_service stopped
+	void stop();
+
+	/// the terminal passed authorization on the connection owner
+	void online(IcsId gwid, IcsId monitorID, uint16_t deviceKind, const void* owner);
+
+	/// the connection owner is closed, ignored if the terminal is online on another connection
+	void offline(IcsId gwid, const void* owner);
+
+	/// online terminals as of the last flush
+	std::shared_ptr<const Snapshot> snapshot() const;
+
+	/// write the online response: the terminals of snapshot from start, at most limit and only as many
+	/// as fit the stream with its crc code; returns the count written
+	static std::size_t writeOnline(const Snapshot& snapshot, std::size_t start, std::size_t limit, ProtocolStream& stream) throw(IcsException);
+
+	/// write the changes to the storage; while a write is in flight the changes wait for the next flush
+	void flush();
+
+private:
+	struct Entry {
+		Terminal	terminal;
+		const void*	owner = nullptr;
+		bool		online = false;
+		bool		written = false;	// state in the database
+		bool		dirty = false;
+	};
+
+	void tick();
+
+	void publish();
+
+	/// the write failed, write the state again at the next flush
+	void retry(const std::vector<IcsId>& gwids);
+
+	/// the write in flight completed
+	void written(const std::vector<IcsId>& gwids, bool success);
+
+	/// wait until no write is in flight
+	void waitWritten();
+
+private:
+	asio::steady_timer	m_timer;
+	Storage&			m_storage;
+	std::string			m_ip;
+	int					m_port = 0;
+	std::size_t			m_flushInterval = 0;
+
+	std::mutex			m_lock;
+	std::unordered_map<IcsId, Entry>	m_entries;
+	std::vector<IcsId>	m_dirty;
+	bool				m_changed = false;
+
+	// one write in flight so that the writes commit in order
+	bool				m_writing = false;
+	std::condition_variable	m_writeDone;
+
+	std::shared_ptr<const Snapshot>	m_snapshot;
+};
+
+} // end namespace ics
+#endif	// end _ICS_PRESENCE_TRACKER_H
@@ -7,6 +7,11 @@
 #include "icsconnection.hpp"
 #include "icsconfig.hpp"
 #include "database.hpp"
+#include "dbexecutor.hpp"
+#include "odbcstorage.hpp"
+#include "memorystorage.hpp"
+#include "ioservicepool.hpp"
+#include "recvbuffer.hpp"
 
 #include <asio.hpp>
 #include <iostream>
@@ -18,6 +23,8 @@ using namespace std;
 ics::IcsConfig g_configFile;
 ics::MemoryPool g_memoryPool;
 ics::DataBase g_database;
+ics::DbSpool g_dbSpool(g_database);
+ics::DbExecutor g_dbExecutor(g_database);
 
 void usage(const char* prog)
 {
@@ -61,21 +68,73 @@ void usage(const char* prog)
 		ics::init_log(g_configFile.getAttributeString("log", "configfile").c_str());
 
 		// 初始内存池模块
-		g_memoryPool.init(g_configFile.getAttributeInt("program", "chunksize"), g_configFile.getAttributeInt("program", "chunkcount"));
+		g_memoryPool.init(g_configFile.getAttributeInt("program", "chunksize")
+			, g_configFile.getAttributeInt("program", "chunkcount")
+			, g_configFile.getAttributeInt("program", "chunkmax"));
+
+		// 接收消息的最大长度
+		ics::ReceiveBuffer::setMaxFrameSize(g_configFile.getAttributeInt("protocol", "maxframe"));
+
+		// 工作线程:分片模式下每个线程独占一个io服务
+		ics::IoServicePool workers(io_service
+			, g_configFile.getAttributeInt("program", "workerthread")
+			, g_configFile.getAttributeInt("program", "ioshard") != 0);
+
+		// 数据存储:odbc-数据库,memory-进程内存储(压力测试)
+		std::unique_ptr<ics::Storage> storage;
+		if (g_configFile.getAttributeString("storage", "backend") == "memory")
+		{
+			auto memoryStorage = std::make_unique<ics::MemoryStorage>();
+			memoryStorage->open(g_configFile.getAttributeString("storage", "seedfile")
+				, g_configFile.getAttributeString("storage", "writelog")
+				, g_configFile.getAttributeInt("storage", "acceptall") != 0);
+			storage = std::move(memoryStorage);
+		}
+		else
+		{
+			ics::DataBase::initialize();
+			ics::OtlConnection::setStatementCacheSize(g_configFile.getAttributeInt("database", "statementcache"));
+			g_database.init(g_configFile.getAttributeString("database", "username"), g_configFile.getAttributeString("database", "password"), g_configFile.getAttributeString("database", "dsn"));
+			g_database.setWaitQueue(g_configFile.getAttributeInt("database", "maxwaiters")
+				, g_configFile.getAttributeInt("database", "waittimeout"));
+			g_database.setPingInterval(g_configFile.getAttributeInt("database", "pinginterval"));
+			g_database.open(g_configFile.getAttributeInt("database", "poolmin")
+				, g_configFile.getAttributeInt("database", "poolmax"));
+
+			// 数据库不可用时的本地缓存
+			g_dbSpool.open(g_configFile.getAttributeString("spool", "dir")
+				, g_configFile.getAttributeInt("spool", "segmentsize") * 1024 * 1024);
+			g_dbSpool.start(g_configFile.getAttributeInt("spool", "retryinterval"));
+
+			// 数据库写线程
+			g_dbExecutor.setSpool(&g_dbSpool);
+			g_dbExecutor.start(g_configFile.getAttributeInt("database", "count")
+				, g_configFile.getAttributeInt("database", "queuesize"));
+
+			// 批量写入:满batchrows行或每batchdelay毫秒写一次;认证:最多threads个查询同时执行,maxpending个等待
+			auto odbcStorage = std::make_unique<ics::OdbcStorage>(workers.getIoService(), g_database, g_dbExecutor);
+			odbcStorage->start(g_configFile.getAttributeInt("database", "batchrows")
+				, g_configFile.getAttributeInt("database", "batchdelay")
+				, g_configFile.getAttributeInt("auth", "threads")
+				, g_configFile.getAttributeInt("auth", "maxpending"));
+			storage = std::move(odbcStorage);
+		}
 
 		// 初始主服务
-		ics::DataBase::initialize();
-		g_database.init(g_configFile.getAttributeString("database", "username"), g_configFile.getAttributeString("database", "password"), g_configFile.getAttributeString("database", "dsn"));
-		g_database.open();
-		
-		auto p = std::make_unique<ics::IcsLocalServer>(io_service
-			, g_configFile.getAttributeString("centeraddr", "terminal"), 100
-			, g_configFile.getAttributeString("centeraddr", "web"), 100
+		auto p = std::make_unique<ics::IcsLocalServer>(workers, *storage
+			, g_configFile.getAttributeString("centeraddr", "terminal"), g_configFile.getAttributeInt("connection", "terminalmax")
+			, g_configFile.getAttributeString("centeraddr", "web"), g_configFile.getAttributeInt("connection", "webmax")
 			, g_configFile.getAttributeString("centeraddr", "msgpush"));		
 
-		// 主线程开始IO事件,忽略错误
-		asio::error_code ec;
-		io_service.run(ec);
+		// 主线程及工作线程开始IO事件
+		workers.run();
+
+		// 服务器下线,写完队列中的数据
+		p.reset();
+		storage.reset();
+		g_dbExecutor.stop();
+		g_dbSpool.stop();
+		g_database.close();
 	}
 	catch (ics::IcsException& ex)
 	{
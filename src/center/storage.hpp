@@ -0,0 +1,225 @@
+
+
+#ifndef _ICS_STORAGE_H
+#define _ICS_STORAGE_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "icsexception.hpp"
+#include "icsprotocol.hpp"
+#include "idtable.hpp"
+#include <string>
+#include <vector>
+#include <tuple>
+#include <functional>
+
+
+namespace ics {
+
+/*
+persistence of the center: one method for each stored procedure or query the center uses.
+writes return at once and may be batched or queued by the backend, they throw IcsException
+if the backend can't take them; lookups and the methods returning a value pass the result to a
+handler called on a backend thread, or on the calling thread if the backend answers at once.
+server registration and the catalog run on the calling thread at startup.
+backends: OdbcStorage(the database) and MemoryStorage(in process tables for load tests)
+*/
+class Storage : NonCopyable {
+public:
+	/// success is false if the write failed
+	typedef std::function<void (bool success)> Completion;
+
+	struct AuthResult {
+		/// 0: passed, > 0: refused, < 0: the backend is busy or unreachable
+		int			ret = -1;
+		std::string	monitorID;
+		std::string	monitorName;
+	};
+
+	/// called once for each authorize, on a backend thread or the calling thread
+	typedef std::function<void (const AuthResult& result)> AuthHandler;
+
+	/// result of a lookup: success is false if the backend failed, value is set if found
+	typedef std::function<void (bool success, bool found, const std::string& value)> LookupHandler;
+
+	/// address of a remote enterprise, as LookupHandler
+	typedef std::function<void (bool success, bool found, const std::string& ip, int port)> AddressHandler;
+
+	/// state of an upgrade, success is false if the backend failed
+	typedef std::function<void (bool success, int state)> ProgressHandler;
+
+	/// online terminal, the ids are interned
+	struct Terminal {
+		IcsId		gwid;
+		IcsId		monitorID;
+		uint16_t	deviceKind = 0;
+	};
+
+	/// flags: 0-east/south, 1-west/north; signal: 0-strong ... 4-none
+	struct GpsPosition {
+		int	longitudeFlag;
+		int	longitude;
+		int	latitudeFlag;
+		int	latitude;
+		int	signal;
+		int	height;
+		int	speed;
+	};
+
+	/// a business report of a terminal, only the fields of its type are set
+	struct BusinessRecord {
+		int			type = 0;
+		IcsId		monitorID;
+		uint32_t	businessNo = 0;
+		IcsDataTime	reportTime{};
+		IcsDataTime	recvTime{};
+
+		/// 1: static vehicle scale
+		struct Vehicle {
+			std::string	cargoNum;
+			std::string	vehicleNum;
+			std::string	consignee;
+			std::string	cargoName;
+			float		grossWeight;
+			float		tareWeight;
+			float		deductWeight;
+			float		netWeight;
+			float		unitPrice;
+			float		money;
+			int			inOut;
+		} vehicle{};
+
+		/// 2: packing scales, one for each scale
+		struct Scale {
+			int		amount;
+			float	totalWeight;
+			float	singleWeight;
+		};
+		std::vector<Scale>	scales;
+
+		/// 3: highway scale, axle weights joined by ',' and axle types by '+'
+		struct Highway {
+			int			totalWeight;
+			double		speed;
+			int			axleNum;
+			std::string	axleWeights;
+			int			typeNum;
+			std::string	axleTypes;
+		} highway{};
+
+		/// 4: kitchen waste truck
+		struct Kitchen {
+			int			mode;
+			int			unit;
+			int			card;
+			int			flow;
+			int			evaluation;
+			std::string	tubID;
+			int			tubVolume;
+			int			weight;
+			int			driverID;
+			GpsPosition	position;
+		} kitchen{};
+
+		/// 5: overload check, [0] the first check and [1] the second
+		struct Overload {
+			std::string	vehicleNum;
+			IcsDataTime	checkTime[2];
+			int			totalWeight[2];
+			int			limitWeight[2];
+			int			axleCount[2];
+			int			overWeight;
+		} overload{};
+
+		/// 6: vehicles of the day
+		int			vehicleCount = 0;
+	};
+
+	/// net id, param id, value
+	typedef std::vector<std::tuple<uint16_t, uint16_t, std::string>> ParamList;
+
+	/// rows used to fill the lookup caches
+	struct Catalog {
+		std::vector<std::pair<std::string, std::string>>	monitorPoints;	// remote gwid, monitor point
+		std::vector<std::tuple<std::string, std::string, int>>	enterprises;	// enterprise id, ip, port
+		std::vector<std::tuple<std::string, int, std::string>>	remoteFiles;	// enterprise id, file id, path
+	};
+
+	typedef std::function<void (const Catalog& catalog)> CatalogHandler;
+
+	virtual ~Storage() {}
+
+	/// wait for the pending authorizations and write the queued rows
+	virtual void stop() = 0;
+
+	// server
+	virtual void serverOnoffLine(const std::string& ip, int port, int stat) throw(IcsException) = 0;
+
+	virtual void clearConnectionInfo(const std::string& ip, int port) throw(IcsException) = 0;
+
+	// terminal
+	virtual void authorize(const std::string& gwid, const std::string& pwd, AuthHandler&& handler) = 0;
+
+	virtual void writePresence(const std::string& ip, int port, std::vector<Terminal>&& onlines, std::vector<IcsId>&& offlines, Completion&& done) throw(IcsException) = 0;
+
+	virtual void statusReport(IcsId monitorID, IcsId gwid, int deviceLight, const std::string& deviceStatus
+		, int cheatLight, const std::string& cheatStatus, float zeroPoint, const IcsDataTime& recvTime) throw(IcsException) = 0;
+
+	virtual void eventReport(IcsId monitorID, uint16_t deviceKind, int eventID, int eventType, const std::string& eventValue
+		, const IcsDataTime& eventTime, const IcsDataTime& recvTime) throw(IcsException) = 0;
+
+	virtual void gpsReport(IcsId monitorID, const GpsPosition& position) throw(IcsException) = 0;
+
+	/// done is called once the record is stored, a record of the same monitor point and business number is stored once
+	virtual void businessReport(BusinessRecord&& record, Completion&& done) throw(IcsException) = 0;
+
+	virtual void paramQueryResult(uint32_t requestID, ParamList&& params) throw(IcsException) = 0;
+
+	virtual void paramReportModify(const std::string& monitorID, uint16_t deviceKind, const IcsDataTime& modifyTime, ParamList&& params) throw(IcsException) = 0;
+
+	virtual void paramModifyResult(uint32_t requestID, ParamList&& results) throw(IcsException) = 0;
+
+	virtual void logReport(const std::string& monitorID, const IcsDataTime& logTime, int logLevel, const std::string& logValue) throw(IcsException) = 0;
+
+	virtual void controlResult(uint32_t requestID, int operatorID, const std::string& result) throw(IcsException) = 0;
+
+	// upgrade
+	virtual void upgradeRefuse(const std::string& monitorID, uint32_t requestID, const std::string& reason) throw(IcsException) = 0;
+
+	virtual void upgradeAccept(const std::string& monitorID, uint32_t requestID) throw(IcsException) = 0;
+
+	/// state of the upgrade after the terminal received recvSize bytes, 0 means going on
+	virtual void upgradeProgress(uint32_t requestID, uint32_t recvSize, ProgressHandler&& handler) = 0;
+
+	virtual void upgradeResult(uint32_t requestID, const std::string& result) throw(IcsException) = 0;
+
+	virtual void upgradeCancelAck(uint32_t requestID) throw(IcsException) = 0;
+
+	/// path of the upgrade file
+	virtual void upgradeFile(uint32_t fileID, LookupHandler&& handler) = 0;
+
+	// web
+	virtual void webCommandStatus(uint32_t requestID, uint16_t messageID, int stat) throw(IcsException) = 0;
+
+	// remote proxy
+	virtual void remoteProxyOnline(const std::string& enterpriseID, const std::string& ip, int port) throw(IcsException) = 0;
+
+	virtual void remoteProxyOffline(const std::string& enterpriseID) throw(IcsException) = 0;
+
+	virtual void webCommandToRemote(const std::string& enterpriseID, uint32_t requestID, uint16_t messageID, int stat, const std::string& info) throw(IcsException) = 0;
+
+	virtual void remoteTerminalOnoffLine(const std::string& enterpriseID, const std::string& gwid, uint16_t deviceKind, int stat) throw(IcsException) = 0;
+
+	// lookups
+	virtual void findMonitorPoint(const std::string& remoteGwid, LookupHandler&& handler) = 0;
+
+	virtual void findEnterpriseAddress(const std::string& enterpriseID, AddressHandler&& handler) = 0;
+
+	virtual void findRemoteFile(const std::string& enterpriseID, uint32_t fileID, LookupHandler&& handler) = 0;
+
+	/// load the catalog off the calling thread if the backend has one
+	virtual void loadCatalog(CatalogHandler&& handler) throw(IcsException) = 0;
+};
+
+} // end namespace ics
+#endif	// end _ICS_STORAGE_H
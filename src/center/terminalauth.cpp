@@ -0,0 +1,97 @@
+
+
+#include "terminalauth.hpp"
+#include "log.hpp"
+#include <memory>
+
+
+namespace ics {
+
+
+TerminalAuth::TerminalAuth(Storage& storage)
+: m_storage(storage)
+{
+
+}
+
+void TerminalAuth::setTtl(std::size_t ttl)
+{
+	m_ttl = std::chrono::seconds(ttl);
+}
+
+bool TerminalAuth::authorize(const std::string& gwid, const std::string& pwd, Result& result, Handler&& handler)
+{
+	std::size_t pwdHash = std::hash<std::string>()(pwd);
+	std::string key = gwid + '\n' + std::to_string(pwdHash);
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_cache.find(gwid);
+		if (it != m_cache.end() && it->second.pwdHash == pwdHash && it->second.expire > std::chrono::steady_clock::now())
+		{
+			result = it->second.result;
+			return true;
+		}
+
+		// the same credential is being queried, wait for its result
+		auto& handlers = m_inFlight[key];
+		handlers.push_back(std::move(handler));
+		if (handlers.size() > 1)
+		{
+			return false;
+		}
+	}
+
+	m_storage.authorize(gwid, pwd, [this, key, gwid, pwdHash](const Result& queried)
+	{
+		complete(key, gwid, pwdHash, queried);
+	});
+	return false;
+}
+
+void TerminalAuth::invalidate(const std::string& gwid)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_cache.erase(gwid);
+}
+
+void TerminalAuth::clear()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_cache.clear();
+}
+
+void TerminalAuth::complete(const std::string& key, const std::string& gwid, std::size_t pwdHash, const Result& result)
+{
+	std::vector<Handler> handlers;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto it = m_inFlight.find(key);
+		if (it != m_inFlight.end())
+		{
+			handlers.swap(it->second);
+			m_inFlight.erase(it);
+		}
+
+		if (result.ret == 0)
+		{
+			m_cache[gwid] = Cached{ pwdHash, result, std::chrono::steady_clock::now() + m_ttl };
+		}
+		else if (result.ret > 0)
+		{
+			m_cache.erase(gwid);
+		}
+	}
+
+	for (auto& handler : handlers)
+	{
+		try {
+			handler(result);
+		}
+		catch (...)
+		{
+			LOG_ERROR("authorize " << gwid << " handler error");
+		}
+	}
+}
+
+} // end namespace ics
@@ -0,0 +1,65 @@
+
+
+#ifndef _ICS_TERMINAL_AUTH_H
+#define _ICS_TERMINAL_AUTH_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "storage.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <chrono>
+
+
+namespace ics {
+
+/*
+terminal authorization off the io threads:
+validated (gwid, password) results are cached for ttl seconds and concurrent requests of
+the same credential share one storage query; a storage too busy to query refuses the
+request as busy so the terminal retries later
+*/
+class TerminalAuth : NonCopyable {
+public:
+	typedef Storage::AuthResult Result;
+
+	/// runs on a storage thread, or on the calling thread if the storage answers at once
+	typedef std::function<void (const Result& result)> Handler;
+
+	TerminalAuth(Storage& storage);
+
+	/// seconds a passed credential is cached
+	void setTtl(std::size_t ttl);
+
+	/// true if the result is taken from the cache and handler isn't called
+	bool authorize(const std::string& gwid, const std::string& pwd, Result& result, Handler&& handler);
+
+	/// drop the cached result of the terminal
+	void invalidate(const std::string& gwid);
+
+	/// drop all cached results
+	void clear();
+
+private:
+	struct Cached {
+		std::size_t	pwdHash;
+		Result		result;
+		std::chrono::steady_clock::time_point	expire;
+	};
+
+	void complete(const std::string& key, const std::string& gwid, std::size_t pwdHash, const Result& result);
+
+private:
+	Storage&		m_storage;
+	std::chrono::seconds	m_ttl{ 300 };
+
+	std::mutex		m_lock;
+	std::unordered_map<std::string, Cached>	m_cache;	// gwid as key
+	std::unordered_map<std::string, std::vector<Handler>>	m_inFlight;	// gwid and password hash as key
+};
+
+} // end namespace ics
+#endif	// end _ICS_TERMINAL_AUTH_H
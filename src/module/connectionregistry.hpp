@@ -0,0 +1,212 @@
+
+
+#ifndef _ICS_CONNECTION_REGISTRY_H
+#define _ICS_CONNECTION_REGISTRY_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+
+namespace ics {
+
+/*
+registry of live connections by key(gwid, enterprise id, ...):
+the keys are spread over lock striped shards, each shard publishes its table as an immutable
+snapshot that writers replace under the shard lock(copy on write), so readers never lock and never
+wait behind the writers; the count of entries is bounded by maxCount
+*/
+template<class Value, class Key = std::string>
+class ConnectionRegistry : NonCopyable {
+public:
+	typedef std::unordered_map<Key, Value> Table;
+
+	typedef std::shared_ptr<const Table> Snapshot;
+
+	/// maxCount 0 for no limit
+	explicit ConnectionRegistry(std::size_t shardCount, std::size_t maxCount = 0)
+		: m_maxCount(maxCount)
+	{
+		if (shardCount == 0)
+		{
+			shardCount = 1;
+		}
+		for (std::size_t i = 0; i < shardCount; i++)
+		{
+			m_shards.emplace_back(new Shard());
+		}
+	}
+
+	void setMaxCount(std::size_t maxCount)
+	{
+		m_maxCount = maxCount;
+	}
+
+	std::size_t maxCount() const
+	{
+		return m_maxCount;
+	}
+
+	/// add or replace the value of the key, false if the key is new and the registry is full;
+	/// the value replaced is moved to replaced if it isn't null
+	bool insert(const Key& key, const Value& value, Value* replaced = nullptr)
+	{
+		Shard& shard = getShard(key);
+		std::lock_guard<std::mutex> lock(shard.lock);
+
+		auto it = shard.table->find(key);
+		if (it == shard.table->end() && !reserve())
+		{
+			return false;
+		}
+		if (it != shard.table->end() && replaced)
+		{
+			*replaced = it->second;
+		}
+
+		auto table = std::make_shared<Table>(*shard.table);
+		(*table)[key] = value;
+		publish(shard, std::move(table));
+		return true;
+	}
+
+	/// remove the key only if it still maps to the value, a newer value is kept
+	bool erase(const Key& key, const Value& value)
+	{
+		Shard& shard = getShard(key);
+		std::lock_guard<std::mutex> lock(shard.lock);
+
+		auto it = shard.table->find(key);
+		if (it == shard.table->end() || !(it->second == value))
+		{
+			return false;
+		}
+		remove(shard, key);
+		return true;
+	}
+
+	/// remove the key whatever it maps to
+	bool erase(const Key& key)
+	{
+		Shard& shard = getShard(key);
+		std::lock_guard<std::mutex> lock(shard.lock);
+
+		if (shard.table->find(key) == shard.table->end())
+		{
+			return false;
+		}
+		remove(shard, key);
+		return true;
+	}
+
+	/// value of the key in the latest snapshot, a default value if not found; lock free
+	Value find(const Key& key) const
+	{
+		Snapshot table = std::atomic_load(&getShard(key).table);
+		auto it = table->find(key);
+		return it != table->end() ? it->second : Value();
+	}
+
+	std::size_t size() const
+	{
+		return m_count.load(std::memory_order_relaxed);
+	}
+
+	std::size_t shardCount() const
+	{
+		return m_shards.size();
+	}
+
+	/// snapshot of one shard, stays valid and unchanged while it is held
+	Snapshot snapshot(std::size_t index) const
+	{
+		return std::atomic_load(&m_shards[index]->table);
+	}
+
+	/// call handler(const Table&) with the snapshot of each shard in turn, the writers are not blocked
+	template<class Handler>
+	void forEachShard(Handler&& handler) const
+	{
+		for (std::size_t i = 0; i < m_shards.size(); i++)
+		{
+			Snapshot table = snapshot(i);
+			if (!table->empty())
+			{
+				handler(*table);
+			}
+		}
+	}
+
+	/// call handler(key, value) for each entry, one shard snapshot after another
+	template<class Handler>
+	void forEach(Handler&& handler) const
+	{
+		forEachShard([&handler](const Table& table)
+		{
+			for (auto& entry : table)
+			{
+				handler(entry.first, entry.second);
+			}
+		});
+	}
+
+	void clear()
+	{
+		for (auto& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard->lock);
+			m_count.fetch_sub(shard->table->size(), std::memory_order_relaxed);
+			publish(*shard, std::make_shared<Table>());
+		}
+	}
+
+private:
+	struct Shard {
+		std::mutex	lock;
+		Snapshot	table = std::make_shared<Table>();
+	};
+
+	Shard& getShard(const Key& key) const
+	{
+		return *m_shards[std::hash<Key>()(key) % m_shards.size()];
+	}
+
+	/// count a new entry, false if the registry is full
+	bool reserve()
+	{
+		std::size_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+		if (m_maxCount && count >= m_maxCount)
+		{
+			m_count.fetch_sub(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	/// remove the key under the shard lock
+	void remove(Shard& shard, const Key& key)
+	{
+		auto table = std::make_shared<Table>(*shard.table);
+		table->erase(key);
+		publish(shard, std::move(table));
+		m_count.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	static void publish(Shard& shard, std::shared_ptr<Table>&& table)
+	{
+		std::atomic_store(&shard.table, Snapshot(std::move(table)));
+	}
+
+private:
+	std::vector<std::unique_ptr<Shard>>	m_shards;
+	std::size_t				m_maxCount;
+	std::atomic<std::size_t>	m_count{ 0 };
+};
+
+} // end namespace ics
+#endif	// end _ICS_CONNECTION_REGISTRY_H
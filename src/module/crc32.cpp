@@ -0,0 +1,320 @@
+
+
+#include "crc32.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ICS_CRC32_CLMUL 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+
+namespace ics {
+
+namespace {
+
+const uint32_t Crc32Poly = 0x04C11DB7;
+
+/// byte table: Crc32Table[v] = v * x^32 mod P
+const uint32_t Crc32Table[] =
+{
+	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC,
+	0x17C56B6B, 0x1A864DB2, 0x1E475005, 0x2608EDB8, 0x22C9F00F,
+	0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A,
+	0x384FBDBD, 0x4C11DB70, 0x48D0C6C7, 0x4593E01E, 0x4152FDA9,
+	0x5F15ADAC, 0x5BD4B01B, 0x569796C2, 0x52568B75, 0x6A1936C8,
+	0x6ED82B7F, 0x639B0DA6, 0x675A1011, 0x791D4014, 0x7DDC5DA3,
+	0x709F7B7A, 0x745E66CD, 0x9823B6E0, 0x9CE2AB57, 0x91A18D8E,
+	0x95609039, 0x8B27C03C, 0x8FE6DD8B, 0x82A5FB52, 0x8664E6E5,
+	0xBE2B5B58, 0xBAEA46EF, 0xB7A96036, 0xB3687D81, 0xAD2F2D84,
+	0xA9EE3033, 0xA4AD16EA, 0xA06C0B5D, 0xD4326D90, 0xD0F37027,
+	0xDDB056FE, 0xD9714B49, 0xC7361B4C, 0xC3F706FB, 0xCEB42022,
+	0xCA753D95, 0xF23A8028, 0xF6FB9D9F, 0xFBB8BB46, 0xFF79A6F1,
+	0xE13EF6F4, 0xE5FFEB43, 0xE8BCCD9A, 0xEC7DD02D, 0x34867077,
+	0x30476DC0, 0x3D044B19, 0x39C556AE, 0x278206AB, 0x23431B1C,
+	0x2E003DC5, 0x2AC12072, 0x128E9DCF, 0x164F8078, 0x1B0CA6A1,
+	0x1FCDBB16, 0x018AEB13, 0x054BF6A4, 0x0808D07D, 0x0CC9CDCA,
+	0x7897AB07, 0x7C56B6B0, 0x71159069, 0x75D48DDE, 0x6B93DDDB,
+	0x6F52C06C, 0x6211E6B5, 0x66D0FB02, 0x5E9F46BF, 0x5A5E5B08,
+	0x571D7DD1, 0x53DC6066, 0x4D9B3063, 0x495A2DD4, 0x44190B0D,
+	0x40D816BA, 0xACA5C697, 0xA864DB20, 0xA527FDF9, 0xA1E6E04E,
+	0xBFA1B04B, 0xBB60ADFC, 0xB6238B25, 0xB2E29692, 0x8AAD2B2F,
+	0x8E6C3698, 0x832F1041, 0x87EE0DF6, 0x99A95DF3, 0x9D684044,
+	0x902B669D, 0x94EA7B2A, 0xE0B41DE7, 0xE4750050, 0xE9362689,
+	0xEDF73B3E, 0xF3B06B3B, 0xF771768C, 0xFA325055, 0xFEF34DE2,
+	0xC6BCF05F, 0xC27DEDE8, 0xCF3ECB31, 0xCBFFD686, 0xD5B88683,
+	0xD1799B34, 0xDC3ABDED, 0xD8FBA05A, 0x690CE0EE, 0x6DCDFD59,
+	0x608EDB80, 0x644FC637, 0x7A089632, 0x7EC98B85, 0x738AAD5C,
+	0x774BB0EB, 0x4F040D56, 0x4BC510E1, 0x46863638, 0x42472B8F,
+	0x5C007B8A, 0x58C1663D, 0x558240E4, 0x51435D53, 0x251D3B9E,
+	0x21DC2629, 0x2C9F00F0, 0x285E1D47, 0x36194D42, 0x32D850F5,
+	0x3F9B762C, 0x3B5A6B9B, 0x0315D626, 0x07D4CB91, 0x0A97ED48,
+	0x0E56F0FF, 0x1011A0FA, 0x14D0BD4D, 0x19939B94, 0x1D528623,
+	0xF12F560E, 0xF5EE4BB9, 0xF8AD6D60, 0xFC6C70D7, 0xE22B20D2,
+	0xE6EA3D65, 0xEBA91BBC, 0xEF68060B, 0xD727BBB6, 0xD3E6A601,
+	0xDEA580D8, 0xDA649D6F, 0xC423CD6A, 0xC0E2D0DD, 0xCDA1F604,
+	0xC960EBB3, 0xBD3E8D7E, 0xB9FF90C9, 0xB4BCB610, 0xB07DABA7,
+	0xAE3AFBA2, 0xAAFBE615, 0xA7B8C0CC, 0xA379DD7B, 0x9B3660C6,
+	0x9FF77D71, 0x92B45BA8, 0x9675461F, 0x8832161A, 0x8CF30BAD,
+	0x81B02D74, 0x857130C3, 0x5D8A9099, 0x594B8D2E, 0x5408ABF7,
+	0x50C9B640, 0x4E8EE645, 0x4A4FFBF2, 0x470CDD2B, 0x43CDC09C,
+	0x7B827D21, 0x7F436096, 0x7200464F, 0x76C15BF8, 0x68860BFD,
+	0x6C47164A, 0x61043093, 0x65C52D24, 0x119B4BE9, 0x155A565E,
+	0x18197087, 0x1CD86D30, 0x029F3D35, 0x065E2082, 0x0B1D065B,
+	0x0FDC1BEC, 0x3793A651, 0x3352BBE6, 0x3E119D3F, 0x3AD08088,
+	0x2497D08D, 0x2056CD3A, 0x2D15EBE3, 0x29D4F654, 0xC5A92679,
+	0xC1683BCE, 0xCC2B1D17, 0xC8EA00A0, 0xD6AD50A5, 0xD26C4D12,
+	0xDF2F6BCB, 0xDBEE767C, 0xE3A1CBC1, 0xE760D676, 0xEA23F0AF,
+	0xEEE2ED18, 0xF0A5BD1D, 0xF464A0AA, 0xF9278673, 0xFDE69BC4,
+	0x89B8FD09, 0x8D79E0BE, 0x803AC667, 0x84FBDBD0, 0x9ABC8BD5,
+	0x9E7D9662, 0x933EB0BB, 0x97FFAD0C, 0xAFB010B1, 0xAB710D06,
+	0xA6322BDF, 0xA2F33668, 0xBCB4666D, 0xB8757BDA, 0xB5365D03,
+	0xB1F740B4
+};
+
+/// r * x^n mod P
+uint32_t crc32_shift(uint32_t r, std::size_t n)
+{
+	while (n--)
+	{
+		r = (r & 0x80000000) ? (r << 1) ^ Crc32Poly : (r << 1);
+	}
+	return r;
+}
+
+/// a * b mod P
+uint32_t crc32_multiply(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0;
+	for (uint32_t bit = 0x80000000; bit; bit >>= 1)
+	{
+		r = (r & 0x80000000) ? (r << 1) ^ Crc32Poly : (r << 1);
+		if (a & bit)
+		{
+			r ^= b;
+		}
+	}
+	return r;
+}
+
+/// power[k] = x^(32 * 2^k) mod P, the crc shift of 2^k bytes
+struct ShiftTable {
+	uint32_t power[64];
+
+	ShiftTable()
+	{
+		power[0] = crc32_shift(1, 32);
+		for (std::size_t k = 1; k < 64; k++)
+		{
+			power[k] = crc32_multiply(power[k - 1], power[k - 1]);
+		}
+	}
+};
+
+/*
+slicing tables, N bytes (8 or 16) a step:
+crc' = byteTable[N][c0 ^ b0] ^ crcTable[k][ck](k=1..3) ^ byteTable[N-j][bj](j=1..N-1)
+where ck is the k-th byte of the crc, bj the j-th input byte
+*/
+struct SliceTables {
+	/// byteTable[m][v] = v * x^(32m) mod P
+	uint32_t byteTable[17][256];
+	/// crcTable16[k][v] = v * x^(8k+512) mod P
+	uint32_t crcTable16[4][256];
+	/// crcTable8[k][v] = v * x^(8k+256) mod P
+	uint32_t crcTable8[4][256];
+
+	SliceTables()
+	{
+		for (uint32_t v = 0; v < 256; v++)
+		{
+			byteTable[0][v] = v;
+			for (std::size_t m = 1; m <= 16; m++)
+			{
+				byteTable[m][v] = crc32_shift(byteTable[m - 1][v], 32);
+			}
+			for (std::size_t k = 0; k < 4; k++)
+			{
+				crcTable16[k][v] = crc32_shift(byteTable[16][v], 8 * k);
+				crcTable8[k][v] = crc32_shift(byteTable[8][v], 8 * k);
+			}
+		}
+	}
+};
+
+const SliceTables& sliceTables()
+{
+	static const SliceTables tables;
+	return tables;
+}
+
+/// byte at a time
+inline uint32_t crc32_byte(uint32_t crc, uint8_t b)
+{
+	crc ^= b;
+	for (int j = 0; j < 4; j++)
+	{
+		crc = (crc << 8) ^ Crc32Table[crc >> 24];
+	}
+	return crc;
+}
+
+uint32_t crc32_slice(uint32_t crc, const uint8_t* p, std::size_t size)
+{
+	const SliceTables& t = sliceTables();
+
+	for (; size >= 16; size -= 16, p += 16)
+	{
+		crc = t.byteTable[16][(crc & 0xff) ^ p[0]]
+			^ t.crcTable16[1][(crc >> 8) & 0xff]
+			^ t.crcTable16[2][(crc >> 16) & 0xff]
+			^ t.crcTable16[3][crc >> 24]
+			^ t.byteTable[15][p[1]] ^ t.byteTable[14][p[2]] ^ t.byteTable[13][p[3]]
+			^ t.byteTable[12][p[4]] ^ t.byteTable[11][p[5]] ^ t.byteTable[10][p[6]]
+			^ t.byteTable[9][p[7]] ^ t.byteTable[8][p[8]] ^ t.byteTable[7][p[9]]
+			^ t.byteTable[6][p[10]] ^ t.byteTable[5][p[11]] ^ t.byteTable[4][p[12]]
+			^ t.byteTable[3][p[13]] ^ t.byteTable[2][p[14]] ^ t.byteTable[1][p[15]];
+	}
+
+	if (size >= 8)
+	{
+		crc = t.byteTable[8][(crc & 0xff) ^ p[0]]
+			^ t.crcTable8[1][(crc >> 8) & 0xff]
+			^ t.crcTable8[2][(crc >> 16) & 0xff]
+			^ t.crcTable8[3][crc >> 24]
+			^ t.byteTable[7][p[1]] ^ t.byteTable[6][p[2]] ^ t.byteTable[5][p[3]]
+			^ t.byteTable[4][p[4]] ^ t.byteTable[3][p[5]] ^ t.byteTable[2][p[6]]
+			^ t.byteTable[1][p[7]];
+		size -= 8;
+		p += 8;
+	}
+
+	while (size--)
+	{
+		crc = crc32_byte(crc, *p++);
+	}
+	return crc;
+}
+
+#ifdef ICS_CRC32_CLMUL
+
+/*
+carry-less multiply folding: every input byte is a 32-bit word of the crc'ed stream,
+so 16 input bytes are expanded by pshufb into four 128-bit blocks and folded
+into four accumulators
+*/
+/// x * x^D mod P, k holds x^(D+64) mod P in the high half and x^D mod P in the low half
+__attribute__((target("pclmul,ssse3")))
+inline __m128i crc32_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+__attribute__((target("pclmul,ssse3")))
+uint32_t crc32_clmul(uint32_t crc, const uint8_t* p, std::size_t size)
+{
+	static const uint32_t k128hi = crc32_shift(1, 192), k128lo = crc32_shift(1, 128);
+	static const uint32_t k512hi = crc32_shift(1, 576), k512lo = crc32_shift(1, 512);
+
+	const __m128i fold128 = _mm_set_epi64x(k128hi, k128lo);
+	const __m128i fold512 = _mm_set_epi64x(k512hi, k512lo);
+
+	// input byte i of a group of 4 goes to the low byte of word 3-i
+	const __m128i expand[4] = {
+		_mm_set_epi8(-128, -128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3),
+		_mm_set_epi8(-128, -128, -128, 4, -128, -128, -128, 5, -128, -128, -128, 6, -128, -128, -128, 7),
+		_mm_set_epi8(-128, -128, -128, 8, -128, -128, -128, 9, -128, -128, -128, 10, -128, -128, -128, 11),
+		_mm_set_epi8(-128, -128, -128, 12, -128, -128, -128, 13, -128, -128, -128, 14, -128, -128, -128, 15),
+	};
+
+	__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	__m128i x[4];
+	for (int i = 0; i < 4; i++)
+	{
+		x[i] = _mm_shuffle_epi8(data, expand[i]);
+	}
+	x[0] = _mm_xor_si128(x[0], _mm_set_epi32(static_cast<int>(crc), 0, 0, 0));
+	p += 16;
+	size -= 16;
+
+	for (; size >= 16; size -= 16, p += 16)
+	{
+		data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		for (int i = 0; i < 4; i++)
+		{
+			x[i] = _mm_xor_si128(crc32_fold(x[i], fold512), _mm_shuffle_epi8(data, expand[i]));
+		}
+	}
+
+	__m128i r = x[0];
+	for (int i = 1; i < 4; i++)
+	{
+		r = _mm_xor_si128(crc32_fold(r, fold128), x[i]);
+	}
+
+	// crc of the 128-bit remainder, most significant byte first
+	uint8_t bytes[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), r);
+	crc = 0;
+	for (int i = 15; i >= 0; i--)
+	{
+		crc = (crc << 8) ^ Crc32Table[(crc >> 24) ^ bytes[i]];
+	}
+
+	return crc32_slice(crc, p, size);
+}
+
+typedef uint32_t (*Crc32Func)(uint32_t, const uint8_t*, std::size_t);
+
+/// the folding path is taken when the cpu has pclmulqdq and ssse3
+Crc32Func crc32_select()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3))
+	{
+		return crc32_clmul;
+	}
+	return crc32_slice;
+}
+
+/// below it the folding setup costs more than it saves
+const std::size_t Crc32ClmulMinSize = 512;
+
+#endif
+
+}
+
+/// crc32 of the buffer
+uint32_t crc32_code(const void* buf, std::size_t size)
+{
+	return crc32_update(CRC32_INIT, buf, size);
+}
+
+uint32_t crc32_update(uint32_t crc, const void* buf, std::size_t size)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(buf);
+#ifdef ICS_CRC32_CLMUL
+	static const Crc32Func func = crc32_select();
+	if (size >= Crc32ClmulMinSize)
+	{
+		return func(crc, p, size);
+	}
+#endif
+	return crc32_slice(crc, p, size);
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, std::size_t len2)
+{
+	static const ShiftTable table;
+	for (std::size_t k = 0; len2; k++, len2 >>= 1)
+	{
+		if (len2 & 1)
+		{
+			crc1 = crc32_multiply(crc1, table.power[k]);
+		}
+	}
+	return crc1 ^ crc2;
+}
+
+} // end namespace ics
@@ -0,0 +1,34 @@
+
+
+#ifndef _ICS_CRC32_H
+#define _ICS_CRC32_H
+
+#include <stdint.h>
+#include <cstddef>
+
+
+namespace ics {
+
+/*
+CRC32 of the ICS protocol: polynomial 0x04C11DB7, MSB first, init 0xFFFFFFFF, no final xor;
+each byte is xored into the low bits of the crc and then shifted by 32 bits,
+i.e. crc = (crc ^ byte) * x^32 mod P for every byte
+*/
+
+/// crc value of an empty buffer
+const uint32_t CRC32_INIT = 0xFFFFFFFF;
+
+/// crc32 of the buffer
+uint32_t crc32_code(const void* buf, std::size_t size);
+
+/// continue the crc with the buffer
+uint32_t crc32_update(uint32_t crc, const void* buf, std::size_t size);
+
+/*
+crc of A+B from crc1 = crc of A and crc2 = crc32_update(0, B, len2),
+so the crc of B may be computed once and reused after different prefixes
+*/
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, std::size_t len2);
+
+} // end namespace ics
+#endif	// end _ICS_CRC32_H
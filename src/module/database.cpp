@@ -12,6 +12,103 @@
 
 namespace ics {
 
+std::size_t OtlConnection::s_statementCacheSize = 32;
+
+OtlConnection::OtlConnection()
+{
+
+}
+
+OtlConnection::~OtlConnection()
+{
+	clearStatements();
+}
+
+otl_stream& OtlConnection::stream(const char* sql, int bufferSize)
+{
+	bool cached;
+	return open(sql, bufferSize, cached);
+}
+
+otl_stream& OtlConnection::select(const char* sql)
+{
+	bool cached;
+	otl_stream& s = open(sql, 1, cached);
+	if (cached)
+	{
+		// 新建的流已执行过
+		s.rewind();
+	}
+	return s;
+}
+
+otl_stream& OtlConnection::open(const char* sql, int bufferSize, bool& cached)
+{
+	std::string key(sql);
+	key += '#';
+	key += std::to_string(bufferSize);
+
+	auto it = m_statementIndex.find(key);
+	if (it != m_statementIndex.end())
+	{
+		// 移到最前
+		m_statements.splice(m_statements.begin(), m_statements, it->second);
+		cached = true;
+		return *it->second->stream;
+	}
+	cached = false;
+
+	std::unique_ptr<otl_stream> s(new otl_stream(bufferSize, sql, *this));
+
+	while (m_statements.size() >= s_statementCacheSize)
+	{
+		m_statementIndex.erase(m_statements.back().key);
+		m_statements.pop_back();
+	}
+
+	m_statements.push_front(Statement{ key, std::move(s) });
+	m_statementIndex[key] = m_statements.begin();
+	return *m_statements.front().stream;
+}
+
+void OtlConnection::clearStatements()
+{
+	m_statementIndex.clear();
+	m_statements.clear();
+}
+
+void OtlConnection::logoff()
+{
+	clearStatements();
+	otl_connect::logoff();
+}
+
+void OtlConnection::reconnect(const std::string& connStr) throw(otl_exception)
+{
+	try {
+		logoff();
+	}
+	catch (otl_exception& ex)
+	{
+		LOG_WARN("logoff failed:" << ex.msg);
+	}
+	rlogon(connStr.c_str(), false);
+}
+
+bool OtlConnection::isConnectionLost(const otl_exception& ex)
+{
+	// SQLSTATE 08xxx:连接异常; mysql 2006:server has gone away, 2013:lost connection
+	const char* state = (const char*)ex.sqlstate;
+	return (state[0] == '0' && state[1] == '8') || ex.code == 2006 || ex.code == 2013;
+}
+
+void OtlConnection::setStatementCacheSize(std::size_t size)
+{
+	// 一个任务会同时使用几条语句,不能淘汰正在使用的
+	s_statementCacheSize = size < MinStatementCacheSize ? MinStatementCacheSize : size;
+}
+
+
 DataBase::DataBase(const std::string& uid, const std::string& pwd, const std::string& dsn)
 {
 	init(uid, pwd, dsn);
@@ -24,7 +121,7 @@ DataBase::DataBase()
 
 DataBase::~DataBase()
 {
-
+	close();
 }
 
 void DataBase::init(const std::string& uid, const std::string& pwd, const std::string& dsn)
@@ -32,13 +129,89 @@ void DataBase::init(const std::string& uid, const std::string& pwd, const std::s
 	m_conn_str = uid + "/" + pwd + "@" + dsn;
 }
 
-void DataBase::open(int pool_min_size, int pool_max_size) throw(std::runtime_error)
+void DataBase::setWaitQueue(std::size_t maxWaiters, std::size_t waitTimeout)
+{
+	m_maxWaiters = maxWaiters;
+	m_waitTimeout = std::chrono::milliseconds(waitTimeout);
+}
+
+void DataBase::setPingInterval(std::size_t pingInterval)
+{
+	m_pingInterval = std::chrono::seconds(pingInterval > 0 ? pingInterval : 1);
+}
+
+void DataBase::open(int pool_min_size, int pool_max_size) throw(std::runtime_error, otl_exception)
 {
 	if (m_conn_str.empty())
 	{
 		throw std::runtime_error("connection string is empty");
 	}
-	m_conn_pool.open(m_conn_str.c_str(), false, pool_min_size, pool_max_size);
+	close();
+
+	m_minSize = pool_min_size > 0 ? pool_min_size : 1;
+	m_maxSize = pool_max_size > (int)m_minSize ? pool_max_size : m_minSize;
+
+	// 启动时数据库不可用直接报错
+	std::deque<IdleConnection> conns;
+	for (std::size_t i = 0; i < m_minSize; i++)
+	{
+		OtlConnect conn(new OtlConnection());
+		conn->rlogon(m_conn_str.c_str(), false);
+		conns.push_back(IdleConnection{ std::move(conn), std::chrono::steady_clock::now() });
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_idle = std::move(conns);
+		m_stats = PoolStats();
+		m_stats.total = m_minSize;
+		m_lastReport = std::chrono::steady_clock::now();
+		m_open = true;
+	}
+
+	m_maintainThread = std::thread([this](){
+		maintain();
+	});
+}
+
+void DataBase::close()
+{
+	std::deque<IdleConnection> idle;
+	std::deque<OtlConnect> suspects;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_open)
+		{
+			return;
+		}
+		m_open = false;
+
+		while (!m_waiters.empty())
+		{
+			WaiterPtr waiter = std::move(m_waiters.front());
+			m_waiters.pop_front();
+			complete(waiter, OtlConnect());
+		}
+		idle.swap(m_idle);
+		suspects.swap(m_suspects);
+		m_stats.total -= idle.size() + suspects.size();
+	}
+	m_maintainCond.notify_all();
+
+	if (m_maintainThread.joinable())
+	{
+		m_maintainThread.join();
+	}
+
+	// 使用中的连接放回时释放
+	for (auto& c : idle)
+	{
+		destroy(std::move(c.conn));
+	}
+	for (auto& c : suspects)
+	{
+		destroy(std::move(c));
+	}
 }
 
 void DataBase::initialize(bool multi_thread)
@@ -46,14 +219,299 @@ void DataBase::initialize(bool multi_thread)
 	otl_connect::otl_initialize(multi_thread);
 }
     
-DataBase::OtlConnect DataBase::getConnection()
+DataBase::OtlConnect DataBase::getConnection() throw(IcsException)
 {
-	return m_conn_pool.get();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_open)
+	{
+		throw IcsException("database is not open");
+	}
+
+	if (!m_idle.empty())
+	{
+		OtlConnect conn = std::move(m_idle.back().conn);
+		m_idle.pop_back();
+		m_stats.inUse++;
+		m_stats.acquired++;
+		m_stats.waitHistogram[0]++;
+		return conn;
+	}
+
+	if (m_waiters.size() >= m_maxWaiters)
+	{
+		m_stats.rejected++;
+		throw IcsException("too many waiters(%d) for database connection", (int)m_waiters.size());
+	}
+
+	WaiterPtr waiter = std::make_shared<Waiter>();
+	waiter->start = std::chrono::steady_clock::now();
+	m_waiters.push_back(waiter);
+	m_maintainCond.notify_one();
+
+	if (!waiter->cond.wait_until(lock, waiter->start + m_waitTimeout, [&waiter](){ return waiter->done; }))
+	{
+		removeWaiter(waiter);
+		m_stats.timeouts++;
+		throw IcsException("wait database connection timeout(%d ms)", (int)m_waitTimeout.count());
+	}
+
+	if (!waiter->conn)
+	{
+		throw IcsException("database is closed");
+	}
+	return std::move(waiter->conn);
 }
-    
-void DataBase::putConnection(DataBase::OtlConnect conn)
+
+void DataBase::putConnection(DataBase::OtlConnect conn, bool suspect)
+{
+	if (!conn)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.inUse--;
+		if (m_open)
+		{
+			if (!suspect)
+			{
+				release(std::move(conn));
+				return;
+			}
+			m_suspects.push_back(std::move(conn));
+			m_maintainCond.notify_one();
+			return;
+		}
+		m_stats.total--;
+	}
+	destroy(std::move(conn));
+}
+
+void DataBase::reconnect(OtlConnection& conn) throw(otl_exception)
+{
+	conn.reconnect(m_conn_str);
+}
+
+DataBase::PoolStats DataBase::getStats()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	PoolStats stats = m_stats;
+	stats.idle = m_idle.size();
+	stats.waiters = m_waiters.size();
+	return stats;
+}
+
+void DataBase::release(OtlConnect conn)
+{
+	if (m_waiters.empty())
+	{
+		m_idle.push_back(IdleConnection{ std::move(conn), std::chrono::steady_clock::now() });
+		return;
+	}
+
+	WaiterPtr waiter = std::move(m_waiters.front());
+	m_waiters.pop_front();
+	complete(waiter, std::move(conn));
+}
+
+void DataBase::complete(const WaiterPtr& waiter, OtlConnect conn)
+{
+	waiter->done = true;
+	if (conn)
+	{
+		auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - waiter->start).count();
+		std::size_t bucket = 0;
+		for (long bound = 1; bucket < WaitBuckets - 1 && wait >= bound; bound *= 10)
+		{
+			bucket++;
+		}
+		m_stats.waitHistogram[bucket]++;
+		m_stats.inUse++;
+		m_stats.acquired++;
+		waiter->conn = std::move(conn);
+	}
+	waiter->cond.notify_one();
+}
+
+void DataBase::removeWaiter(const WaiterPtr& waiter)
+{
+	for (auto it = m_waiters.begin(); it != m_waiters.end(); ++it)
+	{
+		if (*it == waiter)
+		{
+			m_waiters.erase(it);
+			return;
+		}
+	}
+}
+
+void DataBase::maintain()
+{
+	auto nextRetry = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_open)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		// 出过错的连接先检测
+		if (!m_suspects.empty())
+		{
+			OtlConnect conn = std::move(m_suspects.front());
+			m_suspects.pop_front();
+			lock.unlock();
+			bool valid = validate(*conn);
+			lock.lock();
+			if (valid && m_open)
+			{
+				release(std::move(conn));
+			}
+			else
+			{
+				m_stats.total--;
+				lock.unlock();
+				destroy(std::move(conn));
+				lock.lock();
+			}
+			continue;
+		}
+
+		// 有等待者或不足最小数量时新建连接,登录失败后间隔一段时间再试
+		bool needMore = !m_waiters.empty() || m_stats.total < m_minSize;
+		if (needMore && m_stats.total < m_maxSize && now >= nextRetry)
+		{
+			lock.unlock();
+			OtlConnect conn = connect();
+			lock.lock();
+			if (!conn)
+			{
+				nextRetry = std::chrono::steady_clock::now() + std::chrono::milliseconds(RetryInterval);
+			}
+			else if (m_open)
+			{
+				m_stats.total++;
+				release(std::move(conn));
+			}
+			else
+			{
+				lock.unlock();
+				destroy(std::move(conn));
+				lock.lock();
+			}
+			continue;
+		}
+
+		// 最久未用的连接到期检测
+		if (!m_idle.empty() && now >= m_idle.front().since + m_pingInterval)
+		{
+			OtlConnect conn = std::move(m_idle.front().conn);
+			m_idle.pop_front();
+			lock.unlock();
+			bool valid = validate(*conn);
+			lock.lock();
+			if (valid && m_open)
+			{
+				release(std::move(conn));
+			}
+			else
+			{
+				m_stats.total--;
+				lock.unlock();
+				destroy(std::move(conn));
+				lock.lock();
+			}
+			continue;
+		}
+
+		if (now >= m_lastReport + std::chrono::seconds(ReportInterval))
+		{
+			m_lastReport = now;
+			lock.unlock();
+			report();
+			lock.lock();
+			continue;
+		}
+
+		auto wake = m_lastReport + std::chrono::seconds(ReportInterval);
+		if (!m_idle.empty() && m_idle.front().since + m_pingInterval < wake)
+		{
+			wake = m_idle.front().since + m_pingInterval;
+		}
+		if (needMore && m_stats.total < m_maxSize && nextRetry < wake)
+		{
+			wake = nextRetry;
+		}
+		m_maintainCond.wait_until(lock, wake);
+	}
+}
+
+bool DataBase::validate(OtlConnection& conn)
+{
+	try {
+		int value = 0;
+		conn.select("select 1") >> value;
+		return true;
+	}
+	catch (otl_exception& ex)
+	{
+		LOG_WARN("database ping failed:" << ex.msg);
+		conn.clearStatements();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.failedPings++;
+	}
+
+	try {
+		conn.reconnect(m_conn_str);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.reconnects++;
+		return true;
+	}
+	catch (otl_exception& ex)
+	{
+		LOG_WARN("database reconnect failed:" << ex.msg);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.failedLogons++;
+	}
+	return false;
+}
+
+DataBase::OtlConnect DataBase::connect()
+{
+	OtlConnect conn(new OtlConnection());
+	try {
+		conn->rlogon(m_conn_str.c_str(), false);
+		return conn;
+	}
+	catch (otl_exception& ex)
+	{
+		LOG_WARN("database logon failed:" << ex.msg);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.failedLogons++;
+	}
+	return OtlConnect();
+}
+
+void DataBase::destroy(OtlConnect conn)
+{
+	try {
+		conn->logoff();
+	}
+	catch (otl_exception& ex)
+	{
+		LOG_WARN("logoff failed:" << ex.msg);
+	}
+}
+
+void DataBase::report()
 {
-	m_conn_pool.put(std::move(conn));
+	PoolStats stats = getStats();
+	LOG_INFO("database pool total=" << stats.total << " idle=" << stats.idle << " inuse=" << stats.inUse
+		<< " waiters=" << stats.waiters << " acquired=" << stats.acquired
+		<< " timeouts=" << stats.timeouts << " rejected=" << stats.rejected
+		<< " reconnects=" << stats.reconnects << " failedpings=" << stats.failedPings << " failedlogons=" << stats.failedLogons
+		<< " wait(<1,<10,<100,<1000,>=1000ms)=" << stats.waitHistogram[0] << "," << stats.waitHistogram[1] << ","
+		<< stats.waitHistogram[2] << "," << stats.waitHistogram[3] << "," << stats.waitHistogram[4]);
 }
 
 }
\ No newline at end of file
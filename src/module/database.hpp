@@ -11,19 +11,89 @@
 
 #include "config.hpp"
 #include "otlv4.h"
+#include "icsexception.hpp"
 #include <string>
 #include <exception>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 
 namespace ics {
     
 
-class DataBase {
+/// 数据库连接:缓存预编译的语句,按最近最少使用淘汰
+class OtlConnection : public otl_connect {
 public:
-//	using OtlConnectPool = otl_connect_pool<otl_connect, otl_exception>;
+	OtlConnection();
+
+	~OtlConnection();
+
+	/// 取该语句的流,未缓存时预编译并放入缓存;流出错后须调用clearStatements
+	otl_stream& stream(const char* sql, int bufferSize = 1);
+
+	/// 取无输入变量的查询流,缓存的流重新执行查询
+	otl_stream& select(const char* sql);
+
+	/// 释放缓存的全部语句
+	void clearStatements();
 
-	typedef otl_connect_pool<otl_connect,otl_exception> OtlConnectPool;
+	/// 断开连接,先释放缓存的语句(隐藏otl_connect::logoff,连接池关闭时调用)
+	void logoff();
 
-	typedef OtlConnectPool::connect_ptr OtlConnect;
+	/// 重新连接,缓存的语句随旧连接失效
+	void reconnect(const std::string& connStr) throw(otl_exception);
+
+	/// 每个连接缓存的语句数量
+	static void setStatementCacheSize(std::size_t size);
+
+	/// 缓存语句的最小数量
+	static const std::size_t MinStatementCacheSize = 4;
+
+	/// 是否为连接断开的错误
+	static bool isConnectionLost(const otl_exception& ex);
+
+private:
+	otl_stream& open(const char* sql, int bufferSize, bool& cached);
+
+private:
+	struct Statement {
+		std::string key;
+		std::unique_ptr<otl_stream> stream;
+	};
+
+	/// 最近使用的在前
+	std::list<Statement>	m_statements;
+	std::unordered_map<std::string, std::list<Statement>::iterator>	m_statementIndex;
+
+	static std::size_t s_statementCacheSize;
+};
+
+
+class DataBase {
+public:
+	typedef std::unique_ptr<OtlConnection> OtlConnect;
+
+	/// 等待时间分布的上限(毫秒),最后一档为超过1000毫秒
+	static const std::size_t WaitBuckets = 5;
+
+	struct PoolStats {
+		std::size_t total = 0;		// 连接总数
+		std::size_t idle = 0;		// 空闲连接
+		std::size_t inUse = 0;		// 使用中的连接
+		std::size_t waiters = 0;	// 等待连接的请求
+		uint64_t acquired = 0;		// 取得连接的次数
+		uint64_t timeouts = 0;		// 等待超时的次数
+		uint64_t rejected = 0;		// 等待队列满被拒绝的次数
+		uint64_t reconnects = 0;	// 重连成功的次数
+		uint64_t failedPings = 0;	// 检测失败的次数
+		uint64_t failedLogons = 0;	// 登录失败的次数
+		uint64_t waitHistogram[WaitBuckets] = {};	// 等待时间分布:<1,<10,<100,<1000,>=1000毫秒
+	};
 
 	DataBase(const std::string& uid, const std::string& pwd, const std::string& dsn);
     
@@ -31,22 +101,92 @@ public:
 
 	void init(const std::string& uid, const std::string& pwd, const std::string& dsn);
 
-	void open(int pool_min_size = 8, int pool_max_size = 16) throw(std::runtime_error);
+	/// 设置等待连接的请求数上限和等待超时(毫秒),open前调用
+	void setWaitQueue(std::size_t maxWaiters, std::size_t waitTimeout);
+
+	/// 设置空闲连接的检测周期(秒),open前调用
+	void setPingInterval(std::size_t pingInterval);
+
+	/// 建立pool_min_size个连接并启动维护线程,连接数按需增长到pool_max_size
+	void open(int pool_min_size = 8, int pool_max_size = 16) throw(std::runtime_error, otl_exception);
+
+	/// 关闭连接池,等待中的请求全部失败
+	void close();
 
     ~DataBase();
     
     static void initialize(bool multi_thread = true);
     
-	OtlConnect getConnection();
+	/// 取连接,没有空闲连接时最多等待设置的超时时间,超时或等待队列满抛出异常
+	OtlConnect getConnection() throw(IcsException);
     
-	void putConnection(OtlConnect conn);
+	/// 放回连接,出过错的连接(suspect)检测通过后才能再次使用
+	void putConnection(OtlConnect conn, bool suspect = false);
+
+	/// 连接断开后重新连接
+	void reconnect(OtlConnection& conn) throw(otl_exception);
+
+	PoolStats getStats();
     
 private:
+	struct Waiter {
+		std::chrono::steady_clock::time_point start;
+		OtlConnect conn;
+		bool done = false;
+		std::condition_variable cond;
+	};
+
+	struct IdleConnection {
+		OtlConnect conn;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	typedef std::shared_ptr<Waiter> WaiterPtr;
+
+	/// 连接交给最早的等待者或放入空闲队列,持有m_mutex时调用
+	void release(OtlConnect conn);
+
+	/// 交付连接或失败(conn为空),持有m_mutex时调用
+	void complete(const WaiterPtr& waiter, OtlConnect conn);
+
+	void removeWaiter(const WaiterPtr& waiter);
 
-	OtlConnectPool	m_conn_pool;
+	/// 维护线程:检测出错的和长时间空闲的连接,按需新建连接,定时输出统计
+	void maintain();
 
+	/// 检测连接是否可用,不可用时重连
+	bool validate(OtlConnection& conn);
+
+	OtlConnect connect();
+
+	void destroy(OtlConnect conn);
+
+	void report();
+
+	/// 重新登录的间隔(毫秒)
+	static const std::size_t RetryInterval = 1000;
+
+	/// 统计输出间隔(秒)
+	static const std::size_t ReportInterval = 60;
+
+private:
 	std::string		m_conn_str;
-    
+
+	std::size_t		m_minSize = 0;
+	std::size_t		m_maxSize = 0;
+	std::size_t		m_maxWaiters = 256;
+	std::chrono::milliseconds	m_waitTimeout{ 3000 };
+	std::chrono::seconds		m_pingInterval{ 60 };
+
+	std::mutex		m_mutex;
+	std::condition_variable	m_maintainCond;
+	bool			m_open = false;
+	std::deque<IdleConnection>	m_idle;
+	std::deque<OtlConnect>		m_suspects;
+	std::deque<WaiterPtr>		m_waiters;
+	PoolStats		m_stats;
+	std::thread		m_maintainThread;
+	std::chrono::steady_clock::time_point	m_lastReport;
 };
 
 class OtlConnectionGuard {
@@ -58,10 +198,16 @@ public:
 
 	~OtlConnectionGuard()
 	{
-		m_db.putConnection(std::move(m_connection));
+		// 出错时缓存的语句流状态未知,连接检测后再用
+		bool suspect = std::uncaught_exception();
+		if (suspect)
+		{
+			m_connection->clearStatements();
+		}
+		m_db.putConnection(std::move(m_connection), suspect);
 	}
 
-	otl_connect& connection()
+	OtlConnection& connection()
 	{
 		return *m_connection;
 	}
@@ -0,0 +1,166 @@
+
+
+#include "dbbatchwriter.hpp"
+#include "log.hpp"
+#include <ctime>
+
+
+namespace ics {
+
+
+DbBatchWriter::DbBatchWriter(asio::io_service& service, DbExecutor& executor, const char* name, const char* sql)
+: m_timer(service)
+, m_executor(executor)
+, m_name(name)
+, m_sql(sql)
+{
+	// the keys of the batches don't repeat those spooled before a restart
+	m_keyPrefix = std::string(name) + "#" + std::to_string(std::time(nullptr)) + "#";
+}
+
+DbBatchWriter::~DbBatchWriter()
+{
+	stop();
+}
+
+void DbBatchWriter::start(std::size_t maxRows, std::size_t maxDelay)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_maxRows = maxRows;
+		m_maxDelay = maxDelay ? maxDelay : 1;
+	}
+	m_lastReport = std::chrono::steady_clock::now();
+	tick();
+}
+
+void DbBatchWriter::stop()
+{
+	asio::error_code ec;
+	m_timer.cancel(ec);
+	flush();
+
+	// the completions of the batches left refer to the writer
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_idle.wait(lock, [this](){
+		return !m_inFlight && m_batches.empty();
+	});
+}
+
+void DbBatchWriter::write(Row&& row)
+{
+	bool full = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_batches.empty() || m_batches.back().rows >= m_maxRows)
+		{
+			newBatch();
+		}
+		Batch& batch = m_batches.back();
+		row(batch.call);
+		batch.rows++;
+		full = batch.rows >= m_maxRows;
+	}
+
+	if (full)
+	{
+		flush();
+	}
+}
+
+void DbBatchWriter::newBatch()
+{
+	m_batches.emplace_back();
+	Batch& batch = m_batches.back();
+	batch.call = DbCall(m_sql, m_keyPrefix + std::to_string(++m_batchNumber));
+	batch.call.setBufferSize((int)m_maxRows);
+}
+
+void DbBatchWriter::flush()
+{
+	Batch batch;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_inFlight || m_batches.empty())
+		{
+			return;
+		}
+		batch = std::move(m_batches.front());
+		m_batches.pop_front();
+		m_inFlight = true;
+	}
+
+	// the executor runs a failed batch again, spools it while the database is down or rejects it
+	std::size_t count = batch.rows;
+	try {
+		m_executor.post(m_name, std::move(batch.call), [this, count](bool success)
+		{
+			complete(count, success);
+		});
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR(m_name << " drop " << count << " rows: " << ex.message());
+		m_droppedRows += count;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_inFlight = false;
+		}
+		m_idle.notify_all();
+	}
+}
+
+void DbBatchWriter::complete(std::size_t count, bool success)
+{
+	if (success)
+	{
+		m_writtenBatches++;
+		m_writtenRows += count;
+	}
+	else
+	{
+		m_failedRows += count;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_inFlight = false;
+	}
+	m_idle.notify_all();
+
+	// the batches filled while this one was written
+	flush();
+}
+
+void DbBatchWriter::tick()
+{
+	m_timer.expires_from_now(std::chrono::milliseconds(m_maxDelay));
+	m_timer.async_wait([this](const asio::error_code& ec)
+	{
+		if (ec)
+		{
+			return;
+		}
+		flush();
+		report();
+		tick();
+	});
+}
+
+void DbBatchWriter::report()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_lastReport < std::chrono::seconds(ReportInterval))
+	{
+		return;
+	}
+	m_lastReport = now;
+
+	uint64_t batches = m_writtenBatches;
+	uint64_t rows = m_writtenRows;
+	LOG_INFO(m_name << " batches=" << batches << " rows=" << rows
+		<< " rows/batch=" << (batches ? rows / batches : 0)
+		<< " failed=" << m_failedRows.load() << " dropped=" << m_droppedRows.load());
+}
+
+} // end namespace ics
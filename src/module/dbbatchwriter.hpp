@@ -0,0 +1,95 @@
+
+
+#ifndef _ICS_DB_BATCH_WRITER_H
+#define _ICS_DB_BATCH_WRITER_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "dbexecutor.hpp"
+#include "otlv4.h"
+#include <asio.hpp>
+#include <asio/steady_timer.hpp>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+
+namespace ics {
+
+/*
+batch writer of one statement: rows from all connections are collected into calls of
+at most maxRows rows, written through one array-bound otl_stream on the database executor;
+a batch is flushed when it is full or every maxDelay milliseconds, one batch at a time so
+the rows are written in order, a failed batch is run again, spooled or rejected by the executor
+*/
+class DbBatchWriter : NonCopyable {
+public:
+	/// append the parameters of one row to the call
+	typedef std::function<void (DbCall&)> Row;
+
+	/// name: for logging, sql: the statement every row is written to
+	DbBatchWriter(asio::io_service& service, DbExecutor& executor, const char* name, const char* sql);
+
+	~DbBatchWriter();
+
+	/// start the flush timer, before starting every row is written at once
+	void start(std::size_t maxRows, std::size_t maxDelay);
+
+	/// stop the timer and wait until the rows left are written, called after the io_service stopped
+	void stop();
+
+	/// add a row from any thread
+	void write(Row&& row);
+
+	/// queue the next batch to the executor unless one is being written
+	void flush();
+
+	/// interval of logging the counters(seconds)
+	static const std::size_t ReportInterval = 60;
+
+private:
+	void tick();
+
+	void report();
+
+	/// a batch was written, spooled or failed
+	void complete(std::size_t count, bool success);
+
+	struct Batch {
+		DbCall		call;
+		std::size_t	rows = 0;
+	};
+
+	/// a new batch at the end, called with m_lock held
+	void newBatch();
+
+private:
+	asio::steady_timer	m_timer;
+	DbExecutor&			m_executor;
+	const char*			m_name;
+	const char*			m_sql;
+	std::size_t			m_maxRows = 0;
+	std::size_t			m_maxDelay = 0;
+
+	// the last batch takes the new rows, the full ones wait for the batch in flight
+	std::deque<Batch>	m_batches;
+	std::string			m_keyPrefix;
+	uint64_t			m_batchNumber = 0;
+	bool				m_inFlight = false;
+	std::mutex			m_lock;
+	std::condition_variable	m_idle;
+
+	// counters
+	std::atomic<uint64_t>	m_writtenRows{ 0 };
+	std::atomic<uint64_t>	m_writtenBatches{ 0 };
+	std::atomic<uint64_t>	m_failedRows{ 0 };
+	std::atomic<uint64_t>	m_droppedRows{ 0 };
+	std::chrono::steady_clock::time_point	m_lastReport;
+};
+
+} // end namespace ics
+#endif	// end _ICS_DB_BATCH_WRITER_H
@@ -0,0 +1,315 @@
+
+
+#include "dbexecutor.hpp"
+#include "log.hpp"
+
+
+namespace ics {
+
+const std::size_t DbExecutor::MaxCallAttempts;
+
+DbExecutor::DbExecutor(DataBase& db)
+: m_database(db)
+{
+
+}
+
+DbExecutor::~DbExecutor()
+{
+	stop();
+}
+
+void DbExecutor::start(std::size_t threadCount, std::size_t queueSize)
+{
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+
+	LOG_INFO("database executor runs on " << threadCount << " threads, queue size " << queueSize);
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_queueSize = queueSize;
+	m_stopped = false;
+	for (std::size_t i = 0; i < threadCount; i++)
+	{
+		m_workers.emplace_back(new Worker());
+	}
+	for (auto& worker : m_workers)
+	{
+		Worker* w = worker.get();
+		w->thread = std::thread([this, w](){
+			work(*w);
+		});
+	}
+}
+
+void DbExecutor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopped = true;
+		for (auto& worker : m_workers)
+		{
+			worker->cond.notify_all();
+		}
+	}
+
+	// the workers drain their queues before they return
+	for (auto& worker : m_workers)
+	{
+		if (worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_workers.clear();
+}
+
+void DbExecutor::post(const char* name, Job&& job, Completion&& done) throw(IcsException)
+{
+	post(Task{ name, std::move(job), DbCall(), std::move(done) }, std::string());
+}
+
+void DbExecutor::post(const char* name, const std::string& orderKey, Job&& job, Completion&& done) throw(IcsException)
+{
+	post(Task{ name, std::move(job), DbCall(), std::move(done) }, orderKey);
+}
+
+void DbExecutor::post(const char* name, DbCall&& call, Completion&& done) throw(IcsException)
+{
+	post(Task{ name, Job(), std::move(call), std::move(done) }, std::string());
+}
+
+void DbExecutor::post(const char* name, const std::string& orderKey, DbCall&& call, Completion&& done) throw(IcsException)
+{
+	post(Task{ name, Job(), std::move(call), std::move(done) }, orderKey);
+}
+
+void DbExecutor::post(Task&& task, const std::string& orderKey) throw(IcsException)
+{
+	bool started;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		started = !m_workers.empty() && !m_stopped;
+		if (started)
+		{
+			if (m_queued < m_queueSize)
+			{
+				// one worker runs all the jobs of a key, so they can't pass each other on two connections
+				std::size_t index = orderKey.empty() ? m_nextWorker++ : std::hash<std::string>()(orderKey);
+				Worker& worker = *m_workers[index % m_workers.size()];
+				worker.tasks.push_back(std::move(task));
+				m_queued++;
+				worker.cond.notify_one();
+				return;
+			}
+			if (task.call.empty() || m_spool == nullptr)
+			{
+				throw IcsException("database queue is full, drop the job %s", task.name);
+			}
+		}
+	}
+
+	if (started)
+	{
+		// the workers can't keep up, defer the call to the spool
+		complete(task, spool(task));
+		return;
+	}
+
+	// not started or stopped
+	run(task);
+}
+
+std::size_t DbExecutor::queued()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_queued;
+}
+
+void DbExecutor::work(Worker& worker)
+{
+	for (;;)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			worker.cond.wait(lock, [this, &worker](){
+				return m_stopped || !worker.tasks.empty();
+			});
+
+			// drained after stopped
+			if (worker.tasks.empty())
+			{
+				return;
+			}
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			m_queued--;
+		}
+		run(task);
+	}
+}
+
+void DbExecutor::run(Task& task)
+{
+	bool success = false;
+	if (!task.call.empty() && m_spool != nullptr && m_spool->pending())
+	{
+		// keep the order of the calls until the spool is replayed
+		success = spool(task);
+	}
+	else
+	{
+		bool unavailable = false;
+		bool sent = false;
+
+		// a call may fail on a deadlock or a timeout, it is run again a few times before it is rejected
+		std::size_t attempts = task.call.empty() ? 1 : MaxCallAttempts;
+		for (std::size_t i = 0; i < attempts && !success && !unavailable; i++)
+		{
+			success = attempt(task, unavailable, sent);
+		}
+
+		if (success && !task.call.empty() && m_spool != nullptr)
+		{
+			// a resent call with the same key is not replayed again
+			m_spool->markApplied(task.call.key());
+		}
+		else if (!success && unavailable && !task.call.empty() && m_spool != nullptr)
+		{
+			if (sent)
+			{
+				LOG_WARN("database job " << task.name << " lost the connection while running, " << task.call.key() << " may be applied twice");
+			}
+			success = spool(task);
+		}
+		else if (!success && !unavailable && !task.call.empty())
+		{
+			// the sender isn't asked to send it again, it would fail the same way
+			success = reject(task);
+		}
+	}
+
+	complete(task, success);
+}
+
+bool DbExecutor::attempt(Task& task, bool& unavailable, bool& sent)
+{
+	try {
+		execute(task, unavailable, sent);
+		return true;
+	}
+	catch (otl_exception& ex)
+	{
+		LOG_ERROR("database job " << task.name << " otl_exception:" << ex.msg);
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR("database job " << task.name << " error:" << ex.message());
+	}
+	catch (std::exception& ex)
+	{
+		LOG_ERROR("database job " << task.name << " error:" << ex.what());
+	}
+	catch (...)
+	{
+		LOG_ERROR("database job " << task.name << " unknown error");
+	}
+	return false;
+}
+
+void DbExecutor::execute(Task& task, bool& unavailable, bool& sent)
+{
+	// no connection in time means the database is down
+	unavailable = true;
+	OtlConnectionGuard connGuard(m_database);
+	unavailable = false;
+	sent = true;
+	try {
+		if (task.job)
+		{
+			task.job(connGuard.connection());
+		}
+		else
+		{
+			task.call.execute(connGuard.connection());
+		}
+	}
+	catch (otl_exception& ex)
+	{
+		unavailable = OtlConnection::isConnectionLost(ex);
+		recover(connGuard.connection(), ex);
+		throw;
+	}
+}
+
+bool DbExecutor::spool(Task& task)
+{
+	try {
+		m_spool->append(task.call);
+		return true;
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR("database job " << task.name << " spool error:" << ex.message());
+	}
+	return false;
+}
+
+bool DbExecutor::reject(Task& task)
+{
+	if (m_spool == nullptr)
+	{
+		LOG_ERROR("database job " << task.name << " gives up " << task.call.key() << " after " << MaxCallAttempts << " attempts");
+		return true;
+	}
+
+	try {
+		m_spool->reject(task.call);
+		LOG_ERROR("database job " << task.name << " rejects " << task.call.key() << " after " << MaxCallAttempts << " attempts, kept in the spool");
+		return true;
+	}
+	catch (IcsException& ex)
+	{
+		LOG_ERROR("database job " << task.name << " reject error:" << ex.message());
+	}
+	return false;
+}
+
+void DbExecutor::complete(Task& task, bool success)
+{
+	if (task.done)
+	{
+		try {
+			task.done(success);
+		}
+		catch (...)
+		{
+			LOG_ERROR("database job " << task.name << " completion error");
+		}
+	}
+}
+
+void DbExecutor::recover(OtlConnection& conn, const otl_exception& ex)
+{
+	// a cached stream may be left with a half written row
+	conn.clearStatements();
+
+	if (OtlConnection::isConnectionLost(ex))
+	{
+		try {
+			m_database.reconnect(conn);
+			LOG_INFO("database connection reconnected");
+		}
+		catch (otl_exception& e)
+		{
+			LOG_ERROR("database reconnect failed:" << e.msg);
+		}
+	}
+}
+
+} // end namespace ics
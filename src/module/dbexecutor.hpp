@@ -0,0 +1,124 @@
+
+
+#ifndef _ICS_DB_EXECUTOR_H
+#define _ICS_DB_EXECUTOR_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "icsexception.hpp"
+#include "database.hpp"
+#include "dbspool.hpp"
+#include "otlv4.h"
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+
+
+namespace ics {
+
+/*
+database write executor: io threads queue write jobs and return at once,
+the worker threads run them on pooled connections; every worker has its own queue,
+jobs with the same order key go to the same worker and run in the order they are posted
+*/
+class DbExecutor : NonCopyable {
+public:
+	/// runs on a worker thread with a pooled connection
+	typedef std::function<void (OtlConnection&)> Job;
+
+	/// runs on the worker thread after the job, success is false if the job threw
+	typedef std::function<void (bool success)> Completion;
+
+	/// runs of a failing call before it is rejected
+	static const std::size_t MaxCallAttempts = 3;
+
+	DbExecutor(DataBase& db);
+
+	~DbExecutor();
+
+	/// start threadCount workers, at most queueSize jobs wait in the queue
+	void start(std::size_t threadCount, std::size_t queueSize);
+
+	/// run the queued jobs and join the workers
+	void stop();
+
+	/// queue a job from any thread, name is a literal for logging, throw if the queue is full;
+	/// without workers the job runs on the calling thread
+	void post(const char* name, Job&& job, Completion&& done = Completion()) throw(IcsException);
+
+	/// queue a job after the jobs posted before with the same order key(a terminal, a request...)
+	void post(const char* name, const std::string& orderKey, Job&& job, Completion&& done = Completion()) throw(IcsException);
+
+	/// queue a call which goes to the spool if the database is unavailable or the queue is full,
+	/// a call failing MaxCallAttempts times for another reason is rejected(kept aside by the spool, logged without one);
+	/// done(true) once it is written, spooled or rejected
+	void post(const char* name, DbCall&& call, Completion&& done = Completion()) throw(IcsException);
+
+	/// queue a call after the jobs posted before with the same order key
+	void post(const char* name, const std::string& orderKey, DbCall&& call, Completion&& done = Completion()) throw(IcsException);
+
+	/// spool for the calls, set before start
+	void setSpool(DbSpool* spool)
+	{
+		m_spool = spool;
+	}
+
+	/// count of jobs waiting
+	std::size_t queued();
+
+private:
+	struct Task {
+		const char*	name;
+		Job			job;
+		DbCall		call;
+		Completion	done;
+	};
+
+	struct Worker {
+		std::deque<Task>		tasks;
+		std::condition_variable	cond;
+		std::thread				thread;
+	};
+
+	/// an empty order key takes the workers in turn
+	void post(Task&& task, const std::string& orderKey) throw(IcsException);
+
+	void work(Worker& worker);
+
+	void run(Task& task);
+
+	/// unavailable is set if the database can't be reached, sent once the job got a connection
+	void execute(Task& task, bool& unavailable, bool& sent);
+
+	/// run the task once, false if it threw
+	bool attempt(Task& task, bool& unavailable, bool& sent);
+
+	/// write the call of the task to the spool
+	bool spool(Task& task);
+
+	/// keep the call the database refused aside
+	bool reject(Task& task);
+
+	void complete(Task& task, bool success);
+
+	/// the statements of a failed job are dropped, a lost connection is reconnected
+	void recover(OtlConnection& conn, const otl_exception& ex);
+
+private:
+	DataBase&			m_database;
+	DbSpool*			m_spool = nullptr;
+	std::size_t			m_queueSize = 0;
+	std::size_t			m_queued = 0;
+	std::size_t			m_nextWorker = 0;
+	std::mutex			m_lock;
+	bool				m_stopped = false;
+	std::vector<std::unique_ptr<Worker>>	m_workers;
+};
+
+} // end namespace ics
+#endif	// end _ICS_DB_EXECUTOR_H
@@ -0,0 +1,747 @@
+
+
+#include "dbspool.hpp"
+#include "log.hpp"
+#include "crc32.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+
+
+namespace ics {
+
+static const char SegmentMagic[8] = { 'I', 'C', 'S', 'S', 'P', 'O', 'O', 'L' };
+static const char CheckpointMagic[8] = { 'I', 'C', 'S', 'C', 'K', 'P', 'T', '1' };
+
+template<class T>
+static void readValue(const uint8_t*& p, const uint8_t* end, T& value) throw(IcsException)
+{
+	if (p + sizeof(value) > end)
+	{
+		throw IcsException("database call is truncated");
+	}
+	std::memcpy(&value, p, sizeof(value));
+	p += sizeof(value);
+}
+
+template<class T>
+static void writeValue(uint8_t*& p, const T& value)
+{
+	std::memcpy(p, &value, sizeof(value));
+	p += sizeof(value);
+}
+
+/// reserve the blocks of [0,size) so that a full disk fails here and not as SIGBUS on a mapped write, returns 0 or errno
+static int reserveFile(int fd, off_t size)
+{
+	int err = posix_fallocate(fd, 0, size);
+	while (err == EINTR)
+	{
+		err = posix_fallocate(fd, 0, size);
+	}
+	return err;
+}
+
+
+DbCall::DbCall()
+{
+
+}
+
+DbCall::DbCall(const char* sql, const std::string& key)
+: m_sql(sql)
+, m_key(key)
+{
+
+}
+
+DbCall& DbCall::operator << (int value)
+{
+	append(IntValue, value);
+	return *this;
+}
+
+DbCall& DbCall::operator << (unsigned int value)
+{
+	append(UintValue, value);
+	return *this;
+}
+
+DbCall& DbCall::operator << (float value)
+{
+	append(FloatValue, value);
+	return *this;
+}
+
+DbCall& DbCall::operator << (double value)
+{
+	append(DoubleValue, value);
+	return *this;
+}
+
+DbCall& DbCall::operator << (const std::string& value)
+{
+	append(StringValue, (uint32_t)value.size());
+	m_values.insert(m_values.end(), value.begin(), value.end());
+	return *this;
+}
+
+DbCall& DbCall::operator << (const IcsDataTime& value)
+{
+	append(DateTimeValue, value);
+	return *this;
+}
+
+void DbCall::execute(OtlConnection& conn) const throw(otl_exception, IcsException)
+{
+	otl_stream& s = conn.stream(m_sql.c_str(), m_bufferSize);
+
+	const uint8_t* p = m_values.data();
+	const uint8_t* end = p + m_values.size();
+	while (p < end)
+	{
+		ValueType type = (ValueType)*p++;
+		switch (type)
+		{
+		case IntValue:
+		{
+			int value;
+			readValue(p, end, value);
+			s << value;
+			break;
+		}
+		case UintValue:
+		{
+			unsigned int value;
+			readValue(p, end, value);
+			s << value;
+			break;
+		}
+		case FloatValue:
+		{
+			float value;
+			readValue(p, end, value);
+			s << value;
+			break;
+		}
+		case DoubleValue:
+		{
+			double value;
+			readValue(p, end, value);
+			s << value;
+			break;
+		}
+		case StringValue:
+		{
+			uint32_t len;
+			readValue(p, end, len);
+			if (len > std::size_t(end - p))
+			{
+				throw IcsException("database call is truncated");
+			}
+			s << std::string((const char*)p, len);
+			p += len;
+			break;
+		}
+		case DateTimeValue:
+		{
+			IcsDataTime value;
+			readValue(p, end, value);
+			s << value;
+			break;
+		}
+		default:
+			throw IcsException("unknown value type=%d in database call", type);
+		}
+	}
+
+	if (m_bufferSize > 1)
+	{
+		// the rows left in the array buffer
+		s.flush();
+	}
+}
+
+std::size_t DbCall::encodedSize() const
+{
+	return sizeof(uint16_t) + m_key.size() + sizeof(uint32_t) + m_sql.size() + sizeof(uint32_t) + m_values.size();
+}
+
+void DbCall::encode(uint8_t* buf) const
+{
+	writeValue(buf, (uint16_t)m_key.size());
+	std::memcpy(buf, m_key.data(), m_key.size());
+	buf += m_key.size();
+
+	writeValue(buf, (uint32_t)m_sql.size());
+	std::memcpy(buf, m_sql.data(), m_sql.size());
+	buf += m_sql.size();
+
+	writeValue(buf, (uint32_t)m_values.size());
+	std::memcpy(buf, m_values.data(), m_values.size());
+}
+
+DbCall DbCall::decode(const uint8_t* buf, std::size_t len) throw(IcsException)
+{
+	const uint8_t* end = buf + len;
+	DbCall call;
+
+	uint16_t keyLen;
+	readValue(buf, end, keyLen);
+	if (keyLen > std::size_t(end - buf))
+	{
+		throw IcsException("database call is truncated");
+	}
+	call.m_key.assign((const char*)buf, keyLen);
+	buf += keyLen;
+
+	uint32_t sqlLen;
+	readValue(buf, end, sqlLen);
+	if (sqlLen == 0 || sqlLen > std::size_t(end - buf))
+	{
+		throw IcsException("database call is truncated");
+	}
+	call.m_sql.assign((const char*)buf, sqlLen);
+	buf += sqlLen;
+
+	uint32_t valuesLen;
+	readValue(buf, end, valuesLen);
+	if (valuesLen != std::size_t(end - buf))
+	{
+		throw IcsException("database call length=%u mismatch", valuesLen);
+	}
+	call.m_values.assign(buf, end);
+
+	return call;
+}
+
+
+DbSpool::DbSpool(DataBase& db)
+: m_database(db)
+{
+
+}
+
+DbSpool::~DbSpool()
+{
+	stop();
+	closeSegment(m_writer);
+	closeSegment(m_reader);
+	if (m_checkpoint != nullptr)
+	{
+		munmap(m_checkpoint, sizeof(Checkpoint));
+	}
+	if (m_checkpointFd >= 0)
+	{
+		::close(m_checkpointFd);
+	}
+	if (m_rejectFd >= 0)
+	{
+		::close(m_rejectFd);
+	}
+}
+
+void DbSpool::open(const std::string& dir, std::size_t segmentSize) throw(IcsException)
+{
+	m_dir = dir;
+	m_segmentSize = std::max<std::size_t>(segmentSize, 64 * 1024);
+
+	if (mkdir(m_dir.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		throw IcsException("create spool directory %s failed, errno=%d", m_dir.c_str(), errno);
+	}
+
+	// checkpoint
+	std::string path = m_dir + "/checkpoint";
+	m_checkpointFd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_checkpointFd < 0)
+	{
+		throw IcsException("open spool checkpoint %s failed, errno=%d", path.c_str(), errno);
+	}
+	if (int err = reserveFile(m_checkpointFd, sizeof(Checkpoint)))
+	{
+		throw IcsException("reserve spool checkpoint %s failed, errno=%d", path.c_str(), err);
+	}
+	void* addr = mmap(nullptr, sizeof(Checkpoint), PROT_READ | PROT_WRITE, MAP_SHARED, m_checkpointFd, 0);
+	if (addr == MAP_FAILED)
+	{
+		throw IcsException("map spool checkpoint %s failed, errno=%d", path.c_str(), errno);
+	}
+	m_checkpoint = (Checkpoint*)addr;
+	if (std::memcmp(m_checkpoint->magic, CheckpointMagic, sizeof(CheckpointMagic)) != 0)
+	{
+		std::memset(m_checkpoint, 0, sizeof(Checkpoint));
+		std::memcpy(m_checkpoint->magic, CheckpointMagic, sizeof(CheckpointMagic));
+	}
+
+	// segments left by the last run
+	std::vector<uint64_t> numbers;
+	if (DIR* d = opendir(m_dir.c_str()))
+	{
+		while (struct dirent* entry = readdir(d))
+		{
+			char* suffix = nullptr;
+			uint64_t number = std::strtoull(entry->d_name, &suffix, 10);
+			if (number > 0 && suffix != entry->d_name && std::strcmp(suffix, ".spool") == 0)
+			{
+				numbers.push_back(number);
+			}
+		}
+		closedir(d);
+	}
+	std::sort(numbers.begin(), numbers.end());
+
+	if (numbers.empty())
+	{
+		openSegment(m_writer, std::max<uint64_t>(m_checkpoint->segment, 1), true);
+		m_writeOffset = HeaderSize;
+	}
+	else
+	{
+		openSegment(m_writer, numbers.back(), false);
+		m_writeOffset = scanSegment(m_writer);
+	}
+
+	if (numbers.empty() || m_checkpoint->segment > m_writer.number)
+	{
+		m_checkpoint->segment = m_writer.number;
+		m_checkpoint->offset = m_writeOffset;
+	}
+	else if (m_checkpoint->segment < numbers.front())
+	{
+		m_checkpoint->segment = numbers.front();
+		m_checkpoint->offset = HeaderSize;
+	}
+	if (m_checkpoint->offset < HeaderSize)
+	{
+		m_checkpoint->offset = HeaderSize;
+	}
+
+	bool pending = m_checkpoint->segment != m_writer.number || m_checkpoint->offset < m_writeOffset;
+	m_pending.store(pending, std::memory_order_release);
+	if (pending)
+	{
+		LOG_WARN("database spool " << m_dir << " has records to replay from segment " << m_checkpoint->segment);
+	}
+}
+
+void DbSpool::start(std::size_t retryInterval)
+{
+	m_retryInterval = retryInterval > 0 ? retryInterval : 1000;
+	m_stopped = false;
+	m_replayThread = std::thread([this](){
+		replay();
+	});
+}
+
+void DbSpool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopped = true;
+	}
+	m_cond.notify_all();
+
+	if (m_replayThread.joinable())
+	{
+		m_replayThread.join();
+	}
+}
+
+void DbSpool::append(const DbCall& call) throw(IcsException)
+{
+	std::size_t size = call.encodedSize();
+	if (HeaderSize + RecordHeadSize + size > m_segmentSize)
+	{
+		throw IcsException("database call size=%d is larger than the spool segment", (int)size);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_writer.data == nullptr)
+	{
+		throw IcsException("database spool is not open");
+	}
+
+	if (m_writeOffset + RecordHeadSize + size > m_writer.size)
+	{
+		// open the next segment first, if the disk is full the current one stays the writer and the call fails
+		Segment next;
+		openSegment(next, m_writer.number + 1, true);
+		msync(m_writer.data, m_writer.size, MS_ASYNC);
+		closeSegment(m_writer);
+		m_writer = next;
+		m_writeOffset = HeaderSize;
+	}
+
+	// the length is written last, a torn record fails the crc check when the segment is scanned
+	uint8_t* p = m_writer.data + m_writeOffset;
+	call.encode(p + RecordHeadSize);
+	uint32_t crc = crc32_code(p + RecordHeadSize, size);
+	std::memcpy(p + sizeof(uint32_t), &crc, sizeof(crc));
+	uint32_t length = (uint32_t)size;
+	std::memcpy(p, &length, sizeof(length));
+	m_writeOffset += RecordHeadSize + size;
+
+	if (!m_pending.exchange(true, std::memory_order_acq_rel))
+	{
+		LOG_WARN("database is unavailable, calls are spooled to " << m_dir);
+		m_cond.notify_all();
+	}
+}
+
+void DbSpool::reject(const DbCall& call) throw(IcsException)
+{
+	std::size_t size = call.encodedSize();
+	std::vector<uint8_t> record(RecordHeadSize + size);
+	call.encode(record.data() + RecordHeadSize);
+	uint32_t crc = crc32_code(record.data() + RecordHeadSize, size);
+	uint32_t length = (uint32_t)size;
+	std::memcpy(record.data(), &length, sizeof(length));
+	std::memcpy(record.data() + sizeof(uint32_t), &crc, sizeof(crc));
+
+	std::lock_guard<std::mutex> lock(m_rejectLock);
+	if (m_rejectFd < 0)
+	{
+		if (m_dir.empty())
+		{
+			throw IcsException("database spool is not open");
+		}
+		std::string path = m_dir + "/rejected";
+		m_rejectFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (m_rejectFd < 0)
+		{
+			throw IcsException("open spool rejected file %s failed, errno=%d", path.c_str(), errno);
+		}
+	}
+
+	// one write for the whole record, a short write leaves a torn record which fails the crc check
+	ssize_t written = ::write(m_rejectFd, record.data(), record.size());
+	while (written < 0 && errno == EINTR)
+	{
+		written = ::write(m_rejectFd, record.data(), record.size());
+	}
+	if (written != (ssize_t)record.size())
+	{
+		throw IcsException("write spool rejected file failed, errno=%d", errno);
+	}
+	m_rejected++;
+}
+
+std::string DbSpool::segmentPath(uint64_t number) const
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "/%010llu.spool", (unsigned long long)number);
+	return m_dir + name;
+}
+
+void DbSpool::openSegment(Segment& seg, uint64_t number, bool create) throw(IcsException)
+{
+	std::string path = segmentPath(number);
+	int fd = ::open(path.c_str(), create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+	if (fd < 0)
+	{
+		throw IcsException("open spool segment %s failed, errno=%d", path.c_str(), errno);
+	}
+
+	if (create)
+	{
+		if (int err = reserveFile(fd, m_segmentSize))
+		{
+			::close(fd);
+			unlink(path.c_str());
+			throw IcsException("reserve %d bytes for spool segment %s failed, errno=%d", (int)m_segmentSize, path.c_str(), err);
+		}
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < HeaderSize)
+	{
+		::close(fd);
+		throw IcsException("bad spool segment %s, errno=%d", path.c_str(), errno);
+	}
+
+	void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		::close(fd);
+		throw IcsException("map spool segment %s failed, errno=%d", path.c_str(), errno);
+	}
+
+	uint8_t* data = (uint8_t*)addr;
+	if (create)
+	{
+		std::memcpy(data, SegmentMagic, sizeof(SegmentMagic));
+		std::memcpy(data + sizeof(SegmentMagic), &number, sizeof(number));
+	}
+	else if (std::memcmp(data, SegmentMagic, sizeof(SegmentMagic)) != 0)
+	{
+		munmap(addr, st.st_size);
+		::close(fd);
+		throw IcsException("bad spool segment %s", path.c_str());
+	}
+
+	seg.number = number;
+	seg.fd = fd;
+	seg.data = data;
+	seg.size = st.st_size;
+}
+
+void DbSpool::closeSegment(Segment& seg)
+{
+	if (seg.data != nullptr)
+	{
+		munmap(seg.data, seg.size);
+	}
+	if (seg.fd >= 0)
+	{
+		::close(seg.fd);
+	}
+	seg = Segment();
+}
+
+std::size_t DbSpool::scanSegment(const Segment& seg) const
+{
+	std::size_t offset = HeaderSize;
+	while (offset + RecordHeadSize <= seg.size)
+	{
+		uint32_t length, crc;
+		std::memcpy(&length, seg.data + offset, sizeof(length));
+		std::memcpy(&crc, seg.data + offset + sizeof(length), sizeof(crc));
+		if (length == 0 || length > seg.size - offset - RecordHeadSize
+			|| crc32_code(seg.data + offset + RecordHeadSize, length) != crc)
+		{
+			break;
+		}
+		offset += RecordHeadSize + length;
+	}
+	return offset;
+}
+
+void DbSpool::replay()
+{
+	std::vector<uint8_t> record;
+	bool retrying = false;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [this](){
+				return m_stopped || m_pending.load(std::memory_order_acquire);
+			});
+			if (m_stopped)
+			{
+				return;
+			}
+		}
+
+		std::size_t next;
+		if (!nextRecord(record, next))
+		{
+			continue;
+		}
+
+		DbCall call;
+		try {
+			call = DbCall::decode(record.data(), record.size());
+		}
+		catch (IcsException& ex)
+		{
+			LOG_ERROR("database spool drops a bad record:" << ex.message());
+			m_dropped++;
+			commit(std::string(), next);
+			continue;
+		}
+
+		if (!call.key().empty() && applied(hashKey(call.key())))
+		{
+			m_skipped++;
+			commit(std::string(), next);
+			continue;
+		}
+
+		bool unavailable = true;
+		try {
+			OtlConnectionGuard connGuard(m_database);
+			unavailable = false;
+			try {
+				call.execute(connGuard.connection());
+			}
+			catch (otl_exception& ex)
+			{
+				unavailable = OtlConnection::isConnectionLost(ex);
+				throw;
+			}
+			m_replayed++;
+			commit(call.key(), next);
+			retrying = false;
+			continue;
+		}
+		catch (otl_exception& ex)
+		{
+			if (!retrying)
+			{
+				LOG_ERROR("database spool replays " << call.key() << " otl_exception:" << ex.msg);
+			}
+		}
+		catch (IcsException& ex)
+		{
+			if (!retrying)
+			{
+				LOG_ERROR("database spool replays " << call.key() << " error:" << ex.message());
+			}
+		}
+		catch (std::exception& ex)
+		{
+			LOG_ERROR("database spool replays " << call.key() << " error:" << ex.what());
+		}
+
+		if (unavailable)
+		{
+			// try the same record again later, the error is logged once
+			retrying = true;
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait_for(lock, std::chrono::milliseconds(m_retryInterval), [this](){
+				return m_stopped;
+			});
+			continue;
+		}
+
+		// the call itself is bad and would fail forever, keep it aside
+		retrying = false;
+		try {
+			reject(call);
+		}
+		catch (IcsException& ex)
+		{
+			LOG_ERROR("database spool drops " << call.key() << ":" << ex.message());
+			m_dropped++;
+		}
+		commit(std::string(), next);
+	}
+}
+
+bool DbSpool::nextRecord(std::vector<uint8_t>& record, std::size_t& next)
+{
+	for (;;)
+	{
+		uint64_t number = m_checkpoint->segment;
+		std::size_t offset = m_checkpoint->offset;
+		bool live;
+		std::size_t end = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			live = number == m_writer.number;
+			if (live)
+			{
+				if (offset >= m_writeOffset)
+				{
+					m_pending.store(false, std::memory_order_release);
+					LOG_INFO("database spool is drained, replayed=" << m_replayed << " skipped=" << m_skipped << " rejected=" << m_rejected << " dropped=" << m_dropped);
+					return false;
+				}
+				end = m_writeOffset;
+			}
+		}
+
+		if (m_reader.number != number)
+		{
+			closeSegment(m_reader);
+			try {
+				openSegment(m_reader, number, false);
+			}
+			catch (IcsException& ex)
+			{
+				LOG_ERROR("database spool skips segment " << number << ":" << ex.message());
+				m_checkpoint->segment = number + 1;
+				m_checkpoint->offset = HeaderSize;
+				continue;
+			}
+		}
+		if (!live)
+		{
+			end = m_reader.size;
+		}
+
+		if (offset + RecordHeadSize <= end)
+		{
+			uint32_t length, crc;
+			std::memcpy(&length, m_reader.data + offset, sizeof(length));
+			std::memcpy(&crc, m_reader.data + offset + sizeof(length), sizeof(crc));
+			const uint8_t* data = m_reader.data + offset + RecordHeadSize;
+			if (length > 0 && length <= end - offset - RecordHeadSize && crc32_code(data, length) == crc)
+			{
+				record.assign(data, data + length);
+				next = offset + RecordHeadSize + length;
+				return true;
+			}
+		}
+
+		if (live)
+		{
+			LOG_ERROR("database spool segment " << number << " is corrupted at " << offset);
+			m_checkpoint->offset = end;
+			continue;
+		}
+
+		// the writer has moved on, the segment is done
+		closeSegment(m_reader);
+		unlink(segmentPath(number).c_str());
+		m_checkpoint->segment = number + 1;
+		m_checkpoint->offset = HeaderSize;
+	}
+}
+
+void DbSpool::markApplied(const std::string& key)
+{
+	if (m_checkpoint != nullptr && !key.empty())
+	{
+		saveKey(key);
+	}
+}
+
+void DbSpool::commit(const std::string& key, std::size_t next)
+{
+	if (!key.empty())
+	{
+		saveKey(key);
+	}
+	// the key must reach the checkpoint before the position
+	std::atomic_thread_fence(std::memory_order_release);
+	m_checkpoint->offset = next;
+}
+
+void DbSpool::saveKey(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(m_appliedLock);
+	m_checkpoint->applied[m_checkpoint->next % AppliedKeys] = hashKey(key);
+	m_checkpoint->next++;
+}
+
+bool DbSpool::applied(uint64_t hash)
+{
+	std::lock_guard<std::mutex> lock(m_appliedLock);
+	return std::find(m_checkpoint->applied, m_checkpoint->applied + AppliedKeys, hash) != m_checkpoint->applied + AppliedKeys;
+}
+
+uint64_t DbSpool::hashKey(const std::string& key)
+{
+	// FNV-1a, stable across builds unlike std::hash
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : key)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+} // end namespace ics
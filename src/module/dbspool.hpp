@@ -0,0 +1,216 @@
+
+
+#ifndef _ICS_DB_SPOOL_H
+#define _ICS_DB_SPOOL_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "icsexception.hpp"
+#include "icsprotocol.hpp"
+#include "database.hpp"
+#include "otlv4.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+namespace ics {
+
+/*
+a database call kept as its sql text and the encoded values bound to it,
+unlike a Job it can be written to the spool and run again later
+*/
+class DbCall {
+public:
+	DbCall();
+
+	/// key identifies the call for idempotent replay, empty if it may run twice
+	DbCall(const char* sql, const std::string& key);
+
+	DbCall& operator << (int value);
+
+	DbCall& operator << (unsigned int value);
+
+	DbCall& operator << (float value);
+
+	DbCall& operator << (double value);
+
+	DbCall& operator << (const std::string& value);
+
+	DbCall& operator << (const IcsDataTime& value);
+
+	bool empty() const
+	{
+		return m_sql.empty();
+	}
+
+	const std::string& key() const
+	{
+		return m_key;
+	}
+
+	/// bind rows rows at once as arrays, the size isn't spooled: a replayed call runs row by row
+	void setBufferSize(int rows)
+	{
+		m_bufferSize = rows > 0 ? rows : 1;
+	}
+
+	/// bind the values in order, a stream with several rows executes each row
+	void execute(OtlConnection& conn) const throw(otl_exception, IcsException);
+
+	std::size_t encodedSize() const;
+
+	void encode(uint8_t* buf) const;
+
+	static DbCall decode(const uint8_t* buf, std::size_t len) throw(IcsException);
+
+private:
+	enum ValueType : uint8_t {
+		IntValue = 1,
+		UintValue,
+		FloatValue,
+		DoubleValue,
+		StringValue,
+		DateTimeValue,
+	};
+
+	template<class T>
+	void append(ValueType type, const T& value)
+	{
+		m_values.push_back(type);
+		m_values.insert(m_values.end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(value));
+	}
+
+private:
+	std::string	m_sql;
+	std::string	m_key;
+	std::vector<uint8_t>	m_values;
+	int			m_bufferSize = 1;
+};
+
+
+/*
+write-ahead spool of database calls which can't be written while the database is down:
+records are appended to memory mapped segment files under the spool directory,
+a replay thread runs them in order once the database is back and removes the replayed segments.
+
+segment: header(magic, number) + records(length, crc32, encoded call), zero length ends the segment
+rejected: records of the calls the database refused, replayed ones included, kept for the operator
+checkpoint: replay position and the keys of the last applied calls, replayed or written live,
+a call whose key was applied already is skipped; a call whose connection was lost after it was
+sent can't be told from one that never ran and is replayed, it may be applied twice
+*/
+class DbSpool : NonCopyable {
+public:
+	DbSpool(DataBase& db);
+
+	~DbSpool();
+
+	/// open or create the spool in dir, segmentSize is the size of a segment file in bytes
+	void open(const std::string& dir, std::size_t segmentSize) throw(IcsException);
+
+	/// start the replay thread, retry every retryInterval milliseconds while the database is down
+	void start(std::size_t retryInterval);
+
+	/// stop the replay thread, the records left are replayed at the next start
+	void stop();
+
+	/// append a call from any thread
+	void append(const DbCall& call) throw(IcsException);
+
+	/// record the key of a call written without the spool, a spooled call with the same key is skipped
+	void markApplied(const std::string& key);
+
+	/// keep a call the database refuses for another reason than being down in the rejected file
+	/// of the spool directory(records as in a segment, without header), it is never replayed
+	void reject(const DbCall& call) throw(IcsException);
+
+	/// some records are waiting for replay, new calls should be appended to keep the order
+	bool pending() const
+	{
+		return m_pending.load(std::memory_order_acquire);
+	}
+
+	static const std::size_t AppliedKeys = 4096;
+
+private:
+	struct Segment {
+		uint64_t	number = 0;
+		int			fd = -1;
+		uint8_t*	data = nullptr;
+		std::size_t	size = 0;
+	};
+
+	struct Checkpoint {
+		char		magic[8];
+		uint64_t	segment;
+		uint64_t	offset;
+		uint64_t	next;
+		uint64_t	applied[AppliedKeys];
+	};
+
+	static const std::size_t HeaderSize = 16;
+	static const std::size_t RecordHeadSize = 8;
+
+	std::string segmentPath(uint64_t number) const;
+
+	void openSegment(Segment& seg, uint64_t number, bool create) throw(IcsException);
+
+	void closeSegment(Segment& seg);
+
+	/// offset after the last valid record
+	std::size_t scanSegment(const Segment& seg) const;
+
+	void replay();
+
+	/// next record at the checkpoint, false if the reader caught up with the writer
+	bool nextRecord(std::vector<uint8_t>& record, std::size_t& next);
+
+	/// move the checkpoint past the record, the key is saved before
+	void commit(const std::string& key, std::size_t next);
+
+	void saveKey(const std::string& key);
+
+	bool applied(uint64_t hash);
+
+	static uint64_t hashKey(const std::string& key);
+
+private:
+	DataBase&		m_database;
+	std::string		m_dir;
+	std::size_t		m_segmentSize = 0;
+	std::size_t		m_retryInterval = 1000;
+
+	std::mutex		m_mutex;
+	std::condition_variable	m_cond;
+	std::atomic<bool>	m_pending{ false };
+	bool			m_stopped = true;
+	std::thread		m_replayThread;
+
+	// written under m_mutex by append
+	Segment			m_writer;
+	std::size_t		m_writeOffset = 0;
+
+	// used by the replay thread only
+	Segment			m_reader;
+	int				m_checkpointFd = -1;
+	Checkpoint*		m_checkpoint = nullptr;
+
+	// appended by reject under m_rejectLock
+	std::mutex		m_rejectLock;
+	int				m_rejectFd = -1;
+
+	// the applied keys of the checkpoint, saved by the replay thread and the executor
+	std::mutex		m_appliedLock;
+
+	uint64_t		m_replayed = 0;
+	uint64_t		m_skipped = 0;
+	uint64_t		m_dropped = 0;
+	std::atomic<uint64_t>	m_rejected{ 0 };
+};
+
+} // end namespace ics
+#endif	// end _ICS_DB_SPOOL_H
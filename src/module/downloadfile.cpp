@@ -1,7 +1,8 @@
 
 
 #include "downloadfile.hpp"
-#include "database.hpp"
+#include "icsprotocol.hpp"
+#include "crc32.hpp"
 #include "log.hpp"
 #include "icsexception.hpp"
 #include <cstdio>
@@ -18,9 +19,6 @@
 #endif
 
 
-extern ics::DataBase g_database;
-
-
 namespace ics {
 
 
@@ -92,6 +90,51 @@ FileUpgradeManager::FileInfo::~FileInfo()
 	}
 }
 
+std::shared_ptr<const FileUpgradeManager::Fragment> FileUpgradeManager::FileInfo::getFragment(uint32_t offset, uint16_t length) throw(IcsException)
+{
+	if (offset > this->file_length)	// ļС
+	{
+		throw IcsException("require file offset [%d] is more than file's length [%d]", offset, this->file_length);
+	}
+	else if (offset + length > this->file_length)	// ļСȡʣС
+	{
+		length = this->file_length - offset;
+	}
+
+	if (length > UPGRADE_FILE_SEGMENG_SIZE)	// ļƬΪʣ೤
+	{
+		length = UPGRADE_FILE_SEGMENG_SIZE;
+	}
+
+	uint64_t key = (uint64_t)offset << 16 | length;
+	{
+		std::lock_guard<std::mutex> lock(this->fragment_lock);
+		auto it = this->fragment_map.find(key);
+		if (it != this->fragment_map.end())
+		{
+			return it->second;
+		}
+	}
+
+	// ЭֽдƫƼ,ٸƬ
+	auto fragment = std::make_shared<Fragment>();
+	uint32_t order_offset = ics_byteorder(offset);
+	uint16_t order_length = ics_byteorder(length);
+	fragment->body.resize(sizeof(order_offset) + sizeof(order_length) + length);
+	std::memcpy(&fragment->body[0], &order_offset, sizeof(order_offset));
+	std::memcpy(&fragment->body[sizeof(order_offset)], &order_length, sizeof(order_length));
+	std::memcpy(&fragment->body[sizeof(order_offset) + sizeof(order_length)], (char*)this->file_content + offset, length);
+	fragment->crc = crc32_update(0, fragment->body.data(), fragment->body.size());
+
+	// ն˰̶ƬδС,Ƭʱ˵ƫƲ,ٻ
+	std::lock_guard<std::mutex> lock(this->fragment_lock);
+	if (this->fragment_map.size() < this->file_length / UPGRADE_FILE_SEGMENG_SIZE * 2 + 16)
+	{
+		this->fragment_map.emplace(key, fragment);
+	}
+	return fragment;
+}
+
 
 
 FileUpgradeManager* FileUpgradeManager::s_instance = NULL;
@@ -114,61 +157,65 @@ FileUpgradeManager* FileUpgradeManager::getInstance()
 	return s_instance;
 }
 
-/// ļIDļϢ
+/// ļIDѼصļϢ
 std::shared_ptr<FileUpgradeManager::FileInfo> FileUpgradeManager::getFileInfo(uint32_t fileid) throw()
 {
+	std::lock_guard<std::mutex> lock(m_loadFileLock);
 	auto it = m_fileMap.find(fileid);
 	if (it != m_fileMap.end())	// ҵ
 	{
 		return it->second;
 	}
-	else	// δҵ,Լ
+	return nullptr;
+}
+
+/// ļIDļϢ,δʱѯļ
+void FileUpgradeManager::getFileInfo(uint32_t fileid, FileHandler&& handler) throw()
+{
+	auto fileInfo = getFileInfo(fileid);
+	if (fileInfo || !m_fileResolver)
 	{
-#ifdef ICS_CENTER_MODE	
-		try {
-			// ICSģʽɴݿгԶȡļ
-			auto fileinfo = loadFileInfo(fileid);
-			m_fileMap[fileid] = fileinfo;
-			return fileinfo;
-		}
-		catch (IcsException& ex)
+		if (!fileInfo)
 		{
-			LOG_ERROR("FileUpgradeManager get file error:" << ex.message());
+			// ģʽ޷ѯļ·
+			LOG_ERROR("FileUpgradeManager can't get info file by fileid");
 		}
-		catch (std::exception& ex)
+		handler(fileInfo);
+		return;
+	}
+
+	// ICSģʽݿвѯļȡļ,ڲѯɵ߳ϼ
+	auto h = std::make_shared<FileHandler>(std::move(handler));
+	m_fileResolver(fileid, [this, fileid, h](const std::string& filename)
+	{
+		std::shared_ptr<FileInfo> loaded;
+		if (filename.empty())
 		{
-			LOG_ERROR("FileUpgradeManager get file error:" << ex.what());
+			LOG_ERROR("cann't find upgrade file by fileid: " << fileid);
 		}
-		catch (otl_exception& ex)
+		else
 		{
-			LOG_ERROR("FileUpgradeManager get file error:" << ex.msg);
+			try {
+				// ʱڼ״̬·ӳ
+				loaded = loadFileInfo(fileid, filename);
+			}
+			catch (IcsException& ex)
+			{
+				LOG_ERROR("FileUpgradeManager get file error:" << ex.message());
+			}
+			catch (std::exception& ex)
+			{
+				LOG_ERROR("FileUpgradeManager get file error:" << ex.what());
+			}
 		}
-#else
-		// ģʽ޷ѯļ·
-		LOG_ERROR("FileUpgradeManager can't get info file by fileid");
-#endif
-		return nullptr;
-	}
+		(*h)(loaded);
+	});
 }
 
-/// ݾļIDݿѯļļϢ
-std::shared_ptr<FileUpgradeManager::FileInfo> FileUpgradeManager::loadFileInfo(uint32_t fileid) throw(IcsException, otl_exception)
+/// ļIDļĲѯ
+void FileUpgradeManager::setFileResolver(FileResolver&& resolver)
 {
-	// ļidݿȡļ·
-	OtlConnectionGuard connGuard(g_database);
-	otl_stream s(1, "{ call sp_upgrade_getfile(:fileid<int,in>,@filename) }", connGuard.connection());
-	s << (int)fileid;
-
-	otl_stream queryResult(1, "select @filename :#filename<char[126]>", connGuard.connection());
-	std::string filename;
-	queryResult >> filename;
-
-	if (filename.empty())
-	{
-		LOG_ERROR("cann't find upgrade file by fileid: " << fileid);
-	}
-
-	return loadFileInfo(fileid, filename);
+	m_fileResolver = std::move(resolver);
 }
 
 /// ļIDӦļļϢ
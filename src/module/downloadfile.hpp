@@ -7,9 +7,11 @@
 #include "config.hpp"
 #include "otlv4.h"
 #include <memory>
+#include <functional>
 #include <unordered_map>
 #include <mutex>
 #include <string>
+#include <vector>
 
 
 namespace ics {
@@ -23,35 +25,62 @@ class FileUpgradeManager
 {
 public:
 
+	// ԤлļƬ
+	struct Fragment
+	{
+		// Ƭƫ+Ƭγ+Ƭ
+		std::vector<uint8_t> body;
+		// bodycrc32_update(0, ...),ʱϢͷֵУϲ
+		uint32_t crc;
+	};
+
 	// ļϢ
 	struct FileInfo
 	{
 		FileInfo(const std::string& filename);
 
 		~FileInfo();
+
+		/// ȡļƬ,ļСʱȡʣС,ƬΪUPGRADE_FILE_SEGMENG_SIZE
+		std::shared_ptr<const Fragment> getFragment(uint32_t offset, uint16_t length) throw(IcsException);
 		
 		void* file_content;
 		uint32_t file_length;
 		std::string file_name;
+
+		// Ƭλ,(ƫ,)Ϊ,ն˹
+		std::unordered_map<uint64_t, std::shared_ptr<const Fragment>> fragment_map;
+		std::mutex fragment_lock;
 	};
 
 	FileUpgradeManager();
 
 	~FileUpgradeManager();
 
-	/// ļIDļϢ
+	/// ļIDѼصļϢ,δʱؿ
 	std::shared_ptr<FileInfo> getFileInfo(uint32_t fileid) throw();
 
+	/// ҽ,ҲʱΪ
+	typedef std::function<void (const std::shared_ptr<FileInfo>& fileInfo)> FileHandler;
+
+	/// ļIDļϢ,δʱѯļ;Ѽʱڵ߳ϻص,ڲѯɵ߳ϻص
+	void getFileInfo(uint32_t fileid, FileHandler&& handler) throw();
+
 	/// ļIDӦļļϢ
 	std::shared_ptr<FileInfo> loadFileInfo(uint32_t fileid, const std::string& filename) throw(IcsException);
 
+	/// ļĲѯ,ҲѯʧʱΪ
+	typedef std::function<void (const std::string& filename)> FileNameHandler;
+
+	/// ѯļIDӦļ,̻߳ص
+	typedef std::function<void (uint32_t fileid, FileNameHandler&& handler)> FileResolver;
+
+	/// ļIDļĲѯ,δʱ(ģʽ)ֻҵѼصļ
+	void setFileResolver(FileResolver&& resolver);
+
 public:
 	static FileUpgradeManager* getInstance();
 
-private:
-	/// ݾļIDݿѯļļϢ
-	std::shared_ptr<FileInfo> loadFileInfo(uint32_t fileid) throw(IcsException, otl_exception);
-
 private:
 	// ļidӳ
 	std::unordered_map<uint32_t, std::shared_ptr<FileInfo>> m_fileMap;
@@ -59,6 +88,9 @@ private:
 	// ļ
 	std::mutex		m_loadFileLock;
 
+	// ļIDļĲѯ
+	FileResolver	m_fileResolver;
+
 private:
 	static FileUpgradeManager* s_instance;
 };
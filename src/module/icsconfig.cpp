@@ -40,7 +40,9 @@ void IcsConfig::reload(const char* file) throw(IcsException)
 		std::unordered_map<std::string, std::string> sectionMap;		
 		for (TiXmlElement* node = section->FirstChildElement(); node != nullptr; node = node->NextSiblingElement())
 		{
-			sectionMap[node->Value()] = node->GetText();
+			// 空元素的值为空字符串
+			const char* text = node->GetText();
+			sectionMap[node->Value()] = text != nullptr ? text : "";
 		}
 		m_attributeMap[section->Value()] = std::move(sectionMap);
 	}
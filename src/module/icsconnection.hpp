@@ -9,8 +9,12 @@
 #include "otlv4.h"
 #include "timer.hpp"
 #include "util.hpp"
+#include "recvbuffer.hpp"
 #include <asio.hpp>
 #include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 
 extern ics::MemoryPool g_memoryPool;
@@ -30,9 +34,17 @@ public:
 
 	typedef typename socket::shutdown_type shutdown_type;
 
+	/// һдϲϢ
+	static const std::size_t MaxSendBatch = 16;
+
+	/// ݱ󳤶:̫MTU 1500IPͷ20UDPͷ8
+	static const std::size_t MaxDatagramSize = 1472;
+
 	/// s:׽֣name:
 	IcsConnection(socket&& s, const char* name )
 		: m_socket(std::move(s))
+		, m_strand(m_socket.get_io_service())
+		, m_recvBuffer(g_memoryPool)
 	{
 		char buff[126];
 		auto endpoint = m_socket.remote_endpoint();
@@ -47,11 +59,22 @@ public:
 
 		m_name = buff;
 
+		// ɶͬ,
+		asio::error_code ec;
+		m_socket.non_blocking(true, ec);
+
 		LOG_DEBUG("Create the connection " << m_name);
 	}
 
 	virtual ~IcsConnection()
 	{
+		// ͷδ͵Ϣ
+		m_sendCarry.reset();
+		m_sendHeld.clear();
+		while (MpscNode* node = m_sendQueue.pop())
+		{
+			PooledBuffer::fromNode(node);
+		}
 		LOG_DEBUG("Destroy the connection " << m_name);
 	}
 
@@ -59,9 +82,10 @@ public:
 	void start(const uint8_t* data, std::size_t length)
 	{
 		// Ϣ
-		if (handleData(const_cast<uint8_t*>(data), length))
+		if (m_recvBuffer.reserve(length))
 		{
-
+			std::memcpy(m_recvBuffer.writePtr(), data, length);
+			handleData(length);
 		}
 		// ʼ
 		do_read();
@@ -80,6 +104,12 @@ public:
 		return m_name;
 	}
 
+	/// ڵio
+	asio::io_service& getIoService()
+	{
+		return m_strand.get_io_service();
+	}
+
 	void replaced()
 	{
 		m_replaced = true;
@@ -98,44 +128,131 @@ public:
 	// ƽϢ
 	virtual void dispatch(ProtocolStream& request) throw(IcsException, otl_exception) = 0;
 
+	// Զ˵ӦϢ,ĬϺ
+	virtual void handleResponse(ProtocolStream& response) throw(IcsException, otl_exception)
+	{
+		LOG_DEBUG(m_name << " ignore response message");
+	}
+
 	// 
 	virtual void error() throw()
 	{
 
 	}
 
-	/// ʱ:true-Чfalse-Ч
-	bool timeout() throw()
+	/*
+	гʱ:MaxIdleHeartbeatsδյϢʱر,̵߳һ;
+	յϢʱֻ¼ʱ,ʱʱټ,δʱİʣʱ¶ʱ;ʱб
+	*/
+	void watchIdle(TimingWheel& wheel, std::chrono::milliseconds heartbeat)
 	{
-		if (m_valid && ++m_timeoutCount > m_timeoutMax)
+		m_idleWheel = &wheel;
+		m_idleTimeout = heartbeat * MaxIdleHeartbeats;
+		m_lastReceive = std::chrono::steady_clock::now().time_since_epoch().count();
+
+		std::weak_ptr<IcsConnection<Protocol>> weak(this->shared_from_this());
+		m_idleTimer.setCallback([weak]()
 		{
-			do_error();
-		}	
-		return m_valid;
+			auto self = weak.lock();
+			if (self && self->m_valid)
+			{
+				self->checkIdle();
+			}
+		});
+		wheel.schedule(m_idleTimer, m_idleTimeout);
 	}
 
-	/// 
+	/// ڱӵstrandִ:̵߳
+	template<class Handler>
+	void strandPost(Handler&& handler)
+	{
+		m_strand.post(std::forward<Handler>(handler));
+	}
+
+	/// :̵߳,ڱӵstrandйر
 	void do_error()
 	{
-		if (m_valid)
+		auto self(this->shared_from_this());
+		m_strand.dispatch([self]()
 		{
-			m_valid = false;
-			error();	/// ֪ͨϲӦó	
-			asio::error_code ec;
-			m_socket.close(ec);		/// ر
-		}
+			if (self->m_valid)
+			{
+				self->m_valid = false;
+				self->m_idleTimer.cancel();		/// ټгʱ
+				self->error();	/// ֪ͨϲӦó	
+				asio::error_code ec;
+				self->m_socket.close(ec);		/// ر
+			}
+		});
 	}
 
 protected:
-	/// 
-	void trySend(ProtocolStream& msg)
+	/*
+	:̵߳,;ظϢķš
+	ԭӼȡú뷢Ͷ,˳Ųͬ,strandад;
+	ȡ֮ʧ,ȱʹϢһֱȴ,ȷϢԶռط
+	*/
+	uint16_t trySend(ProtocolStream& msg)
 	{
-		msg.serialize(m_serialNum++);
+		msg.reserve(IcsMsgHead::CrcCodeSize);
+
+		uint16_t sendNum = m_serialNum.fetch_add(1, std::memory_order_relaxed);
+		if (!m_valid)
+		{
+			return sendNum;
+		}
+
+		msg.serialize(sendNum);
+		m_sendQueue.push(msg.toBuffer().toNode());
+
+		// һеͶݷ
+		if (!m_sending.exchange(true, std::memory_order_acq_rel))
+		{
+			auto self(this->shared_from_this());
+			m_strand.dispatch([self]()
+			{
+				self->trySend();
+			});
+		}
+		return sendNum;
+	}
+
+	/// ǰϢݲӦ,֮sendAckӦ
+	void deferResponse()
+	{
+		m_responseDeferred = true;
+	}
+
+	/// ͨӦ:̵߳
+	void sendAck(uint16_t ackNum)
+	{
+		ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		response.initHead(MessageId::MessageId_min_0x0000, ackNum);
+		trySend(response);
+	}
+
+	/// strandдӺϢ(첽ѯɺ),needResponseackNumȡԭϢ,ӦͬյϢ
+	void handleDeferred(ProtocolStream& request, bool needResponse, uint16_t ackNum)
+	{
+		uint16_t id = (uint16_t)request.getHead()->getMsgID();
+		try {
+			ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+			m_responseDeferred = false;
+			handle(request, response);
+			respond(response, needResponse, ackNum);
+		}
+		catch (IcsException& ex)
+		{
+			LOG_ERROR(m_name << " occurs IcsException: id=" << id << ",error=" << ex.message());
+		}
+		catch (otl_exception& ex)
 		{
-			std::lock_guard<std::mutex> lock(m_sendLock);
-			m_sendList.push_back(msg.toMemoryChunk());
+			LOG_ERROR(m_name << " occurs otl_exception: id=" << id << ",error=" << ex.msg);
+		}
+		catch (std::exception& ex)
+		{
+			LOG_ERROR(m_name << " occurs std::exception: id=" << id << ",error=" << ex.what());
 		}
-		trySend();
 	}
 
 	/// ø
@@ -146,41 +263,115 @@ protected:
 
 
 	/// Ƿͬ滻
-	bool m_replaced = false;
+	std::atomic<bool> m_replaced{ false };
 
 private:
 
 	/// Ͷݶ
 	void do_read()
 	{
-		// wait response
 		auto self(this->shared_from_this());
-		m_socket.async_receive(asio::buffer(m_recvBuff + m_recvSize, sizeof(m_recvBuff)-m_recvSize)
-			, [self](const std::error_code& ec, std::size_t length)
+		if (m_recvBuffer.empty())
 		{
-			// no error and handle message
-			if (!ec && self->handleData(length))
-			{
-				// continue to read
-				self->do_read();
-			}
-			else
+			// ʱռýջ,ɶȡ
+			m_recvBuffer.shrink();
+			m_socket.async_receive(asio::null_buffers()
+				, m_strand.wrap([self](const std::error_code& ec, std::size_t length)
 			{
-				/*
-				if (ec)
+				if (!ec)
 				{
-					LOG_WARN(this->m_name << " read error: " << ec.message());
+					self->do_receive();
 				}
-				*/
-				self->do_error();
+				else
+				{
+					self->do_error();
+				}
+			}));
+		}
+		else
+		{
+			// вϢ,յ
+			m_socket.async_receive(asio::buffer(m_recvBuffer.writePtr(), m_recvBuffer.writeSpace())
+				, m_strand.wrap([self](const std::error_code& ec, std::size_t length)
+			{
+				self->handleReceive(ec, length);
+			}));
+		}
+	}
+
+	/// ѿɶ:ȡջ
+	void do_receive()
+	{
+		if (!m_recvBuffer.prepare())
+		{
+			LOG_ERROR(m_name << " no memory to receive data");
+			do_error();
+			return;
+		}
+		asio::error_code ec;
+		std::size_t length = m_socket.receive(asio::buffer(m_recvBuffer.writePtr(), m_recvBuffer.writeSpace()), 0, ec);
+		if (ec == asio::error::would_block || ec == asio::error::try_again)
+		{
+			do_read();
+			return;
+		}
+		handleReceive(ec, length);
+	}
+
+	/// 
+	void handleReceive(const std::error_code& ec, std::size_t length)
+	{
+		// no error and handle message
+		if (!ec && handleData(length))
+		{
+			// continue to read, unless the memory pool is used up and this link still has data to send
+			if (!pauseRead())
+			{
+				do_read();
 			}
-		});
+		}
+		else
+		{
+			/*
+			if (ec)
+			{
+				LOG_WARN(this->m_name << " read error: " << ec.message());
+			}
+			*/
+			do_error();
+		}
+	}
+
+	/// ڴд͵ʱͣ,ָ;ֻڱӵstrandе
+	bool pauseRead()
+	{
+		if (!g_memoryPool.exhausted())
+		{
+			return false;
+		}
+		m_readPaused = !m_sendingBlocks.empty() || m_sendCarry.valid() || !m_sendHeld.empty() || !m_sendQueue.empty();
+		if (m_readPaused)
+		{
+			LOG_WARN(m_name << " pause reading, memory pool is exhausted");
+		}
+		return m_readPaused;
 	}
 
-	/// Ͷд
-	void do_write()
+	/// гʱ:ѳʱر,յϢĳʱʱټ
+	void checkIdle()
 	{
-		trySend();
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point lastReceive(std::chrono::steady_clock::duration(m_lastReceive.load(std::memory_order_relaxed)));
+		auto idle = now - lastReceive;
+		if (idle >= m_idleTimeout)
+		{
+			LOG_INFO(m_name << " no message in " << m_idleTimeout.count() << " ms, close it");
+			do_error();
+		}
+		else
+		{
+			m_idleWheel->schedule(m_idleTimer, std::chrono::duration_cast<std::chrono::milliseconds>(m_idleTimeout - idle));
+		}
 	}
 
 	/// ʮʾ
@@ -197,79 +388,199 @@ private:
 #endif
 	}
 
-	/// Է
+	/// ʽ:һдϢ
+	static std::size_t maxSendBatch(icstcp::socket&)
+	{
+		return MaxSendBatch;
+	}
+
+	/// ݱ:ϢϲΪһݱ
+	static std::size_t maxSendBatch(icsudp::socket&)
+	{
+		return MaxSendBatch;
+	}
+
+	/// ʽ:һдֽ
+	static std::size_t maxSendBytes(icstcp::socket&)
+	{
+		return SIZE_MAX;
+	}
+
+	/// ݱ:ϲ󲻳MTU,MTUĵϢ
+	static std::size_t maxSendBytes(icsudp::socket&)
+	{
+		return MaxDatagramSize;
+	}
+
+	/// ʽ:дȫݺص
+	template<class Handler>
+	static void asyncWrite(icstcp::socket& s, const std::vector<asio::const_buffer>& buffers, Handler&& handler)
+	{
+		asio::async_write(s, buffers, std::forward<Handler>(handler));
+	}
+
+	/// ݱ
+	template<class Handler>
+	static void asyncWrite(icsudp::socket& s, const std::vector<asio::const_buffer>& buffers, Handler&& handler)
+	{
+		s.async_send(buffers, std::forward<Handler>(handler));
+	}
+
+	/// ȡһϢ,Ųʱݴ浽m_sendHeld,ȽСŵϢӺȡ;ֻstrandе
+	PooledBuffer nextBlock()
+	{
+		for (;;)
+		{
+			for (auto it = m_sendHeld.begin(); it != m_sendHeld.end(); ++it)
+			{
+				if (((const IcsMsgHead*)it->data())->getSendNum() == m_nextSendNum)
+				{
+					PooledBuffer block = std::move(*it);
+					m_sendHeld.erase(it);
+					m_nextSendNum++;
+					return block;
+				}
+			}
+
+			MpscNode* node = m_sendQueue.pop();
+			if (!node)
+			{
+				return PooledBuffer();
+			}
+
+			PooledBuffer block = PooledBuffer::fromNode(node);
+			if (((const IcsMsgHead*)block.data())->getSendNum() == m_nextSendNum)
+			{
+				m_nextSendNum++;
+				return block;
+			}
+			m_sendHeld.push_back(std::move(block));
+		}
+	}
+
+	/*
+	ͶеϢ,ֻڱӵstrandҳm_sendingʱ;
+	maxSendBatchmaxSendBytesֽڵϢϲΪһд,ŲµϢ´;Ϊʱͷm_sending
+	*/
 	void trySend()
 	{
-		std::lock_guard<std::mutex> lock(m_sendLock);
-		if (!m_isSending && !m_sendList.empty())
+		m_sendBuffers.clear();
+		std::size_t sendBytes = 0;
+		for (;;)
 		{
-			m_isSending = true;
-			MemoryChunk& block = m_sendList.front();
-			auto self(this->shared_from_this());
-			m_socket.async_send(asio::buffer(block.data, block.length),
-				[self](const std::error_code& ec, std::size_t length)
+			while (m_sendingBlocks.size() < maxSendBatch(m_socket))
 			{
-				if (!ec)
+				PooledBuffer block;
+				if (m_sendCarry.valid())
 				{
+					block = std::move(m_sendCarry);
+				}
+				else
+				{
+					block = nextBlock();
+					if (!block.valid())
 					{
-						std::lock_guard<std::mutex> lock(self->m_sendLock);
-						MemoryChunk& chunk = self->m_sendList.front();
-						self->toHexInfo("send to", chunk.data, chunk.length);
-						g_memoryPool.put(chunk);
-						self->m_sendList.pop_front();
-						self->m_isSending = false;
+						break;
 					}
-					self->trySend();
 				}
-				else
+
+				if (!m_sendingBlocks.empty() && sendBytes + block.length() > maxSendBytes(m_socket))
 				{
-					LOG_DEBUG(self->m_name << " send data error");
-					self->do_error();
+					m_sendCarry = std::move(block);
+					break;
 				}
-			});
+				sendBytes += block.length();
+				m_sendingBlocks.push_back(std::move(block));
+				m_sendBuffers.push_back(asio::buffer(m_sendingBlocks.back().data(), m_sendingBlocks.back().length()));
+			}
+
+			if (!m_sendingBlocks.empty())
+			{
+				break;
+			}
 
+			// ѿ:߿ܸշϢǾɱ־,ټһ
+			m_sending.store(false, std::memory_order_release);
+			if (m_sendQueue.empty() || m_sending.exchange(true, std::memory_order_acq_rel))
+			{
+				return;
+			}
 		}
+
+		auto self(this->shared_from_this());
+		asyncWrite(m_socket, m_sendBuffers,
+			m_strand.wrap([self](const std::error_code& ec, std::size_t length)
+		{
+			if (!ec)
+			{
+				// ͷűдȫϢ
+				for (auto& block : self->m_sendingBlocks)
+				{
+					self->toHexInfo("send to", block.data(), block.length());
+				}
+				self->m_sendingBlocks.clear();
+
+				// the send queue is drained, resume the paused reading
+				if (self->m_readPaused && !self->m_sendCarry.valid() && self->m_sendHeld.empty() && self->m_sendQueue.empty())
+				{
+					self->m_readPaused = false;
+					LOG_DEBUG(self->m_name << " resume reading");
+					self->do_read();
+				}
+				self->trySend();
+			}
+			else
+			{
+				LOG_DEBUG(self->m_name << " send data error");
+				self->do_error();
+			}
+		}));
 	}
 
 	/// յݶ
 	bool handleData(std::size_t length)
 	{
 		bool ret = true;
-		IcsMsgHead*	head = (IcsMsgHead*)m_recvBuff;
 
 		/// show debug info
-		this->toHexInfo("recv from", m_recvBuff + m_recvSize , length);
+		this->toHexInfo("recv from", m_recvBuffer.writePtr(), length);
 
-		m_recvSize += length;
+		m_recvBuffer.commit(length);
 
-		while (ret && m_recvSize >= sizeof(IcsMsgHead)+IcsMsgHead::CrcCodeSize)
+		while (ret && m_recvBuffer.size() >= sizeof(IcsMsgHead)+IcsMsgHead::CrcCodeSize)
 		{
+			IcsMsgHead*	head = (IcsMsgHead*)m_recvBuffer.data();
 			uint16_t msgLen = head->getLength();
 			/// Ϣȼ
-			if (msgLen > sizeof(m_recvBuff) || msgLen < sizeof(IcsMsgHead)+IcsMsgHead::CrcCodeSize)
+			if (msgLen > ReceiveBuffer::maxFrameSize() || msgLen < sizeof(IcsMsgHead)+IcsMsgHead::CrcCodeSize)
 			{
-				LOG_ERROR("length of message error:" << msgLen << " ,max length of buffer is:" << sizeof(m_recvBuff));
+				LOG_ERROR("length of message error:" << msgLen << " ,max length of frame is:" << ReceiveBuffer::maxFrameSize());
 				ret = false;
 				break;
 			}
 			
-			if (m_recvSize >= msgLen)	// һϢ
+			if (m_recvBuffer.size() >= msgLen)	// һϢ,ڽջֱӴ
 			{
 				ret = handleMessage(head, msgLen);
-				m_recvSize -= msgLen;
-				head = (IcsMsgHead*)((uint8_t*)head + msgLen);
+				m_recvBuffer.consume(msgLen);
 			}
-			else // һϢ
+			else // һϢ,֤ܽϢ
 			{
-				if (m_recvBuff != (uint8_t*)head)
-				{				
-					LOG_DEBUG(m_name << " move " << m_recvSize << " bytes");
-					std::memmove(m_recvBuff, head, m_recvSize);
+				if (!m_recvBuffer.reserve(msgLen))
+				{
+					LOG_ERROR(m_name << " no memory to receive " << msgLen << " bytes message");
+					ret = false;
 				}
 				break;
 			}
 		}
 
+		/// һϢͷ
+		if (ret && !m_recvBuffer.empty() && !m_recvBuffer.reserve(sizeof(IcsMsgHead)+IcsMsgHead::CrcCodeSize))
+		{
+			ret = false;
+		}
+
 		return ret;
 	}
 
@@ -281,31 +592,24 @@ private:
 		try {
 			ProtocolStream request(ProtocolStream::OptType::readType, data, len);
 
-			// 0ʱ
-			m_timeoutCount = 0;
+			// ¼յϢʱ,гʱʱ
+			m_lastReceive.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
 
-			/// ն˵ӦϢ,FIXME
+			/// Զ˵ӦϢ
 			if (head->isResponse())
 			{
-				LOG_DEBUG(m_name << " ignore response message");
+				handleResponse(request);
 				return true;
 			}
 
-			ProtocolStream response(ProtocolStream::OptType::writeType, g_memoryPool.get());
+			ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 
 			/// ͨ麯Ϣ
+			m_responseDeferred = false;
 			handle(request, response);
 
 			/// send response message
-			if (response.getHead()->getMsgID() != MessageId::MessageId_min_0x0000)
-			{	
-				trySend(response);
-			}
-			else if (head->needResposne())
-			{
-				response.initHead(MessageId::MessageId_min_0x0000, head->getSendNum());	// head->getMsgID()
-				trySend(response);
-			}
+			respond(response, head->needResposne(), head->getSendNum());
 			ret = true;
 		}
 		catch (IcsException& ex)
@@ -328,33 +632,72 @@ private:
 		return ret;
 	}
 
+	/// ʹӦ,δӦʱ跢ͨӦ,ԺӦʱ
+	void respond(ProtocolStream& response, bool needResponse, uint16_t ackNum)
+	{
+		if (m_responseDeferred)
+		{
+			// ɴԺӦ
+		}
+		else if (response.getHead()->getMsgID() != MessageId::MessageId_min_0x0000)
+		{	
+			trySend(response);
+		}
+		else if (needResponse)
+		{
+			response.initHead(MessageId::MessageId_min_0x0000, ackNum);
+			trySend(response);
+		}
+	}
+
 	/// ׽
 	socket	m_socket;
 
+	/// лӵĶд,ͬӿڶ߳ϲд
+	asio::io_service::strand m_strand;
+
 private:
 	/// ǷЧ
-//	std::atomic<bool> m_valid = true;
-//	std::atomic<bool>			m_isSending = false;
-	bool m_valid = true;
-	bool m_isSending = false;
+	std::atomic<bool> m_valid{ true };
+	/// ڴͣ
+	bool m_readPaused = false;
+	/// ǰϢɴԺӦ
+	bool m_responseDeferred = false;
 	// recv area
-	uint8_t				m_recvBuff[1024];
-	/// ѽݴС
-	std::size_t			m_recvSize = 0;
+	ReceiveBuffer		m_recvBuffer;
 
 	// send area
-	uint16_t m_serialNum = 0;
-	std::list<MemoryChunk> m_sendList;
-	std::mutex		m_sendLock;
+	/// һϢķ
+	std::atomic<uint16_t>	m_serialNum{ 0 };
+	/// Ͷ:̷߳,ֻstrandȡ
+	MpscQueue<MpscNode>	m_sendQueue;
+	/// һдϢķ,ֻstrandʹ
+	uint16_t	m_nextSendNum = 0;
+	/// ڽСųӵϢ
+	std::vector<PooledBuffer>	m_sendHeld;
+	/// Ͷݷͻд
+	std::atomic<bool>	m_sending{ false };
+	/// дϢ
+	std::vector<PooledBuffer>	m_sendingBlocks;
+	/// дȵϢ,´д
+	PooledBuffer	m_sendCarry;
+	std::vector<asio::const_buffer>	m_sendBuffers;
 
 	/// ĬΪԶ˵ĵַʽΪ"ip:port"
 	std::string	m_name;
 
-	// ʱ: ÿνյһϢ0ʱһμ1Ч
-	int				m_timeoutCount = 0;
-	static const int m_timeoutMax = 2;
+	// гʱ: յϢʱ(steady_clock),m_idleTimeoutЧ
+	std::atomic<std::chrono::steady_clock::rep>	m_lastReceive{ 0 };
+	std::chrono::milliseconds	m_idleTimeout{ 0 };
+	TimingWheel*	m_idleWheel = nullptr;
+	static const int MaxIdleHeartbeats = 3;
+
+	/// гʱʱ:,ʱȡʱȴִеĻص
+	TimerHandle	m_idleTimer;
 };
 
+template<class Protocol>
+const int IcsConnection<Protocol>::MaxIdleHeartbeats;
 
 /// origin connection
 template<class Protocol>
@@ -233,6 +233,9 @@ ProtocolStream::ProtocolStream(OptType type, void* buf, std::size_t length)
 	, m_start((uint8_t*)buf)
 	, m_pos(m_start + sizeof(IcsMsgHead))
 	, m_end(m_start + length)
+	, m_tailEnd(nullptr)
+	, m_tailLength(0)
+	, m_tailCrc(0)
 {
 	if (!m_start || length < sizeof(IcsMsgHead)+IcsMsgHead::CrcCodeSize)
 	{
@@ -250,14 +253,15 @@ ProtocolStream::ProtocolStream(OptType type, void* buf, std::size_t length)
 	}
 }
 
-ProtocolStream::ProtocolStream(OptType type, const MemoryChunk& chunk)
+ProtocolStream::ProtocolStream(OptType type, PooledBuffer&& buffer)
+	: ProtocolStream(type, buffer.data(), buffer.size())
 {
-	::new (this) ProtocolStream(type, chunk.data, chunk.length);
+	m_buffer = std::move(buffer);
 }
 
-ProtocolStream::ProtocolStream(const ProtocolStream& rhs, const MemoryChunk& chunk)
+ProtocolStream::ProtocolStream(const ProtocolStream& rhs, PooledBuffer&& buffer)
+	: ProtocolStream(rhs.m_optType, std::move(buffer))
 {
-	::new (this) ProtocolStream(rhs.m_optType, chunk);
 	if (size() < rhs.length())
 	{
 		throw IcsException("not enough memory [%d] to store [%d] bytes data", size(), rhs.length());
@@ -266,26 +270,112 @@ ProtocolStream::ProtocolStream(const ProtocolStream& rhs, const MemoryChunk& chu
 	m_pos = m_start + rhs.length();
 }
 
+ProtocolStream::ProtocolStream(ProtocolStream&& rhs)
+	: m_optType(rhs.m_optType)
+	, m_start(rhs.m_start)
+	, m_pos(rhs.m_pos)
+	, m_end(rhs.m_end)
+	, m_buffer(std::move(rhs.m_buffer))
+	, m_tailEnd(rhs.m_tailEnd)
+	, m_tailLength(rhs.m_tailLength)
+	, m_tailCrc(rhs.m_tailCrc)
+{
+	rhs.m_start = rhs.m_pos = rhs.m_end = nullptr;
+	rhs.m_tailEnd = nullptr;
+}
+
 ProtocolStream::~ProtocolStream()
 {
-	if (m_start && m_optType == OptType::writeType)
+
+}
+
+
+/// 确保数据在内存池缓冲区中且还可写入len字节
+void ProtocolStream::reserve(std::size_t len) throw(IcsException)
+{
+	if (!m_start)
+	{
+		throw IcsException("buffer has been moved");
+	}
+
+	if (m_buffer.valid() && leftLength() >= len)
 	{
-		g_memoryPool.put(toMemoryChunk());
+		return;
 	}
+
+	std::size_t used = length();
+	PooledBuffer buffer(g_memoryPool, used + len);
+	if (!buffer.valid())
+	{
+		throw IcsException("no memory to copy %d bytes", used);
+	}
+	std::memcpy(buffer.data(), m_start, used);
+
+	if (m_tailEnd)
+	{
+		m_tailEnd = buffer.data() + (m_tailEnd - m_start);
+	}
+	m_start = buffer.data();
+	m_pos = m_start + used;
+	m_end = m_start + buffer.size();
+	m_buffer = std::move(buffer);
 }
 
+/// 外部数据复制到内存池缓冲区
+void ProtocolStream::keep() throw(IcsException)
+{
+	if (!m_start)
+	{
+		throw IcsException("buffer has been moved");
+	}
+
+	if (m_buffer.valid())
+	{
+		return;
+	}
+
+	PooledBuffer buffer(g_memoryPool, size());
+	if (!buffer.valid())
+	{
+		throw IcsException("no memory to copy %d bytes", size());
+	}
+	std::memcpy(buffer.data(), m_start, size());
+
+	if (m_tailEnd)
+	{
+		m_tailEnd = buffer.data() + (m_tailEnd - m_start);
+	}
+	m_pos = buffer.data() + (m_pos - m_start);
+	m_end = buffer.data() + size();
+	m_start = buffer.data();
+	m_buffer = std::move(buffer);
+}
 
 /// 调用该接口以后不可读写操作
-MemoryChunk ProtocolStream::toMemoryChunk()
+PooledBuffer ProtocolStream::toBuffer()
 {
 	if (!m_start)
 	{
-		throw IcsException("MemoryChunk has been moved");
+		throw IcsException("buffer has been moved");
 	}
 
-	MemoryChunk mc(m_start, length());
+	PooledBuffer buffer;
+	if (m_buffer.valid())
+	{
+		buffer = std::move(m_buffer);
+	}
+	else	/// 数据不属于内存池时复制一份
+	{
+		buffer = PooledBuffer(g_memoryPool, length());
+		if (!buffer.valid())
+		{
+			throw IcsException("no memory to copy %d bytes", length());
+		}
+		std::memcpy(buffer.data(), m_start, length());
+	}
+	buffer.setLength(length());
 	m_start = nullptr;
-	return mc;
+	return buffer;
 }
 
 
@@ -299,7 +389,16 @@ void ProtocolStream::serialize(uint16_t sendNum)
 	IcsMsgHead* head = (IcsMsgHead*)m_start;
 	head->setSendNum(sendNum);
 	head->setLength(length() + IcsMsgHead::CrcCodeSize);
-	*this << crc32_code(m_start, length());
+
+	if (m_tailEnd == m_pos)	// 末尾数据段校验码已知,只计算其前的数据
+	{
+		uint32_t crc = crc32_code(m_start, length() - m_tailLength);
+		*this << crc32_combine(crc, m_tailCrc, m_tailLength);
+	}
+	else
+	{
+		*this << crc32_code(m_start, length());
+	}
 }
 
 
@@ -357,6 +456,7 @@ void ProtocolStream::moveBack(std::size_t offset) throw(IcsException)
 		throw IcsException("can't move back %s bytes", offset);
 	}
 	m_pos -= offset;
+	m_tailEnd = nullptr;
 }
 
 void ProtocolStream::append(const void* data, std::size_t len)
@@ -369,6 +469,14 @@ void ProtocolStream::append(const void* data, std::size_t len)
 	m_pos += len;
 }
 
+void ProtocolStream::append(const void* data, std::size_t len, uint32_t crc)
+{
+	append(data, len);
+	m_tailEnd = m_pos;
+	m_tailLength = len;
+	m_tailCrc = crc;
+}
+
 ProtocolStream& ProtocolStream::operator >> (IcsDataTime& data) throw(IcsException)
 {
 	if (sizeof(data) > leftLength())
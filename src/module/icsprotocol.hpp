@@ -175,6 +175,9 @@ enum MessageId {
 	// 终端上报日志
 	T2C_log_report_0x0c01 = 0x0c01,
 
+	// 终端回应控制结果
+	T2C_control_response_0x0d02 = 0x0d02,
+
 	T2C_max,
 
 
@@ -188,6 +191,12 @@ enum MessageId {
 	W2C_disconnect_remote_0x2003 = 0x2003,
 	// 发给远程代理服务器对应终端
 	W2C_send_to_remote_terminal_0x2004 = 0x2004,
+	// 数据库查询缓存失效:缓存种类(uint8_t) 键值(ShortString,为空时清空该种缓存)
+	W2C_invalidate_cache_0x2005 = 0x2005,
+	// 查询在线终端:起始序号(uint32_t) 最大数量(uint16_t)
+	W2C_online_query_0x2006 = 0x2006,
+	// 在线终端:总数(uint32_t) 数量(uint16_t) [网关ID(ShortString) 监测点编号(ShortString) 设备类型(uint16_t)]...
+	C2W_online_response_0x2007 = 0x2007,
 
 	W2C_max,
 
@@ -330,19 +339,31 @@ public:
 
 	ProtocolStream(OptType type, void* buf, std::size_t length);
 
-	ProtocolStream(OptType type, const MemoryChunk& chunk);
+	/// 使用内存池缓冲区,随本对象释放
+	ProtocolStream(OptType type, PooledBuffer&& buffer);
+
+	/// 复制rhs已写入的数据
+	ProtocolStream(const ProtocolStream& rhs, PooledBuffer&& buffer);
 
-	ProtocolStream(const ProtocolStream& rhs, const MemoryChunk& chunk);
+	/// 接管rhs的数据和操作位置,rhs不再可用
+	ProtocolStream(ProtocolStream&& rhs);
 
 	~ProtocolStream();
 
-	/// 调用该接口以后不可读写操作
-	MemoryChunk toMemoryChunk();
+	/// 取出已写入的数据,调用该接口以后不可读写操作
+	PooledBuffer toBuffer();
+
+	/// 确保数据在内存池缓冲区中且还可写入len字节:外部数据或空间不足时复制到新的缓冲区,之后toBuffer不再失败
+	void reserve(std::size_t len) throw(IcsException);
+
+	/// 外部数据(如接收缓冲区中的消息)复制到内存池缓冲区,操作位置不变;消息在异步操作完成后再处理时使用
+	void keep() throw(IcsException);
 
 	/// 重置操作位置
 	void rewind()
 	{
 		m_pos = m_start + sizeof(IcsMsgHead);
+		m_tailEnd = nullptr;
 	}
 
 	/// 跳过该类型的数据
@@ -414,6 +435,24 @@ public:
 		return m_end - m_start;
 	}
 
+	/// 当前操作位置
+	uint8_t* position() const
+	{
+		return m_pos;
+	}
+
+	/// 取出len字节:返回当前位置并前移,剩余长度不足时抛出异常;按消息格式整体读写时使用
+	uint8_t* take(std::size_t len) throw(IcsException)
+	{
+		if (len > leftLength())
+		{
+			throw IcsException("OOM to take %d bytes", (int)len);
+		}
+		uint8_t* pos = m_pos;
+		m_pos += len;
+		return pos;
+	}
+
 	// -----------------------write data----------------------- 
 	/// 按请求消息初始化消息头
 	void initHead(MessageId id, bool needResponse);
@@ -463,6 +502,9 @@ public:
 
 	void append(const void* data, std::size_t len);
 
+	/// 追加末尾数据,crc为该段数据的crc32_update(0, data, len),序列化时合并校验码不再重新计算
+	void append(const void* data, std::size_t len, uint32_t crc);
+
 
 	// -----------------------read data----------------------- 
 	template<class T>
@@ -495,6 +537,14 @@ private:
 	uint8_t*	m_pos;
 	/// 终止地址
 	uint8_t*	m_end;
+	/// 内存池缓冲区,外部数据时无效
+	PooledBuffer	m_buffer;
+	/// 已知校验码的末尾数据段结束地址,其后再写入数据则失效
+	uint8_t*	m_tailEnd;
+	/// 末尾数据段长度
+	std::size_t	m_tailLength;
+	/// 末尾数据段校验码
+	uint32_t	m_tailCrc;
 };
 
 /*
@@ -2,20 +2,22 @@
 
 #include "icspushsystem.hpp"
 #include <regex>
+#include <algorithm>
 
 
 namespace ics {
 
 
-PushMsgConnection::PushMsgConnection(socket&& s)
+PushMsgConnection::PushMsgConnection(socket&& s, AckHandler&& ackHandler)
 	: _baseType(std::move(s),"PushMsg")
+	, m_ackHandler(std::move(ackHandler))
 {
 }
 
 // ײϢ
 void PushMsgConnection::handle(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
-	LOG_DEBUG("recv response of push message");
+	LOG_DEBUG("recv request of push server");
 }
 
 // ƽϢ
@@ -24,48 +26,296 @@ void PushMsgConnection::dispatch(ProtocolStream& request) throw(IcsException, ot
 	_baseType::trySend(request);
 }
 
+// ͷȷ
+void PushMsgConnection::handleResponse(ProtocolStream& response) throw(IcsException, otl_exception)
+{
+	m_ackHandler(response.getHead()->getAckNum());
+}
+
+uint16_t PushMsgConnection::push(ProtocolStream& msg)
+{
+	return _baseType::trySend(msg);
+}
+
 
 PushSystem::PushSystem(asio::io_service& ioService, const std::string& addr)
-	:m_ioService(ioService)
+	: m_ioService(ioService)
+	, m_timer(ioService)
 {
 	std::regex pattern("^((\\d{1,3}\\.){3}\\d{1,3}):(\\d{1,5})$");
 	std::match_results<std::string::const_iterator> result;
 
-	if (!std::regex_match(addr, result, pattern))
+	std::size_t begin = 0;
+	while (begin <= addr.size())
 	{
-		throw IcsException("address=%s isn't match ip:port", addr.c_str());
+		std::size_t end = addr.find(',', begin);
+		if (end == std::string::npos)
+		{
+			end = addr.size();
+		}
+		std::string item = addr.substr(begin, end - begin);
+		begin = end + 1;
+
+		if (!std::regex_match(item, result, pattern))
+		{
+			throw IcsException("address=%s isn't match ip:port", item.c_str());
+		}
+		std::unique_ptr<Target> target(new Target());
+		target->endpoint = asio::ip::udp::endpoint(asio::ip::address::from_string(result[1]), std::strtol(result[3].str().c_str(), nullptr, 10));
+		m_targets.push_back(std::move(target));
 	}
-	asio::ip::udp::endpoint endpoint(asio::ip::address::from_string(result[1]), std::strtol(result[3].str().c_str(), nullptr, 10));
-	m_serverEndpoint = endpoint;
-	reconnect();
 }
 
 PushSystem::~PushSystem()
 {
+	stop();
+}
 
+void PushSystem::start(std::size_t queueSize, std::size_t delay, std::size_t retransmit, std::size_t maxRetry, std::size_t rate)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_queueSize = queueSize ? queueSize : 1;
+		m_delay = delay ? delay : 1;
+		m_retransmit = retransmit ? retransmit : 1;
+		m_maxRetry = maxRetry;
+		m_rate = rate;
+		m_lastTick = clock::now();
+		for (auto& target : m_targets)
+		{
+			target->tokens = (double)m_rate;
+		}
+		m_started = true;
+	}
+	tick();
 }
 
+void PushSystem::stop()
+{
+	asio::error_code ec;
+	m_timer.cancel(ec);
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (!m_started)
+	{
+		return;
+	}
+	m_started = false;
+
+	for (auto& target : m_targets)
+	{
+		if (target->connection)
+		{
+			target->connection->do_error();
+			target->connection.reset();
+		}
+		std::size_t left = target->queue.size() + target->retry.size() + target->msgList.size();
+		LOG_INFO("push to " << target->endpoint << " pushed " << target->pushed << " events, acked " << target->acked
+			<< ", dropped " << target->dropped << ", lost " << target->lost << ", left " << left);
+	}
+}
 
 void PushSystem::send(ProtocolStream& request)
 {
-	if (!m_connection || !m_connection->isValid())
+	// ߳̿ͬʱ,ͬһϢ
+	Event event = std::make_shared<const std::string>((const char*)(request.getHead() + 1), request.length() - sizeof(IcsMsgHead));
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (auto& target : m_targets)
 	{
-		LOG_DEBUG("PushMsg reconnect");
-		reconnect();
+		if (target->queue.size() >= m_queueSize)
+		{
+			target->queue.pop_front();
+			if (target->dropped++ == 0)
+			{
+				LOG_WARN("push queue of " << target->endpoint << " is full, drop the oldest events");
+			}
+		}
+		target->queue.push_back(event);
 	}
-	request.initHead(MessageId::C2P_push_message_0x3001, false);
-	m_connection->dispatch(request);
 }
 
-void PushSystem::reconnect()
-{	
+void PushSystem::tick()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (!m_started)
+		{
+			return;
+		}
+
+		// Ͱ:ʱ䲹,һ
+		auto now = clock::now();
+		double elapsed = std::chrono::duration<double>(now - m_lastTick).count();
+		m_lastTick = now;
+		for (auto& target : m_targets)
+		{
+			if (m_rate)
+			{
+				target->tokens = std::min((double)m_rate, target->tokens + elapsed * m_rate);
+			}
+			pushTarget(*target, now);
+		}
+	}
+
+	m_timer.expires_from_now(std::chrono::milliseconds(m_delay));
+	m_timer.async_wait([this](const asio::error_code& ec)
+	{
+		if (!ec)
+		{
+			tick();
+		}
+	});
+}
+
+void PushSystem::pushTarget(Target& target, clock::time_point now)
+{
+	// ӳÿretransmitؽһ
+	if (!target.connection || !target.connection->isValid())
+	{
+		if (now < target.reconnectTime)
+		{
+			return;
+		}
+		target.reconnectTime = now + std::chrono::milliseconds(m_retransmit);
+		try {
+			reconnect(target);
+		}
+		catch (std::exception& ex)
+		{
+			LOG_WARN("push to " << target.endpoint << " reconnect error:" << ex.what());
+			return;
+		}
+	}
+
+	// ʱδȷϵ¼˳ط,طĶ
+	std::size_t lost = 0;
+	bool expired = std::any_of(target.msgList.begin(), target.msgList.end(), [now](const std::pair<const uint16_t, Pending>& entry)
+	{
+		return entry.second.deadline <= now;
+	});
+	for (uint16_t sendNum : expired ? sendOrder(target) : std::vector<uint16_t>())
+	{
+		auto it = target.msgList.find(sendNum);
+		if (it->second.deadline <= now)
+		{
+			if (it->second.retries < m_maxRetry)
+			{
+				it->second.retries++;
+				target.retry.push_back(std::move(it->second));
+			}
+			else
+			{
+				lost++;
+			}
+			target.msgList.erase(it);
+		}
+	}
+	if (lost)
+	{
+		target.lost += lost;
+		LOG_WARN("push to " << target.endpoint << " lost " << lost << " events without ack");
+	}
+
+	// ط¼,ʹڼ
+	try {
+		while (target.msgList.size() < MaxInflight && (!m_rate || target.tokens >= 1))
+		{
+			if (!target.retry.empty())
+			{
+				pushEvent(target, std::move(target.retry.front()), now);
+				target.retry.pop_front();
+			}
+			else if (!target.queue.empty())
+			{
+				Pending pending;
+				pending.event = target.queue.front();
+				pushEvent(target, std::move(pending), now);
+				target.queue.pop_front();
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+	catch (IcsException& ex)
+	{
+		// ڴ,´
+		LOG_WARN("push to " << target.endpoint << " error:" << ex.message());
+	}
+}
+
+void PushSystem::pushEvent(Target& target, Pending&& pending, clock::time_point now) throw(IcsException)
+{
+	const std::string& body = *pending.event;
+	ProtocolStream msg(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool, sizeof(IcsMsgHead) + body.size() + IcsMsgHead::CrcCodeSize));
+	msg.initHead(MessageId::C2P_push_message_0x3001, true);
+	msg.append(body.data(), body.size());
+
+	uint16_t sendNum = target.connection->push(msg);
+
+	pending.deadline = now + std::chrono::milliseconds(m_retransmit);
+	target.msgList[sendNum] = std::move(pending);
+	target.pushed++;
+	if (m_rate)
+	{
+		target.tokens -= 1;
+	}
+}
+
+void PushSystem::acked(Target* target, uint16_t ackNum)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (target->msgList.erase(ackNum))
+	{
+		target->acked++;
+	}
+}
+
+void PushSystem::reconnect(Target& target)
+{
+	LOG_DEBUG("PushMsg reconnect " << target.endpoint);
+
 	asio::ip::udp::socket s(m_ioService);
 
-	s.connect(m_serverEndpoint);
+	s.connect(target.endpoint);
 
-	m_connection.reset(new PushMsgConnection(std::move(s)));
+	if (target.connection)
+	{
+		target.connection->do_error();
+	}
 
-	m_connection->start();
+	Target* t = &target;
+	target.connection.reset(new PushMsgConnection(std::move(s), [this, t](uint16_t ackNum)
+	{
+		acked(t, ackNum);
+	}));
+
+	target.connection->start();
+
+	// ӵķ¿ʼ,ȷϵ¼ԭ˳طǰ,ȫط
+	std::vector<uint16_t> order = sendOrder(target);
+	for (auto it = order.rbegin(); it != order.rend(); ++it)
+	{
+		target.retry.push_front(std::move(target.msgList[*it]));
+	}
+	target.msgList.clear();
+}
+
+std::vector<uint16_t> PushSystem::sendOrder(const Target& target)
+{
+	std::vector<uint16_t> order;
+	order.reserve(target.msgList.size());
+	for (auto& entry : target.msgList)
+	{
+		order.push_back(entry.first);
+	}
+	std::sort(order.begin(), order.end(), [](uint16_t a, uint16_t b)
+	{
+		return (int16_t)(uint16_t)(a - b) < 0;
+	});
+	return order;
 }
 
-}
\ No newline at end of file
+}
@@ -3,7 +3,12 @@
 #define _ICS_PUSH_SYSTEM_H
 
 #include "icsconnection.hpp"
+#include <asio/steady_timer.hpp>
 #include <unordered_map>
+#include <functional>
+#include <deque>
+#include <chrono>
+#include <mutex>
 
 namespace ics {
 
@@ -15,7 +20,10 @@ public:
 
 	typedef _baseType::socket		socket;
 
-	PushMsgConnection(socket&& s);
+	/// յͷackNumȷ
+	typedef std::function<void (uint16_t ackNum)> AckHandler;
+
+	PushMsgConnection(socket&& s, AckHandler&& ackHandler);
 
 	// ײϢ
 	virtual void handle(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception);
@@ -23,26 +31,99 @@ public:
 	// ƽϢ
 	virtual void dispatch(ProtocolStream& request) throw(IcsException, otl_exception);
 
+	// ͷȷ
+	virtual void handleResponse(ProtocolStream& response) throw(IcsException, otl_exception);
+
+	/// һϢ,䷢;ͬһдеĶϢϲΪһݱ
+	uint16_t push(ProtocolStream& msg);
+
 //	virtual void error();
+
+private:
+	AckHandler	m_ackHandler;
 };
 
-/// ϵͳ
-class PushSystem {
+/*
+ϵͳ:ÿ¼͸ȫͷ,ÿһн,ʱ¼;
+ÿdelayȡе¼,ÿ¼һȷϵϢ,ϢϲΪһMTUݱ;
+δretransmitȷϵ¼ط,طmaxretryκ;ÿÿrate¼(ط)
+*/
+class PushSystem : NonCopyable {
 public:
+	/// addr:"ip:port",ͷԶŷָ
 	PushSystem(asio::io_service& ioService, const std::string& addr);
 
 	~PushSystem();
 
+	/// queueSize:ÿŶӵ¼,delay:ϲ͵ļ,retransmit:ط,maxRetry:ط,rate:ÿ͵¼,0
+	void start(std::size_t queueSize, std::size_t delay, std::size_t retransmit, std::size_t maxRetry, std::size_t rate);
+
+	/// ֹͣʱر,δȷϵ¼
+	void stop();
+
+	/// ¼:requestΪдϢ,̵߳
 	void send(ProtocolStream& request);
-private:
-	void reconnect();
+
+	/// һʹδȷϵ¼,СڷŵķΧ
+	static const std::size_t MaxInflight = 1024;
 
 private:
-	asio::io_service& m_ioService;
-	std::shared_ptr<PushMsgConnection>	m_connection;
-	std::unordered_map<uint16_t, MemoryChunk> m_msgList;
+	typedef std::chrono::steady_clock	clock;
+
+	/// ¼Ϣ,
+	typedef std::shared_ptr<const std::string>	Event;
+
+	struct Pending {
+		Event		event;
+		std::size_t	retries = 0;
+		clock::time_point	deadline;
+	};
 
-	asio::ip::udp::endpoint		m_serverEndpoint;
+	struct Target {
+		asio::ip::udp::endpoint	endpoint;
+		std::shared_ptr<PushMsgConnection>	connection;
+		clock::time_point	reconnectTime;
+
+		std::deque<Event>	queue;		// ͵¼
+		std::deque<Pending>	retry;		// ط¼,¼
+		std::unordered_map<uint16_t, Pending>	msgList;	// ʹȷ:  -> ¼
+
+		double		tokens = 0;		// Ͱ:͵¼
+		uint64_t	pushed = 0;
+		uint64_t	acked = 0;
+		uint64_t	dropped = 0;	// 
+		uint64_t	lost = 0;		// طδȷ
+	};
+
+	void tick();
+
+	void pushTarget(Target& target, clock::time_point now);
+
+	/// ͸¼¼Ϊȷ,ʧ׳쳣
+	void pushEvent(Target& target, Pending&& pending, clock::time_point now) throw(IcsException);
+
+	void acked(Target* target, uint16_t ackNum);
+
+	/// ȷ¼ķ,Ⱥ:ſɻ,ʹԶСŷΧ
+	static std::vector<uint16_t> sendOrder(const Target& target);
+
+	/// ؽ,ʹȷϵ¼ط
+	void reconnect(Target& target);
+
+private:
+	asio::io_service&	m_ioService;
+	asio::steady_timer	m_timer;
+
+	std::mutex			m_lock;
+	std::vector<std::unique_ptr<Target>>	m_targets;
+	bool				m_started = false;
+	clock::time_point	m_lastTick;
+
+	std::size_t			m_queueSize = 0;
+	std::size_t			m_delay = 0;
+	std::size_t			m_retransmit = 0;
+	std::size_t			m_maxRetry = 0;
+	std::size_t			m_rate = 0;
 };
 
 
@@ -0,0 +1,93 @@
+
+
+#include "idtable.hpp"
+
+
+ics::IdTable g_idTable;
+
+namespace ics {
+
+const std::string& IcsId::str() const
+{
+	return g_idTable.str(*this);
+}
+
+
+const std::size_t IdTable::SegmentBits;
+const std::size_t IdTable::SegmentSize;
+const std::size_t IdTable::MaxSegments;
+const std::size_t IdTable::ShardCount;
+
+IdTable::IdTable()
+{
+	for (auto& segment : m_segments)
+	{
+		segment.store(nullptr, std::memory_order_relaxed);
+	}
+	m_segments[0].store(new std::string[SegmentSize], std::memory_order_release);
+}
+
+IdTable::~IdTable()
+{
+	for (auto& segment : m_segments)
+	{
+		delete[] segment.load(std::memory_order_relaxed);
+	}
+}
+
+IcsId IdTable::intern(const std::string& value) throw(IcsException)
+{
+	if (value.empty())
+	{
+		return IcsId();
+	}
+
+	Shard& shard = getShard(value);
+	std::lock_guard<std::mutex> lock(shard.lock);
+	auto it = shard.handles.find(value);
+	if (it != shard.handles.end())
+	{
+		return IcsId(it->second);
+	}
+
+	uint32_t handle = add(value);
+	shard.handles.emplace(value, handle);
+	return IcsId(handle);
+}
+
+IcsId IdTable::find(const std::string& value) const
+{
+	if (value.empty())
+	{
+		return IcsId();
+	}
+
+	Shard& shard = getShard(value);
+	std::lock_guard<std::mutex> lock(shard.lock);
+	auto it = shard.handles.find(value);
+	return it != shard.handles.end() ? IcsId(it->second) : IcsId();
+}
+
+uint32_t IdTable::add(const std::string& value) throw(IcsException)
+{
+	std::lock_guard<std::mutex> lock(m_segmentLock);
+	std::size_t handle = m_count.load(std::memory_order_relaxed);
+	std::size_t index = handle >> SegmentBits;
+	if (index >= MaxSegments)
+	{
+		throw IcsException("id table is full, %d ids", (int)handle);
+	}
+
+	std::string* segment = m_segments[index].load(std::memory_order_relaxed);
+	if (!segment)
+	{
+		segment = new std::string[SegmentSize];
+	}
+	// the string is written before the handle is handed out
+	segment[handle & (SegmentSize - 1)] = value;
+	m_segments[index].store(segment, std::memory_order_release);
+	m_count.store(handle + 1, std::memory_order_relaxed);
+	return static_cast<uint32_t>(handle);
+}
+
+} // end namespace ics
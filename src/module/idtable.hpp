@@ -0,0 +1,139 @@
+
+
+#ifndef _ICS_ID_TABLE_H
+#define _ICS_ID_TABLE_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <ostream>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+
+namespace ics {
+
+/// interned id: 32-bit handle of a string in the id table, the default is the empty string
+class IcsId {
+public:
+	IcsId() = default;
+
+	explicit IcsId(uint32_t handle)
+		: m_handle(handle)
+	{
+
+	}
+
+	uint32_t handle() const
+	{
+		return m_handle;
+	}
+
+	bool empty() const
+	{
+		return m_handle == 0;
+	}
+
+	/// the interned string, stays valid and unchanged for the life of the process
+	const std::string& str() const;
+
+	bool operator == (const IcsId& rhs) const
+	{
+		return m_handle == rhs.m_handle;
+	}
+
+	bool operator != (const IcsId& rhs) const
+	{
+		return m_handle != rhs.m_handle;
+	}
+
+private:
+	uint32_t	m_handle = 0;
+};
+
+inline std::ostream& operator << (std::ostream& os, const IcsId& id)
+{
+	return os << id.str();
+}
+
+
+/*
+interning table of the gateway, monitor point and enterprise ids:
+each string gets a handle once and is never removed, the strings are kept in fixed segments
+so that a handle is turned back into its string without locking;
+interning locks one of the striped maps and is meant for logins, not for every message
+*/
+class IdTable : NonCopyable {
+public:
+	static const std::size_t SegmentBits = 12;
+
+	static const std::size_t SegmentSize = 1 << SegmentBits;
+
+	static const std::size_t MaxSegments = 1024;
+
+	static const std::size_t ShardCount = 16;
+
+	IdTable();
+
+	~IdTable();
+
+	/// handle of the string, added if it isn't interned yet
+	IcsId intern(const std::string& value) throw(IcsException);
+
+	/// handle of the string if it is interned, empty otherwise; never adds
+	IcsId find(const std::string& value) const;
+
+	/// the string of the handle, lock free
+	const std::string& str(IcsId id) const
+	{
+		uint32_t handle = id.handle();
+		return m_segments[handle >> SegmentBits].load(std::memory_order_acquire)[handle & (SegmentSize - 1)];
+	}
+
+	/// count of the interned strings
+	std::size_t size() const
+	{
+		return m_count.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Shard {
+		mutable std::mutex	lock;
+		std::unordered_map<std::string, uint32_t>	handles;
+	};
+
+	Shard& getShard(const std::string& value) const
+	{
+		return m_shards[std::hash<std::string>()(value) % ShardCount];
+	}
+
+	/// store the string under a new handle
+	uint32_t add(const std::string& value) throw(IcsException);
+
+private:
+	mutable Shard	m_shards[ShardCount];
+	std::atomic<std::string*>	m_segments[MaxSegments];
+	std::mutex		m_segmentLock;
+	std::atomic<std::size_t>	m_count{ 1 };	// handle 0 is the empty string
+};
+
+} // end namespace ics
+
+extern ics::IdTable g_idTable;
+
+namespace std {
+
+template<>
+struct hash<ics::IcsId> {
+	std::size_t operator()(const ics::IcsId& id) const
+	{
+		return id.handle();
+	}
+};
+
+}
+
+#endif	// end _ICS_ID_TABLE_H
@@ -0,0 +1,99 @@
+
+
+#include "ioservicepool.hpp"
+#include "log.hpp"
+
+
+namespace ics {
+
+
+IoServicePool::IoServicePool(asio::io_service& service, std::size_t threadCount, bool sharded)
+: m_threadCount(threadCount)
+, m_sharded(sharded)
+{
+	if (m_threadCount == 0)
+	{
+		m_threadCount = std::thread::hardware_concurrency();
+	}
+	if (m_threadCount == 0)
+	{
+		m_threadCount = 1;
+	}
+
+	m_services.push_back(&service);
+	if (m_sharded)
+	{
+		for (std::size_t i = 1; i < m_threadCount; i++)
+		{
+			m_ownServices.emplace_back(new asio::io_service(1));
+			m_services.push_back(m_ownServices.back().get());
+		}
+		// a shard without any listener must keep running
+		for (auto s : m_services)
+		{
+			m_works.emplace_back(new asio::io_service::work(*s));
+		}
+	}
+}
+
+IoServicePool::~IoServicePool()
+{
+	stop();
+	join();
+}
+
+void IoServicePool::run()
+{
+	LOG_INFO("io_service runs on " << m_threadCount << " threads, " << (m_sharded ? "sharded" : "shared") << " mode");
+
+	for (std::size_t i = 1; i < m_threadCount; i++)
+	{
+		asio::io_service& service = getIoService(m_sharded ? i : 0);
+		m_workers.emplace_back([&service](){
+			// handlers catch their own errors, ignore the error code
+			asio::error_code ec;
+			service.run(ec);
+		});
+	}
+
+	// the calling thread is the first worker
+	asio::error_code ec;
+	getIoService(0).run(ec);
+
+	stop();
+	join();
+}
+
+void IoServicePool::stop()
+{
+	for (auto s : m_services)
+	{
+		s->stop();
+	}
+}
+
+std::size_t IoServicePool::indexOf(const asio::io_service& service) const
+{
+	for (std::size_t i = 0; i < m_services.size(); i++)
+	{
+		if (m_services[i] == &service)
+		{
+			return i;
+		}
+	}
+	return 0;
+}
+
+void IoServicePool::join()
+{
+	for (auto& t : m_workers)
+	{
+		if (t.joinable())
+		{
+			t.join();
+		}
+	}
+	m_workers.clear();
+}
+
+} // end namespace ics
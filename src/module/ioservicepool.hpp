@@ -0,0 +1,71 @@
+
+
+#ifndef _ICS_IO_SERVICE_POOL_H
+#define _ICS_IO_SERVICE_POOL_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include <asio.hpp>
+#include <vector>
+#include <thread>
+#include <memory>
+
+
+namespace ics {
+
+/*
+io_service worker pool:
+shared mode -- all threads run the same io_service
+sharded mode -- each thread owns its io_service(shard), shard 0 is the io_service given
+*/
+class IoServicePool : NonCopyable {
+public:
+	/// threadCount: number of threads (the caller's thread included), 0 means one per core
+	IoServicePool(asio::io_service& service, std::size_t threadCount, bool sharded = false);
+
+	~IoServicePool();
+
+	/// run the io_service(s) on the calling thread and the worker threads until stopped
+	void run();
+
+	/// stop all io_service, may be called from any thread
+	void stop();
+
+	std::size_t threadCount() const
+	{
+		return m_threadCount;
+	}
+
+	bool sharded() const
+	{
+		return m_sharded;
+	}
+
+	/// count of io_service: threadCount in sharded mode, 1 in shared mode
+	std::size_t ioServiceCount() const
+	{
+		return m_services.size();
+	}
+
+	asio::io_service& getIoService(std::size_t index = 0)
+	{
+		return *m_services[index % m_services.size()];
+	}
+
+	/// index of the io_service, 0 if it isn't in the pool
+	std::size_t indexOf(const asio::io_service& service) const;
+
+private:
+	void join();
+
+private:
+	std::size_t					m_threadCount;
+	bool						m_sharded;
+	std::vector<asio::io_service*>	m_services;
+	std::vector<std::unique_ptr<asio::io_service>>	m_ownServices;
+	std::vector<std::unique_ptr<asio::io_service::work>>	m_works;
+	std::vector<std::thread>	m_workers;
+};
+
+} // end namespace ics
+#endif	// end _ICS_IO_SERVICE_POOL_H
@@ -0,0 +1,247 @@
+
+
+#ifndef _ICS_LOOKUP_CACHE_H
+#define _ICS_LOOKUP_CACHE_H
+
+#include "config.hpp"
+#include "util.hpp"
+#include "log.hpp"
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+
+namespace ics {
+
+class LookupCacheBase {
+public:
+	/// result of a lookup, the same type for the caches of all values
+	enum Status {
+		Found,
+		NotFound,
+		Failed,		// the loader couldn't tell, not cached
+	};
+};
+
+/*
+read-through cache of database lookups shared by all connections:
+a miss starts the asynchronous loader once, concurrent misses of the same key wait for its result;
+keys not found are cached as well (negative) for a shorter time, entries expire after ttl,
+the shards are locked separately and drop their least recently used entry when full
+*/
+template<class Value>
+class LookupCache : public LookupCacheBase, NonCopyable {
+public:
+	/// result of a lookup, value is set if found
+	typedef std::function<void (Status status, const Value& value)> Handler;
+
+	/// load the value of the key and call done on any thread; an exception thrown by the loader fails the lookup
+	typedef std::function<void (const std::string& key, Handler&& done)> Loader;
+
+	static const std::size_t ShardCount = 16;
+
+	LookupCache(const char* name, Loader&& loader)
+		: m_name(name)
+		, m_loader(std::move(loader))
+	{
+
+	}
+
+	/// ttl and negativeTtl in seconds, maxEntries bounds the whole cache
+	void setLimit(std::size_t ttl, std::size_t negativeTtl, std::size_t maxEntries)
+	{
+		m_ttl = std::chrono::seconds(ttl);
+		m_negativeTtl = std::chrono::seconds(negativeTtl);
+		m_shardLimit = maxEntries / ShardCount + 1;
+	}
+
+	/// cached value, or load it if missing or expired;
+	/// handler runs on the calling thread on a hit, on the thread the loader completes on otherwise
+	void get(const std::string& key, Handler&& handler)
+	{
+		Shard& shard = getShard(key);
+		Status status;
+		Value value;
+		{
+			std::lock_guard<std::mutex> lock(shard.lock);
+			auto it = shard.entries.find(key);
+			if (it != shard.entries.end() && it->second.expire > std::chrono::steady_clock::now())
+			{
+				m_hits++;
+				shard.lru.splice(shard.lru.begin(), shard.lru, it->second.position);
+				status = it->second.found ? Found : NotFound;
+				value = it->second.value;
+			}
+			else
+			{
+				m_misses++;
+
+				// the key is being loaded, wait for its result
+				auto& handlers = shard.pending[key];
+				handlers.push_back(std::move(handler));
+				if (handlers.size() > 1)
+				{
+					return;
+				}
+				status = Failed;
+			}
+		}
+
+		if (status != Failed)
+		{
+			handler(status, value);
+			return;
+		}
+
+		try {
+			m_loader(key, [this, key](Status loaded, const Value& value)
+			{
+				complete(key, loaded, value);
+			});
+		}
+		catch (...)
+		{
+			complete(key, Failed, Value());
+		}
+	}
+
+	/// add or replace a value, used by the bulk preload
+	void put(const std::string& key, const Value& value)
+	{
+		Shard& shard = getShard(key);
+		std::lock_guard<std::mutex> lock(shard.lock);
+		store(shard, key, value, true);
+	}
+
+	void invalidate(const std::string& key)
+	{
+		Shard& shard = getShard(key);
+		std::lock_guard<std::mutex> lock(shard.lock);
+		auto it = shard.entries.find(key);
+		if (it != shard.entries.end())
+		{
+			shard.lru.erase(it->second.position);
+			shard.entries.erase(it);
+		}
+	}
+
+	void clear()
+	{
+		for (auto& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.lock);
+			shard.entries.clear();
+			shard.lru.clear();
+		}
+	}
+
+	const char* name() const
+	{
+		return m_name;
+	}
+
+	uint64_t hits() const
+	{
+		return m_hits;
+	}
+
+	uint64_t misses() const
+	{
+		return m_misses;
+	}
+
+private:
+	struct Entry {
+		Value	value;
+		bool	found;
+		std::chrono::steady_clock::time_point	expire;
+		std::list<std::string>::iterator	position;	// in the lru list of the shard
+	};
+
+	struct Shard {
+		std::mutex	lock;
+		std::unordered_map<std::string, Entry>	entries;
+		std::list<std::string>	lru;	// keys of the entries, the most recently used first
+		std::unordered_map<std::string, std::vector<Handler>>	pending;	// keys being loaded
+	};
+
+	Shard& getShard(const std::string& key)
+	{
+		return m_shards[std::hash<std::string>()(key) % ShardCount];
+	}
+
+	/// cache the loaded result and pass it to the handlers waiting for the key
+	void complete(const std::string& key, Status status, const Value& value)
+	{
+		Shard& shard = getShard(key);
+		std::vector<Handler> handlers;
+		{
+			std::lock_guard<std::mutex> lock(shard.lock);
+			auto it = shard.pending.find(key);
+			if (it != shard.pending.end())
+			{
+				handlers.swap(it->second);
+				shard.pending.erase(it);
+			}
+			if (status != Failed)
+			{
+				store(shard, key, value, status == Found);
+			}
+		}
+
+		for (auto& handler : handlers)
+		{
+			try {
+				handler(status, value);
+			}
+			catch (...)
+			{
+				LOG_ERROR(m_name << " cache handler error, key=" << key);
+			}
+		}
+	}
+
+	/// called with the shard locked
+	void store(Shard& shard, const std::string& key, const Value& value, bool found)
+	{
+		auto it = shard.entries.find(key);
+		if (it == shard.entries.end())
+		{
+			if (shard.entries.size() >= m_shardLimit)
+			{
+				shard.entries.erase(shard.lru.back());
+				shard.lru.pop_back();
+			}
+			shard.lru.push_front(key);
+			it = shard.entries.emplace(key, Entry()).first;
+		}
+		else
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second.position);
+		}
+
+		Entry& entry = it->second;
+		entry.value = value;
+		entry.found = found;
+		entry.expire = std::chrono::steady_clock::now() + (found ? m_ttl : m_negativeTtl);
+		entry.position = shard.lru.begin();
+	}
+
+private:
+	const char*	m_name;
+	Loader		m_loader;
+	std::chrono::seconds	m_ttl{ 600 };
+	std::chrono::seconds	m_negativeTtl{ 30 };
+	std::size_t	m_shardLimit = 100000 / ShardCount + 1;
+	Shard		m_shards[ShardCount];
+	std::atomic<uint64_t>	m_hits{ 0 };
+	std::atomic<uint64_t>	m_misses{ 0 };
+};
+
+} // end namespace ics
+#endif	// end _ICS_LOOKUP_CACHE_H
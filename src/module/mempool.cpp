@@ -2,7 +2,10 @@
 
 #include "mempool.hpp"
 #include "icsexception.hpp"
+#include "log.hpp"
 #include <cstring>
+#include <algorithm>
+#include <new>
 
 namespace ics {
 
@@ -40,7 +43,11 @@ MemoryChunk::~MemoryChunk()
 
 MemoryChunk MemoryChunk::clone(MemoryPool& mp)
 {
-	auto mc = mp.get();
+	auto mc = mp.get(length);
+	if (!mc.data)
+	{
+		throw IcsException("can't clone %d bytes from memory pool", length);
+	}
 	mc.length = length;
 	std::memcpy(mc.data, data, mc.length);
 	return mc;
@@ -70,9 +77,102 @@ bool MemoryChunk::valid() const
 
 
 
-MemoryPool::MemoryPool(std::size_t chunkSize, std::size_t countOfChunk, bool zeroData)
+const std::size_t MemoryPool::MaxSizeClass;
+const std::size_t MemoryPool::MinClassSize;
+const std::size_t MemoryPool::MaxArena;
+const std::size_t MemoryPool::TrimInterval;
+
+namespace {
+
+// upper bound of chunks kept by one thread for one size class
+const std::size_t MaxThreadCacheSize = 16;
+
+std::atomic<uint64_t> s_poolId{ 0 };
+
+// the free link lives in the first bytes of a free chunk
+inline std::atomic<uint32_t>* freeLink(uint8_t* chunk)
+{
+	return reinterpret_cast<std::atomic<uint32_t>*>(chunk);
+}
+
+inline uint64_t nextHead(uint64_t head, uint64_t index)
+{
+	return (((head >> 32) + 1) << 32) | index;
+}
+
+}
+
+// chunks cached by one thread, only for the first pool the thread uses
+struct MemoryPool::ThreadCache {
+	struct Magazine {
+		uint8_t*	chunks[MaxThreadCacheSize];
+		std::size_t	count = 0;
+	};
+
+	MemoryPool*	owner = nullptr;
+	uint64_t	ownerId = 0;
+	// the trim the cache has given the draining chunks back for
+	uint64_t	trimEpoch = 0;
+	Magazine	magazines[MaxSizeClass];
+
+	// give the cached chunks back when the thread exits, the pool must outlive its threads
+	~ThreadCache()
+	{
+		if (owner && owner->m_id == ownerId)
+		{
+			for (std::size_t i = 0; i < owner->m_classCount; i++)
+			{
+				flush(owner->m_classes[i], magazines[i], magazines[i].count);
+			}
+		}
+	}
+
+	// give back the cached chunks of the arenas trim is waiting for, they would pin the arenas
+	void drain(uint64_t epoch)
+	{
+		for (std::size_t i = 0; i < owner->m_classCount; i++)
+		{
+			SizeClass& sc = owner->m_classes[i];
+			Magazine& mag = magazines[i];
+			std::size_t kept = 0;
+			for (std::size_t n = 0; n < mag.count; n++)
+			{
+				uint8_t* chunk = mag.chunks[n];
+				if (owner->draining(sc, chunk))
+				{
+					freeLink(chunk)->store(0, std::memory_order_relaxed);
+					owner->push(sc, chunk, chunk);
+				}
+				else
+				{
+					mag.chunks[kept++] = chunk;
+				}
+			}
+			mag.count = kept;
+		}
+		trimEpoch = epoch;
+	}
+
+	// give back the newest n chunks of the magazine in one push
+	void flush(SizeClass& sc, Magazine& mag, std::size_t n)
+	{
+		if (n == 0)
+		{
+			return;
+		}
+		std::size_t first = mag.count - n;
+		for (std::size_t i = first; i + 1 < mag.count; i++)
+		{
+			freeLink(mag.chunks[i])->store(owner->indexOf(sc, mag.chunks[i + 1]), std::memory_order_relaxed);
+		}
+		owner->push(sc, mag.chunks[first], mag.chunks[mag.count - 1]);
+		mag.count = first;
+	}
+};
+
+MemoryPool::MemoryPool(std::size_t chunkSize, std::size_t countOfChunk, std::size_t maxCountOfChunk, bool zeroData)
 {
-	init(chunkSize, countOfChunk, zeroData);
+	init(chunkSize, countOfChunk, maxCountOfChunk, zeroData);
 }
 
 MemoryPool::MemoryPool()
@@ -82,50 +182,150 @@ MemoryPool::MemoryPool()
 
 MemoryPool::~MemoryPool()
 {
-	delete[] m_buff;
+	release();
 }
 
-void MemoryPool::init(std::size_t chunkSize, std::size_t countOfChunk, bool zeroData)
+void MemoryPool::init(std::size_t chunkSize, std::size_t countOfChunk, std::size_t maxCountOfChunk, bool zeroData)
 {
+	if (chunkSize < sizeof(uint32_t) || countOfChunk == 0)
+	{
+		throw IcsException("invalid memory pool: chunk size=%d, chunk count=%d", chunkSize, countOfChunk);
+	}
+
+	std::size_t maxArena = std::max<std::size_t>(1, std::min<std::size_t>(MaxArena, maxCountOfChunk / countOfChunk));
+	if ((uint64_t)maxArena * countOfChunk >= UINT32_MAX)
+	{
+		throw IcsException("invalid memory pool: max chunk count=%d", maxCountOfChunk);
+	}
+
+	// a new id invalidates the chunks cached by threads for the old arenas
+	std::lock_guard<std::mutex> lock(m_growLock);
+	release();
+	m_id = ++s_poolId;
+
 	m_chunkSize = chunkSize;
 	m_chunkCount = countOfChunk;
-	m_buff = new uint8_t[m_chunkSize * m_chunkCount];
+	m_zeroData = zeroData;
 
-	if (!m_buff)
+	// chunkSize, chunkSize/2 ... no smaller than MinClassSize, each class starts with one arena
+	m_classCount = 0;
+	for (std::size_t size = m_chunkSize; m_classCount < MaxSizeClass; size /= 2)
 	{
-		throw IcsException("can't allocal %d bytes buffer", m_chunkSize * m_chunkCount);
+		SizeClass& sc = m_classes[m_classCount++];
+		sc.size = size;
+		sc.arenaChunks = m_chunkCount;
+		sc.maxArena = maxArena;
+		sc.idle = false;
+		sc.drainArena.store(MaxArena, std::memory_order_relaxed);
+		sc.freeHead.store(0, std::memory_order_relaxed);
+		if (!addArena(sc))
+		{
+			throw IcsException("can't allocal %d bytes buffer", size * m_chunkCount);
+		}
+
+		if (size / 2 < MinClassSize || size % 2)
+		{
+			break;
+		}
 	}
 
-	if (zeroData)
+	// a thread never hoards more than 1/8 of an arena
+	m_cacheSize = std::min(MaxThreadCacheSize, m_chunkCount / 8);
+	m_exhausted = false;
+}
+
+MemoryChunk MemoryPool::get()
+{
+	return get(0, threadCache());
+}
+
+MemoryChunk MemoryPool::get(std::size_t size)
+{
+	if (size > m_chunkSize)
 	{
-		std::memset(m_buff, 0, m_chunkSize * m_chunkCount);
+		return MemoryChunk();
 	}
 
-	for (size_t i = 0; i < m_chunkCount; i++)
+	std::size_t classIndex = m_classCount;
+	while (classIndex > 0 && m_classes[classIndex - 1].size < size)
 	{
-		m_chunkList.push_back(m_buff + i*m_chunkSize);
+		classIndex--;
 	}
+	return get(classIndex - 1, threadCache());
 }
 
-MemoryChunk MemoryPool::get()
+MemoryChunk MemoryPool::get(std::size_t classIndex, ThreadCache* cache)
 {
-	std::lock_guard<std::mutex> lock(m_chunkLock);
-	MemoryChunk chunk;
-	if (!m_chunkList.empty())
+	// grow the wanted class first, then fall back to the bigger classes
+	for (std::size_t i = classIndex + 1; i-- > 0;)
 	{
-		chunk.data = m_chunkList.front();
-		chunk.length = m_chunkSize;
-		m_chunkList.pop_front();
+		SizeClass& sc = m_classes[i];
+		uint8_t* data = nullptr;
+
+		if (cache)
+		{
+			ThreadCache::Magazine& mag = cache->magazines[i];
+			if (mag.count == 0)
+			{
+				// refill half of the magazine, a chunk of the draining arena is handed out and never cached
+				while (mag.count < (m_cacheSize + 1) / 2 && (data = pop(sc)) != nullptr && !draining(sc, data))
+				{
+					mag.chunks[mag.count++] = data;
+					data = nullptr;
+				}
+			}
+			if (!data)
+			{
+				data = mag.count > 0 ? mag.chunks[--mag.count] : nullptr;
+			}
+		}
+		else
+		{
+			data = pop(sc);
+		}
+
+		if (!data)
+		{
+			data = grow(sc);
+		}
+
+		if (data)
+		{
+			return MemoryChunk(data, sc.size);
+		}
 	}
-	return chunk;
+	return MemoryChunk();
 }
 
 void MemoryPool::put(const MemoryChunk& chunk)
 {
-	if (chunk.data)
+	if (!chunk.data)
+	{
+		return;
+	}
+
+	std::size_t i = classOf(chunk.data);
+	if (i == m_classCount)
+	{
+		return;
+	}
+
+	SizeClass& sc = m_classes[i];
+	ThreadCache* cache = threadCache();
+	if (cache && !draining(sc, chunk.data))
+	{
+		ThreadCache::Magazine& mag = cache->magazines[i];
+		if (mag.count == m_cacheSize)
+		{
+			// keep half of the magazine
+			cache->flush(sc, mag, mag.count - mag.count / 2);
+		}
+		mag.chunks[mag.count++] = chunk.data;
+	}
+	else
 	{
-		std::lock_guard<std::mutex> lock(m_chunkLock);
-		m_chunkList.push_back(chunk.data);
+		freeLink(chunk.data)->store(0, std::memory_order_relaxed);
+		push(sc, chunk.data, chunk.data);
 	}
 }
 
@@ -134,4 +334,418 @@ std::size_t MemoryPool::chunkSize() const
 	return m_chunkSize;
 }
 
+std::size_t MemoryPool::capacity() const
+{
+	std::size_t bytes = 0;
+	for (std::size_t i = 0; i < m_classCount; i++)
+	{
+		const SizeClass& sc = m_classes[i];
+		bytes += sc.arenaCount.load(std::memory_order_relaxed) * sc.size * sc.arenaChunks;
+	}
+	return bytes;
+}
+
+void MemoryPool::trim()
+{
+	std::lock_guard<std::mutex> lock(m_growLock);
+
+	// nobody can still read the arenas retired by the last trim
+	for (auto arena : m_retiredArenas)
+	{
+		delete[] arena;
+	}
+	m_retiredArenas.clear();
+
+	for (std::size_t i = 0; i < m_classCount; i++)
+	{
+		SizeClass& sc = m_classes[i];
+		std::size_t last = sc.arenaCount.load(std::memory_order_relaxed) - 1;
+		if (last == 0)
+		{
+			sc.idle = false;
+			sc.drainArena.store(MaxArena, std::memory_order_relaxed);
+			continue;
+		}
+
+		// take the whole free list, the getters wait on m_growLock meanwhile
+		uint64_t head = sc.freeHead.load(std::memory_order_relaxed);
+		while (!sc.freeHead.compare_exchange_weak(head, nextHead(head, 0), std::memory_order_acquire, std::memory_order_relaxed));
+
+		std::size_t lastFree = 0;
+		for (uint32_t index = static_cast<uint32_t>(head); index != 0; index = freeLink(chunkAt(sc, index))->load(std::memory_order_relaxed))
+		{
+			if ((index - 1) / sc.arenaChunks == last)
+			{
+				lastFree++;
+			}
+		}
+
+		uint32_t first = static_cast<uint32_t>(head);
+		if (lastFree == sc.arenaChunks && sc.idle)
+		{
+			// unlink the chunks of the last arena
+			uint8_t* prev = nullptr;
+			first = 0;
+			for (uint32_t index = static_cast<uint32_t>(head); index != 0;)
+			{
+				uint8_t* chunk = chunkAt(sc, index);
+				uint32_t next = freeLink(chunk)->load(std::memory_order_relaxed);
+				if ((index - 1) / sc.arenaChunks != last)
+				{
+					if (prev)
+					{
+						freeLink(prev)->store(index, std::memory_order_relaxed);
+					}
+					else
+					{
+						first = index;
+					}
+					prev = chunk;
+				}
+				index = next;
+			}
+			if (prev)
+			{
+				freeLink(prev)->store(0, std::memory_order_relaxed);
+			}
+
+			m_retiredArenas.push_back(sc.arenas[last].exchange(nullptr, std::memory_order_relaxed));
+			sc.arenaCount.store(last, std::memory_order_release);
+			sc.idle = false;
+			LOG_INFO("memory pool trims an arena of " << sc.size << " bytes chunk, " << last << " arenas left");
+		}
+		else
+		{
+			sc.idle = lastFree == sc.arenaChunks;
+		}
+
+		// the caches stop keeping chunks of the last arena, so it can be found idle by the next trim
+		std::size_t count = sc.arenaCount.load(std::memory_order_relaxed);
+		sc.drainArena.store(count > 1 ? count - 1 : MaxArena, std::memory_order_relaxed);
+
+		// give the free list back
+		if (first)
+		{
+			uint8_t* tail = chunkAt(sc, first);
+			for (uint32_t next; (next = freeLink(tail)->load(std::memory_order_relaxed)) != 0; tail = chunkAt(sc, next));
+			push(sc, chunkAt(sc, first), tail);
+		}
+	}
+
+	m_trimEpoch.fetch_add(1, std::memory_order_release);
+}
+
+uint8_t* MemoryPool::pop(SizeClass& sc)
+{
+	uint64_t head = sc.freeHead.load(std::memory_order_acquire);
+	for (;;)
+	{
+		uint32_t index = static_cast<uint32_t>(head);
+		if (index == 0)
+		{
+			return nullptr;
+		}
+		uint8_t* chunk = chunkAt(sc, index);
+		if (!chunk)
+		{
+			// the arena has been trimmed since head was read
+			head = sc.freeHead.load(std::memory_order_acquire);
+			continue;
+		}
+		uint32_t next = freeLink(chunk)->load(std::memory_order_relaxed);
+		// the tag changes on every update, a stale next never gets in
+		if (sc.freeHead.compare_exchange_weak(head, nextHead(head, next)
+			, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			return chunk;
+		}
+	}
+}
+
+void MemoryPool::push(SizeClass& sc, uint8_t* first, uint8_t* last)
+{
+	uint64_t index = indexOf(sc, first);
+	uint64_t head = sc.freeHead.load(std::memory_order_relaxed);
+	do {
+		freeLink(last)->store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+	} while (!sc.freeHead.compare_exchange_weak(head, nextHead(head, index)
+		, std::memory_order_release, std::memory_order_relaxed));
+
+	if (m_exhausted.load(std::memory_order_relaxed))
+	{
+		m_exhausted.store(false, std::memory_order_relaxed);
+	}
+}
+
+uint8_t* MemoryPool::grow(SizeClass& sc)
+{
+	std::lock_guard<std::mutex> lock(m_growLock);
+
+	// another thread may have grown it or a trim has given the list back
+	uint8_t* chunk = pop(sc);
+	if (chunk)
+	{
+		return chunk;
+	}
+
+	if (sc.arenaCount.load(std::memory_order_relaxed) >= sc.maxArena)
+	{
+		m_exhausted.store(true, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	if (!addArena(sc))
+	{
+		m_exhausted.store(true, std::memory_order_relaxed);
+		return nullptr;
+	}
+	LOG_INFO("memory pool grows to " << sc.arenaCount.load(std::memory_order_relaxed) << " arenas of " << sc.size << " bytes chunk");
+	return pop(sc);
+}
+
+bool MemoryPool::addArena(SizeClass& sc)
+{
+	std::size_t n = sc.arenaCount.load(std::memory_order_relaxed);
+	uint8_t* arena = new (std::nothrow) uint8_t[sc.size * sc.arenaChunks];
+	if (!arena)
+	{
+		return false;
+	}
+
+	if (m_zeroData)
+	{
+		std::memset(arena, 0, sc.size * sc.arenaChunks);
+	}
+
+	// link all chunks of the arena
+	uint32_t base = static_cast<uint32_t>(n * sc.arenaChunks);
+	for (std::size_t i = 0; i + 1 < sc.arenaChunks; i++)
+	{
+		freeLink(arena + i * sc.size)->store(static_cast<uint32_t>(base + i + 2), std::memory_order_relaxed);
+	}
+
+	sc.arenas[n].store(arena, std::memory_order_release);
+	sc.arenaCount.store(n + 1, std::memory_order_release);
+	push(sc, arena, arena + (sc.arenaChunks - 1) * sc.size);
+	return true;
+}
+
+bool MemoryPool::draining(const SizeClass& sc, const uint8_t* data) const
+{
+	std::size_t n = sc.drainArena.load(std::memory_order_relaxed);
+	if (n >= MaxArena)
+	{
+		return false;
+	}
+	const uint8_t* arena = sc.arenas[n].load(std::memory_order_relaxed);
+	return arena && data >= arena && data < arena + sc.size * sc.arenaChunks;
+}
+
+uint8_t* MemoryPool::chunkAt(const SizeClass& sc, uint32_t index) const
+{
+	uint8_t* arena = sc.arenas[(index - 1) / sc.arenaChunks].load(std::memory_order_acquire);
+	return arena ? arena + (index - 1) % sc.arenaChunks * sc.size : nullptr;
+}
+
+uint32_t MemoryPool::indexOf(const SizeClass& sc, const uint8_t* data) const
+{
+	std::size_t count = sc.arenaCount.load(std::memory_order_acquire);
+	for (std::size_t i = 0; i < count; i++)
+	{
+		const uint8_t* arena = sc.arenas[i].load(std::memory_order_relaxed);
+		if (arena && data >= arena && data < arena + sc.size * sc.arenaChunks)
+		{
+			return static_cast<uint32_t>(i * sc.arenaChunks + (data - arena) / sc.size + 1);
+		}
+	}
+	return 0;
+}
+
+std::size_t MemoryPool::classOf(const uint8_t* data) const
+{
+	for (std::size_t i = 0; i < m_classCount; i++)
+	{
+		if (indexOf(m_classes[i], data))
+		{
+			return i;
+		}
+	}
+	return m_classCount;
+}
+
+MemoryPool::ThreadCache* MemoryPool::threadCache()
+{
+	if (m_cacheSize == 0)
+	{
+		return nullptr;
+	}
+
+	static thread_local ThreadCache cache;
+	if (cache.owner == this && cache.ownerId == m_id)
+	{
+		uint64_t epoch = m_trimEpoch.load(std::memory_order_acquire);
+		if (cache.trimEpoch != epoch)
+		{
+			cache.drain(epoch);
+		}
+		return &cache;
+	}
+
+	// bind the cache to the first pool, or rebind it when its pool has been re-initialized
+	if (cache.owner == nullptr || cache.owner == this)
+	{
+		for (auto& mag : cache.magazines)
+		{
+			mag.count = 0;
+		}
+		cache.owner = this;
+		cache.ownerId = m_id;
+		cache.trimEpoch = m_trimEpoch.load(std::memory_order_acquire);
+		return &cache;
+	}
+	return nullptr;
+}
+
+void MemoryPool::release()
+{
+	for (std::size_t i = 0; i < m_classCount; i++)
+	{
+		SizeClass& sc = m_classes[i];
+		std::size_t count = sc.arenaCount.load(std::memory_order_relaxed);
+		for (std::size_t n = 0; n < count; n++)
+		{
+			delete[] sc.arenas[n].exchange(nullptr, std::memory_order_relaxed);
+		}
+		sc.arenaCount.store(0, std::memory_order_relaxed);
+	}
+	m_classCount = 0;
+
+	for (auto arena : m_retiredArenas)
+	{
+		delete[] arena;
+	}
+	m_retiredArenas.clear();
+}
+
+
+
+const std::size_t PooledBuffer::HeaderSize;
+
+PooledBuffer::PooledBuffer()
+{
+
+}
+
+PooledBuffer::PooledBuffer(MemoryPool& pool)
+{
+	init(pool, pool.get());
+}
+
+PooledBuffer::PooledBuffer(MemoryPool& pool, std::size_t size)
+{
+	init(pool, pool.get(size + HeaderSize));
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& rhs)
+: m_chunk(rhs.m_chunk), m_length(rhs.m_length)
+{
+	rhs.m_chunk = nullptr;
+	rhs.m_length = 0;
+}
+
+PooledBuffer& PooledBuffer::operator = (PooledBuffer&& rhs)
+{
+	if (this != &rhs)
+	{
+		reset();
+		m_chunk = rhs.m_chunk;
+		m_length = rhs.m_length;
+		rhs.m_chunk = nullptr;
+		rhs.m_length = 0;
+	}
+	return *this;
+}
+
+PooledBuffer::~PooledBuffer()
+{
+	reset();
+}
+
+PooledBuffer PooledBuffer::share() const
+{
+	PooledBuffer buffer;
+	if (m_chunk)
+	{
+		header()->refs.fetch_add(1, std::memory_order_relaxed);
+		buffer.m_chunk = m_chunk;
+		buffer.m_length = m_length;
+	}
+	return buffer;
+}
+
+void PooledBuffer::reset()
+{
+	if (m_chunk)
+	{
+		Header* head = header();
+		if (head->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			head->pool->put(MemoryChunk(m_chunk, head->size + HeaderSize));
+		}
+		m_chunk = nullptr;
+		m_length = 0;
+	}
+}
+
+MpscNode* PooledBuffer::toNode()
+{
+	if (!m_chunk || header()->refs.load(std::memory_order_acquire) != 1)
+	{
+		return nullptr;
+	}
+	Header* head = header();
+	head->length = static_cast<uint32_t>(m_length);
+	m_chunk = nullptr;
+	m_length = 0;
+	return head;
+}
+
+PooledBuffer PooledBuffer::fromNode(MpscNode* node)
+{
+	PooledBuffer buffer;
+	if (node)
+	{
+		Header* head = static_cast<Header*>(node);
+		buffer.m_chunk = reinterpret_cast<uint8_t*>(head);
+		buffer.m_length = head->length;
+	}
+	return buffer;
+}
+
+uint8_t* PooledBuffer::data() const
+{
+	return m_chunk ? m_chunk + HeaderSize : nullptr;
+}
+
+std::size_t PooledBuffer::size() const
+{
+	return m_chunk ? header()->size : 0;
+}
+
+void PooledBuffer::init(MemoryPool& pool, const MemoryChunk& chunk)
+{
+	if (chunk.data && chunk.length > HeaderSize)
+	{
+		m_chunk = chunk.data;
+		Header* head = new (m_chunk) Header();
+		head->refs.store(1, std::memory_order_relaxed);
+		head->size = static_cast<uint32_t>(chunk.length - HeaderSize);
+		head->pool = &pool;
+	}
+	else
+	{
+		pool.put(chunk);
+	}
+}
+
 }
\ No newline at end of file
@@ -4,9 +4,12 @@
 #define _MEM_POOL_H
 
 //#include "icsconfig.hpp"
+#include <atomic>
 #include <mutex>
-#include <list>
+#include <vector>
 #include <memory>
+#include <cstdint>
+#include "mpscqueue.hpp"
 
 namespace ics {
 
@@ -43,28 +46,232 @@ public:
 };
 
 
+/*
+ڴ:ߴ(chunkSize,chunkSize/2,chunkSize/4,chunkSize/8)ֵslab,
+ÿһ,ÿ̻߳п,get/put;
+ʱarena(countOfChunk)maxCountOfChunk,еarenatrim()
+*/
 class MemoryPool {
 public:
-	MemoryPool(std::size_t chunkSize, std::size_t countOfChunk, bool zeroData = true);
+	/// ߴ
+	static const std::size_t MaxSizeClass = 4;
+
+	/// СߴĿС
+	static const std::size_t MinClassSize = 64;
+
+	/// ÿarena
+	static const std::size_t MaxArena = 64;
+
+	/// trim()ļ()
+	static const std::size_t TrimInterval = 60;
+
+	MemoryPool(std::size_t chunkSize, std::size_t countOfChunk, std::size_t maxCountOfChunk = 0, bool zeroData = true);
 
 	MemoryPool();
 
-	void init(std::size_t chunkSize, std::size_t countOfChunk, bool zeroData = true);
+	/// maxCountOfChunk:ÿĿ,countOfChunkʱ
+	void init(std::size_t chunkSize, std::size_t countOfChunk, std::size_t maxCountOfChunk = 0, bool zeroData = true);
 
 	~MemoryPool();
 
+	/// ȡߴ(chunkSize)ڴ
 	MemoryChunk get();
 
+	/// ȡСsizeڴ,ʱȡ
+	MemoryChunk get(std::size_t size);
+
+	/// 黹ڴ,̵߳
 	void put(const MemoryChunk& chunk);
 
 	std::size_t chunkSize() const;
+
+	/// ǰȫarenaֽ
+	std::size_t capacity() const;
+
+	/// տеarena:μ鶼ȫеһarenaͷ,趨ʱ;
+	/// ˺߳´get/putʱ黹һarenaĿ,ҲٻarenaĿ
+	void trim();
+
+	/// ,黹ڴ
+	bool exhausted() const
+	{
+		return m_exhausted.load(std::memory_order_relaxed);
+	}
 private:
-	uint8_t*		m_buff;
-	std::size_t		m_chunkSize;
-	std::size_t		m_chunkCount;
+	/*
+	ߴ:ΪTreiberջ,32λΪ汾(ABA),32λΪ+1,һŴڿп;
+	 = arena * arenaChunks + arena
+	*/
+	struct SizeClass {
+		SizeClass()
+		{
+			for (auto& arena : arenas)
+			{
+				arena.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+
+		std::size_t	size = 0;
+		std::size_t	arenaChunks = 0;
+		std::size_t	maxArena = 1;
+		std::atomic<std::size_t>	arenaCount{ 0 };
+		std::atomic<uint8_t*>		arenas[MaxArena];
+		std::atomic<uint64_t>	freeHead{ 0 };
+		/// ϴtrimʱһarenaȫ
+		bool		idle = false;
+		/// trimȴյarena,̻߳治еĿ;MaxArenaʾû
+		std::atomic<std::size_t>	drainArena{ MaxArena };
+	};
+
+	/// ̻߳
+	struct ThreadCache;
+
+	/// ȡһ,ʱnullptr
+	uint8_t* pop(SizeClass& sc);
+
+	/// first..last(ڿ)Ż
+	void push(SizeClass& sc, uint8_t* first, uint8_t* last);
+
+	/// һarenaȡһ,ѵʱnullptr
+	uint8_t* grow(SizeClass& sc);
+
+	/// ½arenaȫ,m_growLockе
+	bool addArena(SizeClass& sc);
+
+	/// ڴڸȴյarena
+	bool draining(const SizeClass& sc, const uint8_t* data) const;
 
-	std::list<uint8_t*>	m_chunkList;
-	std::mutex		m_chunkLock;
+	/// ŶӦĵַ
+	uint8_t* chunkAt(const SizeClass& sc, uint32_t index) const;
+
+	/// ַӦĿ,ڸʱ0
+	uint32_t indexOf(const SizeClass& sc, const uint8_t* data) const;
+
+	/// ڴ,ڱڴʱm_classCount
+	std::size_t classOf(const uint8_t* data) const;
+
+	/// ȡñ̵߳Ļ,ڴʱnullptr
+	ThreadCache* threadCache();
+
+	MemoryChunk get(std::size_t classIndex, ThreadCache* cache);
+
+	/// ͷȫarena
+	void release();
+private:
+	std::size_t		m_chunkSize = 0;
+	std::size_t		m_chunkCount = 0;
+	bool			m_zeroData = true;
+
+	SizeClass		m_classes[MaxSizeClass];
+	std::size_t		m_classCount = 0;
+
+	/// ÿ߳ÿ𻺴
+	std::size_t		m_cacheSize = 0;
+
+	/// ڴر,̻߳ڴ
+	uint64_t		m_id = 0;
+
+	/// ÿtrim1,̻߳ݴ˹黹ȴյarenaĿ
+	std::atomic<uint64_t>	m_trimEpoch{ 0 };
+
+	/// arena
+	std::mutex		m_growLock;
+
+	/// ϴtrimյarena,´trimʱͷ,߳ڶȡ
+	std::vector<uint8_t*>	m_retiredArenas;
+
+	std::atomic<bool>	m_exhausted{ false };
+};
+
+
+/*
+ڴеĻ:ֻƶ,share()ͬһ,üΪ0ʱ黹ڴ;
+üڴؼнڵڿͷ,δĻ޷طMpscQueue
+*/
+class PooledBuffer
+{
+public:
+	PooledBuffer();
+
+	/// ڴػȡߴĻ,ڴʱЧ
+	explicit PooledBuffer(MemoryPool& pool);
+
+	/// ڴػȡСsizeֽڵĻ,ڴʱЧ
+	PooledBuffer(MemoryPool& pool, std::size_t size);
+
+	PooledBuffer(PooledBuffer&& rhs);
+
+	PooledBuffer& operator = (PooledBuffer&& rhs);
+
+	PooledBuffer(const PooledBuffer& rhs) = delete;
+
+	PooledBuffer& operator = (const PooledBuffer& rhs) = delete;
+
+	~PooledBuffer();
+
+	/// û,ü1
+	PooledBuffer share() const;
+
+	/// ͷ
+	void reset();
+
+	bool valid() const
+	{
+		return m_chunk != nullptr;
+	}
+
+	/// ݵַ
+	uint8_t* data() const;
+
+	/// 󳤶
+	std::size_t size() const;
+
+	/// ʹó
+	std::size_t length() const
+	{
+		return m_length;
+	}
+
+	void setLength(std::size_t length)
+	{
+		m_length = length;
+	}
+
+	/// Ϊнڵ,ЧʱnullptrҲ
+	MpscNode* toNode();
+
+	/// ӹtoNode()Ļ
+	static PooledBuffer fromNode(MpscNode* node);
+
+private:
+	/*
+	ͷ,λÿ֮ǰ:
+	64λΪָ8ֽ + refs/size/length4ֽ + 4ֽ + poolָ8ֽ = 32ֽ,
+	32λΪ20ֽ;ĿóΪߴȥHeaderSize
+	*/
+	struct Header : public MpscNode {
+		std::atomic<uint32_t>	refs;
+		uint32_t		size;
+		/// Ϊнڵʱʹó
+		uint32_t		length;
+		MemoryPool*		pool;
+	};
+
+	/// ͷ,ݰָ
+	static const std::size_t HeaderSize = (sizeof(Header) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+
+	static_assert(sizeof(void*) != 8 || HeaderSize == 32, "PooledBuffer header is 32 bytes on 64-bit, update the comment above");
+
+	void init(MemoryPool& pool, const MemoryChunk& chunk);
+
+	Header* header() const
+	{
+		return reinterpret_cast<Header*>(m_chunk);
+	}
+
+private:
+	uint8_t*	m_chunk = nullptr;
+	std::size_t	m_length = 0;
 };
 
 }
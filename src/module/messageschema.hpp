@@ -0,0 +1,439 @@
+
+
+#ifndef _ICS_MESSAGE_SCHEMA_H
+#define _ICS_MESSAGE_SCHEMA_H
+
+#include "config.hpp"
+#include "icsprotocol.hpp"
+#include "icsexception.hpp"
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+
+
+namespace ics {
+
+/*
+wire codec of one field type: numbers and IcsDataTime have a fixed size, strings have a fixed
+length prefix and a variable body; load() gets end and fixed(the fixed bytes not read yet,
+this field included) so that a string can check its body against what the rest still needs
+*/
+template<class T>
+struct FieldCodec {
+	static const std::size_t FixedSize = sizeof(T);
+
+	static const bool Variable = false;
+
+	static std::size_t variableSize(const T&)
+	{
+		return 0;
+	}
+
+	static void load(const uint8_t*& p, const uint8_t*, std::size_t& fixed, T& value)
+	{
+		T raw;
+		std::memcpy(&raw, p, sizeof(raw));
+		value = ics_byteorder(raw);
+		p += sizeof(raw);
+		fixed -= FixedSize;
+	}
+
+	static void store(uint8_t*& p, const T& value)
+	{
+		T raw = ics_byteorder(value);
+		std::memcpy(p, &raw, sizeof(raw));
+		p += sizeof(raw);
+	}
+};
+
+template<>
+struct FieldCodec<IcsDataTime> {
+	static const std::size_t FixedSize = sizeof(IcsDataTime);
+
+	static const bool Variable = false;
+
+	static std::size_t variableSize(const IcsDataTime&)
+	{
+		return 0;
+	}
+
+	static void load(const uint8_t*& p, const uint8_t* end, std::size_t& fixed, IcsDataTime& value)
+	{
+		uint16_t year, sec;
+		FieldCodec<uint16_t>::load(p, end, fixed, year);
+		value.year = year;
+		value.month = *p++;
+		value.day = *p++;
+		value.hour = *p++;
+		value.miniute = *p++;
+		fixed -= 4;
+		FieldCodec<uint16_t>::load(p, end, fixed, sec);
+		value.sec_data = sec;
+	}
+
+	static void store(uint8_t*& p, const IcsDataTime& value)
+	{
+		FieldCodec<uint16_t>::store(p, value.year);
+		*p++ = value.month;
+		*p++ = value.day;
+		*p++ = value.hour;
+		*p++ = value.miniute;
+		FieldCodec<uint16_t>::store(p, value.sec_data);
+	}
+};
+
+/// string with a LengthType length prefix
+template<class LengthType, class String>
+struct StringCodec {
+	static const std::size_t FixedSize = sizeof(LengthType);
+
+	static const bool Variable = true;
+
+	static std::size_t variableSize(const String& value) throw(IcsException)
+	{
+		if (value.size() > std::numeric_limits<LengthType>::max())
+		{
+			throw IcsException("string of %d bytes is too long", (int)value.size());
+		}
+		return value.size();
+	}
+
+	static void load(const uint8_t*& p, const uint8_t* end, std::size_t& fixed, String& value) throw(IcsException)
+	{
+		LengthType len;
+		FieldCodec<LengthType>::load(p, end, fixed, len);
+		if (len > std::size_t(end - p) - fixed)
+		{
+			throw IcsException("OOM to get %d bytes string data", (int)len);
+		}
+		value.assign((const char*)p, len);
+		p += len;
+	}
+
+	static void store(uint8_t*& p, const String& value)
+	{
+		FieldCodec<LengthType>::store(p, (LengthType)value.size());
+		std::memcpy(p, value.data(), value.size());
+		p += value.size();
+	}
+};
+
+template<>
+struct FieldCodec<ShortString> : StringCodec<uint8_t, ShortString> {};
+
+template<>
+struct FieldCodec<LongString> : StringCodec<uint16_t, LongString> {};
+
+
+template<std::size_t... Sizes>
+struct SchemaSize;
+
+template<>
+struct SchemaSize<> {
+	static const std::size_t value = 0;
+};
+
+template<std::size_t Size, std::size_t... Sizes>
+struct SchemaSize<Size, Sizes...> {
+	static const std::size_t value = Size + SchemaSize<Sizes...>::value;
+};
+
+template<bool... Variables>
+struct SchemaVariable;
+
+template<>
+struct SchemaVariable<> {
+	static const bool value = false;
+};
+
+template<bool Variable, bool... Variables>
+struct SchemaVariable<Variable, Variables...> {
+	static const bool value = Variable || SchemaVariable<Variables...>::value;
+};
+
+
+/*
+layout of a message body as a list of field types, in wire order:
+decode() checks the fixed part once and then loads the fields straight from the buffer,
+only the string bodies are checked on their own; encode() checks the whole size once and
+stores the fields; the field arguments must have exactly the schema types
+*/
+template<class... Fields>
+class MessageSchema {
+public:
+	/// bytes of the fixed parts: numbers, times and the string length prefixes
+	static const std::size_t FixedSize = SchemaSize<FieldCodec<Fields>::FixedSize...>::value;
+
+	/// no string field, the size is always FixedSize
+	static const bool IsFixed = !SchemaVariable<FieldCodec<Fields>::Variable...>::value;
+
+	static void decode(ProtocolStream& stream, Fields&... values) throw(IcsException)
+	{
+		std::size_t left = stream.leftLength();
+		if (FixedSize > left)
+		{
+			throw IcsException("OOM to get %d bytes message, left %d bytes", (int)FixedSize, (int)left);
+		}
+
+		const uint8_t* begin = stream.position();
+		const uint8_t* end = begin + left;
+		const uint8_t* p = begin;
+		std::size_t fixed = FixedSize;
+		int expand[] = { 0, (FieldCodec<Fields>::load(p, end, fixed, values), 0)... };
+		(void)expand;
+		stream.take(p - begin);
+	}
+
+	static void encode(ProtocolStream& stream, const Fields&... values) throw(IcsException)
+	{
+		std::size_t size = FixedSize;
+		int sizes[] = { 0, (size += FieldCodec<Fields>::variableSize(values), 0)... };
+		(void)sizes;
+
+		uint8_t* p = stream.take(size);
+		int expand[] = { 0, (FieldCodec<Fields>::store(p, values), 0)... };
+		(void)expand;
+	}
+
+	/// decode count items of this layout in a row, call handler(values...) for each; fixed layouts only
+	template<class Handler>
+	static void decodeRepeated(ProtocolStream& stream, std::size_t count, Handler&& handler) throw(IcsException)
+	{
+		static_assert(IsFixed, "repeated items must have a fixed size");
+
+		const uint8_t* p = stream.take(count * FixedSize);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			loadItem(p, handler, std::index_sequence_for<Fields...>());
+		}
+	}
+
+private:
+	template<class Handler, std::size_t... Index>
+	static void loadItem(const uint8_t*& p, Handler& handler, std::index_sequence<Index...>)
+	{
+		std::tuple<Fields...> values;
+		const uint8_t* end = p + FixedSize;
+		std::size_t fixed = FixedSize;
+		int expand[] = { 0, (FieldCodec<Fields>::load(p, end, fixed, std::get<Index>(values)), 0)... };
+		(void)expand;
+		handler(std::get<Index>(values)...);
+	}
+};
+
+template<class... Fields>
+const std::size_t MessageSchema<Fields...>::FixedSize;
+
+template<class... Fields>
+const bool MessageSchema<Fields...>::IsFixed;
+
+
+/// body layout of each message id, shared by the center and the proxy; undefined for the messages not described yet
+template<MessageId Id>
+struct MessageLayout;
+
+/// gwid, password, device kind, extend info
+template<>
+struct MessageLayout<MessageId::T2C_auth_request_0x0101> : MessageSchema<ShortString, ShortString, uint16_t, ShortString> {};
+
+/// status type, then StatusLayout<type>
+template<>
+struct MessageLayout<MessageId::T2C_std_status_report_0x0301> : MessageSchema<uint32_t> {};
+
+/// event time, event count, then count EventItemLayout
+template<>
+struct MessageLayout<MessageId::T2C_event_report_0x0501> : MessageSchema<IcsDataTime, uint16_t> {};
+
+/// report time, business number, business type, then BusinessLayout<type>
+template<>
+struct MessageLayout<MessageId::T2C_bus_report_0x0901> : MessageSchema<IcsDataTime, uint32_t, uint32_t> {};
+
+/// position flag, longitude, latitude, height, speed
+template<>
+struct MessageLayout<MessageId::T2C_gps_report_0x0902> : MessageSchema<uint8_t, uint32_t, uint32_t, uint32_t, uint32_t> {};
+
+/// terminal time
+template<>
+struct MessageLayout<MessageId::T2C_datetime_sync_request_0x0a01> : MessageSchema<IcsDataTime> {};
+
+/// terminal time, receive time, send time
+template<>
+struct MessageLayout<MessageId::C2T_datetime_sync_response_0x0a02> : MessageSchema<IcsDataTime, IcsDataTime, IcsDataTime> {};
+
+/// log time, log level, encode type(0-UTF-8, 1-GB2312), log
+template<>
+struct MessageLayout<MessageId::T2C_log_report_0x0c01> : MessageSchema<IcsDataTime, uint8_t, uint8_t, ShortString> {};
+
+/// monitor point id, device kind, event time, event id, event value
+template<>
+struct MessageLayout<MessageId::C2P_push_message_0x3001> : MessageSchema<ShortString, uint16_t, IcsDataTime, uint16_t, ShortString> {};
+
+/// start index, max count
+template<>
+struct MessageLayout<MessageId::W2C_online_query_0x2006> : MessageSchema<uint32_t, uint16_t> {};
+
+/// online count, count in this response, then count OnlineTerminalLayout
+template<>
+struct MessageLayout<MessageId::C2W_online_response_0x2007> : MessageSchema<uint32_t, uint16_t> {};
+
+/// gwid, device kind, status(0-online, 1-offline)
+template<>
+struct MessageLayout<MessageId::C2C_terminal_onoff_line_0x4006> : MessageSchema<ShortString, uint16_t, uint8_t> {};
+
+/// request id, parameter count, then count ParamItemLayout
+template<>
+struct MessageLayout<MessageId::T2C_param_query_response_0x0602> : MessageSchema<uint32_t, uint16_t> {};
+
+/// alter time, parameter count, then count ParamItemLayout
+template<>
+struct MessageLayout<MessageId::T2C_param_alter_report_0x0701> : MessageSchema<IcsDataTime, uint16_t> {};
+
+/// request id, parameter count, then count ParamResultLayout
+template<>
+struct MessageLayout<MessageId::T2C_param_modiy_response_0x0802> : MessageSchema<uint32_t, uint16_t> {};
+
+/// request id, operator id, result
+template<>
+struct MessageLayout<MessageId::T2C_control_response_0x0d02> : MessageSchema<uint32_t, uint16_t, ShortString> {};
+
+/// request id, file id, then the rest of the request
+template<>
+struct MessageLayout<MessageId::C2T_upgrade_request_0x0201> : MessageSchema<uint32_t, uint32_t> {};
+
+/// request id, reason
+template<>
+struct MessageLayout<MessageId::T2C_upgrade_deny_0x0202> : MessageSchema<uint32_t, ShortString> {};
+
+/// request id
+template<>
+struct MessageLayout<MessageId::T2C_upgrade_agree_0x0203> : MessageSchema<uint32_t> {};
+
+/// file id, request id, fragment offset, fragment length, received size
+template<>
+struct MessageLayout<MessageId::T2C_upgrade_file_request_0x0204> : MessageSchema<uint32_t, uint32_t, uint32_t, uint16_t, uint32_t> {};
+
+/// request id, upgrade result
+template<>
+struct MessageLayout<MessageId::T2C_upgrade_result_report_0x0207> : MessageSchema<uint32_t, ShortString> {};
+
+/// request id
+template<>
+struct MessageLayout<MessageId::T2C_upgrade_cancel_ack_0x0209> : MessageSchema<uint32_t> {};
+
+/// gwid, message id, then ForwardRequestLayout and the rest of the message to the terminal
+template<>
+struct MessageLayout<MessageId::W2C_send_to_ics_terminal_0x2001> : MessageSchema<ShortString, uint16_t> {};
+
+/// enterprise id
+template<>
+struct MessageLayout<MessageId::W2C_connect_remote_request_0x2002> : MessageSchema<ShortString> {};
+
+/// enterprise id
+template<>
+struct MessageLayout<MessageId::W2C_disconnect_remote_0x2003> : MessageSchema<ShortString> {};
+
+/// enterprise id, gwid, message id, then ForwardRequestLayout and the rest of the message to the terminal
+template<>
+struct MessageLayout<MessageId::W2C_send_to_remote_terminal_0x2004> : MessageSchema<ShortString, ShortString, uint16_t> {};
+
+/// cache kind, key
+template<>
+struct MessageLayout<MessageId::W2C_invalidate_cache_0x2005> : MessageSchema<uint8_t, ShortString> {};
+
+/// time of the requesting center
+template<>
+struct MessageLayout<MessageId::C2C_auth_request1_0x4001> : MessageSchema<std::time_t> {};
+
+/// time of the requesting center, time of the proxy
+template<>
+struct MessageLayout<MessageId::C2C_auth_response_0x4002> : MessageSchema<std::time_t, std::time_t> {};
+
+/// time of the proxy, encrypted
+template<>
+struct MessageLayout<MessageId::C2C_auth_request2_0x4003> : MessageSchema<std::time_t> {};
+
+/// gwid, message id, then the message to the terminal; an upgrade request has UpgradePathLayout first
+template<>
+struct MessageLayout<MessageId::C2C_forward_to_terminal_0x4004> : MessageSchema<ShortString, uint16_t> {};
+
+/// gwid, message id, request id, result(0-success, 1-failed), then ForwardFailureLayout when failed
+template<>
+struct MessageLayout<MessageId::C2C_forward_response_0x4005> : MessageSchema<ShortString, uint16_t, uint32_t, uint8_t> {};
+
+/// gwid, message id, then the message from the terminal
+template<>
+struct MessageLayout<MessageId::C2C_forward_to_ics_0x4007> : MessageSchema<ShortString, uint16_t> {};
+
+
+/// gwid, monitor point id, device kind
+struct OnlineTerminalLayout : MessageSchema<ShortString, ShortString, uint16_t> {};
+
+/// event id, event type, event value
+struct EventItemLayout : MessageSchema<uint16_t, uint8_t, ShortString> {};
+
+/// net id, parameter id, parameter type, parameter value
+struct ParamItemLayout : MessageSchema<uint16_t, uint16_t, uint8_t, ShortString> {};
+
+/// net id, parameter id, modify result
+struct ParamResultLayout : MessageSchema<uint16_t, uint16_t, ShortString> {};
+
+/// request id leading every message the web sends to a terminal
+struct ForwardRequestLayout : MessageSchema<uint32_t> {};
+
+/// full path of the upgrade file, put by the center before a forwarded upgrade request
+struct UpgradePathLayout : MessageSchema<ShortString> {};
+
+/// reason of a failed forward
+struct ForwardFailureLayout : MessageSchema<ShortString> {};
+
+/// body of each standard status type
+template<uint32_t Type>
+struct StatusLayout;
+
+/// weighing device: device light, device status, cheat light, cheat status, zero point
+template<>
+struct StatusLayout<1> : MessageSchema<uint8_t, LongString, uint8_t, ShortString, float> {};
+
+/// body of each business type
+template<uint32_t Type>
+struct BusinessLayout;
+
+/// static truck scale: cargo number, vehicle number, consignee, cargo name, gross, tare, deduction, net, unit price, money, in or out
+template<>
+struct BusinessLayout<1> : MessageSchema<ShortString, ShortString, ShortString, ShortString, float, float, float, float, float, float, uint8_t> {};
+
+/// packing scale: scale count, then count PackingScaleLayout
+template<>
+struct BusinessLayout<2> : MessageSchema<uint8_t> {};
+
+/// scale number, weighing count, total weight, single weight
+struct PackingScaleLayout : MessageSchema<uint8_t, uint16_t, float, float> {};
+
+/// highway scale: total weight, speed(0.1km/h), axle count, then axle count AxleWeightLayout,
+/// axle type count and axle type count AxleTypeLayout
+template<>
+struct BusinessLayout<3> : MessageSchema<uint32_t, uint16_t, uint8_t> {};
+
+struct AxleWeightLayout : MessageSchema<uint16_t> {};
+
+struct AxleTypeLayout : MessageSchema<uint8_t> {};
+
+/// kitchen waste truck: weight flag, tub id, tub volume, weight, driver id, position flag, longitude, latitude, height, speed
+template<>
+struct BusinessLayout<4> : MessageSchema<uint8_t, ShortString, uint32_t, uint32_t, uint32_t, uint8_t, uint32_t, uint32_t, uint32_t, uint32_t> {};
+
+/// freeway overload check: vehicle id, recheck time, total weight, limit weight, axle count,
+/// precheck time, total weight, limit weight, over weight, axle count
+template<>
+struct BusinessLayout<5> : MessageSchema<ShortString, IcsDataTime, uint32_t, uint32_t, uint8_t, IcsDataTime, uint32_t, uint32_t, uint32_t, uint8_t> {};
+
+/// freeway overload day report: vehicle count
+template<>
+struct BusinessLayout<6> : MessageSchema<uint32_t> {};
+
+} // end namespace ics
+#endif	// end _ICS_MESSAGE_SCHEMA_H
@@ -0,0 +1,95 @@
+
+
+#ifndef _ICS_MPSC_QUEUE_H
+#define _ICS_MPSC_QUEUE_H
+
+#include "util.hpp"
+#include <atomic>
+
+
+namespace ics {
+
+/// intrusive link, the queued object must derive from it
+struct MpscNode {
+	std::atomic<MpscNode*> mpscNext{ nullptr };
+};
+
+/*
+intrusive lock-free multi-producer/single-consumer queue (D.Vyukov):
+push() may be called from any thread, pop()/empty() only from the single consumer
+*/
+template<class T>
+class MpscQueue : NonCopyable {
+public:
+	MpscQueue()
+		: m_head(&m_stub), m_tail(&m_stub)
+	{
+
+	}
+
+	/// put a node, wait-free
+	void push(T* node)
+	{
+		link(static_cast<MpscNode*>(node));
+	}
+
+	/// get the oldest node, nullptr if empty or a producer has not finished its push
+	T* pop()
+	{
+		MpscNode* tail = m_tail;
+		MpscNode* next = tail->mpscNext.load(std::memory_order_acquire);
+		if (tail == &m_stub)
+		{
+			if (next == nullptr)
+			{
+				return nullptr;
+			}
+			m_tail = next;
+			tail = next;
+			next = next->mpscNext.load(std::memory_order_acquire);
+		}
+
+		if (next)
+		{
+			m_tail = next;
+			return static_cast<T*>(tail);
+		}
+
+		if (tail != m_head.load(std::memory_order_acquire))
+		{
+			return nullptr;
+		}
+
+		link(&m_stub);
+
+		next = tail->mpscNext.load(std::memory_order_acquire);
+		if (next)
+		{
+			m_tail = next;
+			return static_cast<T*>(tail);
+		}
+		return nullptr;
+	}
+
+	/// no node is queued or being queued
+	bool empty() const
+	{
+		return m_tail == &m_stub && m_head.load(std::memory_order_acquire) == &m_stub;
+	}
+
+private:
+	void link(MpscNode* node)
+	{
+		node->mpscNext.store(nullptr, std::memory_order_relaxed);
+		MpscNode* prev = m_head.exchange(node, std::memory_order_acq_rel);
+		prev->mpscNext.store(node, std::memory_order_release);
+	}
+
+private:
+	std::atomic<MpscNode*>	m_head;
+	MpscNode*				m_tail;
+	MpscNode				m_stub;
+};
+
+} // end namespace ics
+#endif	// end _ICS_MPSC_QUEUE_H
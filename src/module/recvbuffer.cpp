@@ -0,0 +1,125 @@
+
+
+#include "recvbuffer.hpp"
+#include <cstring>
+#include <new>
+
+
+namespace ics {
+
+namespace {
+
+// 16-bit length field of the protocol head
+const std::size_t ProtocolMaxFrameSize = 0xffff;
+
+std::size_t s_maxFrameSize = 1024;
+
+}
+
+ReceiveBuffer::ReceiveBuffer(MemoryPool& pool)
+: m_pool(pool)
+{
+
+}
+
+void ReceiveBuffer::setMaxFrameSize(std::size_t size)
+{
+	s_maxFrameSize = size > ProtocolMaxFrameSize ? ProtocolMaxFrameSize : size;
+}
+
+std::size_t ReceiveBuffer::maxFrameSize()
+{
+	return s_maxFrameSize;
+}
+
+bool ReceiveBuffer::prepare()
+{
+	if (writeSpace() > 0)
+	{
+		return true;
+	}
+	if (m_capacity == 0)
+	{
+		return reallocate(0);
+	}
+	return reserve(m_size + 1);
+}
+
+bool ReceiveBuffer::reserve(std::size_t n)
+{
+	if (n > s_maxFrameSize)
+	{
+		return false;
+	}
+	if (m_begin + n <= m_capacity)
+	{
+		return true;
+	}
+	if (n <= m_capacity)
+	{
+		// move the partial frame to the front
+		std::memmove(m_storage, data(), m_size);
+		m_begin = 0;
+		return true;
+	}
+	return reallocate(n);
+}
+
+void ReceiveBuffer::shrink()
+{
+	if (m_size == 0 && m_capacity != 0)
+	{
+		m_chunk.reset();
+		m_heap.reset();
+		m_storage = nullptr;
+		m_capacity = 0;
+		m_begin = 0;
+	}
+}
+
+bool ReceiveBuffer::reallocate(std::size_t capacity)
+{
+	PooledBuffer chunk;
+	std::unique_ptr<uint8_t[]> heap;
+	uint8_t* storage = nullptr;
+
+	// a pool chunk is enough for most frames
+	if (capacity <= m_pool.chunkSize())
+	{
+		chunk = PooledBuffer(m_pool);
+	}
+
+	if (chunk.valid() && chunk.size() >= capacity)
+	{
+		storage = chunk.data();
+		capacity = chunk.size();
+	}
+	else
+	{
+		chunk.reset();
+		if (capacity < m_pool.chunkSize())
+		{
+			capacity = m_pool.chunkSize();
+		}
+		heap.reset(new (std::nothrow) uint8_t[capacity]);
+		storage = heap.get();
+	}
+
+	if (!storage)
+	{
+		return false;
+	}
+
+	if (m_size)
+	{
+		std::memcpy(storage, data(), m_size);
+	}
+	m_chunk = std::move(chunk);
+	m_heap = std::move(heap);
+	m_storage = storage;
+	m_capacity = capacity;
+	m_begin = 0;
+	return true;
+}
+
+} // end namespace ics
@@ -0,0 +1,93 @@
+
+
+#ifndef _ICS_RECV_BUFFER_H
+#define _ICS_RECV_BUFFER_H
+
+#include "config.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <memory>
+#include <cstdint>
+
+
+namespace ics {
+
+/*
+receive buffer of one connection: storage is taken from the memory pool when
+data arrives, grows on the heap for frames bigger than a chunk (up to the max
+frame size) and is given back when no partial frame is left
+*/
+class ReceiveBuffer : NonCopyable {
+public:
+	ReceiveBuffer(MemoryPool& pool);
+
+	/// max frame size of all connections
+	static void setMaxFrameSize(std::size_t size);
+
+	static std::size_t maxFrameSize();
+
+	/// make sure there is room to receive, false if no memory
+	bool prepare();
+
+	/// make the next n bytes from data() contiguous, false if n is too big or no memory
+	bool reserve(std::size_t n);
+
+	/// give the storage back if no data is left
+	void shrink();
+
+	/// unhandled data
+	uint8_t* data() const
+	{
+		return m_storage + m_begin;
+	}
+
+	std::size_t size() const
+	{
+		return m_size;
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	/// where to receive
+	uint8_t* writePtr() const
+	{
+		return m_storage + m_begin + m_size;
+	}
+
+	std::size_t writeSpace() const
+	{
+		return m_capacity - m_begin - m_size;
+	}
+
+	/// n bytes are received at writePtr()
+	void commit(std::size_t n)
+	{
+		m_size += n;
+	}
+
+	/// n bytes are handled
+	void consume(std::size_t n)
+	{
+		m_size -= n;
+		m_begin = m_size ? m_begin + n : 0;
+	}
+
+private:
+	/// move to a storage of capacity bytes
+	bool reallocate(std::size_t capacity);
+
+private:
+	MemoryPool&		m_pool;
+	PooledBuffer	m_chunk;
+	std::unique_ptr<uint8_t[]>	m_heap;
+	uint8_t*		m_storage = nullptr;
+	std::size_t		m_capacity = 0;
+	std::size_t		m_begin = 0;
+	std::size_t		m_size = 0;
+};
+
+} // end namespace ics
+#endif	// end _ICS_RECV_BUFFER_H
@@ -8,11 +8,14 @@
 
 namespace ics{
 
+#ifdef SO_REUSEPORT
+/// let several acceptors listen on the same address, the kernel spreads the connections
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
 
-TcpServer::TcpServer(asio::io_service& service)
-: m_io_service(service)
-, m_acceptor(service)
-, m_clientSocket(m_io_service)
+
+TcpServer::TcpServer(IoServicePool& pool)
+: m_ioPool(pool)
 , m_io_service_thread(nullptr)
 {
 	
@@ -39,17 +42,39 @@ void TcpServer::init(const char* name, const std::string& addr, AddClientHandler
 
 	asio::ip::tcp::endpoint endpoint(asio::ip::address::from_string(result[1]), std::strtol(result[3].str().c_str(), nullptr, 10));
 
-	m_acceptor.open(endpoint.protocol());
+	std::size_t count = 1;
+#ifdef SO_REUSEPORT
+	if (m_ioPool.sharded())
+	{
+		count = m_ioPool.ioServiceCount();
+	}
+#endif
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		std::unique_ptr<Acceptor> a(new Acceptor(m_ioPool.getIoService(i)));
+
+		a->acceptor.open(endpoint.protocol());
+
+		a->acceptor.set_option(asio::socket_base::reuse_address(true));
 
-	m_acceptor.set_option(asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+		if (count > 1)
+		{
+			a->acceptor.set_option(reuse_port(true));
+		}
+#endif
 
-	m_acceptor.bind(endpoint);
+		a->acceptor.bind(endpoint);
 
-	m_acceptor.listen();
+		a->acceptor.listen();
+
+		m_acceptors.push_back(std::move(a));
+	}
 
 	m_do_add_client = do_add_client;
 
-	LOG_DEBUG("The " << name << " tcp server starts to listen at " << addr);
+	LOG_DEBUG("The " << name << " tcp server starts to listen at " << addr << " with " << count << " acceptors");
 
 	do_accept();
 }
@@ -71,19 +96,31 @@ void TcpServer::stop()
 	{
 		m_io_service_thread->join();
 	}
-	m_acceptor.close();
+	for (auto& a : m_acceptors)
+	{
+		asio::error_code ec;
+		a->acceptor.close(ec);
+	}
 }
 
 void TcpServer::do_accept()
+{
+	for (auto& a : m_acceptors)
+	{
+		do_accept(*a);
+	}
+}
+
+void TcpServer::do_accept(Acceptor& a)
 {
 	// accept client
-	m_acceptor.async_accept(m_clientSocket,
-		[this](std::error_code ec)
+	a.acceptor.async_accept(a.clientSocket,
+		[this, &a](std::error_code ec)
 		{
 			if (!ec)
 			{
 				try {
-					m_do_add_client(std::move(m_clientSocket));
+					m_do_add_client(std::move(a.clientSocket));
 				}
 				catch (IcsException& ex)
 				{
@@ -98,12 +135,17 @@ void TcpServer::do_accept()
 					LOG_ERROR("create tcp connection unknown error=");
 				}
 			}
+			else if (ec == asio::error::operation_aborted)
+			{
+				// acceptor closed
+				return;
+			}
 			else
 			{
 				LOG_ERROR("listen error=" << ec.message());
 			}
 			// accept next client
-			do_accept();
+			do_accept(a);
 		});
 }
 
@@ -8,9 +8,12 @@ ics server
 #define _ICS_TCP_SERVER_H
 
 #include "icsconfig.hpp"
+#include "ioservicepool.hpp"
 #include <asio.hpp>
 #include <string>
 #include <thread>
+#include <vector>
+#include <memory>
 
 
 namespace ics {
@@ -19,7 +22,8 @@ class TcpServer {
 public:
 	typedef std::function<void (asio::ip::tcp::socket&&)> AddClientHandler;
 
-	TcpServer(asio::io_service& service);
+	/// in sharded mode each io_service of the pool gets its own acceptor
+	TcpServer(IoServicePool& pool);
 
 	void init(const char* name, const std::string& addr, AddClientHandler do_add_client);
 
@@ -31,12 +35,20 @@ public:
 private:
 	TcpServer() = delete;
 
+	/// acceptor of one io_service, the accepted socket belongs to the same io_service
+	struct Acceptor {
+		Acceptor(asio::io_service& service) : acceptor(service), clientSocket(service){}
+		asio::ip::tcp::acceptor	acceptor;
+		asio::ip::tcp::socket	clientSocket;
+	};
+
 	void do_accept();
 
+	void do_accept(Acceptor& acceptor);
+
 private:
-	asio::io_service&		m_io_service;
-	asio::ip::tcp::acceptor	m_acceptor;
-	asio::ip::tcp::socket	m_clientSocket;
+	IoServicePool&			m_ioPool;
+	std::vector<std::unique_ptr<Acceptor>>	m_acceptors;
 	std::thread*			m_io_service_thread;
 	AddClientHandler		m_do_add_client;
 
@@ -44,3 +56,4 @@ private:
 
 } // end namespace ics
 #endif	// end _ICS_TCP_SERVER_H
+
@@ -2,6 +2,7 @@
 
 #include "timer.hpp"
 #include "log.hpp"
+#include <condition_variable>
 
 Timer::Timer()
 	: m_running(false)
@@ -73,4 +74,259 @@ void Timer::loop()
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+
+/// ʱֵĲλ״̬,ʱּʱľ
+struct TimerHandle::Wheel {
+	std::mutex		lock;
+	std::condition_variable	fired;
+	uint64_t		current = 0;	// ƽĿ̶
+	std::size_t		count = 0;
+	TimerLink		slots[TimingWheel::Levels][TimingWheel::Slots];
+	TimerLink		due;			// ̶ȵڵľ
+	TimerHandle*	firing = nullptr;	// ִлصľ
+	std::thread::id	firingThread;
+
+	Wheel()
+	{
+		for (auto& level : slots)
+		{
+			for (auto& slot : level)
+			{
+				slot.prev = slot.next = &slot;
+			}
+		}
+		due.prev = due.next = &due;
+	}
+
+	static void pushBack(TimerLink& list, TimerLink& link)
+	{
+		link.prev = list.prev;
+		link.next = &list;
+		list.prev->next = &link;
+		list.prev = &link;
+	}
+
+	/// ڿ̶ȷڲĲλ
+	void insert(TimerHandle& handle)
+	{
+		const uint64_t maxTicks = (uint64_t(1) << (TimingWheel::SlotBits * TimingWheel::Levels)) - 1;
+		if (handle.m_expire - current > maxTicks)
+		{
+			handle.m_expire = current + maxTicks;
+		}
+		uint64_t ticks = handle.m_expire - current;
+
+		std::size_t level = 0;
+		while (ticks >> (TimingWheel::SlotBits * (level + 1)))
+		{
+			level++;
+		}
+		std::size_t slot = (handle.m_expire >> (TimingWheel::SlotBits * level)) & (TimingWheel::Slots - 1);
+		pushBack(slots[level][slot], handle);
+		count++;
+	}
+
+	void remove(TimerHandle& handle)
+	{
+		if (handle.next)
+		{
+			handle.prev->next = handle.next;
+			handle.next->prev = handle.prev;
+			handle.prev = handle.next = nullptr;
+			count--;
+		}
+	}
+
+	/// òλľʣ̶·
+	void cascade(std::size_t level, std::size_t slot)
+	{
+		TimerLink& list = slots[level][slot];
+		while (list.next != &list)
+		{
+			TimerHandle& handle = static_cast<TimerHandle&>(*list.next);
+			remove(handle);
+			insert(handle);
+		}
+	}
+
+	/// òλľ뵽ڶ
+	void expire(std::size_t slot)
+	{
+		TimerLink& list = slots[0][slot];
+		if (list.next != &list)
+		{
+			list.next->prev = due.prev;
+			due.prev->next = list.next;
+			list.prev->next = &due;
+			due.prev = list.prev;
+			list.prev = list.next = &list;
+		}
+	}
+};
+
+
+void TimerHandle::cancel()
+{
+	if (!m_wheel)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_wheel->lock);
+	for (;;)
+	{
+		m_wheel->remove(*this);
+
+		// صִ߳,ȴ;صпٴζʱ
+		if (m_wheel->firing != this || m_wheel->firingThread == std::this_thread::get_id())
+		{
+			break;
+		}
+		m_wheel->fired.wait(lock);
+	}
+}
+
+bool TimerHandle::armed() const
+{
+	if (!m_wheel)
+	{
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(m_wheel->lock);
+	return next != nullptr;
+}
+
+
+const std::size_t TimingWheel::Levels;
+const std::size_t TimingWheel::SlotBits;
+const std::size_t TimingWheel::Slots;
+
+TimingWheel::TimingWheel(asio::io_service& service, std::chrono::milliseconds tick)
+	: m_timer(service)
+	, m_tick(tick.count() > 0 ? tick : std::chrono::milliseconds(1))
+	, m_startTime(std::chrono::steady_clock::now())
+	, m_wheel(std::make_shared<TimerHandle::Wheel>())
+{
+
+}
+
+TimingWheel::~TimingWheel()
+{
+	stop();
+}
+
+void TimingWheel::start()
+{
+	stop();
+	{
+		std::lock_guard<std::mutex> lock(m_wheel->lock);
+		m_startTime = std::chrono::steady_clock::now() - m_tick * m_wheel->current;
+	}
+	m_running = true;
+	wait();
+}
+
+void TimingWheel::stop()
+{
+	m_running = false;
+	asio::error_code ec;
+	m_timer.cancel(ec);
+}
+
+void TimingWheel::schedule(TimerHandle& handle, std::chrono::milliseconds delay)
+{
+	if (handle.m_wheel != m_wheel)
+	{
+		handle.cancel();
+		handle.m_wheel = m_wheel;
+	}
+
+	// һ̶ȵİһ̶
+	uint64_t ticks = delay.count() > 0 ? (delay.count() + m_tick.count() - 1) / m_tick.count() : 1;
+
+	std::lock_guard<std::mutex> lock(m_wheel->lock);
+	m_wheel->remove(handle);
+	handle.m_expire = m_wheel->current + ticks;
+	m_wheel->insert(handle);
+}
+
+std::size_t TimingWheel::size() const
+{
+	std::lock_guard<std::mutex> lock(m_wheel->lock);
+	return m_wheel->count;
+}
+
+void TimingWheel::advance()
+{
+	TimerHandle::Wheel& wheel = *m_wheel;
+	uint64_t target = (std::chrono::steady_clock::now() - m_startTime) / m_tick;
+
+	std::unique_lock<std::mutex> lock(wheel.lock);
+	while (wheel.current < target)
+	{
+		wheel.current++;
+
+		// ²תһȦʱ,ϲĵǰλ²
+		for (std::size_t level = 1; level < Levels; level++)
+		{
+			if ((wheel.current >> (SlotBits * (level - 1))) & (Slots - 1))
+			{
+				break;
+			}
+			wheel.cascade(level, (wheel.current >> (SlotBits * level)) & (Slots - 1));
+		}
+		wheel.expire(wheel.current & (Slots - 1));
+
+		// ִеڵĻص,ִʱ
+		while (wheel.due.next != &wheel.due)
+		{
+			TimerHandle* handle = static_cast<TimerHandle*>(wheel.due.next);
+			wheel.remove(*handle);
+			wheel.firing = handle;
+			wheel.firingThread = std::this_thread::get_id();
+			lock.unlock();
+
+			try {
+				handle->m_callback();
+			}
+			catch (std::exception& ex)
+			{
+				LOG_ERROR("timer callback error:" << ex.what());
+			}
+			catch (...)
+			{
+				LOG_ERROR("timer callback unknown error");
+			}
+
+			// صпþ,ٷ
+			lock.lock();
+			wheel.firing = nullptr;
+			wheel.fired.notify_all();
+		}
+	}
+}
+
+void TimingWheel::wait()
+{
+	if (!m_running)
+	{
+		return;
+	}
+
+	uint64_t next;
+	{
+		std::lock_guard<std::mutex> lock(m_wheel->lock);
+		next = m_wheel->current + 1;
+	}
+	m_timer.expires_at(m_startTime + m_tick * next);
+	m_timer.async_wait([this](const asio::error_code& ec)
+	{
+		if (!ec && m_running)
+		{
+			advance();
+			wait();
+		}
+	});
+}
@@ -10,6 +10,9 @@
 #include <mutex>
 #include <list>
 #include <array>
+#include <atomic>
+#include <asio.hpp>
+#include <asio/steady_timer.hpp>
 
 /*
 Duration:һʱ¼ʱ䳤ȣԱʾӡӻ߼Сʱʱ
@@ -59,108 +62,111 @@ private:
 };
 
 
-/// WheelCount:ʱһȦĿ̶; Tick̶ȵļʱ()
-template<std::size_t WheelCount, std::size_t Tick = 1>
-class TimingWheel {
+/*
+ʱ:Ƕ߶,ʱֵĲλ,ʱȡ޶ѷ;
+صúɷʱ,ʱioִ߳,ʱֵ;
+߳ȡ()ʱȴִеĻص,صп¶ʱ
+*/
+struct TimerLink {
+	TimerLink*	prev = nullptr;
+	TimerLink*	next = nullptr;
+};
+
+class TimerHandle : private TimerLink {
 public:
-	using TimeOutHandler = std::function<void (void)>;
+	typedef std::function<void ()> Callback;
 
-	TimingWheel()
+	TimerHandle()
 	{
 
 	}
 
-	~TimingWheel()
+	explicit TimerHandle(Callback&& callback)
+		: m_callback(std::move(callback))
 	{
-		stop();
-	}
 
-	/// һintervaltickʱth
-	void add(std::size_t interval, TimeOutHandler&& th)
-	{
-		int positon = (interval + m_currentPoint) % WheelCount;
-		int count = interval / WheelCount;
-		m_wheel[positon].add(count, std::forward<TimeOutHandler>(th));
 	}
 
-	/// 
-	void start()
+	TimerHandle(const TimerHandle&) = delete;
+
+	TimerHandle& operator = (const TimerHandle&) = delete;
+
+	~TimerHandle()
 	{
-		stop();
-		m_loopFlag = true;
-		m_loopThread.reset(new std::thread([this](){
-			this->loop();
-		}));
+		cancel();
 	}
-	
-	/// ֹͣ
-	void stop()
+
+	/// ûص,ֻδʱʱ
+	void setCallback(Callback&& callback)
 	{
-		m_loopFlag = false;
-		if (m_loopThread)
-		{
-			m_loopThread->join();
-		}
+		m_callback = std::move(callback);
 	}
 
+	/// ȡʱ,̵߳
+	void cancel();
+
+	/// ǷѶʱδʱ
+	bool armed() const;
+
 private:
+	friend class TimingWheel;
 
-	/// ʱ
-	class TaskList {
-	public:
-		/// һcountκõ
-		void add(int count, TimeOutHandler&& th)
-		{
-			std::lock_guard<std::recursive_mutex> lock(m_workListLock);
-			m_workList.emplace_front(count, std::forward<TimeOutHandler>(th));
-		}
-
-		/// öеȫ
-		void timeWork()
-		{
-			// recursive_mutexԭִеĳʱٴעᳬʱһٴηͬһ̶߳λȡͬһ
-			std::lock_guard<std::recursive_mutex> lock(m_workListLock);
-			for (auto it = m_workList.begin(); it != m_workList.end();)
-			{
-				if (--it->count <= 0)
-				{
-					it->handler();
-					it = m_workList.erase(it);
-				}
-				else
-				{
-					it++;
-				}
-			}
-		}
-
-	private:
-		struct TimeWork{
-			TimeWork(int c, TimeOutHandler&& th) :count(c), handler(std::forward<TimeOutHandler>(th)){}
-			int				count;
-			TimeOutHandler	handler;
-		};
-
-		std::recursive_mutex m_workListLock;
-		std::list<TimeWork> m_workList;
-	};
+	struct Wheel;
 
-	/// ѭ
-	void loop()
+	uint64_t	m_expire = 0;
+	std::shared_ptr<Wheel>	m_wheel;
+	Callback	m_callback;
+};
+
+
+/*
+ֲʱ:Levels,ÿSlotsλ,nһλΪSlots^n̶,ʱʱ䳬Χİֵʱ;
+iosteady_timerÿ̶ƽһ,ڵϲλ㽵²,0λеľ
+*/
+class TimingWheel {
+public:
+	static const std::size_t Levels = 4;
+
+	static const std::size_t SlotBits = 6;
+
+	static const std::size_t Slots = 1 << SlotBits;
+
+	/// tick:̶ȵļʱ
+	explicit TimingWheel(asio::io_service& service, std::chrono::milliseconds tick = std::chrono::milliseconds(100));
+
+	~TimingWheel();
+
+	/// 
+	void start();
+
+	/// ֹͣ,Ѷʱľٳʱ
+	void stop();
+
+	/// delayhandleĻص,Ѷʱľ¶ʱ;̵߳
+	void schedule(TimerHandle& handle, std::chrono::milliseconds delay);
+
+	/// ̶ȼ
+	std::chrono::milliseconds tick() const
 	{
-		while (m_loopFlag)
-		{
-			std::this_thread::sleep_for(std::chrono::seconds(Tick));
-			m_wheel[m_currentPoint++%m_wheel.size()].timeWork();
-		}
+		return m_tick;
 	}
 
+	/// Ѷʱľ
+	std::size_t size() const;
+
+private:
+	/// ƽǰʱ,ִеڵĻص
+	void advance();
+
+	/// ȴһ̶
+	void wait();
+
 private:
-	std::unique_ptr<std::thread>		m_loopThread;
-	std::array<TaskList, WheelCount>	m_wheel;
-	bool m_loopFlag = false;
-	/// ָĵǰ̶ֵ
-	std::size_t m_currentPoint = 0;
+	asio::steady_timer		m_timer;
+	std::chrono::milliseconds	m_tick;
+	std::chrono::steady_clock::time_point	m_startTime;
+	std::shared_ptr<TimerHandle::Wheel>	m_wheel;
+	std::atomic<bool>	m_running{ false };
 };
 
 
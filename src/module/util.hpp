@@ -4,6 +4,7 @@
 #define _UTIL_H
 
 #include "icsexception.hpp"
+#include "crc32.hpp"
 #include <stdint.h>
 #include <cstddef>
 #include <string>
@@ -22,9 +23,6 @@ public:
 	NonCopyable& operator=(NonCopyable&&) = delete;
 };
 
-/// ݶCRC32Уֵ
-uint32_t crc32_code(const void* buf, std::size_t size);
-
 /// ַת
 void character_convert(const char* from_code, const std::string& src, std::size_t len, const char* to_code, std::string& dest) throw (IcsException);
 
@@ -2,6 +2,8 @@
 #include "icsproxyserver.hpp"
 #include "util.hpp"
 #include "downloadfile.hpp"
+#include "messageschema.hpp"
+#include <algorithm>
 
 extern ics::IcsConfig g_configFile;
 
@@ -95,22 +97,21 @@ void IcsProxyTerminalClient::handle(ProtocolStream& request, ProtocolStream& res
 void IcsProxyTerminalClient::dispatch(ProtocolStream& request) throw(IcsException, otl_exception)
 {
 	// 消息结构：网关ID 消息ID 消息体内容(请求ID 文件ID)
+	ShortString gatewayID;	//网关Id
 	uint16_t messageID;		//消息Id
 
-	request.moveForward<ShortString>();
-	request >> messageID;
+	MessageLayout<C2C_forward_to_terminal_0x4004>::decode(request, gatewayID, messageID);
 	
 	/// 若为请求升级，取出文件预先加载
 	if (messageID == MessageId::C2T_upgrade_request_0x0201)
 	{
 		ShortString filename;
-		uint32_t fileid;
-		request >> filename;
-		request.moveForward<uint32_t>();
-		request >> fileid;
+		uint32_t requestid, fileid;
+		UpgradePathLayout::decode(request, filename);
+		MessageLayout<C2T_upgrade_request_0x0201>::decode(request, requestid, fileid);
 
 		// 退回 请求ID 文件ID 字段
-		request.moveBack(sizeof(uint32_t)+sizeof(uint32_t));
+		request.moveBack(sizeof(requestid) + sizeof(fileid));
 
 		filename = g_configFile.getAttributeString("program", "filedir") 
 #ifdef WIN32
@@ -127,7 +128,7 @@ void IcsProxyTerminalClient::dispatch(ProtocolStream& request) throw(IcsExceptio
 		}
 	}
 	// 发送到该链接对端
-	ProtocolStream forward(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream forward(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 	forward.initHead((MessageId)messageID, true);
 	forward << request;
 
@@ -149,7 +150,7 @@ void IcsProxyTerminalClient::error() throw()
 /// 转发到ICS中心
 void IcsProxyTerminalClient::forwardToIcsCenter(ProtocolStream& request)
 {
-	ProtocolStream forward(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream forward(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 
 	request.rewind();
 	forward.initHead(MessageId::C2C_forward_to_ics_0x4007, false);
@@ -161,9 +162,9 @@ void IcsProxyTerminalClient::forwardToIcsCenter(ProtocolStream& request)
 /// 上下线通知:status 0-online,1-offline
 void IcsProxyTerminalClient::onoffLineToIcsCenter(uint8_t status)
 {
-	ProtocolStream forward(ProtocolStream::OptType::writeType, g_memoryPool.get());
+	ProtocolStream forward(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 	forward.initHead(MessageId::C2C_terminal_onoff_line_0x4006, false);
-	forward << m_gwid << m_deviceKind << status;
+	MessageLayout<C2C_terminal_onoff_line_0x4006>::encode(forward, m_gwid, m_deviceKind, status);
 
 	m_proxyServer.sendToIcsCenter(forward);
 }
@@ -182,7 +183,7 @@ void IcsProxyTerminalClient::handleAuthRequest(ProtocolStream& request, Protocol
 	// auth info
 	string gwId, gwPwd, extendInfo;
 
-	request >> gwId >> gwPwd >> m_deviceKind >> extendInfo;
+	MessageLayout<T2C_auth_request_0x0101>::decode(request, gwId, gwPwd, m_deviceKind, extendInfo);
 
 	request.assertEmpty();
 
@@ -214,7 +215,7 @@ void IcsProxyTerminalClient::handleStdStatusReport(ProtocolStream& request, Prot
 {
 	uint32_t status_type;	// 标准状态类别
 
-	request >> status_type;
+	MessageLayout<T2C_std_status_report_0x0301>::decode(request, status_type);
 
 	// 通用衡器
 	if (status_type == 1)
@@ -225,7 +226,7 @@ void IcsProxyTerminalClient::handleStdStatusReport(ProtocolStream& request, Prot
 		string cheat_status;	// 作弊状态
 		float zero_point;		// 秤体零点	
 
-		request >> device_ligtht >> device_status >> cheat_ligtht >> cheat_status >> zero_point;
+		StatusLayout<1>::decode(request, device_ligtht, device_status, cheat_ligtht, cheat_status, zero_point);
 
 		request.assertEmpty();
 
@@ -286,7 +287,7 @@ void IcsProxyTerminalClient::handleEventsReport(ProtocolStream& request, Protoco
 
 	getIcsNowTime(recv_time);
 
-	request >> event_time >> event_count;
+	MessageLayout<T2C_event_report_0x0501>::decode(request, event_time, event_count);
 
 	/*
 	OtlConnectionGuard connGuard(g_database);
@@ -299,7 +300,7 @@ void IcsProxyTerminalClient::handleEventsReport(ProtocolStream& request, Protoco
 	// 遍历取出全部事件
 	for (uint16_t i = 0; i < event_count; i++)
 	{
-		request >> event_id >> event_type >> event_value;
+		EventItemLayout::decode(request, event_id, event_type, event_value);
 
 		eventStream << m_connName << (int)m_deviceKind << (int)event_id << (int)event_type << event_value << event_time << recv_time;
 
@@ -326,7 +327,7 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 
 	getIcsNowTime(recv_time);
 
-	request >> report_time >> business_no >> business_type;
+	MessageLayout<T2C_bus_report_0x0901>::decode(request, report_time, business_no, business_type);
 
 	if (m_lastBusSerialNum == business_no)	// 重复的业务流水号，直接忽略
 	{
@@ -349,7 +350,7 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 		float weight1, weight2, weight3, weight4, unit_price, money;	// 毛重 皮重 扣重 净重 单价 金额
 		uint8_t in_out;	// 进出
 
-		request >> cargo_num >> vehicle_num >> consigness >> cargo_name >> weight1 >> weight2 >> weight3 >> weight4 >> unit_price >> money >> in_out;
+		BusinessLayout<1>::decode(request, cargo_num, vehicle_num, consigness, cargo_name, weight1, weight2, weight3, weight4, unit_price, money, in_out);
 
 		otl_stream s(1
 			, "{ call `ics_vehicle`.sp_business_vehicle(:id<char[33],in>,:num<int,in>,:cargoNum<char[126],in>,:vehNum<char[126],in>"
@@ -365,7 +366,7 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 	else if (business_type == 2)	// 包装秤
 	{
 		uint8_t count;	// 秤数量
-		request >> count;
+		BusinessLayout<2>::decode(request, count);
 
 		otl_stream s(1
 			, "{ call `ics_packing`.sp_business_pack(:id<char[33],in>,:num<int,in>,:amount<int,in>,:weight<int,in>,:sWeight<int,in>,:F6<float,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>) }"
@@ -378,7 +379,7 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 			float total_weight;		// 称重总重
 			float single_weighet;// 单次重量
 
-			request >> number >> amount >> total_weight >> single_weighet;
+			PackingScaleLayout::decode(request, number, amount, total_weight, single_weighet);
 
 			s << m_connName << business_no << (int)amount << total_weight << single_weighet << report_time << recv_time;
 		}
@@ -394,13 +395,13 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 		uint8_t axle_num;	// 轴数(1-20)
 		uint8_t type_num;	// 轴类型数(1-轴数)
 
-		request >> total_weight >> speed >> axle_num;
+		BusinessLayout<3>::decode(request, total_weight, speed, axle_num);
 
 		// 处理各个轴重
 		for (uint8_t i = 0; i < axle_num; i++)
 		{
 			uint16_t axle_weight;
-			request >> axle_weight;
+			AxleWeightLayout::decode(request, axle_weight);
 			std::sprintf(buff, "%u,", axle_weight);
 			axle_str += buff;
 		}
@@ -410,13 +411,13 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 			axle_str.erase(axle_str.end() - 1);
 		}
 
-		request >> type_num;
+		MessageSchema<uint8_t>::decode(request, type_num);
 
 		// 处理各个轴类型
 		for (uint8_t i = 0; i < type_num; i++)
 		{
 			uint8_t axle_type;
-			request >> axle_type;
+			AxleTypeLayout::decode(request, axle_type);
 			std::sprintf(buff, "%u+", axle_type);
 			type_str += buff;
 		}
@@ -450,8 +451,6 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 		ShortString tubID;
 		uint32_t tubVolumn, weight, driverID;
 
-		request >> weightFlag.data >> tubID >> tubVolumn >> weight >> driverID;
-
 		union
 		{
 			uint8_t	data;
@@ -464,7 +463,7 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 		}postionFlag;
 		uint32_t longitude, latitude, height, speed;
 
-		request >> postionFlag.data >> longitude >> latitude >> height >> speed;
+		BusinessLayout<4>::decode(request, weightFlag.data, tubID, tubVolumn, weight, driverID, postionFlag.data, longitude, latitude, height, speed);
 
 		otl_stream s(1
 			, "{ call `ics_canchu`.sp_weight_report(:id<char[33],in>,:num<int,in>,:reportTime<timestamp,in>,:recvTime<timestamp,in>"
@@ -493,13 +492,13 @@ void IcsProxyTerminalClient::handleBusinessReport(ProtocolStream& request, Proto
 void IcsProxyTerminalClient::handleDatetimeSync(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	IcsDataTime dt1, dt2;
-	request >> dt1;
+	MessageLayout<T2C_datetime_sync_request_0x0a01>::decode(request, dt1);
 	request.assertEmpty();
 
 	getIcsNowTime(dt2);
 
 	response.initHead(MessageId::MessageId_min_0x0000, m_send_num++);
-	response << dt1 << dt2 << dt2;
+	MessageLayout<C2T_datetime_sync_response_0x0a02>::encode(response, dt1, dt2, dt2);
 }
 
 // GPS上报
@@ -518,7 +517,7 @@ void IcsProxyTerminalClient::handleGpsReport(ProtocolStream& request, ProtocolSt
 
 	uint32_t longitude, latitude, height, speed;
 
-	request >> postionFlag.data >> longitude >> latitude >> height >> speed;
+	MessageLayout<T2C_gps_report_0x0902>::decode(request, postionFlag.data, longitude, latitude, height, speed);
 
 	request.assertEmpty();
 
@@ -535,7 +534,7 @@ void IcsProxyTerminalClient::handleLogReport(ProtocolStream& request, ProtocolSt
 	uint8_t encode_type = 0;	//	编码方式
 	string log_value;			//	日志内容
 
-	request >> status_time >> log_level >> encode_type >> log_value;
+	MessageLayout<T2C_log_report_0x0c01>::decode(request, status_time, log_level, encode_type, log_value);
 
 	request.assertEmpty();
 
@@ -558,7 +557,7 @@ void IcsProxyTerminalClient::handleDenyUpgrade(ProtocolStream& request, Protocol
 	uint32_t request_id;	// 请求id
 	string reason;	// 拒绝升级原因
 
-	request >> request_id >> reason;
+	MessageLayout<T2C_upgrade_deny_0x0202>::decode(request, request_id, reason);
 
 	request.assertEmpty();
 
@@ -569,7 +568,7 @@ void IcsProxyTerminalClient::handleDenyUpgrade(ProtocolStream& request, Protocol
 void IcsProxyTerminalClient::handleAgreeUpgrade(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	uint32_t request_id;	// 请求id
-	request >> request_id;
+	MessageLayout<T2C_upgrade_agree_0x0203>::decode(request, request_id);
 	request.assertEmpty();
 
 	forwardToIcsCenter(request);
@@ -581,7 +580,7 @@ void IcsProxyTerminalClient::handleRequestFile(ProtocolStream& request, Protocol
 	uint32_t file_id, request_id, fragment_offset, received_size;
 	uint16_t fragment_length;
 
-	request >> file_id >> request_id >> fragment_offset >> fragment_length >> received_size;
+	MessageLayout<T2C_upgrade_file_request_0x0204>::decode(request, file_id, request_id, fragment_offset, fragment_length, received_size);
 
 	request.assertEmpty();
 
@@ -592,25 +591,15 @@ void IcsProxyTerminalClient::handleRequestFile(ProtocolStream& request, Protocol
 	auto fileInfo = FileUpgradeManager::getInstance()->getFileInfo(file_id);
 
 	// 查看是否已取消升级
-	if (fragment_length > 0 && fileInfo)	// 正常状态且找到该文件
+	if (fragment_length > 0 && fileInfo && fragment_offset < fileInfo->file_length)	// 正常状态且找到该文件
 	{
-		if (fragment_offset > fileInfo->file_length)	// 超出文件大小
-		{
-			throw IcsException("require file offset [%d] is more than file's length [%d]", fragment_offset, fileInfo->file_length);
-		}
-		else if (fragment_offset + fragment_length > fileInfo->file_length)	// 超过文件大小则取剩余大小
-		{
-			fragment_length = fileInfo->file_length - fragment_offset;
-		}
-
-		if (fragment_length > UPGRADE_FILE_SEGMENG_SIZE)	// 限制文件片段最大为缓冲区剩余长度
-		{
-			fragment_length = UPGRADE_FILE_SEGMENG_SIZE;
-		}
-
 		response.initHead(C2T_upgrade_file_response_0x0206, false);
-		response << file_id << request_id << fragment_offset << fragment_length;
-		response.append((char*)fileInfo->file_content + fragment_offset, fragment_length);
+		response << file_id << request_id;
+
+		// 片段长度由终端指定,限制为响应缓冲区剩余可容纳的长度(片段偏移+片段长度+片段内容+校验码)
+		std::size_t room = response.leftLength() - sizeof(fragment_offset) - sizeof(fragment_length) - IcsMsgHead::CrcCodeSize;
+		auto fragment = fileInfo->getFragment(fragment_offset, (uint16_t)std::min<std::size_t>(fragment_length, room));
+		response.append(fragment->body.data(), fragment->body.size(), fragment->crc);
 
 //		forwardToIcsCenter(request);
 	}
@@ -626,7 +615,7 @@ void IcsProxyTerminalClient::handleUpgradeResult(ProtocolStream& request, Protoc
 	uint32_t request_id;	// 文件id
 	string upgrade_result;	// 升级结果
 
-	request >> request_id >> upgrade_result;
+	MessageLayout<T2C_upgrade_result_report_0x0207>::decode(request, request_id, upgrade_result);
 
 	request.assertEmpty();
 
@@ -638,7 +627,7 @@ void IcsProxyTerminalClient::handleUpgradeCancelAck(ProtocolStream& request, Pro
 {
 	uint32_t request_id;	// 文件id
 
-	request >> request_id;
+	MessageLayout<T2C_upgrade_cancel_ack_0x0209>::decode(request, request_id);
 
 	request.assertEmpty();
 
@@ -696,12 +685,12 @@ void IcsCenter::dispatch(ProtocolStream& request) throw(IcsException, otl_except
 void IcsCenter::handleAuthrize1(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	std::time_t t1, t2 = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	request >> t1;
+	MessageLayout<C2C_auth_request1_0x4001>::decode(request, t1);
 
 	request.assertEmpty();
 
 	response.initHead(MessageId::C2C_auth_response_0x4002, false);
-	response << t1 << t2;
+	MessageLayout<C2C_auth_response_0x4002>::encode(response, t1, t2);
 }
 
 /// 出错
@@ -714,7 +703,7 @@ void IcsCenter::error() throw()
 void IcsCenter::handleAuthrize2(ProtocolStream& request, ProtocolStream& response) throw(IcsException, otl_exception)
 {
 	std::time_t t2, t4 = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	request >> t2;
+	MessageLayout<C2C_auth_request2_0x4003>::decode(request, t2);
 
 	request.assertEmpty();
 
@@ -728,7 +717,7 @@ void IcsCenter::handleAuthrize2(ProtocolStream& request, ProtocolStream& respons
 		LOG_DEBUG("ics center authrize success, interval=" << interval);
 
 		// 将当前全部终端通报给中心服务器
-		ProtocolStream forwardStream(ProtocolStream::OptType::writeType, g_memoryPool.get());
+		ProtocolStream forwardStream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
 		forwardStream.initHead(C2C_terminal_onoff_line_0x4006, false);
 		
 	}
@@ -746,14 +735,14 @@ void IcsCenter::handleForwardToTermianl(ProtocolStream& request, ProtocolStream&
 	ShortString gatewayID;	//网关Id
 	uint16_t messageID;		//消息Id
 	uint32_t requestID;		//请求Id
-	request >> gatewayID >> messageID;
+	MessageLayout<C2C_forward_to_terminal_0x4004>::decode(request, gatewayID, messageID);
 
 	/// 若为请求升级，跳过文件全路径
 	if (messageID == MessageId::C2T_upgrade_request_0x0201)
 	{
 		request.moveForward<ShortString>();
 	}
-	request>> requestID;
+	ForwardRequestLayout::decode(request, requestID);
 
 	//应答中心服务器转发结果;
 	response.initHead(C2C_forward_response_0x4005, false);
@@ -784,12 +773,13 @@ void IcsCenter::handleForwardToTermianl(ProtocolStream& request, ProtocolStream&
 }
 
 //---------------------------IcsPorxyServer---------------------------//
-IcsPorxyServer::IcsPorxyServer(asio::io_service& ioService
+IcsPorxyServer::IcsPorxyServer(IoServicePool& ioPool
 	, const string& terminalAddr, std::size_t terminalMaxCount
 	, const string& icsCenterAddr, std::size_t icsCenterCount)
-	: m_ioService(ioService)
-	, m_terminalTcpServer(ioService), m_terminalMaxCount(terminalMaxCount)
-	, m_icsCenterTcpServer(ioService), m_icsCenterMaxCount(icsCenterCount)
+	: m_ioPool(ioPool)
+	, m_terminalTcpServer(ioPool), m_terminalMaxCount(terminalMaxCount)
+	, m_icsCenterTcpServer(ioPool), m_icsCenterMaxCount(icsCenterCount)
+	, m_timer(ioPool.getIoService())
 {
 	m_heartbeatTime = g_configFile.getAttributeInt("protocol", "heartbeat");
 
@@ -812,6 +802,8 @@ IcsPorxyServer::IcsPorxyServer(asio::io_service& ioService
 	});
 
 	m_timer.start();
+
+	trimMemoryPool();
 }
 
 IcsPorxyServer::~IcsPorxyServer()
@@ -914,7 +906,7 @@ void IcsPorxyServer::sendToIcsCenter(ProtocolStream& request)
 	std::lock_guard<std::mutex> lock(m_icsCenterConnMapLock);
 	for (auto& it : m_icsCenterConnMap)
 	{
-		ProtocolStream message(request, g_memoryPool.get());
+		ProtocolStream message(request, PooledBuffer(g_memoryPool));
 		it->dispatch(message);
 	}
 }
@@ -922,13 +914,17 @@ void IcsPorxyServer::sendToIcsCenter(ProtocolStream& request)
 /// 
 void IcsPorxyServer::connectionTimeoutHandler(ConneciontPrt conn)
 {
-	m_timer.add(m_heartbeatTime, 
-		std::bind([conn, this](){
-			if (conn->timeout())
-			{
-				this->connectionTimeoutHandler(conn);
-			}
-		}));
+	conn->watchIdle(m_timer, std::chrono::seconds(m_heartbeatTime));
+}
+
+/// 定时回收内存池空闲的arena
+void IcsPorxyServer::trimMemoryPool()
+{
+	m_trimTimer.setCallback([this](){
+		g_memoryPool.trim();
+		m_timer.schedule(m_trimTimer, std::chrono::seconds(MemoryPool::TrimInterval));
+	});
+	m_timer.schedule(m_trimTimer, std::chrono::seconds(MemoryPool::TrimInterval));
 }
 
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "icsconnection.hpp"
 #include "tcpserver.hpp"
 #include "timer.hpp"
+#include "ioservicepool.hpp"
 #include <unordered_map>
 #include <mutex>
 #include <set>
@@ -140,7 +141,7 @@ public:
 	/// ָ
 	typedef std::shared_ptr<IcsConnection<icstcp>> ConneciontPrt;
 
-	IcsPorxyServer(asio::io_service& ioService
+	IcsPorxyServer(IoServicePool& ioPool
 		, const string& terminalAddr, std::size_t terminalMaxCount
 //		, const string& webAddr, std::size_t webMaxCount
 		, const string& icsCenterAddr, std::size_t icsCenterCount);
@@ -179,9 +180,12 @@ private:
 	/// ն˳ʱ
 	void connectionTimeoutHandler(ConneciontPrt conn);
 
+	/// ʱڴؿеarena
+	void trimMemoryPool();
+
 
 private:
-	asio::io_service& m_ioService;
+	IoServicePool&	m_ioPool;
 
 	// ն˷
 	TcpServer	m_terminalTcpServer;
@@ -202,7 +206,8 @@ private:
 	std::mutex	m_icsCenterConnMapLock;
 
 //	Timer m_timer;
-	TimingWheel<64> m_timer;
+	TimingWheel m_timer;
+	TimerHandle	m_trimTimer;
 };
 
 }
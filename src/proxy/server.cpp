@@ -7,6 +7,8 @@
 #include "icsconfig.hpp"
 #include "icsproxyserver.hpp"
 #include "database.hpp"
+#include "ioservicepool.hpp"
+#include "recvbuffer.hpp"
 
 #include <asio.hpp>
 #include <iostream>
@@ -60,16 +62,25 @@ int main(int argc, char** argv)
 		ics::init_log(g_configFile.getAttributeString("log", "configfile").c_str());
 
 		// 初始内存池模块
-		g_memoryPool.init(g_configFile.getAttributeInt("program", "chunksize"), g_configFile.getAttributeInt("program", "chunkcount"));
+		g_memoryPool.init(g_configFile.getAttributeInt("program", "chunksize")
+			, g_configFile.getAttributeInt("program", "chunkcount")
+			, g_configFile.getAttributeInt("program", "chunkmax"));
+
+		// 接收消息的最大长度
+		ics::ReceiveBuffer::setMaxFrameSize(g_configFile.getAttributeInt("protocol", "maxframe"));
 
 		// ICS代理模式
-		auto p = std::make_unique<ics::IcsPorxyServer>(io_service
+		// 工作线程:分片模式下每个线程独占一个io服务
+		ics::IoServicePool workers(io_service
+			, g_configFile.getAttributeInt("program", "workerthread")
+			, g_configFile.getAttributeInt("program", "ioshard") != 0);
+
+		auto p = std::make_unique<ics::IcsPorxyServer>(workers
 			, g_configFile.getAttributeString("proxyraddr", "terminal"), 100
 			, g_configFile.getAttributeString("proxyraddr", "center"), 100);		
 
-		// 主线程开始IO事件,忽略错误
-		asio::error_code ec;
-		io_service.run(ec);
+		// 主线程及工作线程开始IO事件
+		workers.run();
 	}
 	catch (ics::IcsException& ex)
 	{
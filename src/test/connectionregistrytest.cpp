@@ -0,0 +1,189 @@
+
+
+#include "connectionregistry.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+typedef std::shared_ptr<int> Conn;
+
+typedef ConnectionRegistry<Conn> Registry;
+
+/// entries in all shard snapshots
+static std::size_t countEntries(const Registry& registry)
+{
+	std::size_t count = 0;
+	registry.forEach([&count](const std::string&, const Conn&)
+	{
+		count++;
+	});
+	return count;
+}
+
+/*
+insert, replace and erase of one key, the limit on new keys, held snapshots unchanged by later
+writes, and concurrent writers never going over the limit while a reader walks the snapshots
+*/
+int main()
+{
+	// insert, replace, erase
+	{
+		Registry registry(4);
+		Conn a = std::make_shared<int>(1), b = std::make_shared<int>(2);
+		CHECK(registry.find("gw1") == nullptr);
+		CHECK(registry.insert("gw1", a));
+		CHECK(registry.find("gw1") == a);
+		CHECK(registry.size() == 1);
+
+		Conn replaced;
+		CHECK(registry.insert("gw1", b, &replaced));
+		CHECK(replaced == a);
+		CHECK(registry.find("gw1") == b);
+		CHECK(registry.size() == 1);
+
+		// a connection closing late doesn't remove its successor
+		CHECK(!registry.erase("gw1", a));
+		CHECK(registry.find("gw1") == b);
+		CHECK(registry.erase("gw1", b));
+		CHECK(registry.find("gw1") == nullptr);
+		CHECK(registry.size() == 0);
+		CHECK(!registry.erase("gw1"));
+
+		CHECK(registry.insert("gw2", a));
+		CHECK(registry.erase("gw2"));
+		CHECK(registry.size() == 0);
+	}
+
+	// the limit counts new keys only
+	{
+		Registry registry(4, 3);
+		Conn conn = std::make_shared<int>(0);
+		CHECK(registry.insert("a", conn));
+		CHECK(registry.insert("b", conn));
+		CHECK(registry.insert("c", conn));
+		CHECK(!registry.insert("d", conn));
+		CHECK(registry.find("d") == nullptr);
+		CHECK(registry.insert("a", std::make_shared<int>(1)));
+		CHECK(registry.size() == 3);
+		CHECK(registry.erase("b"));
+		CHECK(registry.insert("d", conn));
+		CHECK(registry.size() == 3);
+		CHECK(countEntries(registry) == 3);
+
+		registry.clear();
+		CHECK(registry.size() == 0);
+		CHECK(countEntries(registry) == 0);
+		CHECK(registry.insert("e", conn));
+	}
+
+	// a held snapshot doesn't see the later writes
+	{
+		Registry registry(2);
+		for (int i = 0; i < 100; i++)
+		{
+			registry.insert("gw" + std::to_string(i), std::make_shared<int>(i));
+		}
+
+		std::vector<Registry::Snapshot> snapshots;
+		std::size_t held = 0;
+		for (std::size_t i = 0; i < registry.shardCount(); i++)
+		{
+			snapshots.push_back(registry.snapshot(i));
+			held += snapshots.back()->size();
+		}
+		CHECK(held == 100);
+
+		for (int i = 0; i < 50; i++)
+		{
+			registry.erase("gw" + std::to_string(i));
+			registry.insert("new" + std::to_string(i), std::make_shared<int>(i));
+		}
+		registry.insert("gw99", std::make_shared<int>(-1));
+
+		std::size_t after = 0;
+		for (auto& snapshot : snapshots)
+		{
+			after += snapshot->size();
+			CHECK(snapshot->find("new0") == snapshot->end());
+			auto it = snapshot->find("gw99");
+			CHECK(it == snapshot->end() || *it->second == 99);
+		}
+		CHECK(after == 100);
+		CHECK(countEntries(registry) == 100);
+		CHECK(*registry.find("gw99") == -1);
+	}
+
+	// writers racing for the last places while a reader walks the snapshots
+	{
+		const std::size_t maxCount = 1000;
+		const std::size_t writerCount = 4;
+		Registry registry(16, maxCount);
+
+		std::atomic<std::size_t> inserted{ 0 };
+		std::atomic<bool> done{ false };
+		std::atomic<bool> broken{ false };
+		std::thread reader([&]()
+		{
+			while (!done)
+			{
+				registry.forEach([&broken](const std::string& key, const Conn& conn)
+				{
+					if (key.empty() || !conn)
+					{
+						broken = true;
+					}
+				});
+			}
+		});
+
+		std::vector<std::thread> writers;
+		for (std::size_t w = 0; w < writerCount; w++)
+		{
+			writers.emplace_back([&, w]()
+			{
+				Conn conn = std::make_shared<int>((int)w);
+				for (std::size_t i = 0; i < maxCount; i++)
+				{
+					std::string key = std::to_string(w) + "-" + std::to_string(i);
+					if (registry.insert(key, conn))
+					{
+						inserted++;
+						// every other one leaves again
+						if (i % 2 && registry.erase(key, conn))
+						{
+							inserted--;
+						}
+					}
+				}
+			});
+		}
+		for (auto& writer : writers)
+		{
+			writer.join();
+		}
+		done = true;
+		reader.join();
+
+		// more keys than places are kept, so the registry ends full and never over
+		CHECK(!broken);
+		CHECK(registry.size() == inserted);
+		CHECK(registry.size() == maxCount);
+		CHECK(countEntries(registry) == registry.size());
+	}
+
+	std::cout << "connection registry ok" << std::endl;
+	return 0;
+}
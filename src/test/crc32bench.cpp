@@ -0,0 +1,140 @@
+
+
+#include "crc32.hpp"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+
+
+using namespace ics;
+
+/// the byte loop crc32_code had before the slicing tables, the reference for every path
+static uint32_t crc32_table(const void* buf, std::size_t size)
+{
+	static uint32_t table[256];
+	if (table[1] == 0)
+	{
+		for (uint32_t v = 0; v < 256; v++)
+		{
+			uint32_t c = v << 24;
+			for (int i = 0; i < 8; i++)
+			{
+				c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : (c << 1);
+			}
+			table[v] = c;
+		}
+	}
+
+	uint32_t ret = 0xFFFFFFFF;
+	for (std::size_t i = 0; i < size; i++)
+	{
+		ret ^= ((const uint8_t*)buf)[i];
+		for (int j = 0; j < 4; j++)
+		{
+			ret = (ret << 8) ^ table[ret >> 24];
+		}
+	}
+	return ret;
+}
+
+/// pieces below the folding threshold, so only the slicing tables run
+static uint32_t crc32_pieces(const void* buf, std::size_t size)
+{
+	const std::size_t piece = 256;
+	const uint8_t* p = (const uint8_t*)buf;
+	uint32_t crc = CRC32_INIT;
+	for (; size > piece; size -= piece, p += piece)
+	{
+		crc = crc32_update(crc, p, piece);
+	}
+	return crc32_update(crc, p, size);
+}
+
+/// two halves joined by crc32_combine
+static uint32_t crc32_halves(const void* buf, std::size_t size)
+{
+	const uint8_t* p = (const uint8_t*)buf;
+	std::size_t half = size / 2;
+	return crc32_combine(crc32_code(p, half), crc32_update(0, p + half, size - half), size - half);
+}
+
+typedef uint32_t (*Crc32Path)(const void*, std::size_t);
+
+/// keeps the measured loops from being dropped
+static volatile uint32_t s_sink;
+
+/// MB/s of the path over buf, total bytes in all
+static double measure(Crc32Path path, const std::vector<uint8_t>& buf, std::size_t total)
+{
+	std::size_t rounds = total / buf.size() + 1;
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < rounds; i++)
+	{
+		s_sink = path(buf.data(), buf.size());
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return rounds * buf.size() / elapsed.count() / (1024 * 1024);
+}
+
+/*
+crc32 paths against the old byte loop: every path must give the same crc for every size,
+then the throughput of each over 64B-64KB buffers; argv[1] is the MB to run per path and size
+*/
+int main(int argc, char* argv[])
+{
+	std::size_t totalMB = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+
+	std::mt19937 random(20151021);
+	std::vector<uint8_t> data(64 * 1024 + 64);
+	for (auto& b : data)
+	{
+		b = (uint8_t)random();
+	}
+
+	// all sizes up to 2KB cover the tails and the folding threshold, unaligned starts included
+	for (std::size_t size = 0; size <= data.size() - 16; size = size < 2048 ? size + 1 : size * 2 + 7)
+	{
+		for (std::size_t offset = 0; offset < 16; offset += 5)
+		{
+			const uint8_t* p = data.data() + offset;
+			uint32_t expected = crc32_table(p, size);
+			if (crc32_code(p, size) != expected || crc32_pieces(p, size) != expected || crc32_halves(p, size) != expected)
+			{
+				std::cerr << "crc32 mismatch at size " << size << " offset " << offset << std::endl;
+				return 1;
+			}
+		}
+	}
+	std::cout << "crc32 paths give the same result as the byte loop" << std::endl;
+
+	const struct {
+		const char*	name;
+		Crc32Path	path;
+	} paths[] = {
+		{ "byte loop", crc32_table },
+		{ "slicing", crc32_pieces },
+		{ "crc32_code", crc32_code },
+	};
+
+	std::printf("%8s", "size");
+	for (const auto& path : paths)
+	{
+		std::printf("%14s", path.name);
+	}
+	std::printf("    (MB/s)\n");
+
+	for (std::size_t size = 64; size <= 64 * 1024; size *= 4)
+	{
+		std::vector<uint8_t> buf(data.begin(), data.begin() + size);
+		std::printf("%8u", (unsigned)size);
+		for (const auto& path : paths)
+		{
+			std::printf("%14.0f", measure(path.path, buf, totalMB * 1024 * 1024));
+		}
+		std::printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,194 @@
+
+
+#include "dbspool.hpp"
+#include "crc32.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+static const char* Sql = "{ call sp_test(:key<char[33],in>,:value<int,in>,:text<char[2048],in>) }";
+
+static DbCall makeCall(int i)
+{
+	DbCall call(Sql, "call#" + std::to_string(i));
+	call << i << std::string(1000, (char)('a' + i % 26));
+	return call;
+}
+
+/// names of the files in dir ending with suffix
+static std::vector<std::string> listFiles(const std::string& dir, const char* suffix)
+{
+	std::vector<std::string> names;
+	if (DIR* d = opendir(dir.c_str()))
+	{
+		while (struct dirent* entry = readdir(d))
+		{
+			std::string name = entry->d_name;
+			if (name.size() > std::strlen(suffix) && name.compare(name.size() - std::strlen(suffix), std::string::npos, suffix) == 0)
+			{
+				names.push_back(name);
+			}
+		}
+		closedir(d);
+	}
+	return names;
+}
+
+static std::vector<uint8_t> readFile(const std::string& path)
+{
+	std::vector<uint8_t> data;
+	if (FILE* f = std::fopen(path.c_str(), "rb"))
+	{
+		uint8_t buf[4096];
+		for (std::size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;)
+		{
+			data.insert(data.end(), buf, buf + n);
+		}
+		std::fclose(f);
+	}
+	return data;
+}
+
+/// wait until nothing is left to replay
+static bool drained(DbSpool& spool)
+{
+	for (int i = 0; i < 500 && spool.pending(); i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return !spool.pending();
+}
+
+/*
+without a database: calls spooled over several segments are replayed in order once their keys
+are applied, a record failing its crc ends its segment and the replay goes on with the next,
+an unapplied call waits for the database; rejected calls are kept whole in the rejected file
+*/
+int main()
+{
+	char dirTemplate[] = "/tmp/dbspooltest.XXXXXX";
+	CHECK(mkdtemp(dirTemplate) != nullptr);
+	const std::string dir = dirTemplate;
+	const int callCount = 150;
+
+	DataBase db;	// never opened, every call reaching it fails as unavailable
+
+	// rotation: 64KB segments hold about 60 calls each
+	{
+		DbSpool spool(db);
+		spool.open(dir, 64 * 1024);
+		CHECK(!spool.pending());
+		for (int i = 0; i < callCount; i++)
+		{
+			spool.append(makeCall(i));
+		}
+		CHECK(spool.pending());
+		CHECK(listFiles(dir, ".spool").size() == 3);
+
+		// the calls written live, all but call#1 and call#2 of the first segment
+		for (int i = 0; i < callCount; i++)
+		{
+			if (i != 1 && i != 2)
+			{
+				spool.markApplied(makeCall(i).key());
+			}
+		}
+	}
+
+	// break call#1 in the first segment: header(16) + call#0 record(8 + size) + call#1 head(8)
+	{
+		std::string path = dir + "/0000000001.spool";
+		int fd = ::open(path.c_str(), O_RDWR);
+		CHECK(fd >= 0);
+		off_t offset = 16 + 8 + makeCall(0).encodedSize() + 8 + 100;
+		uint8_t byte;
+		CHECK(pread(fd, &byte, 1, offset) == 1);
+		byte ^= 0xff;
+		CHECK(pwrite(fd, &byte, 1, offset) == 1);
+		::close(fd);
+	}
+
+	// replay: call#1 fails its crc, so call#1 and call#2 are never tried against the database
+	// (they would be retried forever), the other segments are applied already and removed
+	{
+		DbSpool spool(db);
+		spool.open(dir, 64 * 1024);
+		CHECK(spool.pending());
+		spool.start(10);
+		CHECK(drained(spool));
+		spool.stop();
+		CHECK(listFiles(dir, ".spool").size() == 1);
+	}
+
+	// the checkpoint is kept: nothing to replay after reopening
+	{
+		DbSpool spool(db);
+		spool.open(dir, 64 * 1024);
+		CHECK(!spool.pending());
+
+		// an unapplied call waits for the database, and is skipped once written live
+		DbCall call = makeCall(callCount);
+		spool.append(call);
+		spool.start(10);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		CHECK(spool.pending());
+		spool.markApplied(call.key());
+		CHECK(drained(spool));
+
+		// rejected calls are not replayed and are kept as records in the rejected file
+		DbCall first = makeCall(1000), second = makeCall(1001);
+		spool.reject(first);
+		spool.reject(second);
+		CHECK(!spool.pending());
+		spool.stop();
+
+		std::vector<uint8_t> rejected = readFile(dir + "/rejected");
+		std::size_t offset = 0;
+		for (const DbCall* c : { &first, &second })
+		{
+			std::vector<uint8_t> expected(c->encodedSize());
+			c->encode(expected.data());
+
+			uint32_t length, crc;
+			CHECK(offset + 8 <= rejected.size());
+			std::memcpy(&length, rejected.data() + offset, sizeof(length));
+			std::memcpy(&crc, rejected.data() + offset + 4, sizeof(crc));
+			CHECK(length == expected.size());
+			CHECK(offset + 8 + length <= rejected.size());
+			CHECK(crc == crc32_code(rejected.data() + offset + 8, length));
+			CHECK(std::memcmp(rejected.data() + offset + 8, expected.data(), length) == 0);
+			CHECK(DbCall::decode(rejected.data() + offset + 8, length).key() == c->key());
+			offset += 8 + length;
+		}
+		CHECK(offset == rejected.size());
+	}
+
+	for (auto& name : listFiles(dir, ".spool"))
+	{
+		unlink((dir + "/" + name).c_str());
+	}
+	unlink((dir + "/checkpoint").c_str());
+	unlink((dir + "/rejected").c_str());
+	rmdir(dir.c_str());
+
+	std::cout << "database spool replay, rotation, crc and rejected file ok" << std::endl;
+	return 0;
+}
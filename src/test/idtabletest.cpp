@@ -0,0 +1,94 @@
+
+
+#include "idtable.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+/*
+one handle per string, find never adds, the strings stay in place while the table grows over
+several segments, and threads interning the same strings at once get the same handles
+*/
+int main()
+{
+	IdTable table;
+	CHECK(table.size() == 1);
+	CHECK(table.intern("").empty());
+	CHECK(table.str(IcsId()).empty());
+
+	CHECK(table.find("gateway-1").empty());
+	CHECK(table.size() == 1);
+	IcsId first = table.intern("gateway-1");
+	CHECK(!first.empty());
+	CHECK(table.intern("gateway-1") == first);
+	CHECK(table.find("gateway-1") == first);
+	CHECK(table.str(first) == "gateway-1");
+	CHECK(table.size() == 2);
+
+	// more than two segments, the strings interned first don't move
+	const std::string* kept = &table.str(first);
+	const std::size_t idCount = IdTable::SegmentSize * 2 + 10;
+	std::vector<IcsId> ids;
+	for (std::size_t i = 0; i < idCount; i++)
+	{
+		ids.push_back(table.intern("monitor-" + std::to_string(i)));
+	}
+	CHECK(table.size() == idCount + 2);
+	CHECK(&table.str(first) == kept);
+	for (std::size_t i = 0; i < idCount; i++)
+	{
+		CHECK(table.str(ids[i]) == "monitor-" + std::to_string(i));
+		CHECK(table.find("monitor-" + std::to_string(i)) == ids[i]);
+	}
+
+	// the same strings from several threads at once
+	const std::size_t threadCount = 4;
+	const std::size_t sharedCount = 5000;
+	std::vector<std::vector<IcsId>> results(threadCount);
+	std::vector<std::thread> threads;
+	for (std::size_t t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&table, &results, t, sharedCount]()
+		{
+			// each thread starts at another place, so the new strings race
+			for (std::size_t n = 0; n < sharedCount; n++)
+			{
+				std::size_t i = (n + t * sharedCount / threadCount) % sharedCount;
+				results[t].push_back(table.intern("enterprise-" + std::to_string(i)));
+			}
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	CHECK(table.size() == idCount + 2 + sharedCount);
+	for (std::size_t i = 0; i < sharedCount; i++)
+	{
+		IcsId id = results[0][i];
+		CHECK(table.str(id) == "enterprise-" + std::to_string(i));
+		for (std::size_t t = 1; t < threadCount; t++)
+		{
+			std::size_t at = (i + sharedCount - t * sharedCount / threadCount) % sharedCount;
+			CHECK(results[t][at] == id);
+		}
+	}
+
+	// IcsId reads the process table
+	IcsId global = g_idTable.intern("gateway-1");
+	CHECK(global.str() == "gateway-1");
+
+	std::cout << table.size() - 1 << " ids interned" << std::endl;
+	return 0;
+}
@@ -0,0 +1,209 @@
+
+
+#include "mempool.hpp"
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+/// steps of the main thread and the worker holding the pool's thread cache
+class Steps {
+public:
+	void go(int step)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_step = step;
+		m_cond.notify_all();
+	}
+
+	void wait(int step)
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_cond.wait(lock, [this, step]() { return m_step >= step; });
+	}
+
+private:
+	std::mutex	m_lock;
+	std::condition_variable	m_cond;
+	int		m_step = 0;
+};
+
+/// get and put chunks of every size from several threads, each chunk is written and checked while held
+static bool stress(MemoryPool& pool)
+{
+	const std::size_t threadCount = 4;
+	const std::size_t rounds = 20000;
+
+	std::vector<std::thread> threads;
+	std::vector<int> failed(threadCount, 0);
+	for (std::size_t t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&pool, &failed, t]()
+		{
+			std::vector<PooledBuffer> held;
+			for (std::size_t i = 0; i < rounds; i++)
+			{
+				std::size_t size = (i * 37 + t * 11) % 900 + 1;
+				PooledBuffer buffer(pool, size);
+				if (!buffer.valid() || buffer.size() < size)
+				{
+					failed[t] = 1;
+					return;
+				}
+				std::memset(buffer.data(), (int)t + 1, size);
+				buffer.setLength(size);
+				held.push_back(std::move(buffer));
+
+				if (held.size() == 8)
+				{
+					for (auto& b : held)
+					{
+						for (std::size_t n = 0; n < b.length(); n++)
+						{
+							if (b.data()[n] != t + 1)
+							{
+								failed[t] = 1;
+								return;
+							}
+						}
+					}
+					held.clear();
+				}
+			}
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	for (auto f : failed)
+	{
+		if (f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+size classes and the chunk of each size, shared buffers, gets and puts from several threads, growth up to the limit,
+then trim: the grown arena is given back only after the thread caching its chunks drained them
+*/
+int main()
+{
+	const std::size_t chunkSize = 1024;
+	const std::size_t chunkCount = 64;
+
+	MemoryPool pool(chunkSize, chunkCount, chunkCount * 2);
+	const std::size_t initial = pool.capacity();
+	CHECK(initial == chunkCount * (1024 + 512 + 256 + 128));
+
+	// the smallest class holding the size
+	MemoryChunk big = pool.get();
+	CHECK(big.length == 1024);
+	MemoryChunk small = pool.get(100);
+	CHECK(small.length == 128);
+	MemoryChunk middle = pool.get(300);
+	CHECK(middle.length == 512);
+	CHECK(!pool.get(chunkSize + 1).valid());
+	pool.put(big);
+	pool.put(small);
+	pool.put(middle);
+
+	// a shared buffer goes back when the last reference is released
+	{
+		PooledBuffer buffer(pool, 200);
+		CHECK(buffer.valid());
+		CHECK(buffer.size() >= 200);
+		PooledBuffer shared = buffer.share();
+		CHECK(shared.data() == buffer.data());
+		CHECK(buffer.toNode() == nullptr);
+		buffer.reset();
+		CHECK(shared.valid());
+	}
+
+	CHECK(stress(pool));
+	CHECK(!pool.exhausted());
+	CHECK(pool.capacity() <= initial + chunkCount * chunkSize * 3);
+
+	MemoryPool trimmed(chunkSize, chunkCount, chunkCount * 2);
+	Steps steps;
+	std::size_t gotten = 0;
+	bool exhausted = false, released = false;
+	std::thread worker([&]()
+	{
+		// everything of the biggest class, the second arena included, then back in the same order
+		// so that the thread cache keeps chunks of the second arena
+		std::vector<MemoryChunk> chunks;
+		for (MemoryChunk chunk = trimmed.get(); chunk.valid(); chunk = trimmed.get())
+		{
+			chunks.push_back(chunk);
+		}
+		gotten = chunks.size();
+		exhausted = trimmed.exhausted();
+		for (auto& chunk : chunks)
+		{
+			trimmed.put(chunk);
+		}
+		released = !trimmed.exhausted();
+		steps.go(1);
+
+		// one call after the trims gives the cached chunks of the second arena back
+		steps.wait(2);
+		trimmed.put(trimmed.get(100));
+		steps.go(3);
+
+		steps.wait(4);
+	});
+
+	steps.wait(1);
+	CHECK(gotten == chunkCount * 2);
+	CHECK(exhausted);
+	CHECK(released);
+	CHECK(trimmed.capacity() == initial + chunkCount * chunkSize);
+
+	// the cached chunks pin the second arena
+	for (int i = 0; i < 3; i++)
+	{
+		trimmed.trim();
+	}
+	CHECK(trimmed.capacity() == initial + chunkCount * chunkSize);
+	steps.go(2);
+
+	// idle in one trim, given back by the next
+	steps.wait(3);
+	trimmed.trim();
+	trimmed.trim();
+	CHECK(trimmed.capacity() == initial);
+	steps.go(4);
+	worker.join();
+
+	// and grows again when needed
+	std::vector<MemoryChunk> chunks;
+	for (MemoryChunk chunk = trimmed.get(); chunk.valid(); chunk = trimmed.get())
+	{
+		chunks.push_back(chunk);
+	}
+	CHECK(chunks.size() == chunkCount * 2);
+	CHECK(trimmed.capacity() == initial + chunkCount * chunkSize);
+	for (auto& chunk : chunks)
+	{
+		trimmed.put(chunk);
+	}
+
+	std::cout << "memory pool alloc, free and trim ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,246 @@
+
+
+#include "messageschema.hpp"
+#include "mempool.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <ctime>
+
+
+ics::MemoryPool g_memoryPool(1024, 16);
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+/// the body written so far
+static std::string bodyOf(const ProtocolStream& stream)
+{
+	return std::string((const char*)stream.getHead() + sizeof(IcsMsgHead), stream.length() - sizeof(IcsMsgHead));
+}
+
+/// a readable copy of the message written into stream
+static ProtocolStream readBack(ProtocolStream& stream)
+{
+	stream.serialize(1);
+	return ProtocolStream(ProtocolStream::OptType::readType, stream.getHead(), stream.length());
+}
+
+/// decode throws and leaves the stream where it was
+template<class Layout, class... Fields>
+static bool rejects(ProtocolStream& stream, Fields&... fields)
+{
+	std::size_t left = stream.leftLength();
+	try {
+		Layout::decode(stream, fields...);
+	}
+	catch (IcsException&)
+	{
+		return stream.leftLength() == left;
+	}
+	return false;
+}
+
+/*
+layouts give the same bytes as the chained operator<< and read back what they wrote;
+a body shorter than the fixed part, a string longer than the rest, a string leaving no room
+for the fields after it and too many repeated items are rejected without moving the stream
+*/
+int main()
+{
+	IcsDataTime now;
+	getIcsNowTime(now);
+
+	// numbers, times and strings, the same bytes as the stream operators
+	{
+		ProtocolStream layout(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		layout.initHead(MessageId::T2C_log_report_0x0c01, false);
+		MessageLayout<T2C_log_report_0x0c01>::encode(layout, now, (uint8_t)3, (uint8_t)0, ShortString("log text"));
+
+		ProtocolStream chained(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		chained.initHead(MessageId::T2C_log_report_0x0c01, false);
+		chained << now << (uint8_t)3 << (uint8_t)0 << ShortString("log text");
+		CHECK(bodyOf(layout) == bodyOf(chained));
+
+		ProtocolStream request = readBack(layout);
+		IcsDataTime time;
+		uint8_t level, encode;
+		ShortString text;
+		MessageLayout<T2C_log_report_0x0c01>::decode(request, time, level, encode, text);
+		request.assertEmpty();
+		CHECK(std::memcmp(&time, &now, sizeof(time)) == 0);
+		CHECK(level == 3 && encode == 0);
+		CHECK(text == "log text");
+	}
+
+	// a long string and a float
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::T2C_std_status_report_0x0301, false);
+		LongString status(std::string(300, 's'));
+		StatusLayout<1>::encode(stream, (uint8_t)1, status, (uint8_t)0, ShortString("cheat"), 12.5f);
+
+		ProtocolStream request = readBack(stream);
+		uint8_t light, cheatLight;
+		LongString deviceStatus;
+		ShortString cheatStatus;
+		float zero;
+		StatusLayout<1>::decode(request, light, deviceStatus, cheatLight, cheatStatus, zero);
+		request.assertEmpty();
+		CHECK(light == 1 && cheatLight == 0);
+		CHECK(deviceStatus == status);
+		CHECK(cheatStatus == "cheat");
+		CHECK(zero == 12.5f);
+	}
+
+	// the auth times
+	{
+		std::time_t t1 = 1445400000, t2 = 1445400007;
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::C2C_auth_response_0x4002, false);
+		MessageLayout<C2C_auth_response_0x4002>::encode(stream, t1, t2);
+
+		ProtocolStream request = readBack(stream);
+		std::time_t r1, r2;
+		MessageLayout<C2C_auth_response_0x4002>::decode(request, r1, r2);
+		request.assertEmpty();
+		CHECK(r1 == t1 && r2 == t2);
+	}
+
+	// variable items one by one, fixed items in a row
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::T2C_param_query_response_0x0602, false);
+		MessageLayout<T2C_param_query_response_0x0602>::encode(stream, (uint32_t)77, (uint16_t)3);
+		for (uint16_t i = 0; i < 3; i++)
+		{
+			ParamItemLayout::encode(stream, i, (uint16_t)(i + 100), (uint8_t)1, ShortString(i + 1, 'v'));
+		}
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			PackingScaleLayout::encode(stream, i, (uint16_t)(i * 10), i * 1.5f, 0.5f);
+		}
+
+		ProtocolStream request = readBack(stream);
+		uint32_t requestID;
+		uint16_t count;
+		MessageLayout<T2C_param_query_response_0x0602>::decode(request, requestID, count);
+		CHECK(requestID == 77 && count == 3);
+		for (uint16_t i = 0; i < count; i++)
+		{
+			uint16_t net, param;
+			uint8_t type;
+			ShortString value;
+			ParamItemLayout::decode(request, net, param, type, value);
+			CHECK(net == i && param == i + 100 && type == 1);
+			CHECK(value == ShortString(i + 1, 'v'));
+		}
+
+		std::size_t seen = 0;
+		bool same = true;
+		PackingScaleLayout::decodeRepeated(request, 4, [&](uint8_t number, uint16_t amount, float total, float single)
+		{
+			same = same && number == seen && amount == seen * 10 && total == seen * 1.5f && single == 0.5f;
+			seen++;
+		});
+		CHECK(seen == 4 && same);
+		request.assertEmpty();
+	}
+
+	// a body shorter than the fixed part
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::T2C_upgrade_file_request_0x0204, false);
+		stream << (uint32_t)1 << (uint32_t)2 << (uint32_t)3 << (uint16_t)4;
+
+		ProtocolStream request = readBack(stream);
+		uint32_t fileID, requestID, offset, received;
+		uint16_t length;
+		CHECK((rejects<MessageLayout<T2C_upgrade_file_request_0x0204>>(request, fileID, requestID, offset, length, received)));
+	}
+
+	// a string longer than the rest of the body
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::W2C_connect_remote_request_0x2002, false);
+		stream << (uint8_t)200 << (uint8_t)'x' << (uint8_t)'y';
+
+		ProtocolStream request = readBack(stream);
+		ShortString enterprise;
+		CHECK(rejects<MessageLayout<W2C_connect_remote_request_0x2002>>(request, enterprise));
+	}
+
+	// a string fitting the body but eating the fields after it: gwid of 7 bytes, then the 7 bytes
+	// of message id, request id and result are all that is left
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::C2C_forward_response_0x4005, false);
+		stream << (uint8_t)7 << (uint32_t)0 << (uint16_t)0 << (uint8_t)0;
+
+		ProtocolStream request = readBack(stream);
+		ShortString gwid;
+		uint16_t messageID;
+		uint32_t requestID;
+		uint8_t result;
+		CHECK((rejects<MessageLayout<C2C_forward_response_0x4005>>(request, gwid, messageID, requestID, result)));
+	}
+
+	// more repeated items than the body holds
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::T2C_bus_report_0x0901, false);
+		PackingScaleLayout::encode(stream, (uint8_t)1, (uint16_t)2, 3.0f, 4.0f);
+
+		ProtocolStream request = readBack(stream);
+		std::size_t left = request.leftLength();
+		bool thrown = false;
+		try {
+			PackingScaleLayout::decodeRepeated(request, 2, [](uint8_t, uint16_t, float, float) {});
+		}
+		catch (IcsException&)
+		{
+			thrown = true;
+		}
+		CHECK(thrown && request.leftLength() == left);
+	}
+
+	// a short string over 255 bytes and a body over the buffer can't be written
+	{
+		ProtocolStream stream(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		stream.initHead(MessageId::W2C_connect_remote_request_0x2002, false);
+		bool thrown = false;
+		try {
+			MessageLayout<W2C_connect_remote_request_0x2002>::encode(stream, ShortString(256, 'e'));
+		}
+		catch (IcsException&)
+		{
+			thrown = true;
+		}
+		CHECK(thrown);
+
+		std::size_t written = stream.length();
+		thrown = false;
+		try {
+			for (int i = 0; i < 100; i++)
+			{
+				MessageLayout<W2C_connect_remote_request_0x2002>::encode(stream, ShortString(200, 'e'));
+				written = stream.length();
+			}
+		}
+		catch (IcsException&)
+		{
+			thrown = true;
+		}
+		CHECK(thrown && stream.length() == written);
+	}
+
+	std::cout << "message schema round trip and bounds ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,98 @@
+
+
+#include "mpscqueue.hpp"
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+struct Item : MpscNode {
+	std::size_t	producer;
+	std::size_t	sequence;
+};
+
+/*
+several producers push at once while the consumer pops: every item comes out once,
+and the items of one producer come out in the order it pushed them
+*/
+int main()
+{
+	const std::size_t producerCount = 4;
+	const std::size_t itemCount = 100000;
+
+	std::vector<std::unique_ptr<Item[]>> items;
+	for (std::size_t p = 0; p < producerCount; p++)
+	{
+		items.emplace_back(new Item[itemCount]);
+	}
+	MpscQueue<Item> queue;
+	CHECK(queue.empty());
+	CHECK(queue.pop() == nullptr);
+
+	std::atomic<bool> go{ false };
+	std::vector<std::thread> producers;
+	for (std::size_t p = 0; p < producerCount; p++)
+	{
+		producers.emplace_back([&, p]()
+		{
+			while (!go)
+			{
+				std::this_thread::yield();
+			}
+			for (std::size_t i = 0; i < itemCount; i++)
+			{
+				Item& item = items[p][i];
+				item.producer = p;
+				item.sequence = i;
+				queue.push(&item);
+			}
+		});
+	}
+	go = true;
+
+	// pop() may give nullptr while a push is half done, so keep polling until all came out
+	std::vector<std::size_t> next(producerCount, 0);
+	std::size_t popped = 0;
+	while (popped < producerCount * itemCount)
+	{
+		Item* item = queue.pop();
+		if (item == nullptr)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		CHECK(item->producer < producerCount);
+		CHECK(item == &items[item->producer][next[item->producer]]);
+		CHECK(item->sequence == next[item->producer]);
+		next[item->producer]++;
+		popped++;
+	}
+
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+	CHECK(queue.pop() == nullptr);
+	CHECK(queue.empty());
+
+	// the queue is usable again after it was drained
+	Item again;
+	queue.push(&again);
+	CHECK(!queue.empty());
+	CHECK(queue.pop() == &again);
+	CHECK(queue.empty());
+
+	std::cout << popped << " items from " << producerCount << " producers in order" << std::endl;
+	return 0;
+}
@@ -0,0 +1,80 @@
+
+
+#include "presencetracker.hpp"
+#include "messageschema.hpp"
+#include "mempool.hpp"
+#include <iostream>
+#include <string>
+#include <cstdio>
+
+
+ics::MemoryPool g_memoryPool(1024, 16);
+
+#define CHECK(cond) \
+	if (!(cond)) \
+	{ \
+		std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+		return 1; \
+	}
+
+using namespace ics;
+
+/*
+more online terminals than one response can hold: each response is one pooled chunk,
+it must hold only the terminals that fit and the web pages on with the count it got
+*/
+int main()
+{
+	const std::size_t terminalCount = 200;
+
+	PresenceTracker::Snapshot snapshot;
+	for (std::size_t i = 0; i < terminalCount; i++)
+	{
+		char gwid[32], monitorID[32];
+		std::snprintf(gwid, sizeof(gwid), "gateway-%06u", (unsigned)i);
+		std::snprintf(monitorID, sizeof(monitorID), "monitor-point-%06u", (unsigned)i);
+		snapshot.push_back(PresenceTracker::Terminal{ g_idTable.intern(gwid), g_idTable.intern(monitorID), (uint16_t)(i % 7) });
+	}
+
+	std::size_t start = 0;
+	std::size_t pages = 0;
+	while (start < terminalCount)
+	{
+		ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+		response.initHead(MessageId::C2W_online_response_0x2007, false);
+		std::size_t written = PresenceTracker::writeOnline(snapshot, start, 500, response);
+		CHECK(written > 0);
+		response.serialize(1);
+
+		// read the response back as the web does
+		ProtocolStream request(ProtocolStream::OptType::readType, response.getHead(), response.length());
+		uint32_t total;
+		uint16_t count;
+		MessageLayout<MessageId::C2W_online_response_0x2007>::decode(request, total, count);
+		CHECK(total == terminalCount);
+		CHECK(count == written);
+		for (uint16_t i = 0; i < count; i++)
+		{
+			ShortString gwid, monitorID;
+			uint16_t deviceKind;
+			OnlineTerminalLayout::decode(request, gwid, monitorID, deviceKind);
+			const PresenceTracker::Terminal& terminal = snapshot[start + i];
+			CHECK(gwid == terminal.gwid.str());
+			CHECK(monitorID == terminal.monitorID.str());
+			CHECK(deviceKind == terminal.deviceKind);
+		}
+		request.assertEmpty();
+
+		start += count;
+		pages++;
+	}
+	CHECK(pages > 1);
+
+	// a start past the end gets an empty page
+	ProtocolStream response(ProtocolStream::OptType::writeType, PooledBuffer(g_memoryPool));
+	response.initHead(MessageId::C2W_online_response_0x2007, false);
+	CHECK(PresenceTracker::writeOnline(snapshot, terminalCount + 1, 500, response) == 0);
+
+	std::cout << terminalCount << " terminals in " << pages << " responses" << std::endl;
+	return 0;
+}
@@ -0,0 +1,119 @@
+
+
+#include "timer.hpp"
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+
+
+using namespace std::chrono;
+
+/// one scheduled handle and the time it fired
+struct Probe {
+	TimerHandle	handle;
+	steady_clock::time_point	scheduled;
+	uint64_t	ticks = 0;
+	long long	elapsed = -1;	// ms from schedule to fire, -1 until fired
+};
+
+/*
+handles around every level boundary of the wheel, from the start and from a tick in the middle
+of a slot: 1, 63/64/65 ticks (level 0 to 1), 4095/4096/4097 ticks (level 1 to 2) and more; each
+must fire after its delay and within a few ticks of it, a cancelled one never
+*/
+int main()
+{
+	const milliseconds tick(1);
+	const milliseconds late(40);	// scheduling slack, far below a wrong slot on level 1 (64 ticks)
+	const uint64_t delays[] = { 1, 2, 63, 64, 65, 127, 128, 129, 4095, 4096, 4097, 4160, 4200 };
+	// scheduled at tick 37, each ends on or next to a boundary of the wheel
+	const uint64_t offsetDelays[] = { 26, 27, 28, 91, 4058, 4059, 4060 };
+
+	asio::io_service service;
+	TimingWheel wheel(service, tick);
+
+	std::vector<std::unique_ptr<Probe>> probes;
+	std::size_t fired = 0;
+	std::size_t expected = 0;
+
+	asio::steady_timer deadline(service);
+	auto add = [&](uint64_t ticks)
+	{
+		probes.emplace_back(new Probe());
+		Probe* probe = probes.back().get();
+		probe->ticks = ticks;
+		probe->handle.setCallback([&, probe]()
+		{
+			probe->elapsed = duration_cast<milliseconds>(steady_clock::now() - probe->scheduled).count();
+			if (++fired == expected)
+			{
+				wheel.stop();
+				deadline.cancel();
+			}
+		});
+		probe->scheduled = steady_clock::now();
+		wheel.schedule(probe->handle, tick * ticks);
+		expected++;
+	};
+
+	for (auto ticks : delays)
+	{
+		add(ticks);
+	}
+
+	// the second batch starts from the middle of a level 0 round
+	TimerHandle offset([&]()
+	{
+		for (auto ticks : offsetDelays)
+		{
+			add(ticks);
+		}
+	});
+	wheel.schedule(offset, tick * 37);
+
+	TimerHandle cancelled([]()
+	{
+		std::cerr << "a cancelled handle fired" << std::endl;
+		std::exit(1);
+	});
+	wheel.schedule(cancelled, tick * 100);
+	wheel.schedule(cancelled, tick * 64);
+	cancelled.cancel();
+
+	// well past the last delay, a handle lost by a cascade never fires
+	deadline.expires_from_now(seconds(10));
+	deadline.async_wait([&](const asio::error_code& ec)
+	{
+		if (!ec)
+		{
+			wheel.stop();
+		}
+	});
+
+	wheel.start();
+	service.run();
+
+	int failed = 0;
+	for (auto& probe : probes)
+	{
+		long long delay = duration_cast<milliseconds>(tick * probe->ticks).count();
+		// scheduled within a tick, the first tick may be short
+		if (probe->elapsed < delay - 2 * tick.count() || probe->elapsed > delay + late.count())
+		{
+			std::cerr << "delay " << probe->ticks << " ticks fired after " << probe->elapsed << "ms" << std::endl;
+			failed = 1;
+		}
+	}
+	if (fired != expected || wheel.size() != 0)
+	{
+		std::cerr << fired << " of " << expected << " handles fired, " << wheel.size() << " left" << std::endl;
+		failed = 1;
+	}
+	if (!failed)
+	{
+		std::cout << fired << " handles fired on their ticks" << std::endl;
+	}
+	return failed;
+}